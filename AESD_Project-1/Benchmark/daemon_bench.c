@@ -0,0 +1,648 @@
+/**
+ * @file daemon_bench.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief End-to-end benchmark of the sensor daemon on a Linux host. Starts project1 against the simulated
+ * sensors at the given sampling rates, optionally with streaming socket clients and a sock_load request
+ * load, and measures it after a warmup: sustained samples per second, drops at every stage, CPU per
+ * thread and the latency percentiles of the pipeline. "streamed" counts the samples sent to every subscriber,
+ * "received" those read by the streaming clients, missed_periods needs the daemon option --jitter. The
+ * results are written as one JSON object so that runs of different versions can be compared.
+ * Usage: daemon_bench [--daemon=<path>] [--temp-hz=<hz>] [--light-hz=<hz>] [--seconds=<s>] [--warmup=<s>]
+ *                     [--streams=<n>] [--batch=<n>] [--req-conns=<n>] [--req-depth=<n>] [--format=text|binary]
+ *                     [--log=<file>] [--label=<text>] [--out=<file>] [-- <daemon options>]
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <libgen.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "wire.h"
+
+#define PORT			(3124)
+#define MAX_STREAMS		(64)
+#define MAX_LINES		(64)	//Stats sources in one dump
+#define LINE_SIZE		(4096)
+#define MAX_THREADS		(32)
+#define MAX_ARGS		(32)
+#define STREAM_BUF		(65536)
+
+//One stats dump of the daemon, the lines of all its sources
+struct dump
+{
+	char lines[MAX_LINES][LINE_SIZE];
+	uint32_t n;
+	uint64_t t_ns;	//Arrival of its first line, a dump is written at once
+};
+
+//CPU time of the threads of the daemon, from /proc
+struct cpu_snap
+{
+	char names[MAX_THREADS][16];
+	uint64_t ticks[MAX_THREADS];
+	uint32_t n;
+	uint64_t t_ns;
+};
+
+//Streaming client
+struct stream
+{
+	int fd;
+	uint8_t in[STREAM_BUF];
+	uint32_t in_len;
+	uint32_t next_seq;
+	uint64_t samples;
+	uint64_t gaps;
+};
+
+static struct dump cur, last, warm;
+static struct cpu_snap cpu_warm, cpu_end;
+static struct stream streams[MAX_STREAMS];
+static uint32_t nstreams;
+static char out_line[LINE_SIZE];
+static uint32_t out_len;
+static uint64_t dumps;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Adds one line of daemon output, a source seen twice starts a new dump
+static void dump_line(const char *line)
+{
+	const char *colon;
+
+	if (strncmp(line, "STATS ", 6) != 0 || (colon = strchr(line, ':')) == NULL)
+	{
+		return;
+	}
+	for (uint32_t i = 0; i < cur.n; i++)
+	{
+		if (strncmp(cur.lines[i], line, colon - line + 1) == 0)
+		{
+			last = cur;
+			cur.n = 0;
+			dumps++;
+			break;
+		}
+	}
+	if (cur.n == 0)
+	{
+		cur.t_ns = now_ns();
+	}
+	if (cur.n < MAX_LINES)
+	{
+		snprintf(cur.lines[cur.n++], LINE_SIZE, "%s", line);
+	}
+}
+
+//Reads the output of the daemon, returns 0 at end of file
+static int daemon_read(int fd)
+{
+	char buf[8192];
+	ssize_t res = read(fd, buf, sizeof(buf));
+
+	if (res <= 0)
+	{
+		return (res == -1 && errno == EAGAIN) ? 1 : 0;
+	}
+	for (ssize_t i = 0; i < res; i++)
+	{
+		if (buf[i] == '\n')
+		{
+			out_line[out_len] = '\0';
+			dump_line(out_line);
+			out_len = 0;
+		}
+		else if (out_len < LINE_SIZE - 1)
+		{
+			out_line[out_len++] = buf[i];
+		}
+	}
+	return 1;
+}
+
+//Returns the line of a stats source
+static const char *dump_source(const struct dump *d, const char *source)
+{
+	size_t len = strlen(source);
+
+	for (uint32_t i = 0; i < d->n; i++)
+	{
+		if (strncmp(d->lines[i] + 6, source, len) == 0 && d->lines[i][6 + len] == ':')
+		{
+			return d->lines[i];
+		}
+	}
+	return NULL;
+}
+
+//Returns the value of "key=" in the line of a source, 0 if missing. key may be "logger[delivered".
+static double dump_value(const struct dump *d, const char *source, const char *key)
+{
+	const char *line = dump_source(d, source);
+	char pattern[64];
+	const char *p;
+
+	if (line == NULL)
+	{
+		return 0;
+	}
+	snprintf(pattern, sizeof(pattern), " %s=", key);
+	p = strstr(line, pattern);
+	if (p == NULL)
+	{
+		snprintf(pattern, sizeof(pattern), "[%s=", key);
+		p = strstr(line, pattern);
+	}
+	return p ? strtod(p + strlen(pattern), NULL) : 0;
+}
+
+//Difference of a counter between the warm and the last dump
+static double delta(const char *source, const char *key)
+{
+	return dump_value(&last, source, key) - dump_value(&warm, source, key);
+}
+
+//Reads the CPU time of every thread of the daemon
+static void cpu_read(pid_t pid, struct cpu_snap *snap)
+{
+	char path[64], buf[512];
+	struct dirent *ent;
+	DIR *dir;
+
+	snap->n = 0;
+	snap->t_ns = now_ns();
+	snprintf(path, sizeof(path), "/proc/%d/task", pid);
+	dir = opendir(path);
+	if (dir == NULL)
+	{
+		return;
+	}
+	while ((ent = readdir(dir)) != NULL && snap->n < MAX_THREADS)
+	{
+		unsigned long utime, stime;
+		char *name, *end;
+		FILE *fp;
+
+		if (ent->d_name[0] == '.')
+		{
+			continue;
+		}
+		snprintf(path, sizeof(path), "/proc/%d/task/%s/stat", pid, ent->d_name);
+		fp = fopen(path, "r");
+		if (fp == NULL)
+		{
+			continue;
+		}
+		if (fgets(buf, sizeof(buf), fp) && (name = strchr(buf, '(')) && (end = strrchr(buf, ')')) &&
+			sscanf(end + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &utime, &stime) == 2)
+		{
+			*end = '\0';
+			snprintf(snap->names[snap->n], sizeof(snap->names[0]), "%s", name + 1);
+			snap->ticks[snap->n++] = utime + stime;
+		}
+		fclose(fp);
+	}
+	closedir(dir);
+}
+
+//Connects a client and subscribes it to both channels with the framed protocol
+static int stream_open(struct stream *s, uint32_t batch)
+{
+	struct sockaddr_in addr;
+	wire_subscribe sub = {WIRE_SUB_TEMP | WIRE_SUB_LIGHT, 1, batch};
+	uint8_t msg[sizeof(wire_hdr) + sizeof(wire_subscribe)];
+	wire_hdr hdr;
+	int hello = WIRE_HELLO;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	s->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (s->fd == -1 || connect(s->fd, (struct sockaddr *)&addr, sizeof(addr)))
+	{
+		perror("connect");
+		return -1;
+	}
+
+	hdr.length = WIRE_LENGTH(1, sizeof(wire_subscribe));
+	hdr.magic = WIRE_MAGIC;
+	hdr.version = WIRE_VERSION;
+	hdr.type = WIRE_MSG_SUBSCRIBE;
+	hdr.seq = 0;
+	hdr.count = 1;
+	hdr.reserved = 0;
+	memcpy(msg, &hdr, sizeof(hdr));
+	memcpy(msg + sizeof(hdr), &sub, sizeof(sub));
+	if (send(s->fd, &hello, sizeof(hello), MSG_NOSIGNAL) != sizeof(hello) ||
+		send(s->fd, msg, sizeof(msg), MSG_NOSIGNAL) != sizeof(msg))
+	{
+		perror("send");
+		return -1;
+	}
+	fcntl(s->fd, F_SETFL, O_NONBLOCK);
+	return 0;
+}
+
+//Counts the streamed samples received and the gaps in their sequence numbers
+static void stream_read(struct stream *s)
+{
+	ssize_t res;
+	uint32_t off = 0;
+
+	res = read(s->fd, s->in + s->in_len, STREAM_BUF - s->in_len);
+	if (res <= 0)
+	{
+		return;
+	}
+	s->in_len += res;
+
+	while (s->in_len - off >= sizeof(wire_hdr))
+	{
+		wire_hdr hdr;
+		memcpy(&hdr, s->in + off, sizeof(hdr));
+		if (hdr.magic != WIRE_MAGIC || hdr.length + sizeof(uint32_t) > STREAM_BUF)
+		{
+			fprintf(stderr, "Invalid message from the daemon\n");
+			close(s->fd);
+			s->fd = -1;
+			return;
+		}
+		if (s->in_len - off < hdr.length + sizeof(uint32_t))
+		{
+			break;
+		}
+		if (hdr.type == WIRE_MSG_SAMPLES && hdr.length == WIRE_LENGTH(hdr.count, sizeof(wire_record)))
+		{
+			for (uint16_t i = 0; i < hdr.count; i++)
+			{
+				wire_record rec;
+				memcpy(&rec, s->in + off + sizeof(wire_hdr) + i * sizeof(wire_record), sizeof(rec));
+				if (rec.seq != s->next_seq)
+				{
+					s->gaps += rec.seq - s->next_seq;
+				}
+				s->next_seq = rec.seq + 1;
+				s->samples++;
+			}
+		}
+		off += hdr.length + sizeof(uint32_t);
+	}
+	memmove(s->in, s->in + off, s->in_len - off);
+	s->in_len -= off;
+}
+
+//Runs the poll loop over the daemon output and the streams until the deadline, 0 if the daemon exited
+static int pump(int out_fd, uint64_t deadline)
+{
+	struct pollfd pfd[MAX_STREAMS + 1];
+
+	while (now_ns() < deadline)
+	{
+		int timeout = (deadline - now_ns()) / 1000000 + 1;
+		pfd[0].fd = out_fd;
+		pfd[0].events = POLLIN;
+		for (uint32_t i = 0; i < nstreams; i++)
+		{
+			pfd[i + 1].fd = streams[i].fd;
+			pfd[i + 1].events = POLLIN;
+		}
+		if (poll(pfd, nstreams + 1, timeout) <= 0)
+		{
+			continue;
+		}
+		if ((pfd[0].revents & (POLLIN | POLLHUP)) && daemon_read(out_fd) == 0)
+		{
+			return 0;
+		}
+		for (uint32_t i = 0; i < nstreams; i++)
+		{
+			if (pfd[i + 1].revents & POLLIN)
+			{
+				stream_read(&streams[i]);
+			}
+		}
+	}
+	return 1;
+}
+
+//Starts a program with its output on a pipe, returns the read end
+static int spawn(char *const argv[], pid_t *pid)
+{
+	int fds[2];
+
+	if (pipe(fds))
+	{
+		perror("pipe");
+		return -1;
+	}
+	*pid = fork();
+	if (*pid == -1)
+	{
+		perror("fork");
+		return -1;
+	}
+	if (*pid == 0)
+	{
+		dup2(fds[1], STDOUT_FILENO);
+		dup2(fds[1], STDERR_FILENO);
+		close(fds[0]);
+		close(fds[1]);
+		execv(argv[0], argv);
+		perror("execv");
+		_exit(127);
+	}
+	close(fds[1]);
+	return fds[0];
+}
+
+//Writes the latency histograms of the last dump as a JSON object
+static void json_latency(FILE *fp)
+{
+	const char *line = dump_source(&last, "latency");
+	const char *p = line ? strchr(line, ':') + 1 : NULL;
+	int first = 1;
+
+	fprintf(fp, "{");
+	while (p && (p = strchr(p, '[')) != NULL)
+	{
+		const char *name = p;
+		double v[7];
+
+		while (name > line && name[-1] != ' ')
+		{
+			name--;
+		}
+		if (sscanf(p, "[n=%lf avg=%lf p50=%lf p90=%lf p99=%lf p999=%lf max=%lf]", &v[0], &v[1], &v[2], &v[3], &v[4],
+				   &v[5], &v[6]) == 7)
+		{
+			fprintf(fp, "%s\n    \"%.*s\": {\"n\": %.0f, \"avg\": %.1f, \"p50\": %.1f, \"p90\": %.1f, \"p99\": %.1f, "
+						"\"p999\": %.1f, \"max\": %.1f}",
+					first ? "" : ",", (int)(p - name), name, v[0], v[1], v[2], v[3], v[4], v[5], v[6]);
+			first = 0;
+		}
+		p++;
+	}
+	fprintf(fp, "\n  }");
+}
+
+int main(int argc, char *argv[])
+{
+	const char *daemon = "../project1", *format = "text", *log = "/tmp/daemon_bench.log", *label = "", *out = NULL;
+	double temp_hz = 100, light_hz = 100;
+	uint32_t seconds = 10, warmup = 2, batch = 8, req_conns = 0, req_depth = 4;
+	char temp_arg[32], light_arg[32], format_arg[32], dir[512], load_path[600];
+	char *dargv[MAX_ARGS], *largv[8], conns_arg[16], depth_arg[16], secs_arg[16];
+	char load_out[4096];
+	uint32_t dargc = 0, load_len = 0;
+	pid_t pid, load_pid = -1;
+	int out_fd, load_fd = -1, status;
+	uint64_t t_warm, t_end;
+	FILE *fp = stdout;
+	int i;
+
+	for (i = 1; i < argc; i++)
+	{
+		if (!strcmp(argv[i], "--"))
+		{
+			i++;
+			break;
+		}
+		else if (!strncmp(argv[i], "--daemon=", 9))
+			daemon = argv[i] + 9;
+		else if (!strncmp(argv[i], "--temp-hz=", 10))
+			temp_hz = strtod(argv[i] + 10, NULL);
+		else if (!strncmp(argv[i], "--light-hz=", 11))
+			light_hz = strtod(argv[i] + 11, NULL);
+		else if (!strncmp(argv[i], "--seconds=", 10))
+			seconds = strtoul(argv[i] + 10, NULL, 0);
+		else if (!strncmp(argv[i], "--warmup=", 9))
+			warmup = strtoul(argv[i] + 9, NULL, 0);
+		else if (!strncmp(argv[i], "--streams=", 10))
+			nstreams = strtoul(argv[i] + 10, NULL, 0);
+		else if (!strncmp(argv[i], "--batch=", 8))
+			batch = strtoul(argv[i] + 8, NULL, 0);
+		else if (!strncmp(argv[i], "--req-conns=", 12))
+			req_conns = strtoul(argv[i] + 12, NULL, 0);
+		else if (!strncmp(argv[i], "--req-depth=", 12))
+			req_depth = strtoul(argv[i] + 12, NULL, 0);
+		else if (!strncmp(argv[i], "--format=", 9))
+			format = argv[i] + 9;
+		else if (!strncmp(argv[i], "--log=", 6))
+			log = argv[i] + 6;
+		else if (!strncmp(argv[i], "--label=", 8))
+			label = argv[i] + 8;
+		else if (!strncmp(argv[i], "--out=", 6))
+			out = argv[i] + 6;
+		else
+		{
+			fprintf(stderr, "ERROR: Invalid parameter %s.\n", argv[i]);
+			return 1;
+		}
+	}
+	if (nstreams > MAX_STREAMS || batch == 0 || batch > WIRE_BATCH_MAX || seconds == 0 || temp_hz <= 0 || light_hz <= 0)
+	{
+		fprintf(stderr, "ERROR: At most %d streams, batch 1 to %d, rates and seconds above 0.\n", MAX_STREAMS,
+				WIRE_BATCH_MAX);
+		return 1;
+	}
+
+	//Daemon with the measurement mode on and a stats dump every second
+	snprintf(temp_arg, sizeof(temp_arg), "--temp-hz=%g", temp_hz);
+	snprintf(light_arg, sizeof(light_arg), "--light-hz=%g", light_hz);
+	snprintf(format_arg, sizeof(format_arg), "--format=%s", format);
+	dargv[dargc++] = (char *)daemon;
+	dargv[dargc++] = (char *)log;
+	dargv[dargc++] = "info";
+	dargv[dargc++] = "--sim";
+	dargv[dargc++] = "--measure";
+	dargv[dargc++] = "--stats=1";
+	dargv[dargc++] = temp_arg;
+	dargv[dargc++] = light_arg;
+	dargv[dargc++] = format_arg;
+	for (; i < argc && dargc < MAX_ARGS - 1; i++)
+	{
+		dargv[dargc++] = argv[i];
+	}
+	dargv[dargc] = NULL;
+
+	signal(SIGPIPE, SIG_IGN);
+	out_fd = spawn(dargv, &pid);
+	if (out_fd == -1)
+	{
+		return 1;
+	}
+	fcntl(out_fd, F_SETFL, O_NONBLOCK);
+
+	//The daemon is serving once it has dumped its stats
+	while (dumps == 0)
+	{
+		if (!pump(out_fd, now_ns() + 100000000ULL))
+		{
+			fprintf(stderr, "ERROR: %s exited during startup.\n", daemon);
+			return 1;
+		}
+	}
+	for (uint32_t s = 0; s < nstreams; s++)
+	{
+		if (stream_open(&streams[s], batch))
+		{
+			kill(pid, SIGINT);
+			return 1;
+		}
+	}
+	pump(out_fd, now_ns() + warmup * 1000000000ULL);
+
+	//Measured run
+	warm = last;
+	t_warm = now_ns();
+	cpu_read(pid, &cpu_warm);
+	uint64_t streamed_warm = 0, gaps_warm = 0;
+	for (uint32_t s = 0; s < nstreams; s++)
+	{
+		streamed_warm += streams[s].samples;
+		gaps_warm += streams[s].gaps;
+	}
+	if (req_conns)
+	{
+		snprintf(dir, sizeof(dir), "%s", argv[0]);
+		snprintf(load_path, sizeof(load_path), "%s/sock_load", dirname(dir));
+		snprintf(conns_arg, sizeof(conns_arg), "%u", req_conns);
+		snprintf(depth_arg, sizeof(depth_arg), "%u", req_depth);
+		snprintf(secs_arg, sizeof(secs_arg), "%u", seconds);
+		largv[0] = load_path;
+		largv[1] = "127.0.0.1";
+		largv[2] = conns_arg;
+		largv[3] = depth_arg;
+		largv[4] = secs_arg;
+		largv[5] = "100";
+		largv[6] = NULL;
+		load_fd = spawn(largv, &load_pid);
+	}
+	pump(out_fd, t_warm + seconds * 1000000000ULL);
+	cpu_read(pid, &cpu_end);
+
+	uint64_t streamed = 0, gaps = 0;
+	for (uint32_t s = 0; s < nstreams; s++)
+	{
+		streamed += streams[s].samples;
+		gaps += streams[s].gaps;
+	}
+	streamed -= streamed_warm;
+	gaps -= gaps_warm;
+
+	//The dump written at exit closes the run
+	t_end = now_ns();
+	kill(pid, SIGINT);
+	while (pump(out_fd, now_ns() + 1000000000ULL))
+	{
+	}
+	if (cur.n)
+	{
+		last = cur;
+	}
+	waitpid(pid, &status, 0);
+	if (load_fd != -1)
+	{
+		ssize_t res;
+		while ((res = read(load_fd, load_out + load_len, sizeof(load_out) - 1 - load_len)) > 0)
+		{
+			load_len += res;
+		}
+		load_out[load_len] = '\0';
+		waitpid(load_pid, NULL, 0);
+	}
+
+	//Results, the counters cover the time between the two dumps
+	double elapsed = (last.t_ns - warm.t_ns) / 1e9;
+	double cpu_elapsed = (cpu_end.t_ns - cpu_warm.t_ns) / 1e9;
+	double tick = sysconf(_SC_CLK_TCK);
+
+	if (out && (fp = fopen(out, "w")) == NULL)
+	{
+		perror("fopen");
+		return 1;
+	}
+	fprintf(fp, "{\n  \"label\": \"%s\",\n  \"config\": {\"temp_hz\": %g, \"light_hz\": %g, \"seconds\": %u, \"warmup\": %u, "
+				"\"format\": \"%s\", \"streams\": %u, \"batch\": %u, \"req_conns\": %u, \"req_depth\": %u},\n",
+			label, temp_hz, light_hz, seconds, warmup, format, nstreams, batch, req_conns, req_depth);
+	fprintf(fp, "  \"elapsed_s\": %.3f,\n", (t_end - t_warm) / 1e9);
+	fprintf(fp, "  \"samples_per_s\": {\"target\": %.1f, \"timer\": %.1f, \"published\": %.1f, \"logged\": %.1f, "
+				"\"streamed\": %.1f, \"received\": %.1f},\n",
+			temp_hz + light_hz, (delta("timer_temp", "expiries") + delta("timer_light", "expiries")) / elapsed,
+			delta("sample_bus", "published") / elapsed, delta("sample_bus", "logger[delivered") / elapsed,
+			delta("socket", "samples_streamed") / elapsed, streamed / ((t_end - t_warm) / 1e9));
+	fprintf(fp, "  \"drops\": {\"timer_overruns\": %.0f, \"events_coalesced\": %.0f, \"log_queue\": %.0f, "
+				"\"bus_logger\": %.0f, \"bus_socket\": %.0f, \"stream_frames\": %.0f, \"client_gaps\": %llu, "
+				"\"missed_periods\": %.0f, \"log_queue_blocks\": %.0f},\n",
+			delta("timer_temp", "overruns") + delta("timer_light", "overruns"),
+			delta("temp_event", "coalesced") + delta("light_event", "coalesced"),
+			delta("queue_log", "dropped") + delta("queue_log", "overwritten"),
+			delta("sample_bus", "logger[dropped"), delta("sample_bus", "socket[dropped"), delta("socket", "frames_dropped"),
+			(unsigned long long)gaps, delta("jitter_temp", "missed") + delta("jitter_light", "missed"),
+			delta("queue_log", "blocks"));
+
+	fprintf(fp, "  \"cpu_percent\": {");
+	double total = 0;
+	for (uint32_t t = 0; t < cpu_end.n; t++)
+	{
+		uint64_t before = 0;
+		for (uint32_t w = 0; w < cpu_warm.n; w++)
+		{
+			if (!strcmp(cpu_warm.names[w], cpu_end.names[t]))
+			{
+				before = cpu_warm.ticks[w];
+			}
+		}
+		double pct = cpu_elapsed > 0 ? 100.0 * (cpu_end.ticks[t] - before) / tick / cpu_elapsed : 0;
+		total += pct;
+		fprintf(fp, "\"%s\": %.1f, ", cpu_end.names[t], pct);
+	}
+	fprintf(fp, "\"total\": %.1f},\n", total);
+
+	fprintf(fp, "  \"latency_us\": ");
+	json_latency(fp);
+	if (load_fd != -1)
+	{
+		double rps = 0, l[5] = {0};
+		char *p;
+		if ((p = strstr(load_out, "requests/s=")))
+		{
+			rps = strtod(p + 11, NULL);
+		}
+		if ((p = strstr(load_out, "latency_us")))
+		{
+			sscanf(p, "latency_us p50=%lf p90=%lf p99=%lf p99.9=%lf max=%lf", &l[0], &l[1], &l[2], &l[3], &l[4]);
+		}
+		fprintf(fp, ",\n  \"requests\": {\"per_s\": %.0f, \"p50_us\": %.1f, \"p90_us\": %.1f, \"p99_us\": %.1f, "
+					"\"p999_us\": %.1f, \"max_us\": %.1f}",
+				rps, l[0], l[1], l[2], l[3], l[4]);
+	}
+	fprintf(fp, ",\n  \"daemon_exit\": %d\n}\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+	if (fp != stdout)
+	{
+		fclose(fp);
+	}
+	return 0;
+}
@@ -0,0 +1,200 @@
+/**
+ * @file queue_bench.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Compares the POSIX message queue transport with the SPSC ring channel used by the logger.
+ * Every producer thread sends sensor_struct messages to one consumer thread; the benchmark reports
+ * messages per second and the enqueue latency percentiles of both transports.
+ * Usage: queue_bench [producers] [messages per producer]
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <mqueue.h>
+#include <sched.h>
+#include "main.h"
+#include "ring.h"
+
+#define BENCH_QUEUE		("/queue_bench")
+#define MODE_MQ			(0)
+#define MODE_RING		(1)
+
+struct producer_arg
+{
+	uint8_t id;
+	uint32_t count;
+	uint64_t *lat_ns;
+};
+
+static uint8_t mode;
+static mqd_t bench_mq;
+static ring_chan bench_chan;
+static uint64_t total_msgs;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void *producer(void *arg)
+{
+	struct producer_arg *p = (struct producer_arg *)arg;
+	sensor_struct data;
+	uint64_t start;
+
+	memset(&data, 0, sizeof(data));
+	data.id = TEMP_RCV_ID;
+	for (uint32_t i = 0; i < p->count; i++)
+	{
+		data.sensor_data.temp_data.temp_c = i;
+		start = now_ns();
+		if (mode == MODE_MQ)
+		{
+			while (mq_send(bench_mq, (char *)&data, sizeof(data), 0) == -1 && errno == EINTR)
+			{
+			}
+		}
+		else
+		{
+			//A full ring behaves like a full message queue: wait for space
+			while (!chan_send(&bench_chan, p->id, &data))
+			{
+				sched_yield();
+			}
+		}
+		p->lat_ns[i] = now_ns() - start;
+	}
+	return NULL;
+}
+
+static void *consumer(void *arg)
+{
+	sensor_struct data;
+
+	for (uint64_t i = 0; i < total_msgs; i++)
+	{
+		if (mode == MODE_MQ)
+		{
+			while (mq_receive(bench_mq, (char *)&data, sizeof(data), NULL) == -1 && errno == EINTR)
+			{
+			}
+		}
+		else
+		{
+			chan_receive(&bench_chan, &data, -1);
+		}
+	}
+	return NULL;
+}
+
+static err_t run(uint8_t run_mode, uint8_t producers, uint32_t count)
+{
+	pthread_t prod[CHAN_MAX_PRODUCERS], cons;
+	struct producer_arg args[CHAN_MAX_PRODUCERS];
+	struct mq_attr attr;
+	uint64_t *lat, start, elapsed;
+
+	mode = run_mode;
+	total_msgs = (uint64_t)producers * count;
+	lat = malloc(total_msgs * sizeof(uint64_t));
+	if (lat == NULL)
+	{
+		return FAIL;
+	}
+
+	if (mode == MODE_MQ)
+	{
+		memset(&attr, 0, sizeof(attr));
+		attr.mq_maxmsg = 20;
+		attr.mq_msgsize = sizeof(sensor_struct);
+		mq_unlink(BENCH_QUEUE);
+		bench_mq = mq_open(BENCH_QUEUE, O_RDWR | O_CREAT, 0644, &attr);
+		if (bench_mq == -1)
+		{
+			//Unprivileged users are limited to /proc/sys/fs/mqueue/msg_max, 10 by default
+			attr.mq_maxmsg = 10;
+			bench_mq = mq_open(BENCH_QUEUE, O_RDWR | O_CREAT, 0644, &attr);
+		}
+		if (bench_mq == -1)
+		{
+			perror("ERROR: mq_open();");
+			free(lat);
+			return FAIL;
+		}
+	}
+	else if (chan_init(&bench_chan, sizeof(sensor_struct), 256))
+	{
+		free(lat);
+		return FAIL;
+	}
+
+	start = now_ns();
+	pthread_create(&cons, NULL, consumer, NULL);
+	for (uint8_t i = 0; i < producers; i++)
+	{
+		args[i].id = i + 1;
+		args[i].count = count;
+		args[i].lat_ns = lat + (uint64_t)i * count;
+		pthread_create(&prod[i], NULL, producer, &args[i]);
+	}
+	for (uint8_t i = 0; i < producers; i++)
+	{
+		pthread_join(prod[i], NULL);
+	}
+	pthread_join(cons, NULL);
+	elapsed = now_ns() - start;
+
+	qsort(lat, total_msgs, sizeof(uint64_t), cmp_u64);
+	printf("%-6s producers=%u msgs=%llu msgs/s=%.0f enqueue_ns p50=%llu p99=%llu max=%llu\n",
+		   (mode == MODE_MQ) ? "mqueue" : "ring", producers, (unsigned long long)total_msgs,
+		   total_msgs / (elapsed / 1e9), (unsigned long long)lat[total_msgs / 2],
+		   (unsigned long long)lat[(total_msgs * 99) / 100], (unsigned long long)lat[total_msgs - 1]);
+
+	if (mode == MODE_MQ)
+	{
+		mq_close(bench_mq);
+		mq_unlink(BENCH_QUEUE);
+	}
+	else
+	{
+		chan_free(&bench_chan);
+	}
+	free(lat);
+	return OK;
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t producers = 3;
+	uint32_t count = 200000;
+
+	if (argc > 1)
+	{
+		producers = strtoul(argv[1], NULL, 0);
+	}
+	if (argc > 2)
+	{
+		count = strtoul(argv[2], NULL, 0);
+	}
+	if (producers == 0 || producers >= CHAN_MAX_PRODUCERS || count == 0)
+	{
+		printf("Usage: %s [producers 1-%d] [messages per producer]\n", argv[0], CHAN_MAX_PRODUCERS - 1);
+		exit(EXIT_FAILURE);
+	}
+
+	if (run(MODE_MQ, producers, count) || run(MODE_RING, producers, count))
+	{
+		exit(EXIT_FAILURE);
+	}
+	return 0;
+}
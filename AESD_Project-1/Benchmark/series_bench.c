@@ -0,0 +1,311 @@
+/**
+ * @file series_bench.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Measures the compressed sample blocks written to the binary log with --compress. Every series is
+ * encoded into blocks the way the logger thread does and decoded the way log_export does; the benchmark
+ * checks that every sample comes back unchanged and reports the bytes per sample against the text and
+ * the binary records, the compression ratio and the encode and decode throughput.
+ * The series are generated like the TMP102 and APDS-9301 samples at the given rate, or taken from a
+ * binary log written by the daemon.
+ * Usage: series_bench [samples] [rate in Hz] [binary log]
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "log_format.h"
+#include "light.h"
+
+#define MAX_BLOCK_BYTES	(sizeof(binlog_rec_header) + BINLOG_MAX_PAYLOAD)
+#define JITTER_NS		(100000)	//Timer wake-up jitter of the generated samples
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+//Checks the fields a binary record keeps
+static bool same_sample(const sensor_struct *a, const sensor_struct *b, bool raw)
+{
+	if (a->id != b->id)
+	{
+		return false;
+	}
+	if (a->id == TEMP_RCV_ID || a->id == SOCK_TEMP_RCV_ID)
+	{
+		const struct temp_struct *x = &a->sensor_data.temp_data, *y = &b->sensor_data.temp_data;
+		return x->data_time.tv_sec == y->data_time.tv_sec && x->data_time.tv_nsec == y->data_time.tv_nsec &&
+			   x->unit == y->unit && (raw ? x->raw == y->raw : x->temp_c == y->temp_c);
+	}
+	const struct light_struct *x = &a->sensor_data.light_data, *y = &b->sensor_data.light_data;
+	return x->data_time.tv_sec == y->data_time.tv_sec && x->data_time.tv_nsec == y->data_time.tv_nsec &&
+		   (raw ? (x->adc0 == y->adc0 && x->adc1 == y->adc1) : x->light == y->light);
+}
+
+/**
+ * @brief Encodes a series into blocks, decodes them back and prints one line of results
+ *
+ * @param name - Name of the series
+ * @param samples - The samples, all with the same record id
+ * @param n - Number of samples
+ * @param raw - Store raw registers
+ */
+static void bench_series(const char *name, sensor_struct *samples, uint32_t n, bool raw)
+{
+	static binlog_block blk;
+	binlog_block_reader rd;
+	sensor_struct data;
+	uint8_t *blocks, *rec;
+	size_t used = 0, len, text = 0, plain = 0;
+	uint64_t start, encode_ns, decode_ns;
+	uint32_t nblocks = 0, decoded = 0, bad = 0;
+	char line[512];
+	bool state = false;
+
+	if (n == 0)
+	{
+		return;
+	}
+	//A block holds at least one sample
+	blocks = malloc((size_t)n * MAX_BLOCK_BYTES);
+	if (blocks == NULL)
+	{
+		perror("malloc failed");
+		exit(EXIT_FAILURE);
+	}
+
+	for (uint32_t i = 0; i < n; i++)
+	{
+		text += log_format_text(line, sizeof(line), &samples[i], &state);
+		plain += binlog_encode((uint8_t *)line, sizeof(line), &samples[i], raw);
+	}
+
+	start = now_ns();
+	binlog_block_init(&blk, samples[0].id, raw);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		if (!binlog_block_add(&blk, &samples[i]))
+		{
+			len = binlog_block_finish(&blk);
+			memcpy(blocks + used, blk.buf, len);
+			used += len;
+			nblocks++;
+			binlog_block_add(&blk, &samples[i]);
+		}
+	}
+	len = binlog_block_finish(&blk);
+	memcpy(blocks + used, blk.buf, len);
+	used += len;
+	nblocks++;
+	encode_ns = now_ns() - start;
+
+	start = now_ns();
+	for (rec = blocks; rec < blocks + used; rec += len)
+	{
+		binlog_rec_header hdr;
+		memcpy(&hdr, rec, sizeof(hdr));
+		len = sizeof(hdr) + hdr.length;
+		if (binlog_block_open(&rd, rec, len))
+		{
+			bad++;
+			continue;
+		}
+		while (binlog_block_next(&rd, &data))
+		{
+			if (decoded < n && !same_sample(&data, &samples[decoded], raw))
+			{
+				bad++;
+			}
+			decoded++;
+		}
+	}
+	decode_ns = now_ns() - start;
+
+	printf("%-12s samples=%u blocks=%u text_B=%.2f binary_B=%.2f block_B=%.2f ratio_binary=%.2f ratio_text=%.2f "
+		   "encode_Msamples/s=%.2f decode_Msamples/s=%.2f encode_MB/s=%.1f decode_MB/s=%.1f %s\n",
+		   name, n, nblocks, (double)text / n, (double)plain / n, (double)used / n, (double)plain / used,
+		   (double)text / used, n * 1e3 / encode_ns, n * 1e3 / decode_ns, plain * 1e3 / encode_ns,
+		   plain * 1e3 / decode_ns, (bad || decoded != n) ? "MISMATCH" : "ok");
+	free(blocks);
+}
+
+/**
+ * @brief Generates the samples of both sensors at a steady rate with timer jitter: the temperature
+ * register drifts by one LSB at a time and the light channels wander around a steady level
+ *
+ * @param temp - Filled with the temperature samples
+ * @param light - Filled with the light samples
+ * @param n - Number of samples of each sensor
+ * @param period_ns - Sampling period
+ */
+static void generate(sensor_struct *temp, sensor_struct *light, uint32_t n, uint64_t period_ns)
+{
+	uint64_t t = 1554336000ULL * 1000000000ULL;
+	int reg = 24 * 16, adc0 = 15880, adc1 = 4760;
+
+	srand(1);
+	for (uint32_t i = 0; i < n; i++)
+	{
+		uint64_t ts = t + (uint64_t)(rand() % JITTER_NS);
+		struct temp_struct *tc = &temp[i].sensor_data.temp_data;
+		struct light_struct *lc = &light[i].sensor_data.light_data;
+
+		t += period_ns;
+		if (rand() % 50 == 0)
+		{
+			reg += (rand() % 2) ? 1 : -1;
+		}
+		adc0 += rand() % 5 - 2;
+		adc1 += rand() % 3 - 1;
+
+		memset(&temp[i], 0, sizeof(sensor_struct));
+		temp[i].id = TEMP_RCV_ID;
+		tc->data_time.tv_sec = ts / 1000000000ULL;
+		tc->data_time.tv_nsec = ts % 1000000000ULL;
+		tc->raw = reg & 0x0FFF;
+		tc->unit = UNIT_CELSIUS;
+		tc->temp_c = temp_raw_to_c(tc->raw);
+
+		memset(&light[i], 0, sizeof(sensor_struct));
+		light[i].id = LIGHT_RCV_ID;
+		lc->data_time = tc->data_time;
+		lc->data_time.tv_nsec = (lc->data_time.tv_nsec + 5000000) % 1000000000;
+		lc->adc0 = adc0;
+		lc->adc1 = adc1;
+		lc->light = lux_calc(lc->adc0, lc->adc1);
+		lc->light_state = (lc->light < LIGHT_TH) ? DARK : LIGHT;
+	}
+}
+
+/**
+ * @brief Reads the sensor samples of a binary log, compressed or not, grouped by record id
+ *
+ * @param path - The binary log
+ * @param by_id - Filled with one array of samples per record id, up to BLOCK_RCV_ID
+ * @param counts - Number of samples per record id
+ * @param raw - Set if the log holds raw registers
+ */
+static void read_log(const char *path, sensor_struct **by_id, uint32_t *counts, bool *raw)
+{
+	binlog_file_header hdr;
+	binlog_block_reader rd;
+	sensor_struct data;
+	uint32_t caps[BLOCK_RCV_ID + 1] = {0};
+	uint8_t *buf;
+	long size;
+	size_t pos, used;
+	FILE *in = fopen(path, "rb");
+
+	if (in == NULL || fread(&hdr, sizeof(hdr), 1, in) != 1 || binlog_file_check(&hdr))
+	{
+		printf("ERROR: %s is not a binary log.\n", path);
+		exit(EXIT_FAILURE);
+	}
+	*raw = hdr.flags & BINLOG_FILE_RAW;
+	fseek(in, 0, SEEK_END);
+	size = ftell(in);
+	buf = malloc(size);
+	fseek(in, 0, SEEK_SET);
+	if (buf == NULL || fread(buf, 1, size, in) != (size_t)size)
+	{
+		perror("ERROR: cannot read the binary log");
+		exit(EXIT_FAILURE);
+	}
+	fclose(in);
+
+	for (pos = hdr.header_size; (used = binlog_decode(buf + pos, size - pos, &data)) > 0; pos += used)
+	{
+		bool block = (data.id == BLOCK_RCV_ID && !binlog_block_open(&rd, buf + pos, used));
+
+		while (block ? binlog_block_next(&rd, &data) : (data.id == TEMP_RCV_ID || data.id == LIGHT_RCV_ID ||
+														 data.id == SOCK_TEMP_RCV_ID || data.id == SOCK_LIGHT_RCV_ID))
+		{
+			if (counts[data.id] == caps[data.id])
+			{
+				caps[data.id] = caps[data.id] ? 2 * caps[data.id] : 1024;
+				by_id[data.id] = realloc(by_id[data.id], caps[data.id] * sizeof(sensor_struct));
+				if (by_id[data.id] == NULL)
+				{
+					perror("realloc failed");
+					exit(EXIT_FAILURE);
+				}
+			}
+			by_id[data.id][counts[data.id]++] = data;
+			if (!block)
+			{
+				break;
+			}
+		}
+	}
+	free(buf);
+}
+
+int main(int argc, char *argv[])
+{
+	uint32_t n = 100000;
+	double rate = 10;
+
+	if (argc > 4)
+	{
+		printf("Usage: %s [samples] [rate in Hz] [binary log]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	if (argc > 1)
+	{
+		n = strtoul(argv[1], NULL, 0);
+	}
+	if (argc > 2)
+	{
+		rate = strtod(argv[2], NULL);
+	}
+	if (n == 0 || rate <= 0)
+	{
+		printf("ERROR: Invalid samples or rate.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (argc > 3)
+	{
+		sensor_struct *by_id[BLOCK_RCV_ID + 1] = {NULL};
+		uint32_t counts[BLOCK_RCV_ID + 1] = {0};
+		const char *names[BLOCK_RCV_ID + 1] = {NULL};
+		bool raw;
+
+		names[TEMP_RCV_ID] = "temp";
+		names[LIGHT_RCV_ID] = "light";
+		names[SOCK_TEMP_RCV_ID] = "sock_temp";
+		names[SOCK_LIGHT_RCV_ID] = "sock_light";
+		read_log(argv[3], by_id, counts, &raw);
+		printf("%s, %s\n", argv[3], raw ? "raw registers" : "converted values");
+		for (int id = 0; id <= BLOCK_RCV_ID; id++)
+		{
+			if (names[id])
+			{
+				bench_series(names[id], by_id[id], counts[id], raw);
+			}
+			free(by_id[id]);
+		}
+		return 0;
+	}
+
+	sensor_struct *temp = malloc(n * sizeof(sensor_struct));
+	sensor_struct *light = malloc(n * sizeof(sensor_struct));
+	if (temp == NULL || light == NULL)
+	{
+		perror("malloc failed");
+		exit(EXIT_FAILURE);
+	}
+	generate(temp, light, n, 1e9 / rate);
+	printf("%u generated samples per sensor at %.1f Hz\n", n, rate);
+	bench_series("temp_c", temp, n, false);
+	bench_series("temp_raw", temp, n, true);
+	bench_series("light_lux", light, n, false);
+	bench_series("light_raw", light, n, true);
+	free(temp);
+	free(light);
+	return 0;
+}
@@ -0,0 +1,251 @@
+/**
+ * @file sock_load.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Load test of the sensor socket server. Opens many connections to the server, keeps a fixed
+ * number of requests in flight on each of them and reports the requests per second and the request
+ * latency percentiles.
+ * Usage: sock_load [host] [connections] [requests in flight per connection] [seconds] [command]
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define PORT			(3124)
+#define MAX_DEPTH		(32)
+#define MAX_SAMPLES		(4000000)
+
+struct client
+{
+	int fd;
+	int connected;
+	uint64_t sent_ns[MAX_DEPTH]; //Send time of the requests in flight, oldest first
+	uint32_t head;
+	uint32_t count;
+	uint8_t in[64];
+	uint32_t in_len;
+};
+
+static struct client *clients;
+static uint64_t *lat;
+static uint64_t samples, completed, failed, closed;
+static uint32_t depth, reply_size;
+static int command;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+//Tops the client up to depth requests in flight, all sent with one syscall
+static int client_fill(struct client *c)
+{
+	int req[MAX_DEPTH];
+	uint32_t n = depth - c->count;
+	uint64_t t;
+	ssize_t res;
+
+	if (n == 0)
+	{
+		return 0;
+	}
+	for (uint32_t i = 0; i < n; i++)
+	{
+		req[i] = command;
+	}
+	res = send(c->fd, req, n * sizeof(int), MSG_NOSIGNAL);
+	if (res != (ssize_t)(n * sizeof(int)))
+	{
+		//Partial sends of 4 byte requests are not expected with a few requests in flight
+		return -1;
+	}
+	t = now_ns();
+	for (uint32_t i = 0; i < n; i++)
+	{
+		c->sent_ns[(c->head + c->count) % MAX_DEPTH] = t;
+		c->count++;
+	}
+	return 0;
+}
+
+static int client_read(struct client *c)
+{
+	ssize_t res;
+	uint64_t t;
+
+	while (1)
+	{
+		res = recv(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len, 0);
+		if (res == 0)
+		{
+			return -1;
+		}
+		if (res == -1)
+		{
+			return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+		}
+		c->in_len += res;
+
+		t = now_ns();
+		while (c->in_len >= reply_size && c->count)
+		{
+			if (samples < MAX_SAMPLES)
+			{
+				lat[samples++] = t - c->sent_ns[c->head];
+			}
+			c->head = (c->head + 1) % MAX_DEPTH;
+			c->count--;
+			completed++;
+			memmove(c->in, c->in + reply_size, c->in_len - reply_size);
+			c->in_len -= reply_size;
+		}
+		if (client_fill(c))
+		{
+			return -1;
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const char *host = (argc > 1) ? argv[1] : "127.0.0.1";
+	uint32_t nconn = (argc > 2) ? strtoul(argv[2], NULL, 0) : 200;
+	uint32_t seconds;
+	struct sockaddr_in addr;
+	struct epoll_event ev, events[256];
+	uint64_t start, end, stop;
+	int epfd, one = 1;
+
+	depth = (argc > 3) ? strtoul(argv[3], NULL, 0) : 4;
+	seconds = (argc > 4) ? strtoul(argv[4], NULL, 0) : 5;
+	command = (argc > 5) ? atoi(argv[5]) : 103;
+	if (depth == 0 || depth > MAX_DEPTH)
+	{
+		depth = 4;
+	}
+	reply_size = ((command == 105) || (command == 106)) ? 2 * sizeof(float) : sizeof(float);
+
+	clients = calloc(nconn, sizeof(struct client));
+	lat = malloc(MAX_SAMPLES * sizeof(uint64_t));
+	epfd = epoll_create1(0);
+	if (clients == NULL || lat == NULL || epfd == -1)
+	{
+		perror("ERROR: setup failed");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(PORT);
+	if (inet_pton(AF_INET, host, &addr.sin_addr) != 1)
+	{
+		printf("ERROR: invalid address %s\n", host);
+		return 1;
+	}
+
+	for (uint32_t i = 0; i < nconn; i++)
+	{
+		struct client *c = &clients[i];
+		c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+		setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		if (connect(c->fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 && errno != EINPROGRESS)
+		{
+			failed++;
+			close(c->fd);
+			c->fd = -1;
+			continue;
+		}
+		ev.events = EPOLLIN | EPOLLOUT;
+		ev.data.u32 = i;
+		epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+	}
+
+	start = now_ns();
+	stop = start + (uint64_t)seconds * 1000000000ULL;
+	while (now_ns() < stop)
+	{
+		int n = epoll_wait(epfd, events, 256, 100);
+		for (int i = 0; i < n; i++)
+		{
+			struct client *c = &clients[events[i].data.u32];
+			int err = 0;
+
+			if (!c->connected && (events[i].events & EPOLLOUT))
+			{
+				socklen_t len = sizeof(err);
+				getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+				if (err == 0)
+				{
+					c->connected = 1;
+					ev.events = EPOLLIN;
+					ev.data.u32 = events[i].data.u32;
+					epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+					err = client_fill(c);
+				}
+			}
+			else if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			{
+				err = client_read(c);
+			}
+
+			if (err)
+			{
+				c->connected ? closed++ : failed++;
+				epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				close(c->fd);
+				c->fd = -1;
+				c->connected = 0;
+			}
+		}
+	}
+	end = now_ns();
+
+	uint32_t connected = 0;
+	for (uint32_t i = 0; i < nconn; i++)
+	{
+		if (clients[i].fd != -1)
+		{
+			connected += clients[i].connected;
+			close(clients[i].fd);
+		}
+	}
+
+	printf("connections=%u connected=%u failed=%llu closed_by_server=%llu depth=%u command=%d\n", nconn, connected,
+		   (unsigned long long)failed, (unsigned long long)closed, depth, command);
+	printf("requests=%llu requests/s=%.0f\n", (unsigned long long)completed, completed / ((end - start) / 1e9));
+	if (samples)
+	{
+		qsort(lat, samples, sizeof(uint64_t), cmp_u64);
+		printf("latency_us p50=%.1f p90=%.1f p99=%.1f p99.9=%.1f max=%.1f\n", lat[samples / 2] / 1e3,
+			   lat[samples * 90 / 100] / 1e3, lat[samples * 99 / 100] / 1e3, lat[samples * 999 / 1000] / 1e3,
+			   lat[samples - 1] / 1e3);
+	}
+
+	free(lat);
+	free(clients);
+	close(epfd);
+	return 0;
+}
@@ -0,0 +1,157 @@
+/**
+ * @file log_export.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Standalone tool which converts a binary telemetry log written with --format=binary to the text
+ * layout of the logfile or to CSV. Compressed blocks written with --compress are expanded to one line per
+ * sample. Segments of a rotated log are read the same way, gzipped or not.
+ * Usage: log_export <binary log> [text|csv] [output file]
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <zlib.h>
+#include "log_format.h"
+
+#define READ_SIZE (64 * 1024)
+
+int main(int argc, char *argv[])
+{
+	FILE *out = stdout;
+	gzFile in;
+	binlog_file_header hdr;
+	binlog_block_reader block;
+	sensor_struct data;
+	bool csv = false;
+	bool prev_state = false;
+	uint8_t *buf;
+	char line[512];
+	size_t len = 0, pos, used, n;
+	int got;
+	unsigned long records = 0, skipped = 0;
+	unsigned long blocks = 0, block_samples = 0, block_bytes = 0;
+
+	if (argc < 2 || argc > 4)
+	{
+		printf("Usage: %s <binary log> [text|csv] [output file]\n", argv[0]);
+		exit(EXIT_FAILURE);
+	}
+
+	if (argc > 2)
+	{
+		if (!strcmp(argv[2], "csv"))
+		{
+			csv = true;
+		}
+		else if (strcmp(argv[2], "text"))
+		{
+			printf("ERROR: Invalid output format %s; Valid formats: 'text' or 'csv'.\n", argv[2]);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	//Reads a file that is not gzipped as it is
+	in = gzopen(argv[1], "rb");
+	if (in == NULL)
+	{
+		perror("ERROR: gzopen(); cannot open binary log");
+		exit(EXIT_FAILURE);
+	}
+
+	if (gzread(in, &hdr, sizeof(hdr)) != sizeof(hdr) || binlog_file_check(&hdr))
+	{
+		printf("ERROR: %s is not a binary log or has an unsupported version.\n", argv[1]);
+		gzclose(in);
+		exit(EXIT_FAILURE);
+	}
+	//Skip header fields added by later versions
+	gzseek(in, hdr.header_size, SEEK_SET);
+
+	if (argc > 3)
+	{
+		out = fopen(argv[3], "w");
+		if (out == NULL)
+		{
+			perror("ERROR: fopen(); cannot open output file");
+			gzclose(in);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	buf = malloc(READ_SIZE);
+	if (buf == NULL)
+	{
+		perror("ERROR: malloc();");
+		exit(EXIT_FAILURE);
+	}
+
+	if (csv)
+	{
+		fputs(log_csv_header(), out);
+	}
+
+	while ((got = gzread(in, buf + len, READ_SIZE - len)) > 0)
+	{
+		len += got;
+		pos = 0;
+		while ((used = binlog_decode(buf + pos, len - pos, &data)) > 0)
+		{
+			pos += used;
+			if (data.id == 0)
+			{
+				skipped++;
+				continue;
+			}
+			if (data.id == LOGFMT_RCV_ID)
+			{
+				//Only fills the format table
+				continue;
+			}
+			if (data.id == BLOCK_RCV_ID)
+			{
+				if (binlog_block_open(&block, buf + pos - used, used))
+				{
+					skipped++;
+					continue;
+				}
+				blocks++;
+				block_bytes += used;
+				while (binlog_block_next(&block, &data))
+				{
+					n = csv ? log_format_csv(line, sizeof(line), &data) : log_format_text(line, sizeof(line), &data, &prev_state);
+					fwrite(line, 1, n, out);
+					records++;
+					block_samples++;
+				}
+				continue;
+			}
+			n = csv ? log_format_csv(line, sizeof(line), &data) : log_format_text(line, sizeof(line), &data, &prev_state);
+			fwrite(line, 1, n, out);
+			records++;
+		}
+		//Keep the partial record for the next read
+		memmove(buf, buf + pos, len - pos);
+		len -= pos;
+	}
+
+	if (len)
+	{
+		fprintf(stderr, "WARNING: %zu trailing bytes of a truncated record ignored.\n", len);
+	}
+	fprintf(stderr, "%lu records exported, %lu unknown records skipped.\n", records, skipped);
+	if (blocks)
+	{
+		fprintf(stderr, "%lu samples read from %lu compressed blocks, %.2f bytes per sample.\n", block_samples, blocks,
+				(double)block_bytes / block_samples);
+	}
+
+	free(buf);
+	gzclose(in);
+	if (out != stdout)
+	{
+		fclose(out);
+	}
+	return 0;
+}
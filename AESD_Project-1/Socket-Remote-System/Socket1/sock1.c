@@ -15,6 +15,9 @@ Referred from:- http://www.it.uom.gr/teaching/distrubutedSite/dsIdaLiu/labs/lab2
 #include <arpa/inet.h>
 #include <time.h>
 #include <signal.h>
+#include <sys/uio.h>
+#include "wire.h"
+#include "gorilla.h"
 
 #define PORT 3124 /* server's port number */
 #define MAX_SIZE 100
@@ -25,6 +28,10 @@ Referred from:- http://www.it.uom.gr/teaching/distrubutedSite/dsIdaLiu/labs/lab2
 #define SOCK_TEMP_RCV_ID (5)
 #define SOCK_LIGHT_RCV_ID (6)
 
+//Legacy streaming subscription commands, see sockets.h of the server
+#define SOCK_SUBSCRIBE (107)
+#define SOCK_UNSUBSCRIBE (108)
+
 int len;
 struct sockaddr_in client_addr;
 char *serv_host = "192.168.0.41";
@@ -33,6 +40,8 @@ int buff_size = 0;
 int client_fd, client_f, clilen, port;
 char string[MAX_SIZE];
 typedef uint32_t err_t;
+int legacy;		 //Speak the legacy protocol: bare int commands and bare float replies
+uint32_t tx_seq; //seq of the next message sent in the framed protocol
 
 
 void signal_handler(int signo, siginfo_t *info, void *extra)
@@ -57,77 +66,370 @@ err_t sig_init()
 	}
 }
 
-void socket_request(void)
+/*Reads exactly len bytes, returns -1 if the server closed the connection*/
+int read_full(void *buf, size_t len)
 {
-	const char *strings[7] = {"TC", "TF", "TK", "L", "TCL", "TKL", "TFL"};
-	int strings_define[7] = {100, 101, 102, 103, 104, 105, 106};
-	printf("Client fd %d\n", client_fd);
-	char data[3];
-	printf("\nEnter one of the available commands\n\n");
-	printf("Press TC and enter to request temperature in Celsius\n");
-	printf("Press TF and enter to request temperature in Fahrenheit\n");
-	printf("Press TK and enter to request temperature in Kelvin\n");
-	printf("Press L and enter to request Light intensity in Lux\n");
-	scanf("%s", data);
-	if (strcmp(data, strings[0]) == 0)
+	size_t done = 0;
+	ssize_t res;
+	while (done < len)
 	{
-		if (send(client_fd, (void *)&strings_define[0], sizeof(strings_define[0]), 0) == -1)
+		res = read(client_fd, (char *)buf + done, len - done);
+		if (res <= 0)
 		{
-			perror("send failed");
+			return -1;
 		}
+		done += res;
+	}
+	return 0;
+}
+
+/*Sends one framed message, the header and the payload go out with one writev()*/
+int send_msg(uint8_t type, const void *payload, uint16_t count, size_t rec_size)
+{
+	wire_hdr hdr;
+	struct iovec iov[2];
+	hdr.length = WIRE_LENGTH(count, rec_size);
+	hdr.magic = WIRE_MAGIC;
+	hdr.version = WIRE_VERSION;
+	hdr.type = type;
+	hdr.seq = tx_seq++;
+	hdr.count = count;
+	hdr.reserved = 0;
+	iov[0].iov_base = &hdr;
+	iov[0].iov_len = sizeof(hdr);
+	iov[1].iov_base = (void *)payload;
+	iov[1].iov_len = count * rec_size;
+	if (writev(client_fd, iov, count ? 2 : 1) == -1)
+	{
+		perror("send failed");
+		return -1;
+	}
+	return 0;
+}
+
+/*Returns the size of the records of a message type*/
+size_t record_size(uint8_t type)
+{
+	if (type == WIRE_MSG_HELLO)
+	{
+		return 0;
+	}
+	if (type == WIRE_MSG_ROLLUP)
+	{
+		return sizeof(wire_bucket);
+	}
+	if (type == WIRE_MSG_SERIES)
+	{
+		return 1;
+	}
+	return (type == WIRE_MSG_LATENCY) ? sizeof(wire_latency) : sizeof(wire_record);
+}
+
+/*Reads one framed message, the records are stored in records, which holds size bytes. Returns -1 on error*/
+int read_msg(wire_hdr *hdr, void *records, size_t size)
+{
+	size_t rec_size;
+
+	if (read_full(hdr, sizeof(wire_hdr)))
+	{
+		return -1;
 	}
-	else if (strcmp(data, strings[1]) == 0)
+	rec_size = record_size(hdr->type);
+	if (hdr->magic != WIRE_MAGIC || hdr->version != WIRE_VERSION || hdr->count * rec_size > size ||
+		hdr->length != WIRE_LENGTH(hdr->count, rec_size))
+	{
+		printf("Invalid message\n");
+		return -1;
+	}
+	if (hdr->type == WIRE_MSG_HELLO)
+	{
+		return 0;
+	}
+	return read_full(records, hdr->count * rec_size);
+}
+
+/*Prints the records of a reply or of streamed samples, reporting gaps in the sample sequence*/
+void print_records(wire_hdr *hdr, wire_record *records)
+{
+	static uint32_t next_seq;
+	const char *units[4] = {"C", "K", "F", "lux"};
+
+	for (int i = 0; i < hdr->count; i++)
 	{
-		if (send(client_fd, (void *)&strings_define[1], sizeof(strings_define[1]), 0) == -1)
+		if (hdr->type == WIRE_MSG_SAMPLES)
 		{
-			perror("send failed");
+			if (records[i].seq != next_seq)
+			{
+				printf("Lost %u samples\n", records[i].seq - next_seq);
+			}
+			next_seq = records[i].seq + 1;
 		}
+		printf("[%u.%09u] #%u %s %f %s\n", records[i].tv_sec, records[i].tv_nsec, records[i].seq,
+			   (records[i].id == WIRE_ID_TEMP) ? "Temperature" : "Light", records[i].value,
+			   (records[i].unit < 4) ? units[records[i].unit] : "?");
+	}
+}
+
+/*Switches the connection to the framed protocol*/
+int socket_hello(void)
+{
+	int hello = WIRE_HELLO;
+	wire_hdr hdr;
+	if (send(client_fd, (void *)&hello, sizeof(hello), 0) == -1 || read_msg(&hdr, NULL, 0))
+	{
+		return -1;
+	}
+	if (hdr.type != WIRE_MSG_HELLO)
+	{
+		printf("Unexpected reply to hello\n");
+		return -1;
 	}
+	printf("Server speaks protocol version %u\n", hdr.version);
+	return 0;
+}
 
-	else if (strcmp(data, strings[2]) == 0)
+/*Sends one 100-106 command*/
+int send_command(int cmd)
+{
+	if (legacy)
 	{
-		if (send(client_fd, (void *)&strings_define[2], sizeof(strings_define[2]), 0) == -1)
+		return (send(client_fd, (void *)&cmd, sizeof(cmd), 0) == -1) ? -1 : 0;
+	}
+	return send_msg(WIRE_MSG_REQUEST, &cmd, 1, sizeof(cmd));
+}
+
+/*Asks for the channels, decimation and batch size and subscribes*/
+void socket_subscribe(void)
+{
+	char chan[8];
+	wire_subscribe sub;
+	int req[4];
+	printf("Enter the channels to stream: T, L or TL\n");
+	scanf("%7s", chan);
+	sub.mask = (strchr(chan, 'T') ? WIRE_SUB_TEMP : 0) | (strchr(chan, 'L') ? WIRE_SUB_LIGHT : 0);
+	printf("Enter the decimation factor (1 streams every sample)\n");
+	scanf("%u", &sub.decim);
+	printf("Enter the number of samples per message (1 to %d)\n", WIRE_BATCH_MAX);
+	scanf("%u", &sub.batch);
+	if (legacy)
+	{
+		req[0] = SOCK_SUBSCRIBE;
+		req[1] = sub.mask;
+		req[2] = sub.decim;
+		req[3] = sub.batch;
+		if (send(client_fd, (void *)req, sizeof(req), 0) == -1)
 		{
 			perror("send failed");
 		}
 	}
+	else
+	{
+		send_msg(WIRE_MSG_SUBSCRIBE, &sub, 1, sizeof(sub));
+	}
+}
 
-	else if (strcmp(data, strings[3]) == 0)
+/*Asks for the channel and the number of samples and queries the history of the daemon, packed asks for
+a compressed reply*/
+void socket_history(bool packed)
+{
+	char chan[8];
+	wire_history query;
+	int req[1 + sizeof(wire_history) / sizeof(int)];
+	memset(&query, 0, sizeof(query));
+	printf("Enter the channel: TC, TF, TK or L\n");
+	scanf("%7s", chan);
+	query.id = (chan[0] == 'T') ? WIRE_ID_TEMP : WIRE_ID_LIGHT;
+	query.unit = (chan[1] == 'F') ? WIRE_UNIT_FAHRENHEIT : ((chan[1] == 'K') ? WIRE_UNIT_KELVIN : WIRE_UNIT_CELSIUS);
+	printf("Enter the number of samples (1 to %d)\n", WIRE_HISTORY_MAX);
+	scanf("%u", &query.last);
+	query.flags = packed ? WIRE_HIST_PACKED : 0;
+	if (legacy)
 	{
-		if (send(client_fd, (void *)&strings_define[3], sizeof(strings_define[3]), 0) == -1)
+		req[0] = WIRE_HISTORY;
+		memcpy(&req[1], &query, sizeof(query));
+		if (send(client_fd, (void *)req, sizeof(req), 0) == -1)
 		{
 			perror("send failed");
 		}
 	}
+	else
+	{
+		send_msg(WIRE_MSG_HISTORY, &query, 1, sizeof(query));
+	}
+}
 
-	else if (strcmp(data, strings[4]) == 0)
+/*Asks for the channel, the tier and the number of buckets and queries the rollups of the daemon*/
+void socket_rollup(void)
+{
+	char chan[8];
+	unsigned tier;
+	wire_rollup query;
+	int req[1 + sizeof(wire_rollup) / sizeof(int)];
+	memset(&query, 0, sizeof(query));
+	printf("Enter the channel: TC, TF, TK or L\n");
+	scanf("%7s", chan);
+	query.id = (chan[0] == 'T') ? WIRE_ID_TEMP : WIRE_ID_LIGHT;
+	query.unit = (chan[1] == 'F') ? WIRE_UNIT_FAHRENHEIT : ((chan[1] == 'K') ? WIRE_UNIT_KELVIN : WIRE_UNIT_CELSIUS);
+	printf("Enter the tier (0 is the finest)\n");
+	scanf("%u", &tier);
+	query.tier = tier;
+	printf("Enter the number of buckets (1 to %d)\n", WIRE_ROLLUP_MAX);
+	scanf("%u", &query.last);
+	if (legacy)
 	{
-		if (send(client_fd, (void *)&strings_define[4], sizeof(strings_define[4]), 0) == -1)
+		req[0] = WIRE_ROLLUP;
+		memcpy(&req[1], &query, sizeof(query));
+		if (send(client_fd, (void *)req, sizeof(req), 0) == -1)
 		{
 			perror("send failed");
 		}
 	}
+	else
+	{
+		send_msg(WIRE_MSG_ROLLUP, &query, 1, sizeof(query));
+	}
+}
+
+/*Prints the buckets of a rollup reply*/
+void print_buckets(wire_hdr *hdr, wire_bucket *buckets)
+{
+	const char *units[4] = {"C", "K", "F", "lux"};
 
-	else if (strcmp(data, strings[5]) == 0)
+	printf("%-20s %10s %10s %10s %10s %10s\n", "start", "period_ms", "count", "min", "max", "mean");
+	for (int i = 0; i < hdr->count; i++)
 	{
-		if (send(client_fd, (void *)&strings_define[5], sizeof(strings_define[5]), 0) == -1)
+		printf("%10llu.%09llu %10u %10u %10.3f %10.3f %10.3f %s\n",
+			   (unsigned long long)(buckets[i].start_ns / 1000000000ULL),
+			   (unsigned long long)(buckets[i].start_ns % 1000000000ULL), buckets[i].period_ms, buckets[i].count,
+			   buckets[i].min, buckets[i].max, buckets[i].mean, (buckets[i].unit < 4) ? units[buckets[i].unit] : "?");
+	}
+}
+
+/*Decodes and prints a compressed history reply*/
+void print_series(wire_hdr *hdr, const uint8_t *payload)
+{
+	const char *units[4] = {"C", "K", "F", "lux"};
+	wire_series series;
+	gorilla_dec dec;
+	uint64_t time_ns;
+	uint32_t bits, n = 0;
+	float value;
+
+	if (hdr->count < sizeof(series))
+	{
+		printf("Invalid series\n");
+		return;
+	}
+	memcpy(&series, payload, sizeof(series));
+	gorilla_dec_init(&dec, payload + sizeof(series), hdr->count - sizeof(series), series.mode, series.samples);
+	while (gorilla_dec_next(&dec, &time_ns, &bits))
+	{
+		memcpy(&value, &bits, sizeof(value));
+		printf("[%llu.%09llu] #%u %s %f %s\n", (unsigned long long)(time_ns / 1000000000ULL),
+			   (unsigned long long)(time_ns % 1000000000ULL), series.seq,
+			   (series.id == WIRE_ID_TEMP) ? "Temperature" : "Light", value,
+			   (series.unit < 4) ? units[series.unit] : "?");
+		n++;
+	}
+	if (n != series.samples)
+	{
+		printf("Series truncated after %u of %u samples\n", n, series.samples);
+	}
+	printf("%u samples in %u bytes, %u as records\n", series.samples, hdr->count,
+		   (unsigned)(series.samples * sizeof(wire_record)));
+}
+
+/*Prints the latency percentiles of the daemon, in microseconds except for queue depths*/
+void print_latency(wire_hdr *hdr, wire_latency *lat)
+{
+	printf("%-12s %10s %10s %10s %10s %10s %10s\n", "histogram", "count", "p50", "p90", "p99", "p99.9", "max");
+	for (int i = 0; i < hdr->count; i++)
+	{
+		printf("%-12.12s %10llu %10.1f %10.1f %10.1f %10.1f %10.1f %s\n", lat[i].name, (unsigned long long)lat[i].count,
+			   lat[i].p50, lat[i].p90, lat[i].p99, lat[i].p999, lat[i].max, (lat[i].unit == WIRE_LAT_US) ? "us" : "");
+	}
+}
+
+/*Prints the streamed samples until the connection is closed or the client is interrupted*/
+void socket_stream(void)
+{
+	wire_hdr hdr;
+	wire_record records[WIRE_BATCH_MAX];
+
+	while (read_msg(&hdr, records, sizeof(records)) == 0)
+	{
+		print_records(&hdr, records);
+	}
+}
+
+/*Returns the command sent, SOCK_SUBSCRIBE if a subscription was requested*/
+int socket_request(void)
+{
+	const char *strings[7] = {"TC", "TF", "TK", "L", "STATE", "TFL", "TKL"};
+	int strings_define[7] = {100, 101, 102, 103, 104, 105, 106};
+	printf("Client fd %d\n", client_fd);
+	char data[8];
+	printf("\nEnter one of the available commands\n\n");
+	printf("Press TC and enter to request temperature in Celsius\n");
+	printf("Press TF and enter to request temperature in Fahrenheit\n");
+	printf("Press TK and enter to request temperature in Kelvin\n");
+	printf("Press L and enter to request Light intensity in Lux\n");
+	printf("Press TFL or TKL and enter to request temperature and Light intensity\n");
+	printf("Press SUB and enter to stream temperature and light samples\n");
+	printf("Press LAT and enter to print the latency percentiles of the sample pipeline\n");
+	printf("Press HIST and enter to print the latest samples kept by the daemon\n");
+	printf("Press HISTZ and enter to print them from a compressed reply\n");
+	printf("Press ROLL and enter to print the latest minimum, maximum and mean per period\n");
+	scanf("%7s", data);
+	if (strcmp(data, "SUB") == 0)
+	{
+		socket_subscribe();
+		return SOCK_SUBSCRIBE;
+	}
+	if (strcmp(data, "LAT") == 0)
+	{
+		int req = WIRE_LATENCY;
+		if ((legacy ? send(client_fd, &req, sizeof(req), 0) : send_msg(WIRE_MSG_LATENCY, NULL, 0, 0)) == -1)
 		{
 			perror("send failed");
 		}
+		return WIRE_LATENCY;
 	}
-	else
+	if (strcmp(data, "HIST") == 0 || strcmp(data, "HISTZ") == 0)
 	{
-		printf("Wrong Input\n\n");
-		socket_request();
+		socket_history(data[4] == 'Z');
+		return WIRE_HISTORY;
 	}
+	if (strcmp(data, "ROLL") == 0)
+	{
+		socket_rollup();
+		return WIRE_ROLLUP;
+	}
+	for (int i = 0; i < 7; i++)
+	{
+		if (strcmp(data, strings[i]) == 0)
+		{
+			if (send_command(strings_define[i]) == -1)
+			{
+				perror("send failed");
+			}
+			return strings_define[i];
+		}
+	}
+	printf("Wrong Input\n\n");
+	return socket_request();
 }
 
-
-int main()
+int main(int argc, char *argv[])
 {
 	port = PORT;
 	uint32_t temp;
 	sig_init();
+	if (argc > 1)
+	{
+		serv_host = argv[1];
+	}
+	legacy = (argc > 2) && (strcmp(argv[2], "legacy") == 0);
 	if ((hptr = gethostbyname(serv_host)) == NULL)
 	{
 		perror("gethostbyname error");
@@ -155,12 +457,95 @@ int main()
 		exit(1);
 	}
 
-	socket_request();
-	float data;
-	if (read(client_fd, (void *)&data, sizeof(data)) < 0)
+	if (!legacy && socket_hello())
+	{
+		close(client_fd);
+		exit(1);
+	}
+
+	int cmd = socket_request();
+	if (cmd == SOCK_SUBSCRIBE)
+	{
+		socket_stream();
+		close(client_fd);
+		return 0;
+	}
+
+	if (cmd == WIRE_LATENCY)
+	{
+		//Both protocols get a framed reply
+		wire_hdr hdr;
+		wire_latency lat[WIRE_BATCH_MAX];
+		while (read_msg(&hdr, lat, sizeof(lat)) == 0)
+		{
+			if (hdr.type == WIRE_MSG_LATENCY)
+			{
+				print_latency(&hdr, lat);
+				break;
+			}
+		}
+	}
+	else if (cmd == WIRE_HISTORY)
 	{
-		perror("Read failed\n\n");
+		//Both protocols get a framed reply
+		wire_hdr hdr;
+		static wire_record records[WIRE_HISTORY_MAX];
+		while (read_msg(&hdr, records, sizeof(records)) == 0)
+		{
+			if (hdr.type == WIRE_MSG_HISTORY)
+			{
+				print_records(&hdr, records);
+				break;
+			}
+			if (hdr.type == WIRE_MSG_SERIES)
+			{
+				print_series(&hdr, (const uint8_t *)records);
+				break;
+			}
+		}
+	}
+	else if (cmd == WIRE_ROLLUP)
+	{
+		//Both protocols get a framed reply
+		wire_hdr hdr;
+		static wire_bucket buckets[WIRE_ROLLUP_MAX];
+		while (read_msg(&hdr, buckets, sizeof(buckets)) == 0)
+		{
+			if (hdr.type == WIRE_MSG_ROLLUP)
+			{
+				print_buckets(&hdr, buckets);
+				break;
+			}
+		}
+	}
+	else if (legacy)
+	{
+		//105 and 106 are answered with two values
+		float data[2];
+		int n = ((cmd == 105) || (cmd == 106)) ? 2 : 1;
+		if (read_full(data, n * sizeof(float)) < 0)
+		{
+			perror("Read failed\n\n");
+		}
+		for (int i = 0; i < n; i++)
+		{
+			fprintf(stdout, "Data rcvd %f\n\n", data[i]);
+		}
+	}
+	else
+	{
+		//The replies of one request may be split over several messages
+		wire_hdr hdr;
+		wire_record records[WIRE_BATCH_MAX];
+		int n = ((cmd == 105) || (cmd == 106)) ? 2 : 1;
+		while (n > 0 && read_msg(&hdr, records, sizeof(records)) == 0)
+		{
+			if (hdr.type == WIRE_MSG_REPLY)
+			{
+				print_records(&hdr, records);
+				n -= hdr.count;
+			}
+		}
 	}
-	fprintf(stdout, "Data rcvd %f\n\n", data);
 	close(client_fd);
 }
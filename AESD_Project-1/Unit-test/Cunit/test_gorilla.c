@@ -0,0 +1,311 @@
+/**
+ * @file test_gorilla.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Host unit tests of the compressed series encoding (src/gorilla.c). The expected bit streams were
+ * written by hand from the layout in gorilla.h, independently of the encoder.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "CUnit/CUnit.h"
+#include "CUnit/Basic.h"
+#include "CUnit/Automated.h"
+#include "gorilla.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLES (8)
+#define RANDOM_SAMPLES (10000)
+
+/*
+ * XOR series: a 32-bit delta-of-delta, a new window of one bit, the same window reused, a sign flip,
+ * a 64-bit delta-of-delta escape with a NaN, a clock step back and a window shifted to the left.
+ */
+static const uint64_t xor_time[SAMPLES] = {1000000000ULL, 1100000000ULL, 1200000000ULL, 1300000001ULL,
+                                           1399999702ULL, 0x10059682CABULL, 0x10059682CA6ULL, 0x10059682CADULL};
+static const uint32_t xor_value[SAMPLES] = {0x41C80000, 0x41C80000, 0x41C80001, 0x41C80000,
+                                            0xC1C80000, 0x7FC00000, 0x7FC00001, 0x7FC00003};
+static const uint8_t xor_stream[] = {
+    0x00, 0x00, 0x00, 0x00, 0x3B, 0x9A, 0xCA, 0x00, 0x41, 0xC8, 0x00, 0x00,
+    0xE0, 0xBE, 0xBC, 0x20, 0x03, 0xF8, 0x30, 0x01, 0x58, 0x95, 0xF0, 0x03,
+    0xE0, 0x00, 0x00, 0x40, 0x00, 0x00, 0x00, 0x00, 0x18, 0x19, 0x7C, 0x1F,
+    0x00, 0x00, 0x02, 0x00, 0x0B, 0xEB, 0xBF, 0xB3, 0xFE, 0x0C, 0x03, 0x1F,
+    0x81};
+#define XOR_BITS (392)
+
+/*
+ * Delta series of a register at 10 Hz: a step over the 32-bit wrap-around, the largest negative
+ * difference, and the three difference widths.
+ */
+static const uint32_t delta_value[SAMPLES] = {0xFFFFFFFE, 0xFFFFFFFF, 0x00000001, 0x00000001,
+                                              0x80000001, 0x80000000, 0x800000C8, 0x8000012C};
+static const uint8_t delta_stream[] = {
+    0x15, 0x92, 0x1C, 0x5B, 0x55, 0x9A, 0x00, 0x00, 0xFF, 0xFF, 0xFF, 0xFE,
+    0xE0, 0xBE, 0xBC, 0x20, 0x08, 0x92, 0x0F, 0xFF, 0xFF, 0xFF, 0xFE, 0x85,
+    0xC0, 0x00, 0x00, 0x64, 0x1B, 0x20};
+#define DELTA_BITS (238)
+#define DELTA_START (1554336000000000000ULL)
+#define DELTA_PERIOD (100000000ULL)
+
+uint8_t buf[RANDOM_SAMPLES * GORILLA_SAMPLE_MAX];
+uint64_t random_time[RANDOM_SAMPLES];
+uint32_t random_value[RANDOM_SAMPLES];
+
+int suite_init(void)
+{
+   srand(1);
+   return 0;
+}
+
+int clean_suite(void) { return 0; }
+
+/*Encodes a series and returns the number of samples that fitted*/
+uint32_t encode(gorilla_enc *enc, size_t size, uint8_t mode, const uint64_t *t, const uint32_t *v, uint32_t n)
+{
+   uint32_t i;
+
+   gorilla_enc_init(enc, buf, size, mode);
+   for (i = 0; i < n; i++)
+   {
+      if (!gorilla_enc_add(enc, t[i], v[i]))
+      {
+         break;
+      }
+   }
+   return i;
+}
+
+/*Decodes a series and returns the number of samples equal to the expected ones before the first mismatch*/
+uint32_t decode(const uint8_t *stream, size_t len, uint8_t mode, uint32_t count, const uint64_t *t, const uint32_t *v)
+{
+   gorilla_dec dec;
+   uint64_t time_ns;
+   uint32_t value, i = 0;
+
+   gorilla_dec_init(&dec, stream, len, mode, count);
+   while (gorilla_dec_next(&dec, &time_ns, &value))
+   {
+      if (i == count || time_ns != t[i] || value != v[i])
+      {
+         break;
+      }
+      i++;
+   }
+   return i;
+}
+
+void delta_times(uint64_t *t)
+{
+   for (int i = 0; i < SAMPLES; i++)
+   {
+      t[i] = DELTA_START + i * DELTA_PERIOD;
+   }
+}
+
+void test_xor_encode()
+{
+   gorilla_enc enc;
+
+   CU_ASSERT_EQUAL(SAMPLES, encode(&enc, sizeof(buf), GORILLA_XOR, xor_time, xor_value, SAMPLES));
+   CU_ASSERT_EQUAL(XOR_BITS, enc.bits);
+   CU_ASSERT_EQUAL(sizeof(xor_stream), gorilla_enc_bytes(&enc));
+   CU_ASSERT_EQUAL(0, memcmp(xor_stream, buf, sizeof(xor_stream)));
+}
+
+void test_xor_decode()
+{
+   gorilla_dec dec;
+   uint64_t time_ns;
+   uint32_t value;
+
+   CU_ASSERT_EQUAL(SAMPLES, decode(xor_stream, sizeof(xor_stream), GORILLA_XOR, SAMPLES, xor_time, xor_value));
+
+   /*Nothing is read past the count, even with bits left*/
+   gorilla_dec_init(&dec, xor_stream, sizeof(xor_stream), GORILLA_XOR, 2);
+   CU_ASSERT_TRUE(gorilla_dec_next(&dec, &time_ns, &value));
+   CU_ASSERT_TRUE(gorilla_dec_next(&dec, &time_ns, &value));
+   CU_ASSERT_FALSE(gorilla_dec_next(&dec, &time_ns, &value));
+}
+
+void test_delta_encode()
+{
+   gorilla_enc enc;
+   uint64_t t[SAMPLES];
+
+   delta_times(t);
+   CU_ASSERT_EQUAL(SAMPLES, encode(&enc, sizeof(buf), GORILLA_DELTA, t, delta_value, SAMPLES));
+   CU_ASSERT_EQUAL(DELTA_BITS, enc.bits);
+   CU_ASSERT_EQUAL(sizeof(delta_stream), gorilla_enc_bytes(&enc));
+   CU_ASSERT_EQUAL(0, memcmp(delta_stream, buf, sizeof(delta_stream)));
+}
+
+void test_delta_decode()
+{
+   uint64_t t[SAMPLES];
+
+   delta_times(t);
+   CU_ASSERT_EQUAL(SAMPLES, decode(delta_stream, sizeof(delta_stream), GORILLA_DELTA, SAMPLES, t, delta_value));
+}
+
+void test_short_buffer()
+{
+   gorilla_enc enc;
+   uint8_t before[sizeof(xor_stream)];
+
+   /*The first sample needs 96 bits*/
+   CU_ASSERT_EQUAL(0, encode(&enc, 11, GORILLA_XOR, xor_time, xor_value, SAMPLES));
+   CU_ASSERT_EQUAL(0, enc.bits);
+   CU_ASSERT_EQUAL(0, enc.count);
+   CU_ASSERT_EQUAL(1, encode(&enc, 12, GORILLA_XOR, xor_time, xor_value, SAMPLES));
+
+   /*A rejected sample leaves the series as it was*/
+   CU_ASSERT_EQUAL(1, encode(&enc, 16, GORILLA_XOR, xor_time, xor_value, SAMPLES));
+   CU_ASSERT_EQUAL(96, enc.bits);
+   memcpy(before, buf, sizeof(before));
+   CU_ASSERT_FALSE(gorilla_enc_add(&enc, xor_time[1], xor_value[1]));
+   CU_ASSERT_EQUAL(96, enc.bits);
+   CU_ASSERT_EQUAL(1, enc.count);
+   CU_ASSERT_EQUAL(0, memcmp(before, buf, 12));
+
+   /*Every stream cut before its last sample holds the samples before it*/
+   for (size_t size = 12; size < sizeof(xor_stream); size++)
+   {
+      uint32_t n = encode(&enc, size, GORILLA_XOR, xor_time, xor_value, SAMPLES);
+      CU_ASSERT_TRUE(n < SAMPLES);
+      CU_ASSERT_TRUE(enc.bits <= size * 8);
+      CU_ASSERT_EQUAL(n, decode(buf, gorilla_enc_bytes(&enc), GORILLA_XOR, n, xor_time, xor_value));
+   }
+}
+
+void test_truncated()
+{
+   uint64_t t[SAMPLES];
+
+   /*The last byte of both streams holds bits of the last sample, every cut loses at least that sample*/
+   for (size_t len = 0; len < sizeof(xor_stream); len++)
+   {
+      uint32_t n = decode(xor_stream, len, GORILLA_XOR, SAMPLES, xor_time, xor_value);
+      CU_ASSERT_TRUE(n < SAMPLES);
+      CU_ASSERT_TRUE(len >= 12 || n == 0);
+   }
+   delta_times(t);
+   for (size_t len = 0; len < sizeof(delta_stream); len++)
+   {
+      CU_ASSERT_TRUE(decode(delta_stream, len, GORILLA_DELTA, SAMPLES, t, delta_value) < SAMPLES);
+   }
+
+   /*A count larger than the stream*/
+   CU_ASSERT_EQUAL(SAMPLES, decode(xor_stream, sizeof(xor_stream), GORILLA_XOR, SAMPLES + 1, xor_time, xor_value));
+}
+
+void test_corrupt()
+{
+   gorilla_dec dec;
+   uint64_t time_ns;
+   uint32_t value;
+   uint8_t stream[16];
+
+   memcpy(stream, xor_stream, 12);
+
+   /*Same interval, then '10' with no window to reuse yet*/
+   stream[12] = 0x40;
+   gorilla_dec_init(&dec, stream, 13, GORILLA_XOR, 2);
+   CU_ASSERT_TRUE(gorilla_dec_next(&dec, &time_ns, &value));
+   CU_ASSERT_FALSE(gorilla_dec_next(&dec, &time_ns, &value));
+
+   /*Same interval, then a window of 31 leading zeros and 32 bits*/
+   stream[12] = 0x7F;
+   memset(stream + 13, 0xFF, 3);
+   gorilla_dec_init(&dec, stream, 16, GORILLA_XOR, 2);
+   CU_ASSERT_TRUE(gorilla_dec_next(&dec, &time_ns, &value));
+   CU_ASSERT_FALSE(gorilla_dec_next(&dec, &time_ns, &value));
+
+   /*All ones: a 64-bit delta-of-delta escape cut short*/
+   memset(stream + 12, 0xFF, 4);
+   gorilla_dec_init(&dec, stream, 16, GORILLA_DELTA, 2);
+   CU_ASSERT_TRUE(gorilla_dec_next(&dec, &time_ns, &value));
+   CU_ASSERT_FALSE(gorilla_dec_next(&dec, &time_ns, &value));
+}
+
+void random_round_trip(uint8_t mode)
+{
+   gorilla_enc enc;
+   uint64_t t = 1554336000000000000ULL;
+   uint32_t v = rand();
+
+   for (int i = 0; i < RANDOM_SAMPLES; i++)
+   {
+      /*Mostly steady intervals with jitter, now and then a clock step either way*/
+      switch (rand() % 8)
+      {
+      case 0:
+         t -= (uint64_t)rand() * rand();
+         break;
+      case 1:
+         t += (uint64_t)rand() * rand();
+         break;
+      default:
+         t += 100000000ULL + rand() % 1000;
+         break;
+      }
+      /*Mostly small changes, now and then any value*/
+      v = (rand() % 8) ? v + rand() % 32 - 16 : (uint32_t)rand() << 1 ^ rand();
+      random_time[i] = t;
+      random_value[i] = v;
+   }
+
+   CU_ASSERT_EQUAL(RANDOM_SAMPLES, encode(&enc, sizeof(buf), mode, random_time, random_value, RANDOM_SAMPLES));
+   CU_ASSERT_TRUE(gorilla_enc_bytes(&enc) <= (size_t)RANDOM_SAMPLES * GORILLA_SAMPLE_MAX);
+   CU_ASSERT_EQUAL(RANDOM_SAMPLES,
+                   decode(buf, gorilla_enc_bytes(&enc), mode, RANDOM_SAMPLES, random_time, random_value));
+}
+
+void test_random_xor()
+{
+   random_round_trip(GORILLA_XOR);
+}
+
+void test_random_delta()
+{
+   random_round_trip(GORILLA_DELTA);
+}
+
+int main(void)
+{
+
+   if (CUE_SUCCESS != CU_initialize_registry())
+      return CU_get_error();
+
+   CU_pSuite pSuite = NULL;
+   pSuite = CU_add_suite("GORILLA ENCODING TEST", suite_init, clean_suite);
+   if (NULL == pSuite)
+   {
+      CU_cleanup_registry();
+      return -1;
+   }
+   if ((NULL == CU_add_test(pSuite, "XOR Encode Test", test_xor_encode)) ||
+       (NULL == CU_add_test(pSuite, "XOR Decode Test", test_xor_decode)) ||
+       (NULL == CU_add_test(pSuite, "Delta Encode Test", test_delta_encode)) ||
+       (NULL == CU_add_test(pSuite, "Delta Decode Test", test_delta_decode)) ||
+       (NULL == CU_add_test(pSuite, "Short Buffer Test", test_short_buffer)) ||
+       (NULL == CU_add_test(pSuite, "Truncated Stream Test", test_truncated)) ||
+       (NULL == CU_add_test(pSuite, "Corrupt Stream Test", test_corrupt)) ||
+       (NULL == CU_add_test(pSuite, "Random XOR Round Trip Test", test_random_xor)) ||
+       (NULL == CU_add_test(pSuite, "Random Delta Round Trip Test", test_random_delta)))
+   {
+      CU_cleanup_registry();
+      return CU_get_error();
+   }
+
+   CU_basic_set_mode(CU_BRM_VERBOSE);
+   CU_basic_run_tests();
+
+   CU_set_output_filename("test_gorilla");
+   CU_automated_run_tests();
+   CU_cleanup_registry();
+   return CU_get_error();
+}
@@ -0,0 +1,291 @@
+/**
+ * @file test_tsdb.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Host unit tests of the sample history (src/tsdb.c): the queries over the ring and the recovery
+ * of the history file at startup.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "CUnit/CUnit.h"
+#include "CUnit/Basic.h"
+#include "CUnit/Automated.h"
+#include "tsdb.h"
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define DEPTH (8)
+#define SEC (1000000000ULL)
+#define HIST_FILE "test_tsdb.hist"
+
+uint64_t time_ns[2 * DEPTH];
+float value[2 * DEPTH];
+
+/*The daemon's logger is not linked, error messages are printed instead*/
+void log_send(_Atomic uint16_t *fmt_id, const char *fmt, bool error, const log_arg *args, uint8_t nargs,
+              uint8_t loglevel, uint8_t prio)
+{
+   printf("%s", fmt);
+}
+
+/*First Initialization Function*/
+int suite_init(void)
+{
+   /*The history file holds the first two series initialized, the queries use series of their own*/
+   unlink(HIST_FILE);
+   if (tsdb_init(&temp_series, "temp", DEPTH) || tsdb_init(&light_series, "light", DEPTH))
+   {
+      return -1;
+   }
+   return 0;
+}
+
+int clean_suite(void)
+{
+   tsdb_close();
+   tsdb_free(&temp_series);
+   tsdb_free(&light_series);
+   unlink(HIST_FILE);
+   return 0;
+}
+
+/*Appends n samples one second apart from first seconds, the value is the second*/
+void append(tsdb_series *series, uint32_t first, uint32_t n)
+{
+   for (uint32_t i = first; i < first + n; i++)
+   {
+      struct timespec t = {.tv_sec = i, .tv_nsec = 0};
+      tsdb_append(series, &t, (float)i);
+   }
+}
+
+/*Checks that n samples were returned, one second apart from first seconds*/
+void check(uint32_t returned, uint32_t first, uint32_t n)
+{
+   CU_ASSERT_EQUAL(n, returned);
+   for (uint32_t i = 0; i < returned && i < n; i++)
+   {
+      CU_ASSERT_EQUAL((first + i) * SEC, time_ns[i]);
+      CU_ASSERT_EQUAL((float)(first + i), value[i]);
+   }
+}
+
+void test_ring_wrap()
+{
+   tsdb_series series;
+
+   CU_ASSERT_EQUAL(0, tsdb_init(&series, "wrap", DEPTH - 1));
+   CU_ASSERT_EQUAL(DEPTH - 1, series.mask);
+   check(tsdb_query(&series, 0, 0, 0, time_ns, value, 2 * DEPTH), 0, 0);
+
+   /*Not full yet, every sample is returned*/
+   append(&series, 1, DEPTH - 1);
+   check(tsdb_query(&series, 0, 0, 0, time_ns, value, 2 * DEPTH), 1, DEPTH - 1);
+
+   /*Wrapped twice up to 3 * DEPTH + 2 seconds, the oldest slot is the one the next append overwrites and is
+     left out*/
+   append(&series, DEPTH, 2 * DEPTH + 3);
+   check(tsdb_query(&series, 0, 0, 0, time_ns, value, 2 * DEPTH), 3 * DEPTH + 2 - (DEPTH - 2), DEPTH - 1);
+   CU_ASSERT_EQUAL(3 * DEPTH + 2, atomic_load(&series.head));
+   CU_ASSERT_EQUAL(0, atomic_load(&series.torn));
+   tsdb_free(&series);
+}
+
+void test_range()
+{
+   tsdb_series series;
+
+   CU_ASSERT_EQUAL(0, tsdb_init(&series, "range", DEPTH));
+   append(&series, 10, 6);
+
+   /*Both ends are included, to_ns=0 has no upper limit*/
+   check(tsdb_query(&series, 11 * SEC, 13 * SEC, 0, time_ns, value, 2 * DEPTH), 11, 3);
+   check(tsdb_query(&series, 12 * SEC, 0, 0, time_ns, value, 2 * DEPTH), 12, 4);
+   check(tsdb_query(&series, 12 * SEC + 1, 0, 0, time_ns, value, 2 * DEPTH), 13, 3);
+   check(tsdb_query(&series, 16 * SEC, 0, 0, time_ns, value, 2 * DEPTH), 0, 0);
+   check(tsdb_query(&series, 0, 9 * SEC, 0, time_ns, value, 2 * DEPTH), 0, 0);
+   check(tsdb_query(&series, 0, 0, 0, time_ns, value, 0), 0, 0);
+   tsdb_free(&series);
+}
+
+void test_last_max()
+{
+   tsdb_series series;
+
+   CU_ASSERT_EQUAL(0, tsdb_init(&series, "cut", DEPTH));
+   append(&series, 10, 6);
+
+   /*last keeps the newest samples of the range*/
+   check(tsdb_query(&series, 0, 0, 2, time_ns, value, 2 * DEPTH), 14, 2);
+   check(tsdb_query(&series, 0, 13 * SEC, 2, time_ns, value, 2 * DEPTH), 12, 2);
+   check(tsdb_query(&series, 0, 0, 100, time_ns, value, 2 * DEPTH), 10, 6);
+
+   /*max cuts a range to its oldest samples, or to its newest ones with last*/
+   check(tsdb_query(&series, 0, 0, 0, time_ns, value, 4), 10, 4);
+   check(tsdb_query(&series, 11 * SEC, 0, 0, time_ns, value, 2), 11, 2);
+   check(tsdb_query(&series, 0, 0, 5, time_ns, value, 3), 13, 3);
+   CU_ASSERT_EQUAL(6, atomic_load(&series.queries));
+   CU_ASSERT_EQUAL(19, atomic_load(&series.returned));
+   tsdb_free(&series);
+}
+
+void test_unordered()
+{
+   tsdb_series series;
+   struct timespec t = {.tv_sec = 20, .tv_nsec = 0};
+
+   CU_ASSERT_EQUAL(0, tsdb_init(&series, "step", DEPTH));
+   append(&series, 10, 2);
+
+   /*A clock stepped back, the sample keeps the time of the previous one*/
+   tsdb_append(&series, &t, 12);
+   t.tv_sec = 5;
+   tsdb_append(&series, &t, 13);
+   CU_ASSERT_EQUAL(1, series.unordered);
+   CU_ASSERT_EQUAL(4, tsdb_query(&series, 0, 0, 0, time_ns, value, 2 * DEPTH));
+   CU_ASSERT_EQUAL(20 * SEC, time_ns[2]);
+   CU_ASSERT_EQUAL(20 * SEC, time_ns[3]);
+   CU_ASSERT_EQUAL(13, value[3]);
+
+   /*The time stamps stay sorted, a search still finds the range*/
+   CU_ASSERT_EQUAL(2, tsdb_query(&series, 20 * SEC, 20 * SEC, 0, time_ns, value, 2 * DEPTH));
+   CU_ASSERT_EQUAL(12, value[0]);
+   CU_ASSERT_EQUAL(13, value[1]);
+   check(tsdb_query(&series, 0, 19 * SEC, 0, time_ns, value, 2 * DEPTH), 10, 2);
+   tsdb_free(&series);
+}
+
+/*Stops the series, optionally rewrites the cursor of the temperature series in the file, and starts again*/
+void restart(bool set_cursor, uint64_t cursor)
+{
+   tsdb_close();
+   if (set_cursor)
+   {
+      int fd = open(HIST_FILE, O_RDWR);
+      CU_ASSERT_NOT_EQUAL(-1, fd);
+      CU_ASSERT_EQUAL(sizeof(cursor), pwrite(fd, &cursor, sizeof(cursor), offsetof(tsdb_file_hdr, cursor)));
+      close(fd);
+   }
+   CU_ASSERT_EQUAL(0, tsdb_init(&temp_series, "temp", DEPTH));
+   CU_ASSERT_EQUAL(0, tsdb_init(&light_series, "light", DEPTH));
+   CU_ASSERT_EQUAL(0, tsdb_open(HIST_FILE));
+}
+
+void test_recover()
+{
+   CU_ASSERT_EQUAL(0, tsdb_open(HIST_FILE));
+   CU_ASSERT_EQUAL(0, temp_series.recovered);
+   append(&temp_series, 100, 5);
+   append(&light_series, 200, 2);
+
+   /*Clean restart*/
+   restart(false, 0);
+   CU_ASSERT_EQUAL(5, temp_series.recovered);
+   CU_ASSERT_EQUAL(0, temp_series.discarded);
+   CU_ASSERT_EQUAL(2, light_series.recovered);
+   check(tsdb_query(&temp_series, 0, 0, 0, time_ns, value, 2 * DEPTH), 100, 5);
+   check(tsdb_query(&light_series, 0, 0, 0, time_ns, value, 2 * DEPTH), 200, 2);
+
+   /*The cursor was written back before the last records*/
+   restart(true, 2);
+   CU_ASSERT_EQUAL(5, temp_series.recovered);
+   CU_ASSERT_EQUAL(0, temp_series.discarded);
+   CU_ASSERT_EQUAL(5, *temp_series.disk_cursor);
+   check(tsdb_query(&temp_series, 0, 0, 0, time_ns, value, 2 * DEPTH), 100, 5);
+
+   /*The cursor reached the disk, the last records did not*/
+   restart(true, 9);
+   CU_ASSERT_EQUAL(5, temp_series.recovered);
+   CU_ASSERT_EQUAL(4, temp_series.discarded);
+   CU_ASSERT_EQUAL(5, *temp_series.disk_cursor);
+   check(tsdb_query(&temp_series, 0, 0, 0, time_ns, value, 2 * DEPTH), 100, 5);
+
+   /*New samples go on after the recovered ones*/
+   append(&temp_series, 105, 2);
+   restart(false, 0);
+   CU_ASSERT_EQUAL(7, temp_series.recovered);
+   check(tsdb_query(&temp_series, 0, 0, 0, time_ns, value, 2 * DEPTH), 100, 7);
+}
+
+void test_recover_wrap()
+{
+   /*The ring of the file wrapped, it holds the last DEPTH records*/
+   append(&temp_series, 107, 2 * DEPTH);
+   restart(false, 0);
+   CU_ASSERT_EQUAL(DEPTH, temp_series.recovered);
+   CU_ASSERT_EQUAL(0, temp_series.discarded);
+   check(tsdb_query(&temp_series, 0, 0, 0, time_ns, value, 2 * DEPTH), 107 + 2 * DEPTH - (DEPTH - 1), DEPTH - 1);
+
+   /*A cursor a whole lap behind finds the same records*/
+   restart(true, *temp_series.disk_cursor - DEPTH);
+   CU_ASSERT_EQUAL(DEPTH, temp_series.recovered);
+   CU_ASSERT_EQUAL(7 + 2 * DEPTH, *temp_series.disk_cursor);
+
+   /*A cursor ahead of a wrapped ring, over records of the previous lap*/
+   restart(true, *temp_series.disk_cursor + 3);
+   CU_ASSERT_EQUAL(DEPTH, temp_series.recovered);
+   CU_ASSERT_EQUAL(3, temp_series.discarded);
+   CU_ASSERT_EQUAL(7 + 2 * DEPTH, *temp_series.disk_cursor);
+}
+
+void test_recover_torn()
+{
+   uint64_t cursor = *temp_series.disk_cursor;
+   tsdb_rec *last = &temp_series.disk[(cursor - 1) & temp_series.mask];
+
+   /*The last record was only partly written*/
+   last->value += 1;
+   restart(false, 0);
+   CU_ASSERT_EQUAL(DEPTH - 1, temp_series.recovered);
+   CU_ASSERT_EQUAL(1, temp_series.discarded);
+   CU_ASSERT_EQUAL(cursor - 1, *temp_series.disk_cursor);
+   check(tsdb_query(&temp_series, 0, 0, 0, time_ns, value, 2 * DEPTH), 107 + DEPTH, DEPTH - 1);
+
+   /*A file of another depth is started again*/
+   tsdb_close();
+   CU_ASSERT_EQUAL(0, tsdb_init(&temp_series, "temp", 2 * DEPTH));
+   CU_ASSERT_EQUAL(0, tsdb_init(&light_series, "light", 2 * DEPTH));
+   CU_ASSERT_EQUAL(0, tsdb_open(HIST_FILE));
+   CU_ASSERT_EQUAL(0, temp_series.recovered);
+   CU_ASSERT_EQUAL(0, *temp_series.disk_cursor);
+   CU_ASSERT_EQUAL(0, tsdb_query(&temp_series, 0, 0, 0, time_ns, value, 2 * DEPTH));
+}
+
+int main(void)
+{
+
+   if (CUE_SUCCESS != CU_initialize_registry())
+      return CU_get_error();
+
+   CU_pSuite pSuite = NULL;
+   pSuite = CU_add_suite("SAMPLE HISTORY TEST", suite_init, clean_suite);
+   if (NULL == pSuite)
+   {
+      CU_cleanup_registry();
+      return -1;
+   }
+   if ((NULL == CU_add_test(pSuite, "Ring Wrap Test", test_ring_wrap)) ||
+       (NULL == CU_add_test(pSuite, "Time Range Test", test_range)) ||
+       (NULL == CU_add_test(pSuite, "Last And Max Test", test_last_max)) ||
+       (NULL == CU_add_test(pSuite, "Clock Step Back Test", test_unordered)) ||
+       (NULL == CU_add_test(pSuite, "Recover Cursor Test", test_recover)) ||
+       (NULL == CU_add_test(pSuite, "Recover Wrapped Ring Test", test_recover_wrap)) ||
+       (NULL == CU_add_test(pSuite, "Recover Torn Record Test", test_recover_torn)))
+   {
+      CU_cleanup_registry();
+      return CU_get_error();
+   }
+
+   CU_basic_set_mode(CU_BRM_VERBOSE);
+   CU_basic_run_tests();
+
+   CU_set_output_filename("test_tsdb");
+   CU_automated_run_tests();
+   CU_cleanup_registry();
+   return CU_get_error();
+}
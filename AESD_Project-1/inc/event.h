@@ -0,0 +1,53 @@
+/**
+ * @file event.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of event.c
+ * @version 0.1
+ * @date 2019-03-28
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+
+#ifndef _EVENT_H
+#define _EVENT_H
+
+#include "main.h"
+
+//Event bit posted by the timers, socket requests use the TC, TF, TK, L and STATE bits of sockets.h
+#define EV_TIMER (0x01)
+
+//Stats interval used by --measure when --stats is not given
+#define MEASURE_INTERVAL_SEC (10)
+
+//Wakeup primitive of a thread, a set of pending event bits guarded by a mutex and a condition variable
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint32_t pending;
+	struct timespec posted;	 //Time of the first post still pending
+	struct timespec woken;	 //Post time of the events returned by the last event_wait()
+	uint64_t coalesced;		 //Posts merged with a post of the same bits not taken yet
+
+	//Measurement counters, only updated when g_measure is set
+	uint64_t wakeups;
+	uint64_t wake_ns_total;
+	uint64_t wake_ns_max;
+	uint64_t samples;
+	uint64_t sample_ns_total;
+	uint64_t sample_ns_max;
+} thread_event;
+
+thread_event temp_event;
+thread_event light_event;
+
+//Function Declarations
+err_t event_init(thread_event *ev);
+void event_post(thread_event *ev, uint32_t bits);
+uint32_t event_wait(thread_event *ev);
+void event_sample_done(thread_event *ev);
+err_t event_destroy(thread_event *ev);
+size_t event_stats(void *ev, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * @file gorilla.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of gorilla.c. Shared by the daemon, the log exporter, the benchmarks and the remote
+ * client (Socket-Remote-System/Socket1/sock1.c), so it only depends on the C library.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _GORILLA_H
+#define _GORILLA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Bit stream of one series, most significant bit first. The first sample holds its time in 64 bits
+ * and its value in 32 bits. Every following sample holds:
+ *
+ *   time   delta-of-delta of the nanosecond time stamps, zigzag encoded:
+ *            '0'                     same interval as the previous sample
+ *            '10'   + 12 bits        within 2 us of it
+ *            '110'  + 20 bits        within 524 us
+ *            '1110' + 32 bits        within 2.1 s
+ *            '1111' + 64 bits        anything else
+ *   value  GORILLA_XOR, the XOR with the previous value:
+ *            '0'                     same value
+ *            '10'   + bits           meaningful bits inside the window of the previous XOR
+ *            '11'   + 5 bits leading zeros + 5 bits length - 1 + bits
+ *          GORILLA_DELTA, the difference with the previous value, zigzag encoded:
+ *            '0'                     same value
+ *            '10'   + 4 bits
+ *            '110'  + 8 bits
+ *            '111'  + 32 bits
+ *
+ * XOR suits float values that repeat or change in their low mantissa bits, delta suits registers that
+ * step by a few counts such as the 12-bit TMP102 temperature.
+ */
+#define GORILLA_XOR				(0)
+#define GORILLA_DELTA			(1)
+#define GORILLA_SAMPLE_MAX		(14)	//Bytes one sample takes at worst, 4 + 64 + 2 + 5 + 5 + 32 bits
+
+typedef struct
+{
+	uint8_t *buf;
+	size_t size;				//Bytes in buf
+	size_t bits;				//Bits written
+	uint32_t count;				//Samples written
+	uint8_t mode;				//GORILLA_XOR or GORILLA_DELTA
+	uint64_t prev_ns;
+	int64_t prev_delta;
+	uint32_t prev_value;
+	uint8_t leading;			//Window of the previous XOR
+	uint8_t trailing;
+} gorilla_enc;
+
+typedef struct
+{
+	const uint8_t *buf;
+	size_t bits;				//Bits in buf
+	size_t pos;					//Bits read
+	uint32_t count;				//Samples left
+	bool first;
+	uint8_t mode;
+	uint64_t prev_ns;
+	int64_t prev_delta;
+	uint32_t prev_value;
+	uint8_t leading;
+	uint8_t trailing;
+} gorilla_dec;
+
+//Function Declarations
+void gorilla_enc_init(gorilla_enc *enc, uint8_t *buf, size_t size, uint8_t mode);
+bool gorilla_enc_add(gorilla_enc *enc, uint64_t time_ns, uint32_t value);
+size_t gorilla_enc_bytes(const gorilla_enc *enc);
+void gorilla_dec_init(gorilla_dec *dec, const uint8_t *buf, size_t len, uint8_t mode, uint32_t count);
+bool gorilla_dec_next(gorilla_dec *dec, uint64_t *time_ns, uint32_t *value);
+
+#endif
@@ -0,0 +1,51 @@
+/**
+ * @file heartbeat.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of heartbeat.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _HEARTBEAT_H
+#define _HEARTBEAT_H
+
+#include <sys/eventfd.h>
+#include "main.h"
+
+//Supervised threads, the same indices as my_thread[]
+#define TEMP_HB (0)
+#define LIGHT_HB (1)
+#define LOGGER_HB (2)
+#define SOCKET_HB (3)
+#define HB_THREADS (4)
+
+#define HB_JOIN_MS (500) //Time a cancelled thread is given to exit before it is reported as stuck
+
+//Progress of a thread. The thread only increments beats and stores last_ns, the supervisor reads them.
+typedef struct
+{
+	const char *name;
+	atomic_ullong beats;
+	atomic_ullong last_ns;	//CLOCK_MONOTONIC nanoseconds of the last beat
+	uint64_t timeout_ns;	//Missing once the last beat is older, 0 if the thread is not supervised
+	bool restart;			//Restarted by the supervisor when missing, otherwise only reported
+	atomic_bool alive;
+	atomic_uint misses;		//Checks that found the thread missing
+	atomic_uint restarts;
+} hb_thread;
+
+//Function Declarations
+err_t hb_init(void);
+void hb_watch(uint8_t id, const char *name, uint64_t timeout_ns, bool restart);
+void hb_beat(uint8_t id);
+void hb_tick(void);
+bool hb_wait(void);
+bool hb_missing(uint8_t id);
+void hb_restarted(uint8_t id);
+void hb_close(void);
+size_t hb_stats(void *arg, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,70 @@
+/**
+ * @file i2c_bus.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of i2c_bus.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _I2C_BUS_H
+#define _I2C_BUS_H
+
+#include "i2c_hal.h"
+
+//Request priorities, lower values are served first
+#define I2C_PRIO_HIGH       (0) //Samples a remote host is waiting for
+#define I2C_PRIO_NORMAL     (1) //Periodic samples
+#define I2C_PRIO_LOW        (2) //Sensor configuration
+#define I2C_PRIO_LEVELS     (3)
+
+//Request operations
+#define I2C_OP_WRITE        (0) //One write transaction to addr
+#define I2C_OP_READ         (1) //One read transaction from addr
+#define I2C_OP_TRANSFER     (2) //Combined transfer of msgs, addresses are taken from the messages
+
+#define I2C_NO_SLAVE        (0xFF)
+
+typedef struct i2c_req i2c_req;
+
+//Completion callback, run by the bus manager thread once the request has been executed
+typedef void (*i2c_done_fn)(i2c_req *req);
+
+//Bus request, owned by the submitter until its completion callback has run
+struct i2c_req
+{
+    uint8_t op;
+    uint8_t prio;
+    uint8_t addr;
+    void *buf;                  //I2C_OP_WRITE and I2C_OP_READ
+    size_t len;
+    struct i2c_msg *msgs;       //I2C_OP_TRANSFER
+    uint32_t count;
+
+    i2c_done_fn done;
+    void *arg;                  //Left to the submitter
+
+    //Filled in by the bus manager
+    ssize_t result;             //Bytes or messages transferred, -1 on error
+    int err;                    //errno of a failed request
+    i2c_cost cost;              //Backend calls and bus transactions spent on the request
+    struct timespec submitted;
+    bool complete;              //Used by the blocking helpers
+
+    i2c_req *next;
+};
+
+//Function Declarations
+err_t i2c_bus_init(void);
+void i2c_bus_close(void);
+err_t i2c_bus_submit(i2c_req *req);
+void i2c_bus_priority(uint8_t prio);
+ssize_t i2c_bus_write(uint8_t addr, const void *buf, size_t len);
+ssize_t i2c_bus_read(uint8_t addr, void *buf, size_t len);
+int i2c_bus_transfer(struct i2c_msg *msgs, uint32_t count);
+err_t i2c_bus_write_read(uint8_t addr, const void *wbuf, uint16_t wlen, void *rbuf, uint16_t rlen);
+size_t i2c_bus_stats(void *arg, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,99 @@
+/**
+ * @file i2c_hal.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of i2c_hal.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _I2C_HAL_H
+#define _I2C_HAL_H
+
+#include <stdatomic.h>
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "main.h"
+
+//Bus backends
+#define I2C_BACKEND_LINUX   (0) //i2c-dev character device I2C_BUS
+#define I2C_BACKEND_SIM     (1) //In-process TMP102 and APDS-9301 models, see i2c_sim.c
+
+#define I2C_MAX_MSGS        (8) //Messages in one combined transfer
+
+/*
+ * Operations of a bus backend. They follow the i2c-dev semantics the sensor drivers were written
+ * against: slave() selects the device addressed by the following transfers, every write() and read()
+ * is one bus transaction with a START, the address and a STOP. transfer() is I2C_RDWR: its messages
+ * carry their own address and are joined by repeated STARTs into a single transaction.
+ */
+typedef struct
+{
+    const char *name;
+    err_t (*open)(void);
+    void (*close)(void);
+    int (*slave)(uint8_t addr);
+    ssize_t (*write)(const void *buf, size_t len);
+    ssize_t (*read)(void *buf, size_t len);
+    int (*transfer)(struct i2c_msg *msgs, uint32_t count);
+} i2c_backend;
+
+//Bus counters, summed over all threads
+typedef struct
+{
+    atomic_ullong calls;        //Backend calls, i.e. syscalls on the i2c-dev bus
+    atomic_ullong transactions; //STOP terminated bus transactions
+    atomic_ullong messages;     //Segments of the transactions
+    atomic_ullong bytes;        //Data bytes, addresses excluded
+    atomic_ullong errors;
+} i2c_counters;
+
+//Bus cost of the samples of one sensor, only updated by the thread reading that sensor
+typedef struct
+{
+    uint64_t samples;
+    uint64_t calls;
+    uint64_t transactions;
+    uint64_t ns_total;
+    uint64_t ns_max;
+} i2c_sample_stats;
+
+//Bus cost of a piece of work
+typedef struct
+{
+    uint64_t calls;
+    uint64_t transactions;
+} i2c_cost;
+
+//Start of a sample, see i2c_sample_begin()
+typedef struct
+{
+    i2c_cost cost;
+    struct timespec start;
+} i2c_sample_mark;
+
+uint8_t g_i2c_backend; //I2C_BACKEND_LINUX unless --sim is given
+bool g_i2c_split;      //Read samples register by register like before combined transfers, set by --no-combined
+i2c_sample_stats temp_bus_stats;
+i2c_sample_stats light_bus_stats;
+
+//Function Declarations
+err_t i2c_hal_open(void);
+void i2c_hal_close(void);
+const char *i2c_hal_name(void);
+int i2c_hal_slave(uint8_t addr);
+ssize_t i2c_hal_write(const void *buf, size_t len);
+ssize_t i2c_hal_read(void *buf, size_t len);
+int i2c_hal_transfer(struct i2c_msg *msgs, uint32_t count);
+i2c_cost i2c_thread_cost(void);
+void i2c_thread_charge(const i2c_cost *cost);
+void i2c_sample_begin(i2c_sample_mark *mark);
+void i2c_sample_end(i2c_sample_stats *stats, const i2c_sample_mark *mark);
+size_t i2c_stats(void *arg, char *buf, size_t size);
+size_t i2c_sample_report(void *arg, char *buf, size_t size);
+
+#endif
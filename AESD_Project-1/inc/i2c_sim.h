@@ -0,0 +1,56 @@
+/**
+ * @file i2c_sim.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of i2c_sim.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _I2C_SIM_H
+#define _I2C_SIM_H
+
+#include <math.h>
+#include "i2c_hal.h"
+
+//Signal generator shapes
+#define SIM_SIG_CONST   (0) //base
+#define SIM_SIG_SINE    (1) //base + amp * sin(2 pi t / period)
+#define SIM_SIG_RAMP    (2) //Sawtooth from base - amp to base + amp over period
+#define SIM_SIG_SQUARE  (3) //base + amp for the first half of the period, base - amp for the second
+#define SIM_SIG_NOISE   (4) //base + uniform noise in [-amp, amp]
+
+//Channel ratio adc1 / adc0 of the simulated light, in the daylight range of the lux equations
+#define SIM_LUX_RATIO   (0.30)
+
+//Signal generator
+typedef struct
+{
+    uint8_t shape;
+    double base;
+    double amp;
+    double period_s;
+} sim_signal;
+
+//Simulated bus configuration
+typedef struct
+{
+    sim_signal temp;        //Degree celsius seen by the TMP102
+    sim_signal light;       //Lux seen by the APDS-9301
+    uint32_t latency_us;    //Time every bus transaction takes
+    uint32_t jitter_us;     //Random extra time of up to jitter_us per transaction
+    uint32_t bus_khz;       //Bus clock the transferred bytes are timed with, 0 for no byte time
+} sim_cfg;
+
+sim_cfg g_sim_cfg;
+extern const i2c_backend sim_backend;
+
+//Function Declarations
+void sim_default_cfg(sim_cfg *cfg);
+err_t sim_parse_signal(const char *spec, sim_signal *sig);
+err_t sim_parse_latency(const char *spec, sim_cfg *cfg);
+double sim_signal_value(const sim_signal *sig, double t, uint32_t *seed);
+
+#endif
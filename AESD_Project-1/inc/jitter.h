@@ -0,0 +1,40 @@
+/**
+ * @file jitter.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of jitter.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _JITTER_H
+#define _JITTER_H
+
+#include "main.h"
+
+//Deviation of the timer samples of one sensor from their ideal schedule
+typedef struct
+{
+	const char *name;
+	uint8_t hist;				//Latency histogram the deviations are recorded in
+	uint64_t first_ns;			//First deadline of the timer, on CLOCK_MONOTONIC like the read stamps
+	uint64_t period_ns;
+	uint64_t last_slot;			//Period of the previous sample, counted from the first deadline
+	uint64_t samples;
+	uint64_t missed;			//Periods without a sample
+} sample_jitter;
+
+sample_jitter temp_jitter;
+sample_jitter light_jitter;
+
+//Jitter measurement mode, set by --jitter
+bool g_jitter;
+
+//Function Declarations
+void jitter_start(sample_jitter *j, const char *name, uint8_t hist, const struct timespec *first, uint64_t period_ns);
+void jitter_record(sample_jitter *j, uint64_t read_ns);
+size_t jitter_stats(void *arg, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ * @file latency.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of latency.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _LATENCY_H
+#define _LATENCY_H
+
+#include "main.h"
+#include "wire.h"
+
+/*
+ * Log-linear buckets: values below HIST_SUB have a bucket each, every power of two above is split into
+ * HIST_SUB buckets, which bounds the error of a reported percentile to 1/HIST_SUB (about 3%). Values from
+ * 2^HIST_MAX_BITS on, about 18 minutes in nanoseconds, are counted in the last bucket.
+ */
+#define HIST_SUB_BITS		(5)
+#define HIST_SUB			(1 << HIST_SUB_BITS)
+#define HIST_MAX_BITS		(40)
+#define HIST_BUCKETS		((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB)
+
+//Histograms of the sample pipeline, in nanoseconds unless noted
+#define LAT_TIMER			(0)  //Timer deadline -> expiry handled by the reactor, which posts the event
+#define LAT_WAKE			(1)  //Event posted -> bus read started
+#define LAT_READ			(2)  //Bus read started -> read done, the bus time of a sample
+#define LAT_PUBLISH			(3)  //Read done -> published on the sample bus
+#define LAT_LOG_QUEUE		(4)  //Published -> taken by the logger
+#define LAT_LOG_WRITE		(5)  //Taken by the logger -> written to the log sink
+#define LAT_LOG_E2E			(6)  //Event posted -> written to the log sink
+#define LAT_SOCK_QUEUE		(7)  //Published -> taken by the socket thread
+#define LAT_SOCK_SEND		(8)  //Taken by the socket thread -> handed to the connections
+#define LAT_SOCK_E2E		(9)  //Event posted -> handed to the connections
+#define LAT_I2C_WAIT		(10) //I2C request queued -> started by the bus manager
+#define LAT_I2C_EXEC		(11) //I2C request started -> completed
+#define LAT_LOG_DEPTH		(12) //Samples pending for the logger when it takes one, unitless
+#define LAT_SOCK_DEPTH		(13) //Samples pending for the socket thread when it takes one, unitless
+#define LAT_I2C_DEPTH		(14) //I2C requests queued when the bus manager takes one, unitless
+#define LAT_TEMP_JITTER		(15) //Deviation of a timer sample from its ideal schedule, --jitter only
+#define LAT_LIGHT_JITTER	(16)
+#define LAT_HISTS			(17)
+
+typedef struct
+{
+	const char *name;
+	bool ns;	//Values are nanoseconds, printed in microseconds
+	atomic_ullong count;
+	atomic_ullong sum;
+	atomic_ullong max;
+	atomic_ullong buckets[HIST_BUCKETS];
+} lat_hist;
+
+//Function Declarations
+uint64_t lat_now(void);
+uint64_t lat_ns(const struct timespec *ts);
+void lat_record(uint8_t id, uint64_t value);
+void lat_since(uint8_t id, uint64_t start, uint64_t end);
+uint64_t lat_percentile(uint8_t id, double pct);
+void lat_published(sensor_struct *sample);
+uint16_t lat_fill(wire_latency *recs, uint16_t max);
+size_t lat_stats(void *arg, char *buf, size_t size);
+
+#endif
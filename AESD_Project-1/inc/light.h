@@ -20,6 +20,8 @@
 #include <math.h>
 #include <unistd.h>
 #include "main.h"
+#include "sensor_math.h"
+#include "i2c_bus.h"
 
 
 #define LIGHT_TH (1)
@@ -43,6 +45,8 @@
 #define INT_H_H             0x05
 
 #define COMMAND_MASK        0x80
+#define CLEAR_MASK          0x40
+#define WORD_MASK           0x20
 #define LOW_GAIN_MASK       0x00
 #define HIGH_GAIN_MASK      0x10
 #define INT_13_7_MASK       0x00
@@ -56,6 +60,7 @@ uint8_t light_id(void);
 err_t write_command(uint8_t);
 uint16_t ADC_CH0(void);
 uint16_t ADC_CH1(void); 
+err_t read_adc(uint16_t adc[2]);
 float lux_data(void);
 err_t read_light_reg(uint8_t);
 err_t write_timing_reg(uint8_t);
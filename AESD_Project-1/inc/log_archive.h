@@ -0,0 +1,31 @@
+/**
+ * @file log_archive.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of log_archive.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _LOG_ARCHIVE_H
+#define _LOG_ARCHIVE_H
+
+#include "log_sink.h"
+
+#define ARCHIVE_CHUNK		(64 * 1024)	//Bytes compressed between two checks for the stop request
+#define ARCHIVE_NICE		(19)		//Nice value of the archive thread, the lowest priority
+
+//I/O priority of the archive thread, as in linux/ioprio.h
+#define IOPRIO_WHO_PROCESS	(1)
+#define IOPRIO_CLASS_IDLE	(3)
+#define IOPRIO_CLASS_SHIFT	(13)
+
+//Function Declarations
+err_t archive_start(const char *path, const sink_cfg *cfg);
+void archive_wake(void);
+void archive_stop(void);
+size_t archive_stats(void *arg, char *buf, size_t size);
+
+#endif
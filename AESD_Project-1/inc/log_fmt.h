@@ -0,0 +1,28 @@
+/**
+ * @file log_fmt.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of log_fmt.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _LOG_FMT_H
+#define _LOG_FMT_H
+
+#include "main.h"
+
+#define LOGFMT_MAX			(512) //Interned formats, ids run from 1 to LOGFMT_MAX
+#define LOGFMT_TEXT_SIZE	(256) //Longest formatted message
+
+//Function Declarations
+uint16_t logfmt_intern(const char *fmt);
+const char *logfmt_lookup(uint16_t id);
+err_t logfmt_define(uint16_t id, const char *fmt, size_t len);
+uint16_t logfmt_count(void);
+size_t logfmt_render(char *buf, size_t size, const char *fmt, const log_arg *args, uint8_t nargs);
+size_t logmsg_text(char *buf, size_t size, const struct logmsg_struct *msg);
+
+#endif
@@ -0,0 +1,157 @@
+/**
+ * @file log_format.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of log_format.c. Describes the text layout and the binary telemetry layout of the
+ * log file.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _LOG_FORMAT_H
+#define _LOG_FORMAT_H
+
+#include "main.h"
+#include "sensor_math.h"
+#include "log_fmt.h"
+#include "gorilla.h"
+
+//Log file formats
+#define LOG_FORMAT_TEXT		(0)
+#define LOG_FORMAT_BINARY	(1)
+
+/*
+ * Binary log layout, all fields little endian:
+ *
+ *   binlog_file_header                    written once at offset 0
+ *   binlog_rec_header + payload           repeated, payload is rec.length bytes
+ *
+ * Payloads per record id:
+ *   TEMP_RCV_ID, SOCK_TEMP_RCV_ID         binlog_temp, or binlog_temp_raw if BINLOG_REC_RAW
+ *   LIGHT_RCV_ID, SOCK_LIGHT_RCV_ID       binlog_light, or binlog_light_raw if BINLOG_REC_RAW
+ *   ERROR_RCV_ID                          uint32_t errno followed by the error string
+ *   MSG_RCV_ID                            the message string
+ *   LOGMSG_RCV_ID                         binlog_logmsg followed by nargs raw 8 byte arguments
+ *   LOGFMT_RCV_ID                         uint16_t format id followed by the format string, written
+ *                                         before the first LOGMSG_RCV_ID record using the id
+ *   BLOCK_RCV_ID                          binlog_block_hdr followed by a gorilla.h series of count
+ *                                         samples of one sensor record id, raw registers if
+ *                                         BINLOG_REC_RAW, the record time is that of the first
+ *                                         sample. Written instead of the sensor records with
+ *                                         --compress
+ * Strings are not NUL terminated, their length follows from rec.length.
+ */
+#define BINLOG_MAGIC		("AESD")
+#define BINLOG_VERSION		(1)
+
+//File header flags
+#define BINLOG_FILE_RAW		(0x0001) //Sensor records hold raw registers
+#define BINLOG_FILE_BLOCKS	(0x0002) //Sensor samples are stored in BLOCK_RCV_ID records
+
+//Record header flags
+#define BINLOG_REC_RAW		(0x01)	 //Payload holds raw registers, conversion deferred to the reader
+
+//Log message flags
+#define BINLOG_MSG_ERROR	(0x01)	 //Error message, errno is valid
+
+#define BINLOG_MAX_PAYLOAD	(256)
+
+typedef struct __attribute__((packed))
+{
+	char magic[4];
+	uint16_t version;
+	uint16_t header_size;	  //sizeof(binlog_file_header)
+	uint16_t rec_header_size; //sizeof(binlog_rec_header)
+	uint16_t flags;
+	uint32_t reserved;
+} binlog_file_header;
+
+typedef struct __attribute__((packed))
+{
+	uint8_t id;
+	uint8_t flags;
+	uint16_t length; //Payload length in bytes
+	uint32_t tv_sec;
+	uint32_t tv_nsec;
+} binlog_rec_header;
+
+typedef struct __attribute__((packed))
+{
+	float value;
+	uint8_t unit;
+	uint8_t reserved[3];
+} binlog_temp;
+
+typedef struct __attribute__((packed))
+{
+	uint16_t raw;
+	uint8_t unit;
+	uint8_t reserved;
+} binlog_temp_raw;
+
+typedef struct __attribute__((packed))
+{
+	float lux;
+	uint8_t state;
+	uint8_t reserved[3];
+} binlog_light;
+
+typedef struct __attribute__((packed))
+{
+	uint16_t adc0;
+	uint16_t adc1;
+} binlog_light_raw;
+
+typedef struct __attribute__((packed))
+{
+	uint16_t fmt;
+	uint8_t nargs;
+	uint8_t flags;
+	uint32_t error_value;
+} binlog_logmsg;
+
+typedef struct __attribute__((packed))
+{
+	uint8_t id;		 //Sensor record id of the samples
+	uint8_t unit;	 //Temperature unit, the same for every sample of the block
+	uint16_t count;
+} binlog_block_hdr;
+
+//Block record being filled with the samples of one sensor record id
+typedef struct
+{
+	uint8_t id;
+	bool raw;
+	uint8_t unit;
+	uint64_t first_ns;	 //Time of the first sample
+	gorilla_enc enc;
+	uint8_t buf[sizeof(binlog_rec_header) + BINLOG_MAX_PAYLOAD];
+} binlog_block;
+
+//Samples of a block record being read
+typedef struct
+{
+	uint8_t id;
+	bool raw;
+	uint8_t unit;
+	gorilla_dec dec;
+} binlog_block_reader;
+
+//Function Declarations
+size_t log_format_text(char *buf, size_t size, sensor_struct *data, bool *prev_state);
+size_t log_format_csv(char *buf, size_t size, sensor_struct *data);
+const char *log_csv_header(void);
+void binlog_file_init(binlog_file_header *hdr, bool raw, bool blocks);
+err_t binlog_file_check(const binlog_file_header *hdr);
+size_t binlog_encode(uint8_t *buf, size_t size, sensor_struct *data, bool raw);
+size_t binlog_encode_fmt(uint8_t *buf, size_t size, uint16_t id);
+size_t binlog_decode(const uint8_t *buf, size_t len, sensor_struct *data);
+void binlog_block_init(binlog_block *blk, uint8_t id, bool raw);
+bool binlog_block_add(binlog_block *blk, sensor_struct *data);
+size_t binlog_block_finish(binlog_block *blk);
+err_t binlog_block_open(binlog_block_reader *rd, const uint8_t *buf, size_t len);
+bool binlog_block_next(binlog_block_reader *rd, sensor_struct *data);
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * @file log_sink.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of log_sink.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _LOG_SINK_H
+#define _LOG_SINK_H
+
+#include <stdarg.h>
+#include <sys/types.h>
+#include "main.h"
+
+//fsync() policies
+#define SINK_FSYNC_NEVER	(0) //Leave write back to the kernel
+#define SINK_FSYNC_FLUSH	(1) //fsync() after every flush
+#define SINK_FSYNC_INTERVAL	(2) //fsync() at most once every fsync_ms
+
+//Default sink configuration
+#define SINK_BUF_SIZE		(64 * 1024)
+#define SINK_FLUSH_BYTES	(32 * 1024)
+#define SINK_FLUSH_MS		(1000)
+#define SINK_FSYNC_MS		(5000)
+#define SINK_FSYNC_POLICY	(SINK_FSYNC_INTERVAL)
+#define SINK_GZIP_LEVEL		(6)
+
+//Closed segments are named <log>.<UTC time>-<seq>, e.g. log.txt.20190328T101500-0000, and .gz once gzipped
+#define SINK_SEGMENT_LEN	(20)	//Length of the suffix after the dot
+
+//Sink configuration
+typedef struct
+{
+	size_t buf_size;	 //Size of the user-space record buffer
+	size_t flush_bytes;	 //Flush as soon as this many bytes are buffered
+	uint32_t flush_ms;	 //Flush once the oldest buffered record is this old
+	uint8_t fsync_policy; //SINK_FSYNC_NEVER, SINK_FSYNC_FLUSH or SINK_FSYNC_INTERVAL
+	uint32_t fsync_ms;	 //Interval used by SINK_FSYNC_INTERVAL
+	uint64_t rotate_bytes; //Start a new segment once the file holds this many bytes, 0 for no limit
+	uint32_t rotate_sec;	 //Start a new segment once the file is this old, 0 for no limit
+	uint64_t retain_bytes; //Delete the oldest segments beyond this many bytes on disk, 0 to keep them all
+	int gzip_level;		 //Compression of the closed segments, 0 to leave them as they are
+} sink_cfg;
+
+//Long lived log sink
+typedef struct
+{
+	int fd;
+	char *buf;
+	size_t len;
+	sink_cfg cfg;
+	struct timespec oldest;		//Time at which the first buffered byte was written
+	struct timespec last_sync;	//Time of the last fsync()
+	bool dirty;					//Data written since the last fsync()
+	char *path;
+	uint64_t file_bytes;		//Bytes in the current segment
+	uint64_t file_records;		//Records in the current segment
+	struct timespec opened;		//Time at which the current segment was opened
+	uint32_t segments;			//Segments closed so far, a writer compares it to start each segment with a header
+
+	//Counters
+	uint64_t records;
+	uint64_t bytes;
+	uint64_t flushes;
+	uint64_t syncs;
+	uint64_t flush_ns_total;
+	uint64_t flush_ns_max;
+	uint64_t write_errors;
+	uint64_t rotate_ns_max;
+
+	//Snapshot used to compute rates between two stats dumps
+	uint64_t rate_records;
+	uint64_t rate_bytes;
+	struct timespec rate_time;
+} log_sink;
+
+//Function Declarations
+void sink_default_cfg(sink_cfg *cfg);
+err_t sink_open(log_sink *sink, const char *path, const sink_cfg *cfg);
+err_t sink_write(log_sink *sink, const void *data, size_t len);
+err_t sink_printf(log_sink *sink, const char *fmt, ...);
+void sink_record_end(log_sink *sink);
+err_t sink_flush(log_sink *sink);
+err_t sink_poll(log_sink *sink);
+uint32_t sink_timeout_ms(log_sink *sink);
+bool sink_rotating(const sink_cfg *cfg);
+err_t sink_segment_name(const char *path, char *name, size_t size);
+err_t sink_rotate(log_sink *sink);
+err_t sink_close(log_sink *sink);
+size_t sink_stats(void *sink, char *buf, size_t size);
+
+#endif
@@ -15,12 +15,33 @@
 
 #include "main.h"
 #include "queue.h"
+#include "log_sink.h"
+#include "stats.h"
+#include "log_format.h"
+#include "sample_bus.h"
+#include "latency.h"
+#include "trace.h"
 
 
 #define UNIT ((TEMP_UNIT == 0)? "Celsius": (TEMP_UNIT == 1)? "Kelvin": (TEMP_UNIT == 2)? "Fahrenheit": "")
+#define LOG_RECORD_SIZE (512)
+
+//Log sink owned by the logger thread
+log_sink logfile_sink;
+sink_cfg logfile_cfg;
+uint8_t g_log_format;	//LOG_FORMAT_TEXT or LOG_FORMAT_BINARY
+bool g_log_raw;			//Binary records hold raw registers
+bool g_log_compress;	//Binary log only, sensor samples are stored in compressed blocks
+bus_sub *log_sub;		//Subscription of the logger thread to the sample bus, NULL when samples are not logged
 
 //Function Declarations
 void log_data(sensor_struct data_rcv);
+void log_header(void);
+void log_string(char *str);
+void log_stats(void);
+void log_samples(void);
+void log_blocks_flush(bool all);
+size_t log_block_stats(void *arg, char *buf, size_t size);
 
 
 #endif
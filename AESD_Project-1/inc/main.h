@@ -20,6 +20,7 @@
 #include <errno.h>
 #include <signal.h>
 #include <string.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <fcntl.h>
 #include <unistd.h>
@@ -37,13 +38,6 @@
 
 #define TEMP_UNIT (0) //Set 0 for degree celsius, 1 for kelvin, 2 for fahrenheit.
 
-//Heartbeat values corresponding to different threads 
-#define TEMP_HB (1)
-#define LIGHT_HB (2)
-#define LOGGER_HB (3)
-#define SOCKET_HB (4)
-#define CLEAR_HB (5)
-
 //Log Levels
 #define INFO (0x01)
 #define WARNING (0x02)
@@ -53,6 +47,11 @@
 #define INFO_DEBUG (0x09)
 #define INFO_ERROR_DEBUG (0x0E)
 
+//Log levels compiled in, e.g. -DLOG_COMPILED_LEVELS=0x07 removes every DEBUG only message from the build
+#ifndef LOG_COMPILED_LEVELS
+#define LOG_COMPILED_LEVELS (INFO | WARNING | ERROR | DEBUG)
+#endif
+
 //Prioirty levels
 #define P0		(0)
 #define P1		(1)
@@ -60,17 +59,14 @@
 
 //Mutex declarations
 pthread_mutex_t mutex_a;
-pthread_mutex_t mutex_b;
 pthread_mutex_t mutex_error;
 
 //Global Variables
 int i2c_open;
 char *filename;
-volatile uint8_t temp_timerflag;
-volatile uint8_t light_timerflag;
 uint8_t g_ll;
 uint8_t main_exit;
-volatile uint8_t socket_flag;
+bool g_measure; //Record wakeup latencies and CPU use, set by --measure
 int gpio_fd[2]; //2, one for light and other for the temperature
 
 // Error number
@@ -84,6 +80,11 @@ typedef uint32_t err_t;
 #define MSG_RCV_ID (4)
 #define SOCK_TEMP_RCV_ID (5)
 #define SOCK_LIGHT_RCV_ID (6)
+#define LOGMSG_RCV_ID (7)	//Interned log message, formatted by the logger thread or offline
+#define LOGFMT_RCV_ID (8)	//Binary log only, text of an interned format
+#define BLOCK_RCV_ID (9)	//Binary log only, compressed samples of one sensor
+
+#define LOG_MAX_ARGS (4)
 
 
 //Temperature sensor structure
@@ -91,6 +92,8 @@ struct temp_struct
 {
 	float temp_c;
 	struct timespec data_time;
+	uint16_t raw;	//12 bit temperature register
+	uint8_t unit;	//Unit of temp_c, same values as TEMP_UNIT
 };
 
 //Light sensor structure
@@ -99,6 +102,8 @@ struct light_struct
 	float light;
 	struct timespec data_time;
 	bool light_state;
+	uint16_t adc0;	//Raw ADC channel 0
+	uint16_t adc1;	//Raw ADC channel 1
 };
 
 //Error structure
@@ -115,6 +120,33 @@ struct msg_struct
 	char msg_str[50];
 };
 
+//Raw binary argument of an interned log message, the conversion in the format selects the member
+typedef union
+{
+	int64_t i;
+	double d;
+} log_arg;
+
+//Interned log message structure, the format string is only looked up when the message is formatted
+struct logmsg_struct
+{
+	struct timespec data_time;	//Errors only
+	err_t error_value;			//errno, errors only
+	uint16_t fmt;				//Interned format, see logfmt_lookup()
+	uint8_t nargs;
+	bool error;
+	log_arg args[LOG_MAX_ARGS];
+};
+
+//Pipeline timestamps of a sample in CLOCK_MONOTONIC nanoseconds, 0 for a step that did not happen
+typedef struct
+{
+	uint64_t posted;		//Event the sample was taken for, timer expiry or socket request
+	uint64_t read_start;
+	uint64_t read_done;
+	uint64_t published;		//Handed to the sample bus
+} sample_stamps;
+
 //Main sensor structure
 typedef struct
 {
@@ -124,30 +156,87 @@ typedef struct
 		struct light_struct light_data;
 		struct error_struct error_data;
 		struct msg_struct msg_data;
+		struct logmsg_struct logmsg_data;
 
 	} sensor_data;
+	sample_stamps stamps;	//Samples only, see latency.h
 
 } sensor_struct;
 
+/*
+ * Logging macros. The log level is checked before any work is done, so a disabled message costs one
+ * test of g_ll, and nothing at all if its level is not in LOG_COMPILED_LEVELS. An enabled message is
+ * sent as the interned id of its format, which must be a string literal, and its raw arguments; the
+ * logger thread formats it, or log_export does for binary logs. Arguments are integers or floating
+ * point values, at most LOG_MAX_ARGS of them.
+ *
+ *   msg_log("Entered Logger Thread.\n", DEBUG, P0);
+ *   error_log("ERROR: read(); in conn_read() function", ERROR_DEBUG, P2);
+ *   msg_logf("Connection %u closed after %llu requests.\n", DEBUG, P0, idx, count);
+ */
+#define LOG_ARG(x) _Generic((x), float: log_arg_double, double: log_arg_double, long double: log_arg_double, \
+							default: log_arg_int)(x)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, N, ...) N
+#define LOG_NARGS(...) LOG_NARGS_(_0, ##__VA_ARGS__, 4, 3, 2, 1, 0)
+#define LOG_ARGS0() {0}
+#define LOG_ARGS1(a) LOG_ARG(a)
+#define LOG_ARGS2(a, b) LOG_ARG(a), LOG_ARG(b)
+#define LOG_ARGS3(a, b, c) LOG_ARG(a), LOG_ARG(b), LOG_ARG(c)
+#define LOG_ARGS4(a, b, c, d) LOG_ARG(a), LOG_ARG(b), LOG_ARG(c), LOG_ARG(d)
+#define LOG_CAT_(a, b) a##b
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_ARGS(...) LOG_CAT(LOG_ARGS, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+
+#define log_emit(fmt, loglevel, prio, error, ...)                                                  \
+	do                                                                                             \
+	{                                                                                              \
+		if (((loglevel) & LOG_COMPILED_LEVELS) && ((loglevel) & g_ll))                             \
+		{                                                                                          \
+			static _Atomic uint16_t log_fmt_id;                                                    \
+			const log_arg log_args[LOG_MAX_ARGS] = {LOG_ARGS(__VA_ARGS__)};                        \
+			(void)sizeof(printf("" fmt "", ##__VA_ARGS__));                                        \
+			log_send(&log_fmt_id, fmt, error, log_args, LOG_NARGS(__VA_ARGS__), loglevel, prio);   \
+		}                                                                                          \
+	} while (0)
+
+#define msg_log(str, loglevel, prio) log_emit(str, loglevel, prio, false)
+#define error_log(str, loglevel, prio) log_emit(str, loglevel, prio, true)
+#define msg_logf(fmt, loglevel, prio, ...) log_emit(fmt, loglevel, prio, false, __VA_ARGS__)
+#define error_logf(fmt, loglevel, prio, ...) log_emit(fmt, loglevel, prio, true, __VA_ARGS__)
+
+static inline log_arg log_arg_int(int64_t i)
+{
+	log_arg arg;
+	arg.i = i;
+	return arg;
+}
+
+static inline log_arg log_arg_double(double d)
+{
+	log_arg arg;
+	arg.d = d;
+	return arg;
+}
+
 //Function Declarations
 err_t create_threads(char *filename);
+err_t parse_options(int argc, char *argv[]);
 void *temp_thread(void *);
 void *light_thread(void *);
 void *logger_thread(void *filename);
 void *sock_thread(void *filename);
 err_t i2c_init(void);
-sensor_struct read_error(char *error_str);
-sensor_struct read_msg(char *msg_str);
-void error_log(char *error_str, uint8_t loglevel, uint8_t prio);
-void msg_log(char *msg_str, uint8_t loglevel, uint8_t prio);
-void hb_send(uint8_t hb_value);
-uint8_t hb_receive(void);
-void hb_handle(uint8_t hb_rcv);
+sensor_struct read_error(const char *error_str);
+sensor_struct read_msg(const char *msg_str);
+void log_send(_Atomic uint16_t *fmt_id, const char *fmt, bool error, const log_arg *args, uint8_t nargs,
+			  uint8_t loglevel, uint8_t prio);
+void hb_handle(void);
 err_t mutex_init(void);
 err_t mutex_destroy(void);
 err_t i2c_close(void);
 err_t thread_destroy(void);
 err_t destroy_all(void);
+size_t cpu_stats(void *arg, char *buf, size_t size);
 
 
 #endif
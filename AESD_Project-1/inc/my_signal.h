@@ -20,6 +20,7 @@
 #include "queue.h"
 #include "main.h"
 #include "timer.h"
+#include "trace.h"
 
 //Function Declarations
 err_t sig_init(void);
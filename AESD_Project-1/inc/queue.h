@@ -18,23 +18,53 @@
 #include <mqueue.h>
 #include <errno.h>
 #include "main.h"
+#include "ring.h"
 
 //Names of the different queues.
-#define HEARTBEAT_QUEUE			("/mq1")
 #define LOG_QUEUE				("/mq2")
-#define SOCK_QUEUE				("/mq3")
+#define LOG_QUEUE_DEPTH			(20) //Messages in LOG_QUEUE
+
+//Transport used by queue_send() and queue_receive() for the logger queue
+#define QUEUE_MODE_RING			(0) //In-process SPSC rings, one per producer thread
+#define QUEUE_MODE_MQUEUE		(1) //POSIX message queues, usable across processes
+
+#define QUEUE_RING_SIZE			(256) //Elements per producer ring
+
+//Producer ring of each thread, CHAN_SHARED is used by threads that did not register
+#define QUEUE_ROLE_SHARED		(CHAN_SHARED)
+#define QUEUE_ROLE_MAIN			(1)
+#define QUEUE_ROLE_TEMP			(2)
+#define QUEUE_ROLE_LIGHT		(3)
+#define QUEUE_ROLE_LOGGER		(4)
+#define QUEUE_ROLE_SOCKET		(5)
+#define QUEUE_ROLE_TIMER		(6)
+
+uint8_t g_queue_mode;
+
+//What queue_send() does when the logger queue is full, set with --log-policy
+#define QUEUE_DROP_NEWEST		(CHAN_DROP_NEWEST)	//The new message is dropped
+#define QUEUE_OVERWRITE			(CHAN_OVERWRITE)	//The oldest message is dropped, drops newest with --mqueue
+#define QUEUE_BLOCK				(CHAN_BLOCK)		//The sender waits up to g_queue_block_ms, then drops
+#define QUEUE_BLOCK_MS			(100)
+
+uint8_t g_queue_policy;
+uint32_t g_queue_block_ms;
 
 //Message Queue handles
-mqd_t heartbeat_mq;
 mqd_t log_mq;
-mqd_t sock_mq;
 
 //Function declarations
 int queue_init(void);
+err_t queue_parse_policy(const char *arg);
+void queue_register(uint8_t role);
 void queue_send(mqd_t mq, sensor_struct data_send, uint8_t loglevel, uint8_t prio);
 sensor_struct queue_receive(mqd_t mq);
+err_t queue_timedreceive(mqd_t mq, sensor_struct *data_rcv, uint32_t timeout_ms);
+int queue_fd(mqd_t mq);
+void queue_clear(mqd_t mq);
 err_t queues_close(void);
 err_t queues_unlink(void);
+size_t queue_stats(void *arg, char *buf, size_t size);
 
 
 #endif
@@ -0,0 +1,89 @@
+/**
+ * @file ring.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of ring.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _RING_H
+#define _RING_H
+
+#include <stdatomic.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "main.h"
+
+#define RING_CACHE_LINE		(64)
+#define CHAN_MAX_PRODUCERS	(8)
+#define CHAN_SHARED			(0) //Ring shared by threads that have no ring of their own
+
+//What chan_send() does when the ring of the producer is full
+#define CHAN_DROP_NEWEST	(0) //The new element is dropped
+#define CHAN_OVERWRITE		(1) //The oldest element is dropped to make room for the new one
+#define CHAN_BLOCK			(2) //The producer waits up to block_ms for room, then drops the new element
+
+//Single producer single consumer ring. Producer and consumer indices live on separate cache lines.
+typedef struct
+{
+	_Alignas(RING_CACHE_LINE) atomic_uint head; //Next slot to read, written by the consumer
+	uint32_t tail_cache;						//Consumer's copy of tail
+	uint64_t pops;
+	atomic_ullong overwrites;					//Elements dropped by the producer to make room, see ring_push()
+	uint32_t hwm;								//Most elements the consumer has found in the ring
+
+	_Alignas(RING_CACHE_LINE) atomic_uint tail; //Next slot to write, written by the producer
+	uint32_t head_cache;						//Producer's copy of head
+	uint64_t pushes;
+	uint64_t drops;
+	uint64_t wakeups;
+
+	_Alignas(RING_CACHE_LINE) uint32_t mask;
+	uint32_t elem_size;
+	uint8_t *data;
+} spsc_ring;
+
+//Channel merging one ring per producer into a single consumer
+typedef struct
+{
+	spsc_ring rings[CHAN_MAX_PRODUCERS];
+	pthread_mutex_t shared_lock; //Serializes producers of the CHAN_SHARED ring
+	int efd;					 //eventfd signalled when a ring goes from empty to non-empty
+	uint32_t next;				 //Ring the consumer looks at first
+
+	//Priority lane, shared by all producers and drained before the producer rings
+	spsc_ring prio;
+	pthread_mutex_t prio_lock;
+
+	//Backpressure, see chan_policy()
+	uint8_t policy;
+	uint32_t block_ms;
+	pthread_mutex_t room_lock;
+	pthread_cond_t room;		 //Broadcast by the consumer when a blocked producer waits for room
+	atomic_uint blocked;		 //Producers waiting for room
+	atomic_ullong blocks;
+	atomic_ullong block_timeouts;
+	atomic_ullong block_ns_total;
+	atomic_ullong block_ns_max;
+} ring_chan;
+
+//Function Declarations
+err_t ring_init(spsc_ring *ring, uint32_t elem_size, uint32_t capacity);
+void ring_free(spsc_ring *ring);
+bool ring_push(spsc_ring *ring, const void *elem, bool overwrite, bool *was_empty);
+bool ring_pop(spsc_ring *ring, void *elem);
+uint32_t ring_count(spsc_ring *ring);
+err_t chan_init(ring_chan *chan, uint32_t elem_size, uint32_t capacity);
+void chan_policy(ring_chan *chan, uint8_t policy, uint32_t block_ms);
+void chan_free(ring_chan *chan);
+bool chan_send(ring_chan *chan, uint8_t producer, const void *elem);
+bool chan_send_prio(ring_chan *chan, const void *elem);
+bool chan_tryreceive(ring_chan *chan, void *elem);
+err_t chan_receive(ring_chan *chan, void *elem, int timeout_ms);
+void chan_clear(ring_chan *chan);
+size_t chan_stats(void *chan, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @file rollup.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of rollup.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _ROLLUP_H
+#define _ROLLUP_H
+
+#include "main.h"
+
+#define ROLLUP_TIERS_MAX	(4)
+#define ROLLUP_SERIES_MAX	(2)
+#define ROLLUP_DEPTH_MAX	(1 << 20)
+#define ROLLUP_DEFAULT		("1s:3600,1m:1440,1h:720")	//<period>:<buckets> per tier, set with --rollup
+#define ROLLUP_PERSIST_MS	(1000)						//Interval at which closed buckets are written out
+#define ROLLUP_MAGIC		(0x4C4C4F52)				//"ROLL"
+#define ROLLUP_VERSION		(1)
+
+//Aggregate of the samples of one period
+typedef struct
+{
+	uint64_t start_ns;			//Start of the period on CLOCK_REALTIME, a multiple of the period
+	uint32_t count;				//0 for a bucket that was never filled
+	float min;
+	float max;
+	uint32_t reserved;
+	double sum;
+} rollup_bucket;
+
+//Ring of the latest buckets at one resolution, the bucket of period number b is in slot b % depth
+typedef struct
+{
+	uint64_t period_ns;
+	uint32_t depth;
+	rollup_bucket *buckets;
+	uint64_t open;				//Period number of the bucket being filled, 0 before the first sample
+	atomic_ullong closed;		//Period number of the latest bucket that will not change any more
+	uint64_t persisted;			//Latest period number written to the rollup file
+} rollup_tier;
+
+//Rollups of one sensor. Updated by the sensor thread only, read by any thread: seq is odd while an
+//update is in progress and readers copy again if it changed under them.
+typedef struct
+{
+	const char *name;
+	uint8_t ntiers;
+	rollup_tier tiers[ROLLUP_TIERS_MAX];
+	atomic_uint seq;
+	off_t file_off;				//Offset of the first tier in the rollup file
+
+	//Counters
+	uint64_t samples;
+	uint64_t late;				//Samples older than the open bucket, added to it
+	atomic_ullong queries;
+	atomic_ullong retries;		//Copies made again because the sensor thread updated the buckets
+	atomic_ullong writes;		//Buckets written to the rollup file
+} rollup_series;
+
+//File header, followed by the buckets of every tier of every series in registration order
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint8_t nseries;
+	uint8_t ntiers;
+	uint64_t period_ns[ROLLUP_TIERS_MAX];
+	uint32_t depth[ROLLUP_TIERS_MAX];
+} rollup_file_hdr;
+
+rollup_series temp_rollup;
+rollup_series light_rollup;
+const char *g_rollup_spec;		//Tiers, set with --rollup, "none" disables the rollups
+const char *g_rollup_file;		//Set with --rollup-file, next to the log file by default
+
+//Function Declarations
+err_t rollup_parse(const char *spec);
+err_t rollup_init(rollup_series *series, const char *name);
+void rollup_add(rollup_series *series, const struct timespec *time, float value);
+uint32_t rollup_query(rollup_series *series, uint8_t tier, uint64_t from_ns, uint64_t to_ns, uint32_t last,
+					  rollup_bucket *out, uint32_t max);
+uint64_t rollup_period(uint8_t tier);
+err_t rollup_open(const char *path);
+void rollup_persist(bool force);
+void rollup_close(void);
+size_t rollup_stats(void *arg, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ * @file rt_sched.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of rt_sched.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _RT_SCHED_H
+#define _RT_SCHED_H
+
+#include <sched.h>
+#include <sys/mman.h>
+#include "main.h"
+
+//Thread roles, named as in the trace and in /proc
+#define RT_ROLE_MAIN		(0)
+#define RT_ROLE_TIMER		(1)
+#define RT_ROLE_I2C_BUS		(2)
+#define RT_ROLE_TEMP		(3)
+#define RT_ROLE_LIGHT		(4)
+#define RT_ROLE_LOGGER		(5)
+#define RT_ROLE_SOCKET		(6)
+#define RT_ROLE_ARCHIVE		(7)
+#define RT_ROLES			(8)
+
+#define RT_MAX_CPUS			(64)
+
+//Scheduling of a thread role, applied by each thread to itself when it starts
+typedef struct
+{
+	const char *name;
+	int policy;				//SCHED_OTHER, SCHED_FIFO or SCHED_RR
+	int priority;			//1 to 99 for SCHED_FIFO and SCHED_RR
+	uint64_t cpus;			//Bit i allows CPU i, 0 leaves the affinity alone
+	atomic_int result;		//0 until applied, then RT_APPLIED or the errno of the failure
+} rt_role;
+
+#define RT_APPLIED			(-1)
+
+//Lock all current and future pages of the process in memory, set by --mlock
+bool g_mlock;
+
+//Function Declarations
+err_t rt_parse_sched(const char *arg);
+err_t rt_parse_cpus(const char *arg);
+void rt_apply(uint8_t role);
+err_t rt_mlock(void);
+size_t rt_stats(void *arg, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,90 @@
+/**
+ * @file sample_bus.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of sample_bus.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _SAMPLE_BUS_H
+#define _SAMPLE_BUS_H
+
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "main.h"
+
+#define BUS_SLOTS			(256) //Samples kept for lagging subscribers, a power of two
+#define BUS_MAX_SUBS		(8)
+#define BUS_BLOCK_MS		(100) //Longest a publisher waits for a BUS_BLOCK subscriber before dropping for it
+
+//Topics a sample is published on, subscribers receive the samples matching any topic of their mask
+#define BUS_TOPIC_TEMP		(1 << 0) //New temperature reading
+#define BUS_TOPIC_LIGHT		(1 << 1) //New light reading
+#define BUS_TOPIC_ANSWER	(1 << 2) //Sample answering remote requests, fresh or cached
+
+//What happens to a subscriber that is BUS_SLOTS samples behind when a new sample is published
+#define BUS_DROP_OLDEST		(0) //Its oldest unread sample is skipped
+#define BUS_BLOCK			(1) //The publisher waits up to BUS_BLOCK_MS for it, then skips as BUS_DROP_OLDEST
+
+//Published sample, shared by all subscribers. refs counts the subscribers that have not released it yet.
+typedef struct
+{
+	sensor_struct sample;
+	uint64_t seq;
+	uint32_t topics;
+	uint8_t readers;		//Subscribers that have not taken the sample yet, one bit each
+	uint32_t refs;
+} bus_slot;
+
+//Subscriber, owned by a single consumer thread
+typedef struct
+{
+	const char *name;
+	bool active;
+	uint8_t policy;
+	uint32_t mask;
+	uint64_t cursor;		//Next sequence number to look at
+	uint32_t pending;		//Matching samples not taken yet
+	uint32_t backlog;		//Samples pending when bus_next() took the last one, that one included
+	bus_slot *held;			//Slot returned by bus_next(), until bus_release()
+	int efd;				//eventfd signalled when pending goes from 0 to 1
+
+	//Counters
+	uint64_t delivered;
+	uint64_t dropped;
+	uint64_t waits;			//Publishes that had to wait for this subscriber
+} bus_sub;
+
+//Broadcast ring of samples. Each sample is copied once into a slot and read in place by every subscriber.
+typedef struct
+{
+	pthread_mutex_t lock;
+	pthread_cond_t released;	//Broadcast when a slot a publisher waits for is released
+	bus_slot slots[BUS_SLOTS];
+	uint64_t head;				//Sequence number of the next sample
+	bus_sub subs[BUS_MAX_SUBS];
+	uint32_t waiting;			//Publishers waiting for a slot
+
+	//Counters
+	uint64_t published;
+	uint64_t unheard;			//Samples no subscriber wanted
+} sample_bus;
+
+sample_bus samples;
+
+//Function Declarations
+err_t bus_init(sample_bus *bus);
+void bus_destroy(sample_bus *bus);
+bus_sub *bus_subscribe(sample_bus *bus, const char *name, uint32_t mask, uint8_t policy);
+void bus_mask(sample_bus *bus, bus_sub *sub, uint32_t mask);
+void bus_publish(sample_bus *bus, const sensor_struct *sample, uint32_t topics);
+const sensor_struct *bus_next(sample_bus *bus, bus_sub *sub);
+void bus_release(sample_bus *bus, bus_sub *sub);
+int bus_fd(bus_sub *sub);
+void bus_clear(bus_sub *sub);
+size_t bus_stats(void *bus, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ * @file sample_cache.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of sample_cache.c
+ * @version 0.1
+ * @date 2019-03-28
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+
+#ifndef _SAMPLE_CACHE_H
+#define _SAMPLE_CACHE_H
+
+#include "main.h"
+
+//Default staleness bound of a cached sample served to remote hosts
+#define CACHE_MAX_AGE_MS (250)
+
+//Reads a fresh sample from the sensor
+typedef sensor_struct (*cache_read_fn)(void);
+
+//Latest sample of one sensor, refreshed by its sensor thread only and peeked at by the socket thread
+typedef struct
+{
+	const char *name;
+	pthread_mutex_t lock;
+	bool valid;
+	sensor_struct sample;
+	struct timespec taken;		//CLOCK_MONOTONIC time the sample was stored
+
+	//Counters
+	uint64_t hits;				//Requests served from the cache
+	uint64_t reads;				//Bus reads made on a miss
+	uint64_t updates;			//Samples stored by the periodic timer reads
+} sample_cache;
+
+sample_cache temp_cache;
+sample_cache light_cache;
+uint32_t g_cache_ms;			//Staleness bound in milliseconds, 0 reads the sensor on every request
+
+//Function Declarations
+err_t cache_init(sample_cache *cache, const char *name);
+void cache_put(sample_cache *cache, const sensor_struct *sample);
+bool cache_peek(sample_cache *cache, uint32_t max_age_ms, sensor_struct *sample);
+bool cache_get(sample_cache *cache, uint32_t max_age_ms, cache_read_fn read, sensor_struct *sample);
+err_t cache_destroy(sample_cache *cache);
+size_t cache_stats(void *cache, char *buf, size_t size);
+
+#endif
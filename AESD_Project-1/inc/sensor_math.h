@@ -0,0 +1,31 @@
+/**
+ * @file sensor_math.h
+ * @author Satya Mehta and Siddhant Jajoo
+ * @brief Header file of sensor_math.c
+ * @version 0.1
+ * @date 2019-03-28
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+
+#ifndef _SENSOR_MATH_H
+#define _SENSOR_MATH_H
+
+#include <stdint.h>
+#include <math.h>
+
+//Temperature units, same values as TEMP_UNIT
+#define UNIT_CELSIUS    (0)
+#define UNIT_KELVIN     (1)
+#define UNIT_FAHRENHEIT (2)
+
+#define TEMP_LSB_C      (0.0625)
+
+//Function Declarations
+float temp_raw_to_c(uint16_t raw);
+float temp_convert(float temp_c, uint8_t unit);
+const char *temp_unit_name(uint8_t unit);
+float lux_calc(uint16_t adc0, uint16_t adc1);
+
+#endif
@@ -17,11 +17,16 @@
 #include <unistd.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <netdb.h>
 #include <arpa/inet.h>
 #include "queue.h"
+#include "event.h"
+#include "sensor_math.h"
+#include "wire.h"
 
 #define PORT 3124   /* server's port number */
 #define MAX_SIZE    0x01
@@ -29,20 +34,95 @@
 #define TF          0x04
 #define TK          0x08
 #define L           0x10
-#define STATE       0x12
-#define TFL         0x14
-#define TKL         0x18     
+#define STATE       0x20
+#define TFL         (TF | L)
+#define TKL         (TK | L)
+#define TEMP_REQ    (TC | TF | TK)  //Requests served by the temperature thread
+#define LIGHT_REQ   (L | STATE)     //Requests served by the light thread
+
+//Server limits
+#define SOCK_MAX_CONN       (256)   //Default connection cap
+#define SOCK_IDLE_SEC       (60)    //Default idle time after which a connection is closed
+#define SOCK_BACKLOG        (128)
+#define SOCK_MAX_EVENTS     (64)
+#define SOCK_SWEEP_MS       (1000)  //Interval of the idle connection sweep
+#define SOCK_IN_SIZE        (256)   //Per connection receive buffer
+#define SOCK_OUT_SIZE       (1024)  //Per connection send buffer, grown for one history or rollup reply at a time
+#define SOCK_MAX_PENDING    (32)    //Requests a connection may have in flight
+#define SOCK_LAT_BATCH      (32)    //Bus samples handled between two sends, for the latency histograms
+
+/*
+ * Streaming subscription of legacy connections, framed connections use WIRE_MSG_SUBSCRIBE:
+ *   107 <channel mask> <decimation> <samples per message>
+ *   108                                          unsubscribe
+ * Samples are sent as WIRE_MSG_SAMPLES messages, see wire.h. Every decimation-th sample of each
+ * selected channel is streamed, messages are sent when they are full or after at most SOCK_SWEEP_MS.
+ * Record seq numbers the samples streamed on the connection, a gap means messages were dropped
+ * because the client did not read fast enough.
+ */
+#define SOCK_SUBSCRIBE      (107)
+#define SOCK_UNSUBSCRIBE    (108)
+#define SOCK_SUB_TEMP       (WIRE_SUB_TEMP)
+#define SOCK_SUB_LIGHT      (WIRE_SUB_LIGHT)
+#define SOCK_BATCH_MAX      (WIRE_BATCH_MAX)
+
+//epoll tags of the descriptors that are not connections
+#define SOCK_TAG_LISTEN     (0xFFFFFFFF)
+#define SOCK_TAG_REPLY      (0xFFFFFFFE)
+
+//epoll tag of a connection, the generation tells a new connection from a closed one in the same slot
+#define SOCK_TAG(gen, idx)  (((uint64_t)(gen) << 32) | (idx))
+
+//Request waiting for a sensor reading, answered in the order it was received
+typedef struct
+{
+    uint8_t id;     //SOCK_TEMP_RCV_ID or SOCK_LIGHT_RCV_ID
+    uint8_t unit;   //Temperature unit, same values as TEMP_UNIT
+    bool done;
+    uint32_t tag;   //seq of the WIRE_MSG_REQUEST, framed connections only
+    struct timespec time;   //Time of the reading
+    float value;
+} sock_req;
+
+//Client connection
+typedef struct
+{
+    int fd;
+    uint32_t gen;                       //Generation of the connection, part of its epoll tag
+    uint32_t events;                    //Current epoll interest
+    bool framed;                        //Switched to the wire.h protocol by WIRE_HELLO
+    uint32_t tx_seq;                    //seq of the next message sent
+    uint8_t in[SOCK_IN_SIZE];
+    uint32_t in_len;
+    uint8_t *out;
+    uint32_t out_cap;                   //SOCK_OUT_SIZE unless a history reply is being sent
+    uint32_t out_len;
+    uint32_t out_off;
+    sock_req pending[SOCK_MAX_PENDING]; //FIFO of requests in flight
+    uint32_t head;
+    uint32_t count;
+    struct timespec last_active;
+
+    //Streaming subscription
+    uint8_t sub_mask;                   //0 when not subscribed
+    uint32_t sub_decim;
+    uint32_t sub_batch;
+    uint32_t sub_seen[2];               //Samples seen per channel, for decimation
+    uint32_t seq;
+    uint32_t nbatch;
+    wire_record batch[SOCK_BATCH_MAX];
+} sock_conn;
 
 //Variable Declarations
-int serv, ser, client_len, port;
-struct sockaddr_in serv_addr, client_addr;
-struct hostent *hptr;
+int serv, port;
+struct sockaddr_in serv_addr;
+uint32_t g_sock_max_conn;   //Connection cap, set by --sock-max, 0 selects SOCK_MAX_CONN
+uint32_t g_sock_idle_sec;   //Idle limit, set by --sock-idle, 0 selects SOCK_IDLE_SEC
 
 //Function Declarations
-void socket_init(void);
-int socket_recv(void);
-void handle_socket_req(void);
-void socket_send(sensor_struct);
-void socket_listen(void);
+err_t socket_init(void);
+void socket_poll(int timeout_ms);
+void socket_close(void);
+size_t socket_stats(void *arg, char *buf, size_t size);
 
 #endif
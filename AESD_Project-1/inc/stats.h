@@ -0,0 +1,31 @@
+/**
+ * @file stats.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of stats.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "main.h"
+
+#define STATS_MAX_SOURCES	(32)
+#define STATS_BUF_SIZE		(8192)
+
+//Callback used by a module to format its counters into buf
+typedef size_t (*stats_fn)(void *arg, char *buf, size_t size);
+
+//Interval between periodic stats dumps in seconds, 0 disables them
+uint32_t g_stats_interval;
+
+//Function Declarations
+err_t stats_register(const char *name, stats_fn fn, void *arg);
+size_t stats_dump(char *buf, size_t size);
+bool stats_due(void);
+
+#endif
@@ -17,6 +17,8 @@
 #include <unistd.h>
 #include <stdlib.h>
 #include "main.h"
+#include "sensor_math.h"
+#include "i2c_bus.h"
 #include <linux/i2c-dev.h>
 #include <linux/i2c.h>
 #include <sys/ioctl.h>
@@ -12,7 +12,11 @@
 #ifndef _TIMER_H
 #define _TIMER_H
 
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
 #include "main.h"
+#include "event.h"
+#include "heartbeat.h"
 
 //Timer intervals
 #define TEMP_INTERVAL_SEC   (2)
@@ -22,14 +26,37 @@
 #define HB_INTERVAL_SEC (10)
 #define HB_INTERVAL_NSEC (0)
 
-//Timer Handle declarations
-timer_t timeout_temp;
-timer_t timeout_light;
-timer_t timeout_hb;
+//Sampling periods in nanoseconds, set with --temp-hz and --light-hz
+uint64_t g_temp_period_ns;
+uint64_t g_light_period_ns;
+
+#define TIMER_MAX           (8)     //Periodic tasks the reactor can own
+#define TIMER_JITTER_BUCKETS (24)   //Bucket i counts expiries late by less than 2^i microseconds
+
+//Callback run by the reactor thread on every expiry
+typedef void (*timer_fn)(void *arg);
+
+//Periodic task owned by the reactor
+typedef struct
+{
+    const char *name;
+    int fd;                     //timerfd, CLOCK_MONOTONIC absolute deadlines
+    timer_fn fn;
+    void *arg;
+    uint64_t period_ns;
+    struct timespec deadline;   //Next expected expiry
+    struct timespec first;      //First deadline, the start of the ideal schedule of the task
+    uint64_t expiries;
+    uint64_t overruns;          //Expiries missed because the reactor ran late
+    uint64_t jitter_ns_max;
+    uint64_t jitter[TIMER_JITTER_BUCKETS];
+} reactor_timer;
 
 //Function declarations
-err_t timer_init(uint8_t timer_number);
-void timer_handler(union sigval sv);
+err_t timer_init(void);
+int timer_add(const char *name, time_t sec, long nsec, timer_fn fn, void *arg);
+void timer_handler(void *arg);
 err_t timer_del(void);
+size_t timer_stats(void *arg, char *buf, size_t size);
 
 #endif
@@ -0,0 +1,82 @@
+/**
+ * @file trace.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of trace.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _TRACE_H
+#define _TRACE_H
+
+#include <sys/syscall.h>
+#include <sys/prctl.h>
+#include "main.h"
+
+#define TRACE_MAX_THREADS	(16)
+#define TRACE_RING_SIZE		(4096) //Events kept per thread, a power of two
+
+//Event phases, as named in the Chrome trace event format
+#define TRACE_PH_BEGIN		('B')
+#define TRACE_PH_END		('E')
+#define TRACE_PH_INSTANT	('i')
+
+//Trace event. The name is not copied, it must stay valid for the lifetime of the process.
+typedef struct
+{
+	uint64_t ts;		//CLOCK_MONOTONIC nanoseconds
+	const char *name;
+	int64_t arg;
+	char phase;
+} trace_event;
+
+//Ring of the events of one thread, written by that thread only and overwritten oldest first
+typedef struct
+{
+	const char *name;
+	pid_t tid;
+	atomic_ullong head;	//Events written since the first thread of that name registered
+	trace_event events[TRACE_RING_SIZE];
+} trace_ring;
+
+//Events are only recorded while set, SIGUSR1 toggles it
+atomic_bool g_trace;
+
+//Dump file of SIGUSR2 and of the exit, "<log file>.trace.json" unless --trace-file is given
+const char *g_trace_file;
+
+/*
+ * Tracing points. A disabled point costs one relaxed load of g_trace.
+ *
+ *   trace_begin("log_write");
+ *   ...
+ *   trace_end("log_write");
+ *   trace_instant("accept", idx);
+ */
+#define trace_point(name, phase, arg)                                   \
+	do                                                                  \
+	{                                                                   \
+		if (atomic_load_explicit(&g_trace, memory_order_relaxed))       \
+		{                                                               \
+			trace_record(name, phase, arg);                             \
+		}                                                               \
+	} while (0)
+
+#define trace_begin(name) trace_point(name, TRACE_PH_BEGIN, 0)
+#define trace_end(name) trace_point(name, TRACE_PH_END, 0)
+#define trace_instant(name, arg) trace_point(name, TRACE_PH_INSTANT, arg)
+
+//Function Declarations
+void trace_register(const char *name);
+void trace_record(const char *name, char phase, int64_t arg);
+void trace_toggle(void);
+void trace_request_dump(void);
+void trace_poll(void);
+err_t trace_dump(const char *path);
+void trace_close(void);
+size_t trace_stats(void *arg, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,85 @@
+/**
+ * @file tsdb.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Header file of tsdb.c
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _TSDB_H
+#define _TSDB_H
+
+#include "main.h"
+
+#define TSDB_DEPTH			(65536)	//Default samples kept per series, set with --tsdb-depth
+#define TSDB_DEPTH_MAX		(1 << 24)
+#define TSDB_SERIES_MAX		(2)
+#define TSDB_SYNC_MS		(1000)	//Interval at which the history file is synced to the disk
+#define TSDB_FILE_MAGIC		(0x42445354)	//"TSDB"
+#define TSDB_FILE_VERSION	(1)
+#define TSDB_FILE_HDR_SIZE	(4096)	//The records start on the second page
+
+//Sample in the history file. seq is the position of the record in its series since the file was created,
+//so a record left from an earlier lap of the ring, or only partly written, does not pass for a newer one.
+typedef struct
+{
+	uint64_t seq;
+	uint64_t time_ns;
+	float value;
+	uint32_t check;				//Checksum of the fields above
+} tsdb_rec;
+
+//Header of the history file, followed by a ring of depth records per series
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t series;
+	uint32_t depth;
+	uint32_t rec_size;
+	char names[TSDB_SERIES_MAX][8];
+	uint64_t cursor[TSDB_SERIES_MAX];	//Records appended per series, written back lazily and checked at startup
+} tsdb_file_hdr;
+
+//History of one sensor. Time stamps and values live in separate arrays so that a search by time only
+//touches the time stamps. Written by the sensor thread only, read by any thread without a lock.
+typedef struct
+{
+	const char *name;
+	uint64_t *time_ns;			//CLOCK_REALTIME of each sample, like data_time
+	float *value;				//Celsius or lux
+	uint32_t mask;				//Depth - 1, the depth is a power of two
+	atomic_ullong head;			//Samples appended since the start, the newest is at head - 1
+	tsdb_rec *disk;				//Ring of the series in the mapped history file, NULL without one
+	uint64_t *disk_cursor;		//Cursor of the series in the file header
+
+	//Counters
+	uint64_t unordered;			//Samples older than the previous one, after a clock step
+	atomic_ullong queries;
+	atomic_ullong returned;
+	atomic_ullong torn;			//Samples a query read while they were overwritten, left out
+	uint64_t recovered;			//Samples loaded from the history file at startup
+	uint64_t discarded;			//Records past the last consistent one, found at startup
+} tsdb_series;
+
+tsdb_series temp_series;
+tsdb_series light_series;
+uint32_t g_tsdb_depth;			//Samples per series, 0 disables the store
+const char *g_tsdb_file;		//History file kept across restarts, set by --tsdb-file
+
+//Function Declarations
+err_t tsdb_init(tsdb_series *series, const char *name, uint32_t depth);
+void tsdb_append(tsdb_series *series, const struct timespec *time, float value);
+uint32_t tsdb_query(tsdb_series *series, uint64_t from_ns, uint64_t to_ns, uint32_t last, uint64_t *time_ns,
+					float *value, uint32_t max);
+err_t tsdb_open(const char *path);
+void tsdb_sync(bool force);
+void tsdb_close(void);
+void tsdb_free(tsdb_series *series);
+size_t tsdb_stats(void *arg, char *buf, size_t size);
+size_t tsdb_file_stats(void *arg, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,186 @@
+/**
+ * @file wire.h
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Framed binary protocol spoken on the sensor socket. Shared by the server (sockets.c) and the
+ * remote client (Socket-Remote-System/Socket1/sock1.c), so it only depends on the C library.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#ifndef _WIRE_H
+#define _WIRE_H
+
+#include <stdint.h>
+
+/*
+ * A connection starts in the legacy protocol: the client sends 4 byte int commands 100-106 and reads
+ * one bare 4 byte float per expected value. Sending WIRE_HELLO (109) switches the connection to the
+ * framed protocol; the server answers with a WIRE_MSG_HELLO message carrying its version and from then
+ * on both directions carry messages:
+ *
+ *   wire_hdr                            length counts every byte after the length field
+ *   payload                             depends on the type:
+ *     WIRE_MSG_HELLO        -           no payload
+ *     WIRE_MSG_REQUEST      C -> S      count int32_t commands 100-106
+ *     WIRE_MSG_REPLY        S -> C      count wire_record, record seq is the seq of the request
+ *     WIRE_MSG_SUBSCRIBE    C -> S      wire_subscribe
+ *     WIRE_MSG_UNSUBSCRIBE  C -> S      no payload
+ *     WIRE_MSG_SAMPLES      S -> C      count wire_record, record seq numbers the streamed samples
+ *     WIRE_MSG_LATENCY      C -> S      no payload
+ *                           S -> C      count wire_latency, one per pipeline histogram
+ *     WIRE_MSG_HISTORY      C -> S      wire_history
+ *                           S -> C      count wire_record oldest first, record seq is the seq of the request
+ *     WIRE_MSG_SERIES       S -> C      reply to a wire_history with WIRE_HIST_PACKED, count bytes: a
+ *                                       wire_series followed by the samples as a gorilla.h series
+ *     WIRE_MSG_ROLLUP       C -> S      wire_rollup
+ *                           S -> C      count wire_bucket oldest first, bucket seq is the seq of the request
+ *
+ * All fields are little endian. hdr.seq numbers the messages sent in each direction. A message with a
+ * bad magic or an unknown version closes the connection. Streamed samples are also sent as
+ * WIRE_MSG_SAMPLES to legacy connections that subscribe with command 107, and legacy connections get
+ * the WIRE_MSG_LATENCY reply to command 110. Command 111 followed by a wire_history gets the
+ * WIRE_MSG_HISTORY reply on legacy connections, with record seq 0, and command 112 followed by a
+ * wire_rollup gets the WIRE_MSG_ROLLUP reply the same way.
+ */
+#define WIRE_HELLO              (109)
+#define WIRE_LATENCY            (110)
+#define WIRE_HISTORY            (111)
+#define WIRE_ROLLUP             (112)
+#define WIRE_MAGIC              (0xA5D1)
+#define WIRE_VERSION            (1)
+
+//Message types
+#define WIRE_MSG_HELLO          (1)
+#define WIRE_MSG_REQUEST        (2)
+#define WIRE_MSG_REPLY          (3)
+#define WIRE_MSG_SUBSCRIBE      (4)
+#define WIRE_MSG_UNSUBSCRIBE    (5)
+#define WIRE_MSG_SAMPLES        (6)
+#define WIRE_MSG_LATENCY        (7)
+#define WIRE_MSG_HISTORY        (8)
+#define WIRE_MSG_ROLLUP         (9)
+#define WIRE_MSG_SERIES         (10)
+
+//Record ids
+#define WIRE_ID_TEMP            (1)
+#define WIRE_ID_LIGHT           (2)
+
+//Record units
+#define WIRE_UNIT_CELSIUS       (0)
+#define WIRE_UNIT_KELVIN        (1)
+#define WIRE_UNIT_FAHRENHEIT    (2)
+#define WIRE_UNIT_LUX           (3)
+
+//Subscription channels
+#define WIRE_SUB_TEMP           (0x01)
+#define WIRE_SUB_LIGHT          (0x02)
+#define WIRE_BATCH_MAX          (32)
+
+//Records in one WIRE_MSG_HISTORY reply, a longer range is cut and asked for again from its last time stamp
+#define WIRE_HISTORY_MAX        (1024)
+
+//History query flags
+#define WIRE_HIST_PACKED        (0x0001)    //Reply with one compressed WIRE_MSG_SERIES
+
+//Buckets in one WIRE_MSG_ROLLUP reply
+#define WIRE_ROLLUP_MAX         (1024)
+
+//Latency record units
+#define WIRE_LAT_US             (0)
+#define WIRE_LAT_COUNT          (1)
+
+typedef struct __attribute__((packed))
+{
+    uint32_t length;    //Bytes following this field, header included
+    uint16_t magic;
+    uint8_t version;
+    uint8_t type;
+    uint32_t seq;
+    uint16_t count;     //Records or commands in the payload
+    uint16_t reserved;
+} wire_hdr;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t id;
+    uint8_t unit;
+    uint16_t reserved;
+    uint32_t seq;
+    uint32_t tv_sec;
+    uint32_t tv_nsec;
+    float value;
+} wire_record;
+
+typedef struct __attribute__((packed))
+{
+    uint32_t mask;      //WIRE_SUB_TEMP and/or WIRE_SUB_LIGHT
+    uint32_t decim;     //Every decim-th sample is streamed
+    uint32_t batch;     //Samples per message, at most WIRE_BATCH_MAX
+} wire_subscribe;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t id;         //WIRE_ID_TEMP or WIRE_ID_LIGHT
+    uint8_t unit;       //WIRE_UNIT_CELSIUS, WIRE_UNIT_KELVIN or WIRE_UNIT_FAHRENHEIT, ignored for light
+    uint16_t flags;     //WIRE_HIST_PACKED
+    uint32_t last;      //Only the newest last samples of the range, 0 for the oldest ones
+    uint64_t from_ns;   //Range of time stamps, CLOCK_REALTIME nanoseconds
+    uint64_t to_ns;     //0 for no upper limit
+} wire_history;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t id;         //WIRE_ID_TEMP or WIRE_ID_LIGHT
+    uint8_t unit;       //WIRE_UNIT_CELSIUS, WIRE_UNIT_KELVIN or WIRE_UNIT_FAHRENHEIT, ignored for light
+    uint8_t tier;       //Index of the rollup tier, 0 is the finest
+    uint8_t reserved;
+    uint32_t last;      //Only the newest last buckets of the range, 0 for the oldest ones
+    uint64_t from_ns;   //Range of bucket start times, CLOCK_REALTIME nanoseconds
+    uint64_t to_ns;     //0 for no upper limit
+} wire_rollup;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t id;
+    uint8_t unit;
+    uint8_t mode;       //GORILLA_XOR, the values are the bits of the floats of wire_record
+    uint8_t reserved;
+    uint32_t seq;       //seq of the request
+    uint32_t samples;   //Samples in the series that follows
+} wire_series;
+
+typedef struct __attribute__((packed))
+{
+    uint8_t id;
+    uint8_t unit;
+    uint8_t tier;
+    uint8_t reserved;
+    uint32_t seq;
+    uint64_t start_ns;  //Start of the period
+    uint32_t period_ms;
+    uint32_t count;     //Samples in the period
+    float min;
+    float max;
+    float mean;
+} wire_bucket;
+
+typedef struct __attribute__((packed))
+{
+    char name[12];      //NUL padded
+    uint8_t unit;       //WIRE_LAT_US, or WIRE_LAT_COUNT for queue depths
+    uint8_t reserved[3];
+    uint64_t count;     //Values recorded since the daemon started
+    float p50;
+    float p90;
+    float p99;
+    float p999;
+    float max;
+} wire_latency;
+
+//Size of a message with count records following the length field
+#define WIRE_LENGTH(count, rec_size) ((uint32_t)(sizeof(wire_hdr) - sizeof(uint32_t) + (count) * (rec_size)))
+
+#endif
@@ -12,6 +12,7 @@
  * 
  */
 
+#define _GNU_SOURCE //pthread_timedjoin_np()
 //#include <string.h>
 #include <pthread.h>
 #include <sched.h>
@@ -30,20 +31,40 @@
 #include "queue.h"
 #include "gpio.h"
 #include "timer.h"
+#include "log_sink.h"
+#include "log_archive.h"
+#include "stats.h"
+#include "event.h"
+#include "i2c_bus.h"
+#include "i2c_sim.h"
+#include "sample_cache.h"
+#include "sample_bus.h"
+#include "log_fmt.h"
+#include "latency.h"
+#include "trace.h"
+#include "heartbeat.h"
+#include "rt_sched.h"
+#include "jitter.h"
+#include "tsdb.h"
+#include "rollup.h"
 
 //Global Variables
 pthread_t my_thread[4];
 pthread_attr_t my_attributes;
-volatile static uint32_t temp_hb_value;
-volatile static uint32_t light_hb_value;
-volatile static uint32_t logger_hb_value;
+
+//Supervision state of my_thread[], a thread being restarted is joined before its replacement is created
+#define THREAD_RUNNING		(0)
+#define THREAD_CANCELLED	(1) //Cancelled, not exited yet
+#define THREAD_EXITED		(2) //Joined, the replacement could not be created
+static uint8_t thread_state[4];
 
 int main(int argc, char *argv[])
 {
-	if (argc != 3)
+	if (argc < 3)
 	{
 		printf("ERROR: Wrong number of parameters.\n");
 		printf("Input first parameter = name of log file; second parameter = log level: 'info' or 'warning' or 'error' or 'debug'.\n");
+		printf("Optional parameters: --flush-bytes=<bytes> --flush-ms=<ms> --fsync=never|flush|interval --fsync-ms=<ms> --rotate-bytes=<bytes> --rotate-sec=<sec> --retain-bytes=<bytes> --gzip=<0-9> --stats=<sec> --format=text|binary --raw --compress --mqueue --log-policy=drop|overwrite|block[:<ms>] --measure --sock-max=<n> --sock-idle=<sec> --sim --sim-temp=<shape:base:amp:period> --sim-light=<shape:base:amp:period> --sim-latency=<us>[:<jitter_us>] --sim-bus-khz=<khz> --no-combined --cache-ms=<ms> --trace --trace-file=<file> --temp-hz=<hz> --light-hz=<hz> --sched=<role>:<fifo|rr|other>:<prio> --cpus=<role>:<list> --mlock --jitter --tsdb-depth=<samples> --tsdb-file=<file> --rollup=<period>:<buckets>[,...]|none --rollup-file=<file>\n");
 		exit(EXIT_FAILURE);
 	}
 
@@ -77,17 +98,52 @@ int main(int argc, char *argv[])
 		g_ll = ERROR;
 	}
 
+	sink_default_cfg(&logfile_cfg);
+	sim_default_cfg(&g_sim_cfg);
+	g_cache_ms = CACHE_MAX_AGE_MS;
+	g_tsdb_depth = TSDB_DEPTH;
+	g_rollup_spec = ROLLUP_DEFAULT;
+	g_temp_period_ns = TEMP_INTERVAL_SEC * 1000000000ULL + TEMP_INTERVAL_NSEC;
+	g_light_period_ns = LIGHT_INTERVAL_SEC * 1000000000ULL + LIGHT_INTERVAL_NSEC;
+	if (parse_options(argc, argv))
+	{
+		exit(EXIT_FAILURE);
+	}
+
+	//Locking the memory before the threads and their stacks are created, the daemon still runs without it
+	if (g_mlock && !rt_mlock())
+	{
+		printf("Memory locked.\n");
+	}
+
+	//Trace dumps go next to the log file unless --trace-file is given
+	if (g_trace_file == NULL)
+	{
+		static char trace_file[256];
+		snprintf(trace_file, sizeof(trace_file), "%s.trace.json", filename);
+		g_trace_file = trace_file;
+	}
+
+	//The rollups are kept next to the log file as well
+	if (g_rollup_file == NULL)
+	{
+		static char rollup_file[256];
+		snprintf(rollup_file, sizeof(rollup_file), "%s.rollup", filename);
+		g_rollup_file = rollup_file;
+	}
+
 	//Initializing global variables
-	temp_timerflag = 0;
-	light_timerflag = 0;
 	main_exit = 0;
-	socket_flag = 0;
 	err_t res;
 	uint16_t rcv;
 
 	/*Uncomment to test with random numbers*/
 	//srand(time(NULL));
 
+	queue_register(QUEUE_ROLE_MAIN);
+	trace_register("main");
+	rt_apply(RT_ROLE_MAIN);
+
 	//Initializing GPIOs LEDs
 	gpio_init(LED1);
 	gpio_init(LED2);
@@ -118,7 +174,7 @@ int main(int argc, char *argv[])
 	res = i2c_init();
 	if (!res)
 	{
-		printf("BIST: I2C initialization successful.\n");
+		printf("BIST: I2C initialization successful, %s bus.\n", i2c_hal_name());
 		msg_log("BIST: I2C initialization successful.\n", DEBUG, P0);
 		gpio_ctrl(GPIO53, GPIO53_V, 0);
 	}
@@ -167,8 +223,13 @@ int main(int argc, char *argv[])
 		gpio_ctrl(GPIO53, GPIO53_V, 1);
 	}
 
-	//Deleting previous logfile
-	if (remove(filename))
+	//Deleting previous logfile, a rotated log keeps it as a segment instead
+	if (sink_rotating(&logfile_cfg))
+	{
+		printf("Log rotated every %llu bytes or %u s, %llu bytes retained.\n", (unsigned long long)logfile_cfg.rotate_bytes,
+			   logfile_cfg.rotate_sec, (unsigned long long)logfile_cfg.retain_bytes);
+	}
+	else if (remove(filename))
 	{
 		error_log("ERROR: remove(); cannot delete log file", ERROR_DEBUG, P2);
 	}
@@ -177,6 +238,133 @@ int main(int argc, char *argv[])
 		gpio_ctrl(GPIO53, GPIO53_V, 1);
 	}
 
+	//Opening the log sink, kept open by the logger thread for the lifetime of the process
+	if (sink_open(&logfile_sink, filename, &logfile_cfg))
+	{
+		gpio_ctrl(GPIO53, GPIO53_V, 1);
+		exit(EXIT_FAILURE);
+	}
+	log_header();
+	stats_register("log_sink", sink_stats, &logfile_sink);
+	//The closed segments are compressed and deleted in the background
+	if (sink_rotating(&logfile_cfg))
+	{
+		if (archive_start(filename, &logfile_cfg))
+		{
+			gpio_ctrl(GPIO53, GPIO53_V, 1);
+			exit(EXIT_FAILURE);
+		}
+		stats_register("log_archive", archive_stats, NULL);
+	}
+	if (g_log_compress)
+	{
+		stats_register("log_blocks", log_block_stats, NULL);
+	}
+	stats_register("socket", socket_stats, NULL);
+	stats_register("i2c", i2c_stats, NULL);
+	stats_register("i2c_bus", i2c_bus_stats, NULL);
+	stats_register("i2c_temp", i2c_sample_report, &temp_bus_stats);
+	stats_register("i2c_light", i2c_sample_report, &light_bus_stats);
+
+	//Initializing the events the sensor threads sleep on
+	if (event_init(&temp_event) || event_init(&light_event))
+	{
+		gpio_ctrl(GPIO53, GPIO53_V, 1);
+		exit(EXIT_FAILURE);
+	}
+
+	//Initializing the latest-sample caches remote requests are served from
+	if (cache_init(&temp_cache, "temp") || cache_init(&light_cache, "light"))
+	{
+		gpio_ctrl(GPIO53, GPIO53_V, 1);
+		exit(EXIT_FAILURE);
+	}
+	stats_register("cache_temp", cache_stats, &temp_cache);
+	stats_register("cache_light", cache_stats, &light_cache);
+
+	//Initializing the sample history served to remote hosts, allocated once for the life of the daemon
+	if (g_tsdb_depth)
+	{
+		if (tsdb_init(&temp_series, "temp", g_tsdb_depth) || tsdb_init(&light_series, "light", g_tsdb_depth))
+		{
+			gpio_ctrl(GPIO53, GPIO53_V, 1);
+			exit(EXIT_FAILURE);
+		}
+		stats_register("tsdb_temp", tsdb_stats, &temp_series);
+		stats_register("tsdb_light", tsdb_stats, &light_series);
+	}
+
+	//Loading the history kept in the history file, before the sensor threads append to it
+	if (g_tsdb_file)
+	{
+		if (tsdb_open(g_tsdb_file))
+		{
+			gpio_ctrl(GPIO53, GPIO53_V, 1);
+			exit(EXIT_FAILURE);
+		}
+		printf("History file %s: %llu temperature and %llu light samples recovered.\n", g_tsdb_file,
+			   (unsigned long long)temp_series.recovered, (unsigned long long)light_series.recovered);
+		stats_register("tsdb_file", tsdb_file_stats, NULL);
+	}
+
+	//Initializing the rollups, loaded from the rollup file so that they survive a restart
+	if (strcmp(g_rollup_spec, "none"))
+	{
+		if (rollup_init(&temp_rollup, "temp") || rollup_init(&light_rollup, "light"))
+		{
+			gpio_ctrl(GPIO53, GPIO53_V, 1);
+			exit(EXIT_FAILURE);
+		}
+		if (rollup_open(g_rollup_file))
+		{
+			printf("Rollups not persisted.\n");
+		}
+		stats_register("rollup_temp", rollup_stats, &temp_rollup);
+		stats_register("rollup_light", rollup_stats, &light_rollup);
+	}
+
+	//Initializing the sample bus, every sample is published once to the logger, the socket and other subscribers
+	if (bus_init(&samples))
+	{
+		gpio_ctrl(GPIO53, GPIO53_V, 1);
+		exit(EXIT_FAILURE);
+	}
+	//Only the block policy lets a slow logger hold the sensor threads back, for at most BUS_BLOCK_MS
+	if (INFO_DEBUG & g_ll)
+	{
+		log_sub = bus_subscribe(&samples, "logger", BUS_TOPIC_TEMP | BUS_TOPIC_LIGHT,
+								(g_queue_policy == QUEUE_BLOCK) ? BUS_BLOCK : BUS_DROP_OLDEST);
+	}
+	stats_register("sample_bus", bus_stats, &samples);
+
+	//Initializing the heartbeats. The sensor threads beat once per sample, so they get two periods when sampling slower.
+	if (hb_init())
+	{
+		gpio_ctrl(GPIO53, GPIO53_V, 1);
+		exit(EXIT_FAILURE);
+	}
+	uint64_t hb_period = HB_INTERVAL_SEC * 1000000000ULL + HB_INTERVAL_NSEC;
+	hb_watch(TEMP_HB, "temp", (2 * g_temp_period_ns > hb_period) ? 2 * g_temp_period_ns : hb_period, true);
+	hb_watch(LIGHT_HB, "light", (2 * g_light_period_ns > hb_period) ? 2 * g_light_period_ns : hb_period, true);
+	hb_watch(LOGGER_HB, "logger", hb_period, true);
+	//Only reported, the connections of the socket thread would not survive a restart
+	hb_watch(SOCKET_HB, "socket", hb_period, false);
+	stats_register("heartbeat", hb_stats, NULL);
+	stats_register("latency", lat_stats, NULL);
+	stats_register("trace", trace_stats, NULL);
+	if (g_measure)
+	{
+		stats_register("temp_event", event_stats, &temp_event);
+		stats_register("light_event", event_stats, &light_event);
+		stats_register("cpu", cpu_stats, NULL);
+	}
+	if (g_jitter)
+	{
+		stats_register("jitter_temp", jitter_stats, &temp_jitter);
+		stats_register("jitter_light", jitter_stats, &light_jitter);
+	}
+	stats_register("rt", rt_stats, NULL);
+
 	//Creating threads
 	res = create_threads(filename);
 	if (!res)
@@ -189,13 +377,24 @@ int main(int argc, char *argv[])
 		gpio_ctrl(GPIO53, GPIO53_V, 1);
 	}
 
-	//Initializing Timer
-	timer_init(TIMER_HB);
+	//Initializing the timer reactor, it owns the temperature, light and heartbeat timers
+	res = timer_init();
+	if (res)
+	{
+		gpio_ctrl(GPIO53, GPIO53_V, 1);
+	}
 	msg_log("Reached main while loop.\n", DEBUG, P0);
 
 	while (!main_exit)
 	{
-		hb_handle(hb_receive());
+		//Sleeps until the heartbeat timer fires or a signal arrives
+		if (hb_wait())
+		{
+			trace_begin("hb_handle");
+			hb_handle();
+			trace_end("hb_handle");
+		}
+		trace_poll();
 	}
 
 	msg_log("Exiting Main while loop.\n", DEBUG, P0);
@@ -203,18 +402,347 @@ int main(int argc, char *argv[])
 
 	destroy_all();
 
-	for (int i = 0; i < 4; i++)
+	return OK;
+}
+
+/**
+ * @brief - This function parses the optional command line parameters following the log file name and
+ * 			the log level.
+ * 
+ * @param argc - Argument count.
+ * @param argv - Argument vector.
+ * @return err_t - Returns error value. (0 for success).
+ */
+err_t parse_options(int argc, char *argv[])
+{
+	for (int i = 3; i < argc; i++)
 	{
-		pthread_join(my_thread[i], NULL);
+		if (!strncmp(argv[i], "--flush-bytes=", 14))
+		{
+			logfile_cfg.flush_bytes = strtoul(argv[i] + 14, NULL, 0);
+		}
+		else if (!strncmp(argv[i], "--flush-ms=", 11))
+		{
+			logfile_cfg.flush_ms = strtoul(argv[i] + 11, NULL, 0);
+		}
+		else if (!strcmp(argv[i], "--fsync=never"))
+		{
+			logfile_cfg.fsync_policy = SINK_FSYNC_NEVER;
+		}
+		else if (!strcmp(argv[i], "--fsync=flush"))
+		{
+			logfile_cfg.fsync_policy = SINK_FSYNC_FLUSH;
+		}
+		else if (!strcmp(argv[i], "--fsync=interval"))
+		{
+			logfile_cfg.fsync_policy = SINK_FSYNC_INTERVAL;
+		}
+		else if (!strncmp(argv[i], "--fsync-ms=", 11))
+		{
+			logfile_cfg.fsync_ms = strtoul(argv[i] + 11, NULL, 0);
+		}
+		else if (!strncmp(argv[i], "--rotate-bytes=", 15))
+		{
+			logfile_cfg.rotate_bytes = strtoull(argv[i] + 15, NULL, 0);
+		}
+		else if (!strncmp(argv[i], "--rotate-sec=", 13))
+		{
+			logfile_cfg.rotate_sec = strtoul(argv[i] + 13, NULL, 0);
+		}
+		else if (!strncmp(argv[i], "--retain-bytes=", 15))
+		{
+			logfile_cfg.retain_bytes = strtoull(argv[i] + 15, NULL, 0);
+		}
+		else if (!strncmp(argv[i], "--gzip=", 7))
+		{
+			char *end;
+			logfile_cfg.gzip_level = strtol(argv[i] + 7, &end, 10);
+			if (*end != '\0' || end == argv[i] + 7 || logfile_cfg.gzip_level < 0 || logfile_cfg.gzip_level > 9)
+			{
+				printf("ERROR: Invalid level %s; Valid levels: 0 (no compression) to 9.\n", argv[i] + 7);
+				return FAIL;
+			}
+		}
+		else if (!strcmp(argv[i], "--format=text"))
+		{
+			g_log_format = LOG_FORMAT_TEXT;
+		}
+		else if (!strcmp(argv[i], "--format=binary"))
+		{
+			g_log_format = LOG_FORMAT_BINARY;
+		}
+		else if (!strcmp(argv[i], "--raw"))
+		{
+			g_log_raw = true;
+		}
+		else if (!strcmp(argv[i], "--compress"))
+		{
+			g_log_compress = true;
+		}
+		else if (!strcmp(argv[i], "--mqueue"))
+		{
+			g_queue_mode = QUEUE_MODE_MQUEUE;
+		}
+		else if (!strncmp(argv[i], "--log-policy=", 13))
+		{
+			if (queue_parse_policy(argv[i] + 13))
+			{
+				printf("ERROR: Invalid policy %s; Valid policies: drop, overwrite, block[:<ms>].\n", argv[i] + 13);
+				return FAIL;
+			}
+		}
+		else if (!strncmp(argv[i], "--sock-max=", 11))
+		{
+			g_sock_max_conn = strtoul(argv[i] + 11, NULL, 0);
+		}
+		else if (!strncmp(argv[i], "--sock-idle=", 12))
+		{
+			g_sock_idle_sec = strtoul(argv[i] + 12, NULL, 0);
+		}
+		else if (!strcmp(argv[i], "--sim"))
+		{
+			g_i2c_backend = I2C_BACKEND_SIM;
+		}
+		else if (!strncmp(argv[i], "--sim-temp=", 11))
+		{
+			if (sim_parse_signal(argv[i] + 11, &g_sim_cfg.temp))
+			{
+				printf("ERROR: Invalid signal %s; Valid shapes: const, sine, ramp, square, noise.\n", argv[i] + 11);
+				return FAIL;
+			}
+		}
+		else if (!strncmp(argv[i], "--sim-light=", 12))
+		{
+			if (sim_parse_signal(argv[i] + 12, &g_sim_cfg.light))
+			{
+				printf("ERROR: Invalid signal %s; Valid shapes: const, sine, ramp, square, noise.\n", argv[i] + 12);
+				return FAIL;
+			}
+		}
+		else if (!strncmp(argv[i], "--sim-latency=", 14))
+		{
+			if (sim_parse_latency(argv[i] + 14, &g_sim_cfg))
+			{
+				printf("ERROR: Invalid latency %s.\n", argv[i] + 14);
+				return FAIL;
+			}
+		}
+		else if (!strncmp(argv[i], "--sim-bus-khz=", 14))
+		{
+			g_sim_cfg.bus_khz = strtoul(argv[i] + 14, NULL, 0);
+		}
+		else if (!strcmp(argv[i], "--no-combined"))
+		{
+			g_i2c_split = true;
+		}
+		else if (!strncmp(argv[i], "--cache-ms=", 11))
+		{
+			g_cache_ms = strtoul(argv[i] + 11, NULL, 0);
+		}
+		else if (!strcmp(argv[i], "--measure"))
+		{
+			g_measure = true;
+		}
+		else if (!strncmp(argv[i], "--temp-hz=", 10) || !strncmp(argv[i], "--light-hz=", 11))
+		{
+			bool temp = (argv[i][2] == 't');
+			double hz = strtod(argv[i] + (temp ? 10 : 11), NULL);
+			if (hz <= 0 || hz > 1e6)
+			{
+				printf("ERROR: Invalid rate %s; Valid rates: above 0 and up to 1000000 Hz.\n", argv[i]);
+				return FAIL;
+			}
+			*(temp ? &g_temp_period_ns : &g_light_period_ns) = (uint64_t)(1e9 / hz);
+		}
+		else if (!strcmp(argv[i], "--trace"))
+		{
+			atomic_store(&g_trace, true);
+		}
+		else if (!strncmp(argv[i], "--trace-file=", 13))
+		{
+			g_trace_file = argv[i] + 13;
+		}
+		else if (!strncmp(argv[i], "--sched=", 8))
+		{
+			if (rt_parse_sched(argv[i] + 8))
+			{
+				printf("ERROR: Invalid scheduling %s; Valid roles: main, timer, i2c_bus, temp, light, logger, socket, archive, "
+					   "policies: fifo, rr, other.\n", argv[i] + 8);
+				return FAIL;
+			}
+		}
+		else if (!strncmp(argv[i], "--cpus=", 7))
+		{
+			if (rt_parse_cpus(argv[i] + 7))
+			{
+				printf("ERROR: Invalid CPUs %s; Valid roles: main, timer, i2c_bus, temp, light, logger, socket, archive.\n",
+					   argv[i] + 7);
+				return FAIL;
+			}
+		}
+		else if (!strcmp(argv[i], "--mlock"))
+		{
+			g_mlock = true;
+		}
+		else if (!strcmp(argv[i], "--jitter"))
+		{
+			g_jitter = true;
+		}
+		else if (!strncmp(argv[i], "--tsdb-depth=", 13))
+		{
+			g_tsdb_depth = strtoul(argv[i] + 13, NULL, 0);
+			if (g_tsdb_depth > TSDB_DEPTH_MAX)
+			{
+				printf("ERROR: Invalid depth %s; Valid depths: 0 to %u samples.\n", argv[i] + 13, TSDB_DEPTH_MAX);
+				return FAIL;
+			}
+		}
+		else if (!strncmp(argv[i], "--tsdb-file=", 12))
+		{
+			g_tsdb_file = argv[i] + 12;
+		}
+		else if (!strncmp(argv[i], "--rollup=", 9))
+		{
+			g_rollup_spec = argv[i] + 9;
+			if (strcmp(g_rollup_spec, "none") && rollup_parse(g_rollup_spec))
+			{
+				printf("ERROR: Invalid rollup tiers %s; Up to %u tiers as <period>:<buckets>, periods in ms, s, m, h "
+					   "or d, for example %s.\n",
+					   g_rollup_spec, ROLLUP_TIERS_MAX, ROLLUP_DEFAULT);
+				return FAIL;
+			}
+		}
+		else if (!strncmp(argv[i], "--rollup-file=", 14))
+		{
+			g_rollup_file = argv[i] + 14;
+		}
+		else if (!strncmp(argv[i], "--stats=", 8))
+		{
+			g_stats_interval = strtoul(argv[i] + 8, NULL, 0);
+		}
+		else
+		{
+			printf("ERROR: Invalid parameter %s.\n", argv[i]);
+			return FAIL;
+		}
+	}
+
+	//Only the binary layout has compressed blocks
+	if (g_log_compress && g_log_format != LOG_FORMAT_BINARY)
+	{
+		printf("ERROR: --compress needs --format=binary.\n");
+		return FAIL;
+	}
+
+	//The history file holds the samples of the in-memory history
+	if (g_tsdb_file && !g_tsdb_depth)
+	{
+		printf("ERROR: --tsdb-file needs a --tsdb-depth above 0.\n");
+		return FAIL;
+	}
+
+	//The budget is enforced on the segments, without rotation the log file would be the only one
+	if (logfile_cfg.retain_bytes && !sink_rotating(&logfile_cfg))
+	{
+		printf("ERROR: --retain-bytes needs --rotate-bytes or --rotate-sec.\n");
+		return FAIL;
 	}
 
+	//Measurements are reported through the periodic stats dump
+	if ((g_measure || g_jitter) && !g_stats_interval)
+	{
+		g_stats_interval = MEASURE_INTERVAL_SEC;
+	}
 	return OK;
 }
 
 /**
- * @brief - This thread records temperature from the sensor at regular intervals of time and sends the data
- * 			to the logger thread using message queues.
- * 			It also send data to the socket thread using message queues.
+ * @brief - Reads a temperature sample, for the timer or the sample cache, and stamps its bus time.
+ * 
+ * @return sensor_struct 
+ */
+static sensor_struct temp_sample(void)
+{
+	uint64_t start = lat_now();
+	sensor_struct sample;
+
+	trace_begin("read_temp");
+	sample = read_temp_data(TEMP_UNIT, TEMP_RCV_ID);
+	trace_end("read_temp");
+
+	memset(&sample.stamps, 0, sizeof(sample.stamps));
+	sample.stamps.read_start = start;
+	sample.stamps.read_done = lat_now();
+	return sample;
+}
+
+/**
+ * @brief - Reads a light sample, for the timer or the sample cache, and stamps its bus time.
+ * 
+ * @return sensor_struct 
+ */
+static sensor_struct light_sample(void)
+{
+	uint64_t start = lat_now();
+	sensor_struct sample;
+
+	trace_begin("read_light");
+	sample = read_light_data(LIGHT_RCV_ID);
+	trace_end("read_light");
+
+	memset(&sample.stamps, 0, sizeof(sample.stamps));
+	sample.stamps.read_start = start;
+	sample.stamps.read_done = lat_now();
+	return sample;
+}
+
+/**
+ * @brief - Stamps a sample with the event it was taken for before it is published. A sample answered
+ * 			from the cache was not read for this event and loses its read stamps.
+ * 
+ * @param sample - The sample.
+ * @param ev - The event returned by the last event_wait().
+ * @param fresh - false if the sample came from the cache.
+ */
+static void sample_stamp(sensor_struct *sample, thread_event *ev, bool fresh)
+{
+	if (!fresh)
+	{
+		sample->stamps.read_start = 0;
+		sample->stamps.read_done = 0;
+	}
+	sample->stamps.posted = lat_ns(&ev->woken);
+	lat_published(sample);
+}
+
+/**
+ * @brief - Adds a new temperature sample to the history and the rollups.
+ * 
+ * @param sample - The sample.
+ */
+static void temp_history(const sensor_struct *sample)
+{
+	float celsius = temp_raw_to_c(sample->sensor_data.temp_data.raw);
+
+	tsdb_append(&temp_series, &sample->sensor_data.temp_data.data_time, celsius);
+	rollup_add(&temp_rollup, &sample->sensor_data.temp_data.data_time, celsius);
+}
+
+/**
+ * @brief - Adds a new light sample to the history and the rollups.
+ * 
+ * @param sample - The sample.
+ */
+static void light_history(const sensor_struct *sample)
+{
+	tsdb_append(&light_series, &sample->sensor_data.light_data.data_time, sample->sensor_data.light_data.light);
+	rollup_add(&light_rollup, &sample->sensor_data.light_data.data_time, sample->sensor_data.light_data.light);
+}
+
+/**
+ * @brief - This thread records temperature from the sensor at regular intervals of time and publishes the
+ * 			samples on the sample bus, which hands them to the logger thread, the socket thread and any
+ * 			other subscriber.
  * 
  * @param filename - This is the textfile name that is passed to the thread. This is obtained as a 
  * 					command line argument.
@@ -222,16 +750,16 @@ int main(int argc, char *argv[])
  */
 void *temp_thread(void *filename)
 {
+	queue_register(QUEUE_ROLE_TEMP);
+	trace_register("temp");
+	rt_apply(RT_ROLE_TEMP);
 	msg_log("Entered Temperature Thread.\n", DEBUG, P0);
-	timer_init(TIMER_TEMP);
 
 	/*Uncomment to test with random numbers*/
 	//sensor_struct data_send;
 
-	msg_log("Entered Temperature Thread.\n", DEBUG, P0);
-	timer_init(TIMER_TEMP);
-
 	uint16_t rcv;
+	i2c_bus_priority(I2C_PRIO_LOW);
 	write_thigh(23);
 	write_tlow(22);
 	rcv = read_config();
@@ -242,14 +770,23 @@ void *temp_thread(void *filename)
 
 	while (1)
 	{
-		usleep(10);
-		if (temp_timerflag)
-		{
-			pthread_mutex_lock(&mutex_b);
+		//Sleeps until the timer or a socket request posts an event
+		uint32_t events = event_wait(&temp_event);
+		trace_instant("wake", events);
 
-			//Insert Mutex lock here
-			temp_timerflag = 0;
-			queue_send(log_mq, read_temp_data(TEMP_UNIT, TEMP_RCV_ID), INFO_DEBUG, P0);
+		if (events & EV_TIMER)
+		{
+			i2c_bus_priority(I2C_PRIO_NORMAL);
+			sensor_struct sample = temp_sample();
+			event_sample_done(&temp_event);
+			if (g_jitter)
+			{
+				jitter_record(&temp_jitter, sample.stamps.read_start);
+			}
+			cache_put(&temp_cache, &sample);
+			temp_history(&sample);
+			sample_stamp(&sample, &temp_event, true);
+			bus_publish(&samples, &sample, BUS_TOPIC_TEMP);
 
 			/*Uncomment to test with random numbers*/
 			// data_send.id = SOCK_RCV_ID;
@@ -257,58 +794,36 @@ void *temp_thread(void *filename)
 			//queue_send(log_mq, data_send, INFO_DEBUG, P0);
 
 			msg_log("Temperature Timer event handled.\n", DEBUG, P0);
-			//Insert mutex Unlock here
-			pthread_mutex_unlock(&mutex_b);
-			hb_send(TEMP_HB);
+			hb_beat(TEMP_HB);
 		}
 
-		if (socket_flag & TC)
+		if (events & TEMP_REQ)
 		{
-
 			/*Uncomment to test with random numbers*/
 			// queue_send(log_mq, data_send, INFO_DEBUG, P0);
 			// queue_send(sock_mq, data_send, INFO_DEBUG, P0);
 
-			queue_send(log_mq, read_temp_data(0, SOCK_TEMP_RCV_ID), INFO_DEBUG, P0);
-			queue_send(sock_mq, read_temp_data(0, SOCK_TEMP_RCV_ID), INFO_DEBUG, P0);
-			msg_log("Temp in celsius socket request event handled", DEBUG, P0);
-			pthread_mutex_lock(&mutex_a);
-			socket_flag &= (~TC);
-			pthread_mutex_unlock(&mutex_a);
-		}
-		else if (socket_flag & TK)
-		{
-
-			/*Uncomment to test with random numbers*/
-			//queue_send(log_mq, data_send, INFO_DEBUG);
-			//queue_send(sock_mq, data_send, INFO_DEBUG);
-
-			pthread_mutex_lock(&mutex_a);
-			socket_flag &= (~TK);
-			pthread_mutex_unlock(&mutex_a);
-			queue_send(log_mq, read_temp_data(1, SOCK_TEMP_RCV_ID), INFO_DEBUG, P0);
-			queue_send(sock_mq, read_temp_data(1, SOCK_TEMP_RCV_ID), INFO_DEBUG, P0);
-			msg_log("Temp in kelvin socket request event handled", DEBUG, P0);
-		}
-		else if (socket_flag & TF)
-		{
-			/*Uncomment to test with random numbers*/
-			//queue_send(log_mq, data_send, INFO_DEBUG);
-			//queue_send(sock_mq, data_send, INFO_DEBUG);
+			//Remote hosts are waiting for this sample, it goes ahead of the periodic ones on the bus
+			i2c_bus_priority(I2C_PRIO_HIGH);
+			sensor_struct sample;
+			bool fresh = cache_get(&temp_cache, g_cache_ms, temp_sample, &sample);
+			if (fresh)
+			{
+				temp_history(&sample);
+			}
 
-			pthread_mutex_lock(&mutex_a);
-			socket_flag &= (~TF);
-			pthread_mutex_unlock(&mutex_a);
-			queue_send(log_mq, read_temp_data(2, SOCK_TEMP_RCV_ID), INFO_DEBUG, P0);
-			queue_send(sock_mq, read_temp_data(2, SOCK_TEMP_RCV_ID), INFO_DEBUG, P0);
-			msg_log("Temp in fahrenheit socket request event handled", DEBUG, P0);
+			//One raw sample answers the celsius, kelvin and fahrenheit requests, only new reads are logged
+			sample.id = SOCK_TEMP_RCV_ID;
+			sample_stamp(&sample, &temp_event, fresh);
+			bus_publish(&samples, &sample, fresh ? (BUS_TOPIC_TEMP | BUS_TOPIC_ANSWER) : BUS_TOPIC_ANSWER);
+			msg_log("Temp socket request event handled", DEBUG, P0);
 		}
 	}
 }
 
 /**
- * @brief - This thread records the lux value from the sensor at regular intervals of time and sends the 
- * 			data to the logger file using message queues.
+ * @brief - This thread records the lux value from the sensor at regular intervals of time and publishes
+ * 			the samples on the sample bus.
  * 
  * @param filename - This is the textfile name that is passed to the thread. This is obtained as a 
  * 					command line argument.
@@ -316,8 +831,10 @@ void *temp_thread(void *filename)
  */
 void *light_thread(void *filename)
 {
+	queue_register(QUEUE_ROLE_LIGHT);
+	trace_register("light");
+	rt_apply(RT_ROLE_LIGHT);
 	msg_log("Entered Light Thread.\n", DEBUG, P0);
-	timer_init(TIMER_LIGHT);
 
 	interrupt();
 
@@ -326,6 +843,7 @@ void *light_thread(void *filename)
 
 	/*Set higher light interrupts for ADC Channel 0*/
 	uint16_t ch0, ch1;
+	i2c_bus_priority(I2C_PRIO_LOW);
 	write_int_th(0x60, 1);
 	write_int_ctrl(0x00);
 	write_int_ctrl(0x11);
@@ -340,14 +858,23 @@ void *light_thread(void *filename)
 		// 	write_command(0x40);
 		// }
 
-		usleep(1);
+		//Sleeps until the timer or a socket request posts an event
+		uint32_t events = event_wait(&light_event);
+		trace_instant("wake", events);
 
-		if (light_timerflag)
+		if (events & EV_TIMER)
 		{
-			pthread_mutex_lock(&mutex_b);
-			//Insert Mutex lock here
-			light_timerflag = 0;
-			queue_send(log_mq, read_light_data(LIGHT_RCV_ID), INFO_DEBUG, P0);
+			i2c_bus_priority(I2C_PRIO_NORMAL);
+			sensor_struct sample = light_sample();
+			event_sample_done(&light_event);
+			if (g_jitter)
+			{
+				jitter_record(&light_jitter, sample.stamps.read_start);
+			}
+			cache_put(&light_cache, &sample);
+			light_history(&sample);
+			sample_stamp(&sample, &light_event, true);
+			bus_publish(&samples, &sample, BUS_TOPIC_LIGHT);
 
 			/*Uncomment to test with random values*/
 			// data_send.id = LIGHT_RCV_ID;
@@ -355,44 +882,37 @@ void *light_thread(void *filename)
 			//queue_send(log_mq, data_send, INFO_DEBUG, P0);
 
 			msg_log("Light Timer event handled.\n", DEBUG, P0);
-			//Insert mutex Unlock here
-			pthread_mutex_unlock(&mutex_b);
-			hb_send(LIGHT_HB);
+			hb_beat(LIGHT_HB);
 		}
-		if (socket_flag & L)
-		{
 
-			/*Uncomment to test with random numbers*/
-			//queue_send(log_mq, data_send, INFO_DEBUG);
-			//queue_send(sock_mq, data_send, INFO_DEBUG);
-
-			pthread_mutex_lock(&mutex_a);
-			socket_flag &= (~L);
-			pthread_mutex_unlock(&mutex_a);
-			queue_send(log_mq, read_light_data(SOCK_LIGHT_RCV_ID), INFO_DEBUG, P0);
-			queue_send(sock_mq, read_light_data(SOCK_LIGHT_RCV_ID), INFO_DEBUG, P0);
-			msg_log("Light socket request event handled", DEBUG, P0);
-		}
-		if (socket_flag & STATE)
+		if (events & LIGHT_REQ)
 		{
-
 			/*Uncomment to test with random numbers*/
 			//queue_send(log_mq, data_send, INFO_DEBUG);
 			//queue_send(sock_mq, data_send, INFO_DEBUG);
 
-			pthread_mutex_lock(&mutex_a);
-			socket_flag &= (~STATE);
-			pthread_mutex_unlock(&mutex_a);
-			queue_send(log_mq, read_light_data(SOCK_LIGHT_RCV_ID), INFO_DEBUG, P0);
-			queue_send(sock_mq, read_light_data(SOCK_LIGHT_RCV_ID), INFO_DEBUG, P0);
+			//Remote hosts are waiting for this sample, it goes ahead of the periodic ones on the bus
+			i2c_bus_priority(I2C_PRIO_HIGH);
+			sensor_struct sample;
+			bool fresh = cache_get(&light_cache, g_cache_ms, light_sample, &sample);
+			if (fresh)
+			{
+				light_history(&sample);
+			}
+
+			//One sample answers the lux and the light state requests, only new reads are logged
+			sample.id = SOCK_LIGHT_RCV_ID;
+			sample_stamp(&sample, &light_event, fresh);
+			bus_publish(&samples, &sample, fresh ? (BUS_TOPIC_LIGHT | BUS_TOPIC_ANSWER) : BUS_TOPIC_ANSWER);
 			msg_log("Light socket request event handled", DEBUG, P0);
 		}
 	}
 }
 
 /**
- * @brief - This thread receives data from all the threads using message queues and prints the data to a 
- * 			textfile.
+ * @brief - This thread receives messages from all the threads using message queues and samples from the
+ * 			sample bus, and writes them to the log sink, which keeps the textfile open and flushes it by
+ * 			size, age and fsync policy.
  * 
  * @param filename - This is the textfile name that is passed to the thread. This is obtained as a 
  * 					command line argument.
@@ -400,19 +920,56 @@ void *light_thread(void *filename)
  */
 void *logger_thread(void *filename)
 {
+	sensor_struct data_rcv;
+	struct pollfd pfd[2];
+	uint32_t timeout;
+	int state;
+
+	queue_register(QUEUE_ROLE_LOGGER);
+	trace_register("logger");
+	rt_apply(RT_ROLE_LOGGER);
 	msg_log("Entered Logger Thread.\n", DEBUG, P0);
+	pfd[0].fd = queue_fd(log_mq);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = (log_sub != NULL) ? bus_fd(log_sub) : -1;
+	pfd[1].events = POLLIN;
 	while (1)
 	{
-		usleep(1);
-		log_data(queue_receive(log_mq));
+		//Wake up at least once a second to apply the flush age, fsync and stats intervals
+		timeout = sink_timeout_ms(&logfile_sink);
+		if (timeout > 1000)
+		{
+			timeout = 1000;
+		}
+
+		//Messages arrive on the logger queue, samples on the sample bus
+		poll(pfd, (log_sub != NULL) ? 2 : 1, timeout);
 
-		hb_send(LOGGER_HB);
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+		queue_clear(log_mq);
+		trace_begin("log_messages");
+		while (queue_timedreceive(log_mq, &data_rcv, 0) == OK)
+		{
+			log_data(data_rcv);
+		}
+		trace_end("log_messages");
+		log_samples();
+		sink_poll(&logfile_sink);
+		rollup_persist(false);
+		tsdb_sync(false);
+		if (stats_due())
+		{
+			log_stats();
+		}
+		pthread_setcancelstate(state, NULL);
+
+		hb_beat(LOGGER_HB);
 	}
 }
 
 /**
- * @brief - This thread initializes the socket and waits for a connection to be established from a
- * 			remote host. On socket connection it sends the requested data to the remote host.
+ * @brief - This thread initializes the socket server and serves the requests of all connected remote
+ * 			hosts. Requests are posted to the sensor threads and answered in order as their replies arrive.
  * 
  * @param filename - This is the textfile name that is passed to the thread. This is obtained as a 
  * 					command line argument.
@@ -420,17 +977,19 @@ void *logger_thread(void *filename)
  */
 void *sock_thread(void *filename)
 {
+	queue_register(QUEUE_ROLE_SOCKET);
+	trace_register("socket");
+	rt_apply(RT_ROLE_SOCKET);
 	msg_log("Entered Socket Thread.\n", DEBUG, P0);
-	socket_init();
+	if (socket_init())
+	{
+		return NULL;
+	}
 	while (1)
 	{
-		usleep(1);
-		socket_listen();
-		handle_socket_req();
-
-		//pthread_mutex_lock(&mutex_b);
-		socket_send(queue_receive(sock_mq));
-		//pthread_mutex_unlock(&mutex_b);
+		//Sleeps in epoll_wait() until a client or a sensor thread has something for the server
+		socket_poll(SOCK_SWEEP_MS);
+		hb_beat(SOCKET_HB);
 	}
 }
 
@@ -443,6 +1002,13 @@ void *sock_thread(void *filename)
  */
 err_t create_threads(char *filename)
 {
+	//Default attributes, the threads set their scheduling and CPUs themselves with rt_apply()
+	if (pthread_attr_init(&my_attributes))
+	{
+		perror("ERROR: pthread_attr_init(); in create_threads function");
+		exit(EXIT_FAILURE);
+	}
+
 	if (pthread_create(&my_thread[0],		   // pointer to thread descriptor
 					   (void *)&my_attributes, // use default attributes
 					   temp_thread,			   // thread function entry point
@@ -451,15 +1017,10 @@ err_t create_threads(char *filename)
 
 		perror("ERROR: pthread_create(); in create_threads function, temp_thread not created");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
-		close(i2c_open);
+		i2c_close();
 		pthread_mutex_destroy(&mutex_a);
-		pthread_mutex_destroy(&mutex_b);
 		pthread_mutex_destroy(&mutex_error);
 		exit(EXIT_FAILURE);
 	}
@@ -472,15 +1033,10 @@ err_t create_threads(char *filename)
 	{
 		perror("ERROR: pthread_create(); in create_threads function, light_thread not created");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
-		close(i2c_open);
+		i2c_close();
 		pthread_mutex_destroy(&mutex_a);
-		pthread_mutex_destroy(&mutex_b);
 		pthread_mutex_destroy(&mutex_error);
 		pthread_cancel(my_thread[0]);
 		exit(EXIT_FAILURE);
@@ -494,15 +1050,10 @@ err_t create_threads(char *filename)
 	{
 		perror("ERROR: pthread_create(); in create_threads function, logger_thread not created");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
-		close(i2c_open);
+		i2c_close();
 		pthread_mutex_destroy(&mutex_a);
-		pthread_mutex_destroy(&mutex_b);
 		pthread_mutex_destroy(&mutex_error);
 		pthread_cancel(my_thread[0]);
 		pthread_cancel(my_thread[1]);
@@ -517,15 +1068,10 @@ err_t create_threads(char *filename)
 	{
 		perror("ERROR: pthread_create(); in create_threads function, logger_thread not created");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
-		close(i2c_open);
+		i2c_close();
 		pthread_mutex_destroy(&mutex_a);
-		pthread_mutex_destroy(&mutex_b);
 		pthread_mutex_destroy(&mutex_error);
 		pthread_cancel(my_thread[0]);
 		pthread_cancel(my_thread[1]);
@@ -537,22 +1083,19 @@ err_t create_threads(char *filename)
 }
 
 /**
- * @brief - This function initializes I2C.
+ * @brief - This function initializes I2C on the bus backend selected by the command line, the i2c-dev
+ * 			bus or the simulated sensors, and starts the bus manager thread that owns it.
  * 
  * @return err_t
  */
 err_t i2c_init(void)
 {
-	if ((i2c_open = open(I2C_BUS, O_RDWR)) < 0)
+	if (i2c_bus_init())
 	{
 		perror("ERROR: i2c_open(); in i2c_init() function");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
 		exit(EXIT_FAILURE);
 	}
 	return OK;
@@ -569,28 +1112,9 @@ err_t mutex_init(void)
 	{
 		perror("ERROR: pthread_mutex_init(mutex_a); mutex_a not created");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
-		close(i2c_open);
-		exit(EXIT_FAILURE);
-	}
-
-	if (pthread_mutex_init(&mutex_b, NULL))
-	{
-		perror("ERROR: pthread_mutex_init(mutex_b); mutex_b not created");
-		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
-		mq_close(log_mq);
-		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
-		close(i2c_open);
-		pthread_mutex_destroy(&mutex_a);
+		i2c_close();
 		exit(EXIT_FAILURE);
 	}
 
@@ -598,15 +1122,10 @@ err_t mutex_init(void)
 	{
 		perror("ERROR: pthread_mutex_init(mutex_error); mutex_error not created");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
-		close(i2c_open);
+		i2c_close();
 		pthread_mutex_destroy(&mutex_a);
-		pthread_mutex_destroy(&mutex_b);
 		exit(EXIT_FAILURE);
 	}
 
@@ -614,12 +1133,13 @@ err_t mutex_init(void)
 }
 
 /**
- * @brief - This function reads the error values i.e errno and stores it in a local structure.
+ * @brief - This function reads the error values i.e errno and stores it in a local structure. Used when
+ * 			the format of an error message cannot be interned.
  * 
  * @param error_str - The error string that needs to be printed in the text file.
  * @return sensor_struct 
  */
-sensor_struct read_error(char *error_str)
+sensor_struct read_error(const char *error_str)
 {
 	sensor_struct read_data;
 	read_data.id = ERROR_RCV_ID;
@@ -632,7 +1152,8 @@ sensor_struct read_error(char *error_str)
 	//Errno is thread safe , no mutex required.
 	read_data.sensor_data.error_data.error_value = errno;
 
-	strcpy(read_data.sensor_data.error_data.error_str, error_str);
+	strncpy(read_data.sensor_data.error_data.error_str, error_str, sizeof(read_data.sensor_data.error_data.error_str) - 1);
+	read_data.sensor_data.error_data.error_str[sizeof(read_data.sensor_data.error_data.error_str) - 1] = '\0';
 
 	return read_data;
 }
@@ -643,213 +1164,139 @@ sensor_struct read_error(char *error_str)
  * @param msg_str - The string that needs to be printed in the text file.
  * @return sensor_struct 
  */
-sensor_struct read_msg(char *msg_str)
+sensor_struct read_msg(const char *msg_str)
 {
 	sensor_struct read_data;
 	read_data.id = MSG_RCV_ID;
 
-	strcpy(read_data.sensor_data.msg_data.msg_str, msg_str);
+	strncpy(read_data.sensor_data.msg_data.msg_str, msg_str, sizeof(read_data.sensor_data.msg_data.msg_str) - 1);
+	read_data.sensor_data.msg_data.msg_str[sizeof(read_data.sensor_data.msg_data.msg_str) - 1] = '\0';
 
 	return read_data;
 }
 
 /**
- * @brief - This function sends the error string to be printed in the textfile to the logger thread via
- * 			message queue and prints it in the textile. 
+ * @brief - This function sends an enabled log message to the logger thread via message queue. It is
+ * 			called by the msg_log() and error_log() macros once the log level has been checked. The format
+ * 			is interned on the first call of a call site, after that only its id and the raw arguments are
+ * 			sent; the logger thread formats the message.
  * 
- * @param error_str - The error string that needs to be printed in the textfile.
+ * @param fmt_id - Interned id of the format, kept by the call site. 0 until the first call.
+ * @param fmt - The format string literal.
+ * @param error - True for error messages, which also record errno and a timestamp.
+ * @param args - The raw arguments.
+ * @param nargs - Number of arguments.
  * @param loglevel - The loglevel of the message. Loglevels : INFO, WARNING, ERROR, DEBUG, INFO_DEBUG, ERROR_DEBUG, INFO_ERROR_DEBUG
  * @param prio - Th priorty of the message. Values can be : PO,P1,P2
  */
-void error_log(char *error_str, uint8_t loglevel, uint8_t prio)
+void log_send(_Atomic uint16_t *fmt_id, const char *fmt, bool error, const log_arg *args, uint8_t nargs,
+			  uint8_t loglevel, uint8_t prio)
 {
-	queue_send(log_mq, read_error(error_str), loglevel, prio);
-}
+	sensor_struct data;
+	int error_value = errno;
+	uint16_t id = atomic_load_explicit(fmt_id, memory_order_relaxed);
 
-/**
- * @brief - This function sends the message string to be printed in the textfile to the logger thread via
- * 			message queue and prints it in the textile. 
- * 
- * @param str - The message string that needs to be printed in the textfile.
- * @param loglevel - The loglevel of the message. Loglevels : INFO, WARNING, ERROR, DEBUG, INFO_DEBUG, ERROR_DEBUG, INFO_ERROR_DEBUG
- * @param prio - Th priorty of the message . Values can be : PO,P1,P2
- */
-void msg_log(char *str, uint8_t loglevel, uint8_t prio)
-{
-	queue_send(log_mq, read_msg(str), loglevel, prio);
-}
-
-/**
- * @brief - This function sends heartbeat to the main loop.
- * 
- * @param hb_value - This value specifies the heartbeat is from which thread. 
- * The values can be : 	TEMP_HB
- * 						LIGHT_HB
- * 						LOGGER_HB
- * 						SOCKET_HB
- * 						CLEAR_HB
- */
-void hb_send(uint8_t hb_value)
-{
-	ssize_t res;
-	res = mq_send(heartbeat_mq, (char *)&hb_value, sizeof(uint8_t), 0);
-	if (res == -1)
+	if (id == 0)
 	{
-		error_log("ERROR: mq_send(); in queue_send() function", ERROR_DEBUG, P2);
+		id = logfmt_intern(fmt);
+		if (id == 0)
+		{
+			//Table full, the message is sent as text
+			errno = error_value;
+			queue_send(log_mq, error ? read_error(fmt) : read_msg(fmt), loglevel, prio);
+			return;
+		}
+		atomic_store_explicit(fmt_id, id, memory_order_relaxed);
 	}
-}
 
-/**
- * @brief - This function reads the value received from the messgae queue.
- * 
- * @return uint8_t - Returns the value signifying from which thread it has received the value.
- */
-uint8_t hb_receive(void)
-{
-	ssize_t res;
-	uint8_t hb_rcv;
-	res = mq_receive(heartbeat_mq, (char *)&hb_rcv, sizeof(sensor_struct), NULL);
-	if (res == -1)
+	data.id = LOGMSG_RCV_ID;
+	data.sensor_data.logmsg_data.fmt = id;
+	data.sensor_data.logmsg_data.error = error;
+	data.sensor_data.logmsg_data.nargs = nargs;
+	memcpy(data.sensor_data.logmsg_data.args, args, sizeof(data.sensor_data.logmsg_data.args));
+	if (error)
+	{
+		data.sensor_data.logmsg_data.error_value = error_value;
+		clock_gettime(CLOCK_REALTIME, &data.sensor_data.logmsg_data.data_time);
+	}
+	else
 	{
-		error_log("ERROR: mq_receive(); in queue_receive() function", ERROR_DEBUG, P2);
+		data.sensor_data.logmsg_data.error_value = 0;
+		data.sensor_data.logmsg_data.data_time.tv_sec = 0;
+		data.sensor_data.logmsg_data.data_time.tv_nsec = 0;
 	}
-	return hb_rcv;
+	queue_send(log_mq, data, loglevel, prio);
 }
 
 /**
- * @brief - This function handles the action after receiving the value from the hb_receive() function.
- * 
- * @param hb_rcv - This value is returned from the hb_receive() function.
+ * @brief - This function checks the heartbeats of the threads when the heartbeat timer fires and restarts
+ * 			the threads that have not beaten within their timeout. Every thread owns state no other thread
+ * 			writes, its producer ring, the log sink or its series, so the replacement is only created once
+ * 			the cancelled thread has exited. A thread that does not exit within HB_JOIN_MS is reported and
+ * 			joined again at the next check.
  */
-
-void hb_handle(uint8_t hb_rcv)
+void hb_handle(void)
 {
-	switch (hb_rcv)
-	{
-	case TEMP_HB:
-	{
-		temp_hb_value++;
-		msg_log("Temperaure Heartbeat received.\n", DEBUG, P0);
-		break;
-	}
+	static void *(*const thread_fn[HB_THREADS])(void *) = {temp_thread, light_thread, logger_thread, sock_thread};
+	struct timespec deadline;
 
-	case LIGHT_HB:
+	for (uint8_t i = 0; i < HB_THREADS; i++)
 	{
-		light_hb_value++;
-		msg_log("Light Heartbeat received.\n", DEBUG, P0);
-		break;
-	}
-
-	case LOGGER_HB:
-	{
-		logger_hb_value++;
-		//msg_log("Logger Heartbeat received.\n", DEBUG, P0);
-		break;
-	}
-
-	case CLEAR_HB:
-	{
-		if (temp_hb_value == 0)
+		if (thread_state[i] == THREAD_RUNNING)
 		{
-			if (pthread_cancel(my_thread[0]))
-			{
-				error_log("ERROR: pthread_cancel(0); in hb_handle() function", ERROR_DEBUG, P2);
-			}
-			else
+			if (!hb_missing(i))
 			{
-				msg_log("Stopping temperature thread.\n", DEBUG, P0);
+				continue;
 			}
-
-			if (pthread_create(&my_thread[0],		   // pointer to thread descriptor
-							   (void *)&my_attributes, // use default attributes
-							   temp_thread,			   // thread function entry point
-							   (void *)0))			   // parameters to pass in
-			{
-				error_log("ERROR: pthread_create(); in create_threads function, temp_thread not created", ERROR_DEBUG, P2);
-			}
-			else
+			if (pthread_cancel(my_thread[i]))
 			{
-				msg_log("Resetting temperature thread.\n", DEBUG, P0);
+				error_logf("ERROR: pthread_cancel(%u); in hb_handle() function", ERROR_DEBUG, P2, i);
+				continue;
 			}
-		}
-		else
-		{
-			temp_hb_value = 0;
+			msg_logf("Stopping thread %u.\n", DEBUG, P0, i);
+			thread_state[i] = THREAD_CANCELLED;
 		}
 
-		if (light_hb_value == 0)
+		if (thread_state[i] == THREAD_CANCELLED)
 		{
-			if (pthread_cancel(my_thread[1]))
+			//The thread may have cancellation disabled around its work, it exits at its next cancellation point
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_nsec += HB_JOIN_MS * 1000000L;
+			deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+			deadline.tv_nsec %= 1000000000L;
+			if (pthread_timedjoin_np(my_thread[i], NULL, &deadline))
 			{
-				error_log("ERROR: pthread_cancel(1); in hb_handle() function", ERROR_DEBUG, P2);
+				error_logf("ERROR: thread %u did not exit after pthread_cancel(); in hb_handle() function",
+						   ERROR_DEBUG, P2, i);
+				continue;
 			}
-			else
-			{
-				msg_log("Stopping light thread.\n", DEBUG, P0);
-			}
-
-			if (pthread_create(&my_thread[1],		   // pointer to thread descriptor
-							   (void *)&my_attributes, // use default attributes
-							   light_thread,		   // thread function entry point
-							   (void *)0))			   // parameters to pass in
-			{
-				error_log("ERROR: pthread_create(); in create_threads function, temp_thread not created", ERROR_DEBUG, P2);
-			}
-			else
-			{
-				msg_log("Resetting light thread.\n", DEBUG, P0);
-			}
-		}
-		else
-		{
-			light_hb_value = 0;
+			thread_state[i] = THREAD_EXITED;
 		}
 
-		if (logger_hb_value == 0)
+		if (pthread_create(&my_thread[i],		   // pointer to thread descriptor
+						   (void *)&my_attributes, // use default attributes
+						   thread_fn[i],		   // thread function entry point
+						   (void *)0))			   // parameters to pass in
 		{
-			if (pthread_cancel(my_thread[2]))
-			{
-				error_log("ERROR: pthread_cancel(2); in hb_handle() function", ERROR_DEBUG, P2);
-			}
-			else
-			{
-				msg_log("Stopping logger thread.\n", DEBUG, P0);
-			}
-
-			if (pthread_create(&my_thread[2],		   // pointer to thread descriptor
-							   (void *)&my_attributes, // use default attributes
-							   logger_thread,		   // thread function entry point
-							   (void *)0))			   // parameters to pass in
-			{
-				error_log("ERROR: pthread_create(); in create_threads function, temp_thread not created", ERROR_DEBUG, P2);
-			}
-			else
-			{
-				msg_log("Resetting logger thread.\n", DEBUG, P0);
-			}
+			error_logf("ERROR: pthread_create(%u); in hb_handle() function", ERROR_DEBUG, P2, i);
 		}
 		else
 		{
-			logger_hb_value = 0;
+			thread_state[i] = THREAD_RUNNING;
+			hb_restarted(i);
+			msg_logf("Resetting thread %u.\n", DEBUG, P0, i);
 		}
-
-		msg_log("Clearing all heartbeat values.\n", DEBUG, P0);
-		break;
-	}
 	}
 }
 
 /**
- * @brief - Closes the i2c file descriptor
+ * @brief - Closes the I2C bus
  * 
  * @return err_t 
  */
 err_t i2c_close(void)
 {
-	if (close(i2c_open))
-	{
-		perror("ERROR: close(); in i2c_close");
-	}
+	i2c_bus_close();
 	return OK;
 }
 
@@ -865,11 +1312,6 @@ err_t mutex_destroy(void)
 		perror("ERROR: pthread_mutex_destroy(mutex_a); cannot destroy mutex_a");
 	}
 
-	if (pthread_mutex_destroy(&mutex_b))
-	{
-		perror("ERROR: pthread_mutex_destroy(mutex_b); cannot destroy mutex_b");
-	}
-
 	if (pthread_mutex_destroy(&mutex_error))
 	{
 		perror("ERROR: pthread_mutex_destroy(mutex_error); cannot destroy mutex_error");
@@ -880,39 +1322,132 @@ err_t mutex_destroy(void)
 
 err_t thread_destroy(void)
 {
-	if (pthread_cancel(my_thread[0]))
+	for (uint8_t i = 0; i < 4; i++)
 	{
-		perror("ERROR: pthread_cancel(0); in thread_destroy() function");
+		//A thread cancelled by hb_handle() is only joined, an exited one has no thread left
+		if (thread_state[i] == THREAD_RUNNING && pthread_cancel(my_thread[i]))
+		{
+			perror("ERROR: pthread_cancel(); in thread_destroy() function");
+		}
 	}
+}
+
+err_t destroy_all(void)
+{
+	struct timespec deadline;
+
+	//Stopping the reactor first so that no timer wakes a thread being cancelled
+	timer_del();
+	thread_destroy();
 
-	if (pthread_cancel(my_thread[1]))
+	//A thread stuck outside a cancellation point must not block the shutdown, it is left behind
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += HB_JOIN_MS * 1000000L;
+	deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+	deadline.tv_nsec %= 1000000000L;
+	for (uint8_t i = 0; i < 4; i++)
 	{
-		perror("ERROR: pthread_cancel(1); in thread_destroy() function");
+		if (thread_state[i] != THREAD_EXITED && pthread_timedjoin_np(my_thread[i], NULL, &deadline))
+		{
+			error_logf("ERROR: thread %u did not exit after pthread_cancel(); in destroy_all() function",
+					   ERROR_DEBUG, P2, i);
+		}
 	}
 
-	if (pthread_cancel(my_thread[2]))
+	//Log whatever the logger thread had not dequeued yet
+	sensor_struct data_rcv;
+	while (queue_timedreceive(log_mq, &data_rcv, 0) == OK)
 	{
-		perror("ERROR: pthread_cancel(2); in thread_destroy() function");
+		log_data(data_rcv);
 	}
+	log_samples();
+	log_blocks_flush(true);
 
-	if (pthread_cancel(my_thread[3]))
+	//The threads have been joined and the queue drained, every stats source is still there to be read
+	if (g_stats_interval)
 	{
-		perror("ERROR: pthread_cancel(3); in thread_destroy() function");
+		log_stats();
 	}
-}
 
-err_t destroy_all(void)
-{
-	thread_destroy();
-	timer_del();
+	socket_close();
+	bus_destroy(&samples);
 	mutex_destroy();
+	event_destroy(&temp_event);
+	event_destroy(&light_event);
+	cache_destroy(&temp_cache);
+	cache_destroy(&light_cache);
+	tsdb_close();
+	tsdb_free(&temp_series);
+	tsdb_free(&light_series);
+
+	//The sensor threads have been joined, the open buckets are final
+	rollup_persist(true);
+	rollup_close();
 	queues_close();
 	queues_unlink();
 	i2c_close();
+	hb_close();
 
-	FILE *fptr = fopen(filename, "a");
-	fprintf(fptr, "Terminating gracefully due to signal.\n");
+	//Every thread that recorded events has exited
+	trace_close();
+	log_string("Terminating gracefully due to signal.\n");
+	sink_close(&logfile_sink);
+	archive_stop();
 	printf("\nTerminating gracefully due to signal\n");
-	fclose(fptr);
 	return OK;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief - Formats the CPU use of the process since the previous call and the CPU time consumed by each
+ * 			thread, used by the --measure mode to show how much the process costs while idle.
+ * 
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t cpu_stats(void *arg, char *buf, size_t size)
+{
+	static struct timespec last_wall, last_cpu;
+	static const char *names[4] = {"temp", "light", "logger", "socket"};
+	struct timespec wall, cpu, thread_cpu;
+	clockid_t cid;
+	double wall_s, cpu_s;
+	int len;
+	size_t total;
+
+	clock_gettime(CLOCK_MONOTONIC, &wall);
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &cpu);
+	wall_s = (wall.tv_sec - last_wall.tv_sec) + (wall.tv_nsec - last_wall.tv_nsec) / 1e9;
+	cpu_s = (cpu.tv_sec - last_cpu.tv_sec) + (cpu.tv_nsec - last_cpu.tv_nsec) / 1e9;
+
+	//The first call covers the time since the process started
+	if (last_wall.tv_sec == 0 && last_wall.tv_nsec == 0)
+	{
+		wall_s = 0;
+	}
+	last_wall = wall;
+	last_cpu = cpu;
+
+	len = snprintf(buf, size, "process_cpu=%.2f%%", wall_s > 0 ? 100.0 * cpu_s / wall_s : 0);
+	total = (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+
+	//The threads are joined before the dump at exit, their clocks are gone by then
+	for (uint8_t i = 0; i < 4 && total < size - 1 && !main_exit; i++)
+	{
+		if (thread_state[i] != THREAD_RUNNING || pthread_getcpuclockid(my_thread[i], &cid) || clock_gettime(cid, &thread_cpu))
+		{
+			continue;
+		}
+		len = snprintf(buf + total, size - total, " %s_cpu_ms=%.3f", names[i],
+					   thread_cpu.tv_sec * 1e3 + thread_cpu.tv_nsec / 1e6);
+		total += (len < 0) ? 0 : ((size_t)len >= size - total ? size - total - 1 : (size_t)len);
+	}
+
+	if (total < size - 1)
+	{
+		buf[total++] = '\n';
+		buf[total] = '\0';
+	}
+	return total;
+}
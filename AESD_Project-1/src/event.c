@@ -0,0 +1,178 @@
+/**
+ * @file event.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the wakeup primitive the sensor threads block on. Timer handlers and socket
+ * requests post event bits, the thread sleeps on a condition variable until a bit is pending. The post
+ * time is kept for the latency histograms; in measurement mode the wakeup latency and the wake-to-sample
+ * latency are also accumulated here.
+ * @version 0.1
+ * @date 2019-03-28
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+
+#include "event.h"
+
+/**
+ * @brief - Returns the time elapsed since start in nanoseconds.
+ * 
+ * @param start - Start time, CLOCK_MONOTONIC.
+ * @return uint64_t 
+ */
+static uint64_t elapsed_since(struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)(now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * @brief - Cleanup handler releasing the event mutex when a thread is cancelled in event_wait().
+ * 
+ * @param arg - The event.
+ */
+static void event_unlock(void *arg)
+{
+	pthread_mutex_unlock(&((thread_event *)arg)->lock);
+}
+
+/**
+ * @brief - This function initializes an event.
+ * 
+ * @param ev - The event.
+ * @return err_t 
+ */
+err_t event_init(thread_event *ev)
+{
+	memset(ev, 0, sizeof(thread_event));
+	if (pthread_mutex_init(&ev->lock, NULL))
+	{
+		perror("ERROR: pthread_mutex_init(); in event_init() function");
+		return FAIL;
+	}
+	if (pthread_cond_init(&ev->cond, NULL))
+	{
+		perror("ERROR: pthread_cond_init(); in event_init() function");
+		pthread_mutex_destroy(&ev->lock);
+		return FAIL;
+	}
+	return OK;
+}
+
+/**
+ * @brief - This function sets event bits and wakes up the thread waiting on the event.
+ * 
+ * @param ev - The event.
+ * @param bits - Event bits to be set.
+ */
+void event_post(thread_event *ev, uint32_t bits)
+{
+	pthread_mutex_lock(&ev->lock);
+	if (ev->pending == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &ev->posted);
+	}
+	else if (ev->pending & bits)
+	{
+		//The thread has not taken the previous post of these bits yet, they are merged
+		ev->coalesced++;
+	}
+	ev->pending |= bits;
+	pthread_cond_signal(&ev->cond);
+	pthread_mutex_unlock(&ev->lock);
+}
+
+/**
+ * @brief - This function blocks until at least one event bit is pending, then returns and clears all
+ * 			pending bits.
+ * 
+ * @param ev - The event.
+ * @return uint32_t - The event bits that were pending.
+ */
+uint32_t event_wait(thread_event *ev)
+{
+	uint32_t bits;
+
+	pthread_mutex_lock(&ev->lock);
+	pthread_cleanup_push(event_unlock, ev);
+	while (ev->pending == 0)
+	{
+		pthread_cond_wait(&ev->cond, &ev->lock);
+	}
+	bits = ev->pending;
+	ev->pending = 0;
+	ev->woken = ev->posted;
+	if (g_measure)
+	{
+		uint64_t ns = elapsed_since(&ev->posted);
+		ev->wakeups++;
+		ev->wake_ns_total += ns;
+		if (ns > ev->wake_ns_max)
+		{
+			ev->wake_ns_max = ns;
+		}
+	}
+	pthread_cleanup_pop(1);
+	return bits;
+}
+
+/**
+ * @brief - Records the latency from the event being posted to the sample being taken. Called by the
+ * 			sensor thread once its sample has been read.
+ * 
+ * @param ev - The event returned by the last event_wait().
+ */
+void event_sample_done(thread_event *ev)
+{
+	if (g_measure)
+	{
+		uint64_t ns = elapsed_since(&ev->woken);
+		ev->samples++;
+		ev->sample_ns_total += ns;
+		if (ns > ev->sample_ns_max)
+		{
+			ev->sample_ns_max = ns;
+		}
+	}
+}
+
+/**
+ * @brief - This function destroys an event.
+ * 
+ * @param ev - The event.
+ * @return err_t 
+ */
+err_t event_destroy(thread_event *ev)
+{
+	if (pthread_cond_destroy(&ev->cond))
+	{
+		perror("ERROR: pthread_cond_destroy(); in event_destroy() function");
+	}
+	if (pthread_mutex_destroy(&ev->lock))
+	{
+		perror("ERROR: pthread_mutex_destroy(); in event_destroy() function");
+	}
+	return OK;
+}
+
+/**
+ * @brief - Formats the wakeup and wake-to-sample latencies of an event.
+ * 
+ * @param arg - The event.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t event_stats(void *arg, char *buf, size_t size)
+{
+	thread_event *ev = (thread_event *)arg;
+	int len;
+
+	len = snprintf(buf, size, "wakeups=%llu coalesced=%llu wake_avg_us=%.1f wake_max_us=%.1f samples=%llu "
+							  "wake_to_sample_avg_us=%.1f wake_to_sample_max_us=%.1f\n",
+				   (unsigned long long)ev->wakeups, (unsigned long long)ev->coalesced, ev->wakeups ? (ev->wake_ns_total / ev->wakeups) / 1e3 : 0,
+				   ev->wake_ns_max / 1e3, (unsigned long long)ev->samples,
+				   ev->samples ? (ev->sample_ns_total / ev->samples) / 1e3 : 0, ev->sample_ns_max / 1e3);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
@@ -0,0 +1,386 @@
+/**
+ * @file gorilla.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the compressed encoding of a series of samples, after the Gorilla time
+ * series encoding: time stamps are stored as the change of the sampling interval and values as the
+ * difference with the previous value, so that a sensor sampled at a steady rate with a slowly changing
+ * value takes a few bits per sample. See gorilla.h for the bit layout.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "gorilla.h"
+
+#define NO_WINDOW	(0xFF)
+
+/**
+ * @brief - Writes the low nbits of a value, most significant bit first. The caller checks the room.
+ *
+ * @param enc - The encoder.
+ * @param value - Bits to write.
+ * @param nbits - Number of bits, at most 64.
+ */
+static void put(gorilla_enc *enc, uint64_t value, unsigned nbits)
+{
+	while (nbits)
+	{
+		unsigned room = 8 - (enc->bits & 7);
+		unsigned n = (nbits < room) ? nbits : room;
+		uint8_t chunk = (value >> (nbits - n)) & ((1u << n) - 1);
+
+		//Bytes are cleared as they are reached, the buffer needs no memset
+		if (room == 8)
+		{
+			enc->buf[enc->bits >> 3] = 0;
+		}
+		enc->buf[enc->bits >> 3] |= chunk << (room - n);
+		enc->bits += n;
+		nbits -= n;
+	}
+}
+
+/**
+ * @brief - Reads nbits, most significant bit first.
+ *
+ * @param dec - The decoder.
+ * @param nbits - Number of bits, at most 64.
+ * @param value - The bits read.
+ * @return bool - false if the stream ends first.
+ */
+static bool get(gorilla_dec *dec, unsigned nbits, uint64_t *value)
+{
+	uint64_t v = 0;
+
+	if (dec->pos + nbits > dec->bits)
+	{
+		return false;
+	}
+	while (nbits)
+	{
+		unsigned room = 8 - (dec->pos & 7);
+		unsigned n = (nbits < room) ? nbits : room;
+
+		v = (v << n) | ((dec->buf[dec->pos >> 3] >> (room - n)) & ((1u << n) - 1));
+		dec->pos += n;
+		nbits -= n;
+	}
+	*value = v;
+	return true;
+}
+
+/**
+ * @brief - Counts the 1 bits before the first 0 bit, up to max.
+ *
+ * @param dec - The decoder.
+ * @param max - Longest prefix.
+ * @param ones - Number of 1 bits read.
+ * @return bool - false if the stream ends first.
+ */
+static bool get_prefix(gorilla_dec *dec, unsigned max, unsigned *ones)
+{
+	uint64_t bit;
+
+	*ones = 0;
+	while (*ones < max)
+	{
+		if (!get(dec, 1, &bit))
+		{
+			return false;
+		}
+		if (bit == 0)
+		{
+			break;
+		}
+		(*ones)++;
+	}
+	return true;
+}
+
+/**
+ * @brief - Starts a series in a buffer.
+ *
+ * @param enc - The encoder.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @param mode - GORILLA_XOR or GORILLA_DELTA.
+ */
+void gorilla_enc_init(gorilla_enc *enc, uint8_t *buf, size_t size, uint8_t mode)
+{
+	enc->buf = buf;
+	enc->size = size;
+	enc->bits = 0;
+	enc->count = 0;
+	enc->mode = mode;
+	enc->prev_ns = 0;
+	enc->prev_delta = 0;
+	enc->prev_value = 0;
+	enc->leading = NO_WINDOW;
+	enc->trailing = 0;
+}
+
+/**
+ * @brief - Appends a sample to the series.
+ *
+ * @param enc - The encoder.
+ * @param time_ns - Time stamp of the sample.
+ * @param value - Bits of the float for GORILLA_XOR, the register for GORILLA_DELTA.
+ * @return bool - false if the sample does not fit in the buffer, the series is left as it was.
+ */
+bool gorilla_enc_add(gorilla_enc *enc, uint64_t time_ns, uint32_t value)
+{
+	uint64_t time_code = 0, value_code = 0;
+	unsigned time_bits, value_bits;
+	uint8_t leading = enc->leading, trailing = enc->trailing;
+
+	if (enc->count == 0)
+	{
+		if (enc->size * 8 < 64 + 32)
+		{
+			return false;
+		}
+		put(enc, time_ns, 64);
+		put(enc, value, 32);
+		enc->prev_ns = time_ns;
+		enc->prev_delta = 0;
+		enc->prev_value = value;
+		enc->count = 1;
+		return true;
+	}
+
+	//Sizing both codes first so that a sample that does not fit leaves nothing behind
+	int64_t delta = (int64_t)(time_ns - enc->prev_ns);
+	int64_t dod = delta - enc->prev_delta;
+	uint64_t z = ((uint64_t)dod << 1) ^ (uint64_t)(dod >> 63);
+
+	if (z == 0)
+	{
+		time_bits = 1;
+	}
+	else if (z < (1ULL << 12))
+	{
+		time_code = (0x2ULL << 12) | z;
+		time_bits = 2 + 12;
+	}
+	else if (z < (1ULL << 20))
+	{
+		time_code = (0x6ULL << 20) | z;
+		time_bits = 3 + 20;
+	}
+	else if (z < (1ULL << 32))
+	{
+		time_code = (0xEULL << 32) | z;
+		time_bits = 4 + 32;
+	}
+	else
+	{
+		time_bits = 4 + 64;
+	}
+
+	if (enc->mode == GORILLA_DELTA)
+	{
+		int32_t d = (int32_t)(value - enc->prev_value);
+		uint32_t zd = ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+
+		if (zd == 0)
+		{
+			value_bits = 1;
+		}
+		else if (zd < (1u << 4))
+		{
+			value_code = (0x2u << 4) | zd;
+			value_bits = 2 + 4;
+		}
+		else if (zd < (1u << 8))
+		{
+			value_code = (0x6u << 8) | zd;
+			value_bits = 3 + 8;
+		}
+		else
+		{
+			value_code = (0x7ULL << 32) | zd;
+			value_bits = 3 + 32;
+		}
+	}
+	else
+	{
+		uint32_t x = value ^ enc->prev_value;
+
+		if (x == 0)
+		{
+			value_bits = 1;
+		}
+		else
+		{
+			uint8_t lead = __builtin_clz(x);
+			uint8_t trail = __builtin_ctz(x);
+
+			if (leading != NO_WINDOW && lead >= leading && trail >= trailing)
+			{
+				value_bits = 32 - leading - trailing;
+				value_code = (0x2ULL << value_bits) | (x >> trailing);
+				value_bits += 2;
+			}
+			else
+			{
+				unsigned len = 32 - lead - trail;
+
+				value_code = (((0x3ULL << 5 | lead) << 5 | (len - 1)) << len) | (x >> trail);
+				value_bits = 2 + 5 + 5 + len;
+				leading = lead;
+				trailing = trail;
+			}
+		}
+	}
+
+	if (enc->bits + time_bits + value_bits > enc->size * 8)
+	{
+		return false;
+	}
+	if (time_bits == 4 + 64)
+	{
+		put(enc, 0xF, 4);
+		put(enc, z, 64);
+	}
+	else
+	{
+		put(enc, time_code, time_bits);
+	}
+	put(enc, value_code, value_bits);
+
+	enc->prev_ns = time_ns;
+	enc->prev_delta = delta;
+	enc->prev_value = value;
+	enc->leading = leading;
+	enc->trailing = trailing;
+	enc->count++;
+	return true;
+}
+
+/**
+ * @brief - Returns the bytes taken by the series, the last one padded with 0 bits.
+ *
+ * @param enc - The encoder.
+ * @return size_t
+ */
+size_t gorilla_enc_bytes(const gorilla_enc *enc)
+{
+	return (enc->bits + 7) / 8;
+}
+
+/**
+ * @brief - Starts reading a series.
+ *
+ * @param dec - The decoder.
+ * @param buf - The series.
+ * @param len - Bytes in buf.
+ * @param mode - Mode the series was written with.
+ * @param count - Samples in the series.
+ */
+void gorilla_dec_init(gorilla_dec *dec, const uint8_t *buf, size_t len, uint8_t mode, uint32_t count)
+{
+	dec->buf = buf;
+	dec->bits = len * 8;
+	dec->pos = 0;
+	dec->count = count;
+	dec->first = true;
+	dec->mode = mode;
+	dec->prev_ns = 0;
+	dec->prev_delta = 0;
+	dec->prev_value = 0;
+	dec->leading = NO_WINDOW;
+	dec->trailing = 0;
+}
+
+/**
+ * @brief - Reads the next sample of a series.
+ *
+ * @param dec - The decoder.
+ * @param time_ns - Time stamp of the sample.
+ * @param value - Value of the sample.
+ * @return bool - false at the end of the series, or if it is truncated or corrupt.
+ */
+bool gorilla_dec_next(gorilla_dec *dec, uint64_t *time_ns, uint32_t *value)
+{
+	static const unsigned time_widths[5] = {0, 12, 20, 32, 64};
+	uint64_t bits, z;
+	unsigned ones;
+
+	if (dec->count == 0)
+	{
+		return false;
+	}
+	if (dec->first)
+	{
+		uint64_t v;
+		if (!get(dec, 64, &dec->prev_ns) || !get(dec, 32, &v))
+		{
+			return false;
+		}
+		dec->prev_value = v;
+		dec->first = false;
+	}
+	else
+	{
+		if (!get_prefix(dec, 4, &ones))
+		{
+			return false;
+		}
+		z = 0;
+		if (ones && !get(dec, time_widths[ones], &z))
+		{
+			return false;
+		}
+		dec->prev_delta += (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+		dec->prev_ns += dec->prev_delta;
+
+		if (dec->mode == GORILLA_DELTA)
+		{
+			static const unsigned delta_widths[4] = {0, 4, 8, 32};
+			if (!get_prefix(dec, 3, &ones))
+			{
+				return false;
+			}
+			z = 0;
+			if (ones && !get(dec, delta_widths[ones], &z))
+			{
+				return false;
+			}
+			dec->prev_value += (uint32_t)(((uint32_t)z >> 1) ^ -(uint32_t)(z & 1));
+		}
+		else
+		{
+			if (!get_prefix(dec, 2, &ones))
+			{
+				return false;
+			}
+			if (ones == 1)
+			{
+				if (dec->leading == NO_WINDOW || !get(dec, 32 - dec->leading - dec->trailing, &bits))
+				{
+					return false;
+				}
+				dec->prev_value ^= (uint32_t)bits << dec->trailing;
+			}
+			else if (ones == 2)
+			{
+				uint64_t lead, len;
+				if (!get(dec, 5, &lead) || !get(dec, 5, &len) || lead + len + 1 > 32 ||
+					!get(dec, len + 1, &bits))
+				{
+					return false;
+				}
+				dec->leading = lead;
+				dec->trailing = 32 - lead - (len + 1);
+				dec->prev_value ^= (uint32_t)bits << dec->trailing;
+			}
+		}
+	}
+
+	*time_ns = dec->prev_ns;
+	*value = dec->prev_value;
+	dec->count--;
+	return true;
+}
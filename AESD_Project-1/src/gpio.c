@@ -26,6 +26,7 @@ err_t gpio_init(uint8_t pin)
     if (fptr == NULL)
     {
         error_log("ERROR: fopen(); in gpio_init() function", ERROR_DEBUG, P2);
+        return FAIL;
     }
     fseek(fptr, 0, SEEK_SET); //set cursor to 0th position
     fprintf(fptr, "%d", pin);
@@ -54,6 +55,7 @@ err_t gpio_ctrl(char *directory, char *value, uint8_t onoff)
     if (fptr == NULL)
     {
         error_log("ERROR: fopen(directory); in gpio_ctrl() function", ERROR_DEBUG, P2);
+        return FAIL;
     }
     fseek(fptr, 0, SEEK_SET);   //set cursor to 0th position
     fprintf(fptr, "%s", "out"); //set gpio pin to output
@@ -65,6 +67,7 @@ err_t gpio_ctrl(char *directory, char *value, uint8_t onoff)
     if (fptr == NULL)
     {
         error_log("ERROR: fopen(value); in gpio_ctrl() function", ERROR_DEBUG, P2);
+        return FAIL;
     }
     fseek(fptr, 0, SEEK_SET);   //set cursor to 0th position
     fprintf(fptr, "%d", onoff); //set gpio pin value to high
@@ -91,6 +94,7 @@ err_t gpio_edge(char *directory, char *level)
     if (fptr == NULL)
     {
         error_log("ERROR: fopen(directory); in gpio_ctrl() function", ERROR_DEBUG, P2);
+        return FAIL;
     }
     fseek(fptr, 0, SEEK_SET);   //set cursor to 0th position
     fprintf(fptr, "%s", level); //set gpio pin to output
@@ -115,6 +119,7 @@ err_t gpio_dir(char *directory, char *direction)
     if (fptr == NULL)
     {
         error_log("ERROR: fopen(directory); in gpio_ctrl() function", ERROR_DEBUG, P2);
+        return FAIL;
     }
     fseek(fptr, 0, SEEK_SET);   //set cursor to 0th position
     fprintf(fptr, "%s", direction); //set gpio pin to output
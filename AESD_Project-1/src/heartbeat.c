@@ -0,0 +1,193 @@
+/**
+ * @file heartbeat.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the heartbeats of the threads. A thread beats by incrementing its counter and
+ * storing the time, without a system call. The heartbeat timer wakes the main thread through an eventfd,
+ * which then checks that every supervised thread has beaten recently and restarts the missing ones.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "heartbeat.h"
+
+static hb_thread threads[HB_THREADS];
+static int tick_fd = -1;
+static atomic_ullong checks;
+
+static uint64_t hb_now(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief - This function creates the eventfd the heartbeat timer wakes the supervisor with.
+ *
+ * @return err_t
+ */
+err_t hb_init(void)
+{
+	tick_fd = eventfd(0, EFD_CLOEXEC);
+	if (tick_fd == -1)
+	{
+		perror("ERROR: eventfd(); in hb_init() function");
+		return FAIL;
+	}
+	return OK;
+}
+
+/**
+ * @brief - Supervises a thread from now on.
+ *
+ * @param id - TEMP_HB, LIGHT_HB, LOGGER_HB or SOCKET_HB.
+ * @param name - Name shown in the stats.
+ * @param timeout_ns - The thread is missing when it has not beaten for longer.
+ * @param restart - Restart the thread when it is missing.
+ */
+void hb_watch(uint8_t id, const char *name, uint64_t timeout_ns, bool restart)
+{
+	threads[id].name = name;
+	threads[id].timeout_ns = timeout_ns;
+	threads[id].restart = restart;
+	atomic_store(&threads[id].last_ns, hb_now());
+	atomic_store(&threads[id].alive, true);
+}
+
+/**
+ * @brief - Records progress of the calling thread.
+ *
+ * @param id - TEMP_HB, LIGHT_HB, LOGGER_HB or SOCKET_HB.
+ */
+void hb_beat(uint8_t id)
+{
+	atomic_fetch_add_explicit(&threads[id].beats, 1, memory_order_relaxed);
+	atomic_store_explicit(&threads[id].last_ns, hb_now(), memory_order_relaxed);
+}
+
+/**
+ * @brief - Wakes the supervisor. Called by the reactor thread when the heartbeat timer expires.
+ */
+void hb_tick(void)
+{
+	uint64_t one = 1;
+
+	if (write(tick_fd, &one, sizeof(one)) != sizeof(one))
+	{
+		error_log("ERROR: write(); in hb_tick() function", ERROR_DEBUG, P2);
+	}
+}
+
+/**
+ * @brief - Sleeps until the heartbeat timer expires or a signal arrives.
+ *
+ * @return bool - true if the threads are to be checked.
+ */
+bool hb_wait(void)
+{
+	uint64_t ticks;
+
+	//SIGINT, SIGUSR1 and SIGUSR2 interrupt the wait
+	if (read(tick_fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+	{
+		if (errno != EINTR)
+		{
+			error_log("ERROR: read(); in hb_wait() function", ERROR_DEBUG, P2);
+		}
+		return false;
+	}
+	atomic_fetch_add(&checks, 1);
+	return true;
+}
+
+/**
+ * @brief - Checks a thread and updates its liveness.
+ *
+ * @param id - TEMP_HB, LIGHT_HB, LOGGER_HB or SOCKET_HB.
+ * @return bool - true if the thread has to be restarted.
+ */
+bool hb_missing(uint8_t id)
+{
+	hb_thread *t = &threads[id];
+	uint64_t last;
+	bool alive;
+
+	if (t->timeout_ns == 0)
+	{
+		return false;
+	}
+	//Read before the clock, so that a beat racing with the check is never in the future
+	last = atomic_load(&t->last_ns);
+	alive = hb_now() - last <= t->timeout_ns;
+	atomic_store(&t->alive, alive);
+	if (alive)
+	{
+		return false;
+	}
+	atomic_fetch_add(&t->misses, 1);
+	return t->restart;
+}
+
+/**
+ * @brief - Counts a restart and gives the new thread a full timeout to beat.
+ *
+ * @param id - TEMP_HB, LIGHT_HB, LOGGER_HB or SOCKET_HB.
+ */
+void hb_restarted(uint8_t id)
+{
+	atomic_fetch_add(&threads[id].restarts, 1);
+	atomic_store(&threads[id].last_ns, hb_now());
+}
+
+/**
+ * @brief - Closes the eventfd.
+ */
+void hb_close(void)
+{
+	if (tick_fd != -1)
+	{
+		close(tick_fd);
+		tick_fd = -1;
+	}
+}
+
+/**
+ * @brief - Formats the liveness of the supervised threads.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t hb_stats(void *arg, char *buf, size_t size)
+{
+	size_t used = 0;
+	int len;
+
+	len = snprintf(buf, size, "checks=%llu", (unsigned long long)atomic_load(&checks));
+	used = (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+	for (uint8_t i = 0; i < HB_THREADS && used < size - 1; i++)
+	{
+		hb_thread *t = &threads[i];
+		uint64_t last = atomic_load(&t->last_ns);
+
+		if (t->timeout_ns == 0)
+		{
+			continue;
+		}
+		len = snprintf(buf + used, size - used, " %s[alive=%d beats=%llu age_ms=%llu misses=%u restarts=%u]", t->name,
+					   atomic_load(&t->alive) ? 1 : 0, (unsigned long long)atomic_load(&t->beats),
+					   (unsigned long long)((hb_now() - last) / 1000000), atomic_load(&t->misses),
+					   atomic_load(&t->restarts));
+		used += (len < 0) ? 0 : ((size_t)len >= size - used ? size - used - 1 : (size_t)len);
+	}
+	if (used < size - 1)
+	{
+		buf[used++] = '\n';
+		buf[used] = '\0';
+	}
+	return used;
+}
@@ -0,0 +1,435 @@
+/**
+ * @file i2c_bus.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Bus manager. A single thread owns the I2C bus and executes the requests every other thread
+ * queues for it, highest priority first and in submission order within a priority. Requests carry the
+ * slave address, the manager remembers the slave selected on the bus and only switches it when a request
+ * addresses another one.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "i2c_bus.h"
+#include "latency.h"
+#include "trace.h"
+#include "rt_sched.h"
+
+//Pending requests, one FIFO per priority
+typedef struct
+{
+    i2c_req *head;
+    i2c_req *tail;
+} req_fifo;
+
+static pthread_mutex_t bus_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t bus_cond = PTHREAD_COND_INITIALIZER;  //Signalled when a request is queued
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER; //Broadcast when a blocking request completes
+static req_fifo fifo[I2C_PRIO_LEVELS];
+static uint32_t depth;
+static bool running;
+static pthread_t bus_tid;
+static uint8_t cur_slave = I2C_NO_SLAVE;
+
+//Priority of the requests made by the blocking helpers on the calling thread
+static __thread uint8_t thread_prio = I2C_PRIO_NORMAL;
+
+//Counters, updated under bus_lock except for the slave counters owned by the manager thread
+static uint64_t requests[I2C_PRIO_LEVELS];
+static uint64_t failed;
+static uint32_t depth_max;
+static uint64_t wait_ns_total[I2C_PRIO_LEVELS];
+static uint64_t wait_ns_max[I2C_PRIO_LEVELS];
+static uint64_t slave_switches;
+static uint64_t slave_cached;
+
+/**
+ * @brief - Returns the nanoseconds elapsed since a CLOCK_MONOTONIC time.
+ *
+ * @param start - The start time.
+ * @return uint64_t
+ */
+static uint64_t elapsed_ns(const struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) * 1000000000ULL + now.tv_nsec - start->tv_nsec;
+}
+
+/**
+ * @brief - Selects the slave of a read or write request unless it is already selected.
+ *
+ * @param addr - 7 bit slave address.
+ * @return err_t
+ */
+static err_t bus_select(uint8_t addr)
+{
+    if (addr == cur_slave)
+    {
+        slave_cached++;
+        return OK;
+    }
+    if (i2c_hal_slave(addr) < 0)
+    {
+        cur_slave = I2C_NO_SLAVE;
+        return FAIL;
+    }
+    cur_slave = addr;
+    slave_switches++;
+    return OK;
+}
+
+/**
+ * @brief - Executes one request on the bus and records its result and cost.
+ *
+ * @param req - The request.
+ */
+static void bus_execute(i2c_req *req)
+{
+    i2c_cost before = i2c_thread_cost(), after;
+
+    errno = 0;
+    switch (req->op)
+    {
+    case I2C_OP_WRITE:
+        req->result = bus_select(req->addr) ? -1 : i2c_hal_write(req->buf, req->len);
+        break;
+    case I2C_OP_READ:
+        req->result = bus_select(req->addr) ? -1 : i2c_hal_read(req->buf, req->len);
+        break;
+    case I2C_OP_TRANSFER:
+        req->result = i2c_hal_transfer(req->msgs, req->count);
+        break;
+    default:
+        errno = EINVAL;
+        req->result = -1;
+        break;
+    }
+    req->err = (req->result < 0) ? errno : 0;
+
+    after = i2c_thread_cost();
+    req->cost.calls = after.calls - before.calls;
+    req->cost.transactions = after.transactions - before.transactions;
+}
+
+/**
+ * @brief - Removes the oldest request of the highest non-empty priority. Called with bus_lock held.
+ *
+ * @return i2c_req* - NULL if no request is pending.
+ */
+static i2c_req *bus_pop(void)
+{
+    for (uint8_t p = 0; p < I2C_PRIO_LEVELS; p++)
+    {
+        i2c_req *req = fifo[p].head;
+        if (req)
+        {
+            fifo[p].head = req->next;
+            if (fifo[p].head == NULL)
+            {
+                fifo[p].tail = NULL;
+            }
+            depth--;
+            return req;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief - Bus manager thread. Runs until i2c_bus_close() and drains the pending requests before it
+ * exits, so every submitted request gets its completion callback.
+ *
+ * @param arg - Unused.
+ * @return void*
+ */
+static void *bus_thread(void *arg)
+{
+    i2c_req *req;
+    uint64_t wait, start;
+    uint32_t queued;
+
+    trace_register("i2c_bus");
+    rt_apply(RT_ROLE_I2C_BUS);
+    while (1)
+    {
+        pthread_mutex_lock(&bus_lock);
+        while (depth == 0 && running)
+        {
+            pthread_cond_wait(&bus_cond, &bus_lock);
+        }
+        queued = depth;
+        req = bus_pop();
+        if (req == NULL)
+        {
+            pthread_mutex_unlock(&bus_lock);
+            break;
+        }
+        wait = elapsed_ns(&req->submitted);
+        wait_ns_total[req->prio] += wait;
+        if (wait > wait_ns_max[req->prio])
+        {
+            wait_ns_max[req->prio] = wait;
+        }
+        pthread_mutex_unlock(&bus_lock);
+        lat_record(LAT_I2C_DEPTH, queued);
+        lat_record(LAT_I2C_WAIT, wait);
+
+        start = lat_now();
+        trace_begin("i2c_transfer");
+        bus_execute(req);
+        trace_end("i2c_transfer");
+        lat_since(LAT_I2C_EXEC, start, lat_now());
+        if (req->result < 0)
+        {
+            pthread_mutex_lock(&bus_lock);
+            failed++;
+            pthread_mutex_unlock(&bus_lock);
+        }
+        req->done(req);
+    }
+    return NULL;
+}
+
+/**
+ * @brief - Opens the bus and starts the bus manager thread.
+ *
+ * @return err_t
+ */
+err_t i2c_bus_init(void)
+{
+    if (i2c_hal_open())
+    {
+        return FAIL;
+    }
+
+    cur_slave = I2C_NO_SLAVE;
+    running = true;
+    if (pthread_create(&bus_tid, NULL, bus_thread, NULL))
+    {
+        running = false;
+        i2c_hal_close();
+        return FAIL;
+    }
+    return OK;
+}
+
+/**
+ * @brief - Executes the pending requests, stops the bus manager thread and closes the bus.
+ */
+void i2c_bus_close(void)
+{
+    pthread_mutex_lock(&bus_lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&bus_lock);
+        return;
+    }
+    running = false;
+    pthread_cond_signal(&bus_cond);
+    pthread_mutex_unlock(&bus_lock);
+
+    pthread_join(bus_tid, NULL);
+    i2c_hal_close();
+}
+
+/**
+ * @brief - Queues a request for the bus manager. The request must stay valid until its completion
+ * callback has run on the bus manager thread.
+ *
+ * @param req - The request, op, prio, addr, the buffers and done must be set.
+ * @return err_t - FAIL if the bus manager is not running.
+ */
+err_t i2c_bus_submit(i2c_req *req)
+{
+    uint8_t prio = (req->prio < I2C_PRIO_LEVELS) ? req->prio : I2C_PRIO_LOW;
+
+    req->prio = prio;
+    req->next = NULL;
+    clock_gettime(CLOCK_MONOTONIC, &req->submitted);
+
+    pthread_mutex_lock(&bus_lock);
+    if (!running)
+    {
+        pthread_mutex_unlock(&bus_lock);
+        return FAIL;
+    }
+    if (fifo[prio].tail)
+    {
+        fifo[prio].tail->next = req;
+    }
+    else
+    {
+        fifo[prio].head = req;
+    }
+    fifo[prio].tail = req;
+    requests[prio]++;
+    if (++depth > depth_max)
+    {
+        depth_max = depth;
+    }
+    pthread_cond_signal(&bus_cond);
+    pthread_mutex_unlock(&bus_lock);
+    return OK;
+}
+
+/**
+ * @brief - Sets the priority of the requests the calling thread makes through the blocking helpers.
+ *
+ * @param prio - I2C_PRIO_HIGH, I2C_PRIO_NORMAL or I2C_PRIO_LOW.
+ */
+void i2c_bus_priority(uint8_t prio)
+{
+    thread_prio = prio;
+}
+
+/**
+ * @brief - Completion callback of the blocking helpers.
+ *
+ * @param req - The completed request.
+ */
+static void bus_wake(i2c_req *req)
+{
+    pthread_mutex_lock(&bus_lock);
+    req->complete = true;
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&bus_lock);
+}
+
+/**
+ * @brief - Submits a request at the priority of the calling thread and waits for its completion. The
+ * request lives on the caller's stack, so the caller cannot be cancelled until the bus manager is done
+ * with it.
+ *
+ * @param req - The request, op, addr and the buffers must be set.
+ * @return ssize_t - Result of the request, -1 with errno set on error.
+ */
+static ssize_t bus_run(i2c_req *req)
+{
+    int state;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    req->prio = thread_prio;
+    req->done = bus_wake;
+    req->complete = false;
+    if (i2c_bus_submit(req))
+    {
+        pthread_setcancelstate(state, NULL);
+        errno = ESHUTDOWN;
+        return -1;
+    }
+
+    pthread_mutex_lock(&bus_lock);
+    while (!req->complete)
+    {
+        pthread_cond_wait(&done_cond, &bus_lock);
+    }
+    pthread_mutex_unlock(&bus_lock);
+
+    i2c_thread_charge(&req->cost);
+    pthread_setcancelstate(state, NULL);
+    errno = req->err;
+    return req->result;
+}
+
+/**
+ * @brief - Writes to a slave in one transaction and waits for the result.
+ *
+ * @param addr - 7 bit slave address.
+ * @param buf - Bytes to be written.
+ * @param len - Number of bytes.
+ * @return ssize_t - Number of bytes written, -1 with errno set on error.
+ */
+ssize_t i2c_bus_write(uint8_t addr, const void *buf, size_t len)
+{
+    i2c_req req = {.op = I2C_OP_WRITE, .addr = addr, .buf = (void *)buf, .len = len};
+
+    return bus_run(&req);
+}
+
+/**
+ * @brief - Reads from a slave in one transaction and waits for the result.
+ *
+ * @param addr - 7 bit slave address.
+ * @param buf - Buffer the bytes are read to.
+ * @param len - Number of bytes.
+ * @return ssize_t - Number of bytes read, -1 with errno set on error.
+ */
+ssize_t i2c_bus_read(uint8_t addr, void *buf, size_t len)
+{
+    i2c_req req = {.op = I2C_OP_READ, .addr = addr, .buf = buf, .len = len};
+
+    return bus_run(&req);
+}
+
+/**
+ * @brief - Runs a combined transfer and waits for the result.
+ *
+ * @param msgs - Messages of the transfer, each carrying its slave address.
+ * @param count - Number of messages, at most I2C_MAX_MSGS.
+ * @return int - Number of messages transferred, -1 with errno set on error.
+ */
+int i2c_bus_transfer(struct i2c_msg *msgs, uint32_t count)
+{
+    i2c_req req = {.op = I2C_OP_TRANSFER, .msgs = msgs, .count = count};
+
+    return (int)bus_run(&req);
+}
+
+/**
+ * @brief - Writes a register address to a slave and reads the register back after a repeated START, in
+ * one transaction.
+ *
+ * @param addr - 7 bit slave address.
+ * @param wbuf - Bytes written first, usually the register address or command.
+ * @param wlen - Number of bytes to write.
+ * @param rbuf - Buffer the bytes are read to.
+ * @param rlen - Number of bytes to read.
+ * @return err_t
+ */
+err_t i2c_bus_write_read(uint8_t addr, const void *wbuf, uint16_t wlen, void *rbuf, uint16_t rlen)
+{
+    struct i2c_msg msgs[2] = {
+        {.addr = addr, .flags = 0, .len = wlen, .buf = (uint8_t *)wbuf},
+        {.addr = addr, .flags = I2C_M_RD, .len = rlen, .buf = rbuf},
+    };
+
+    return (i2c_bus_transfer(msgs, 2) == 2) ? OK : FAIL;
+}
+
+/**
+ * @brief - Formats the bus manager counters: requests and queueing delay per priority, the deepest
+ * queue seen and how often the slave address had to be switched.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t i2c_bus_stats(void *arg, char *buf, size_t size)
+{
+    static const char *names[I2C_PRIO_LEVELS] = {"high", "normal", "low"};
+    size_t total = 0;
+    int len;
+
+    pthread_mutex_lock(&bus_lock);
+    for (uint8_t p = 0; p < I2C_PRIO_LEVELS && total < size - 1; p++)
+    {
+        len = snprintf(buf + total, size - total, "%s=%llu wait_%s_avg_us=%.1f wait_%s_max_us=%.1f ", names[p],
+                       (unsigned long long)requests[p], names[p], requests[p] ? (wait_ns_total[p] / requests[p]) / 1e3 : 0,
+                       names[p], wait_ns_max[p] / 1e3);
+        total += (len < 0) ? 0 : ((size_t)len >= size - total ? size - total - 1 : (size_t)len);
+    }
+    if (total < size - 1)
+    {
+        len = snprintf(buf + total, size - total, "failed=%llu depth=%u depth_max=%u slave_switches=%llu slave_cached=%llu\n",
+                       (unsigned long long)failed, depth, depth_max, (unsigned long long)slave_switches,
+                       (unsigned long long)slave_cached);
+        total += (len < 0) ? 0 : ((size_t)len >= size - total ? size - total - 1 : (size_t)len);
+    }
+    pthread_mutex_unlock(&bus_lock);
+    return total;
+}
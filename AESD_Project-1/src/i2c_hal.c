@@ -0,0 +1,323 @@
+/**
+ * @file i2c_hal.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Bus abstraction under the temperature and light sensor drivers. The bus manager of i2c_bus.c
+ * is the only caller of these functions, so that the daemon runs either against the i2c-dev driver on
+ * the board or against the simulated sensors of i2c_sim.c on any Linux host.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "i2c_hal.h"
+#include "i2c_sim.h"
+
+/**
+ * @brief - Opens the i2c-dev bus.
+ *
+ * @return err_t
+ */
+static err_t linux_open(void)
+{
+    if ((i2c_open = open(I2C_BUS, O_RDWR)) < 0)
+    {
+        return FAIL;
+    }
+    return OK;
+}
+
+/**
+ * @brief - Closes the i2c-dev bus.
+ */
+static void linux_close(void)
+{
+    if (close(i2c_open))
+    {
+        perror("ERROR: close(); in linux_close() function");
+    }
+    i2c_open = -1;
+}
+
+/**
+ * @brief - Selects the slave addressed by the following read() and write() calls.
+ *
+ * @param addr - 7 bit slave address.
+ * @return int
+ */
+static int linux_slave(uint8_t addr)
+{
+    return ioctl(i2c_open, I2C_SLAVE, addr);
+}
+
+/**
+ * @brief - Writes to the selected slave.
+ *
+ * @param buf - Bytes to be written.
+ * @param len - Number of bytes.
+ * @return ssize_t
+ */
+static ssize_t linux_write(const void *buf, size_t len)
+{
+    return write(i2c_open, buf, len);
+}
+
+/**
+ * @brief - Reads from the selected slave.
+ *
+ * @param buf - Buffer the bytes are read to.
+ * @param len - Number of bytes.
+ * @return ssize_t
+ */
+static ssize_t linux_read(void *buf, size_t len)
+{
+    return read(i2c_open, buf, len);
+}
+
+/**
+ * @brief - Runs a combined transfer with one I2C_RDWR ioctl.
+ *
+ * @param msgs - Messages of the transfer.
+ * @param count - Number of messages.
+ * @return int - Number of messages transferred, -1 with errno set on error.
+ */
+static int linux_transfer(struct i2c_msg *msgs, uint32_t count)
+{
+    struct i2c_rdwr_ioctl_data data = {.msgs = msgs, .nmsgs = count};
+
+    return ioctl(i2c_open, I2C_RDWR, &data);
+}
+
+static const i2c_backend linux_backend = {
+    .name = "linux",
+    .open = linux_open,
+    .close = linux_close,
+    .slave = linux_slave,
+    .write = linux_write,
+    .read = linux_read,
+    .transfer = linux_transfer,
+};
+
+static const i2c_backend *bus = &linux_backend;
+static i2c_counters counters;
+
+//Calls and transactions of the calling thread, sampled by i2c_sample_begin() and i2c_sample_end()
+static __thread i2c_cost thread_cost;
+
+/**
+ * @brief - Accounts for one backend call.
+ *
+ * @param transactions - Bus transactions run by the call.
+ * @param messages - Messages of those transactions.
+ * @param bytes - Data bytes transferred.
+ * @param ok - false if the call failed.
+ */
+static void i2c_account(uint32_t transactions, uint32_t messages, size_t bytes, bool ok)
+{
+    thread_cost.calls++;
+    thread_cost.transactions += transactions;
+    atomic_fetch_add_explicit(&counters.calls, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters.transactions, transactions, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters.messages, messages, memory_order_relaxed);
+    atomic_fetch_add_explicit(&counters.bytes, bytes, memory_order_relaxed);
+    if (!ok)
+    {
+        atomic_fetch_add_explicit(&counters.errors, 1, memory_order_relaxed);
+    }
+}
+
+/**
+ * @brief - Selects the backend given by g_i2c_backend and opens the bus.
+ *
+ * @return err_t
+ */
+err_t i2c_hal_open(void)
+{
+    bus = (g_i2c_backend == I2C_BACKEND_SIM) ? &sim_backend : &linux_backend;
+    i2c_open = -1;
+    return bus->open();
+}
+
+/**
+ * @brief - Closes the bus.
+ */
+void i2c_hal_close(void)
+{
+    bus->close();
+}
+
+/**
+ * @brief - Returns the name of the selected backend.
+ *
+ * @return const char*
+ */
+const char *i2c_hal_name(void)
+{
+    return bus->name;
+}
+
+/**
+ * @brief - Selects the slave addressed by the following transfers.
+ *
+ * @param addr - 7 bit slave address.
+ * @return int - -1 with errno set on error.
+ */
+int i2c_hal_slave(uint8_t addr)
+{
+    int res = bus->slave(addr);
+
+    i2c_account(0, 0, 0, res >= 0);
+    return res;
+}
+
+/**
+ * @brief - Writes len bytes to the selected slave in one transaction.
+ *
+ * @param buf - Bytes to be written.
+ * @param len - Number of bytes.
+ * @return ssize_t - Number of bytes written, -1 with errno set on error.
+ */
+ssize_t i2c_hal_write(const void *buf, size_t len)
+{
+    ssize_t res = bus->write(buf, len);
+
+    i2c_account(1, 1, (res > 0) ? res : 0, res >= 0);
+    return res;
+}
+
+/**
+ * @brief - Reads len bytes from the selected slave in one transaction.
+ *
+ * @param buf - Buffer the bytes are read to.
+ * @param len - Number of bytes.
+ * @return ssize_t - Number of bytes read, -1 with errno set on error.
+ */
+ssize_t i2c_hal_read(void *buf, size_t len)
+{
+    ssize_t res = bus->read(buf, len);
+
+    i2c_account(1, 1, (res > 0) ? res : 0, res >= 0);
+    return res;
+}
+
+/**
+ * @brief - Runs the messages as one combined transaction, the slave selected by i2c_hal_slave() is left
+ * untouched.
+ *
+ * @param msgs - Messages of the transfer, each carrying its slave address.
+ * @param count - Number of messages, at most I2C_MAX_MSGS.
+ * @return int - Number of messages transferred, -1 with errno set on error.
+ */
+int i2c_hal_transfer(struct i2c_msg *msgs, uint32_t count)
+{
+    size_t bytes = 0;
+    int res = bus->transfer(msgs, count);
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bytes += msgs[i].len;
+    }
+    i2c_account(1, count, (res == (int)count) ? bytes : 0, res == (int)count);
+    return res;
+}
+
+/**
+ * @brief - Returns the backend calls and bus transactions made by the calling thread so far.
+ *
+ * @return i2c_cost
+ */
+i2c_cost i2c_thread_cost(void)
+{
+    return thread_cost;
+}
+
+/**
+ * @brief - Charges bus work done on behalf of the calling thread by another thread, i.e. the bus
+ * manager, to the calling thread.
+ *
+ * @param cost - Calls and transactions to be charged.
+ */
+void i2c_thread_charge(const i2c_cost *cost)
+{
+    thread_cost.calls += cost->calls;
+    thread_cost.transactions += cost->transactions;
+}
+
+/**
+ * @brief - Marks the start of a sample read by the calling thread.
+ *
+ * @param mark - Filled with the bus counters of the thread and the current time.
+ */
+void i2c_sample_begin(i2c_sample_mark *mark)
+{
+    mark->cost = thread_cost;
+    clock_gettime(CLOCK_MONOTONIC, &mark->start);
+}
+
+/**
+ * @brief - Accounts the calls, transactions and time the calling thread spent on the bus since
+ * i2c_sample_begin(), including the work the bus manager did for it.
+ *
+ * @param stats - Sample statistics of the sensor.
+ * @param mark - Mark filled by i2c_sample_begin().
+ */
+void i2c_sample_end(i2c_sample_stats *stats, const i2c_sample_mark *mark)
+{
+    struct timespec now;
+    uint64_t ns;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - mark->start.tv_sec) * 1000000000ULL + now.tv_nsec - mark->start.tv_nsec;
+    stats->samples++;
+    stats->calls += thread_cost.calls - mark->cost.calls;
+    stats->transactions += thread_cost.transactions - mark->cost.transactions;
+    stats->ns_total += ns;
+    if (ns > stats->ns_max)
+    {
+        stats->ns_max = ns;
+    }
+}
+
+/**
+ * @brief - Formats the bus counters.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t i2c_stats(void *arg, char *buf, size_t size)
+{
+    int len;
+
+    len = snprintf(buf, size, "backend=%s mode=%s calls=%llu transactions=%llu messages=%llu bytes=%llu errors=%llu\n",
+                   bus->name, g_i2c_split ? "split" : "combined",
+                   (unsigned long long)atomic_load_explicit(&counters.calls, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&counters.transactions, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&counters.messages, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&counters.bytes, memory_order_relaxed),
+                   (unsigned long long)atomic_load_explicit(&counters.errors, memory_order_relaxed));
+    return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
+
+/**
+ * @brief - Formats the average bus cost of one sample of a sensor.
+ *
+ * @param arg - Sample statistics of the sensor.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t i2c_sample_report(void *arg, char *buf, size_t size)
+{
+    i2c_sample_stats *stats = (i2c_sample_stats *)arg;
+    uint64_t n = stats->samples;
+    int len;
+
+    len = snprintf(buf, size, "samples=%llu calls_per_sample=%.2f transactions_per_sample=%.2f us_per_sample=%.1f "
+                              "us_per_sample_max=%.1f\n",
+                   (unsigned long long)n, n ? (double)stats->calls / n : 0, n ? (double)stats->transactions / n : 0,
+                   n ? (stats->ns_total / n) / 1e3 : 0, stats->ns_max / 1e3);
+    return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
@@ -0,0 +1,593 @@
+/**
+ * @file i2c_sim.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief Simulated I2C bus carrying models of the TMP102 temperature sensor and the APDS-9301 light
+ * sensor. The models implement the register maps and the pointer/command protocols the drivers use, read
+ * their physical inputs from configurable signal generators and can delay every transaction to mimic the
+ * bus. Selected with --sim so that the daemon can be run, profiled and benchmarked on any Linux host.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "i2c_sim.h"
+#include "temp.h"
+#include "light.h"
+
+#define SIM_NO_SLAVE        (0xFF)
+#define SIM_SELECTED        (0xFFFF) //Message address standing for the slave selected by sim_slave_select()
+
+//TMP102 configuration register bits modelled by the simulation
+#define TMP102_CFG_EM       (0x0010) //Extended 13 bit mode
+#define TMP102_CFG_SD       (0x0100) //Shutdown, conversions stop
+#define TMP102_CFG_RO       (0x6020) //Resolution and alert bits are read only
+#define TMP102_TLOW_DEFAULT (0x4B00) //75 degree celsius
+#define TMP102_THIGH_DEFAULT (0x5000) //80 degree celsius
+
+//APDS-9301 register defaults and limits
+#define APDS_ID             (0x50)
+#define APDS_TIMING_DEFAULT (0x02) //Low gain, 402 ms integration
+#define APDS_POWER_ON       (0x03)
+
+//TMP102 model
+typedef struct
+{
+    uint8_t ptr;        //Pointer register
+    uint16_t reg[4];    //Temperature, configuration, TLOW and THIGH
+} sim_tmp102;
+
+//APDS-9301 model
+typedef struct
+{
+    uint8_t cmd;        //Last command byte, holds the register address and the WORD bit
+    uint8_t reg[16];
+    uint16_t adc[2];    //Last conversion of channel 0 and channel 1
+} sim_apds9301;
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec sim_start;
+static uint32_t sim_seed;
+static uint8_t sim_slave = SIM_NO_SLAVE;
+static sim_tmp102 tmp102;
+static sim_apds9301 apds;
+
+/**
+ * @brief - Fills a configuration with the default simulation: a slowly changing room temperature and
+ * indoor light level and no bus latency.
+ *
+ * @param cfg - The configuration to be filled.
+ */
+void sim_default_cfg(sim_cfg *cfg)
+{
+    cfg->temp = (sim_signal){SIM_SIG_SINE, 24.0, 2.0, 60.0};
+    cfg->light = (sim_signal){SIM_SIG_SINE, 300.0, 250.0, 120.0};
+    cfg->latency_us = 0;
+    cfg->jitter_us = 0;
+    cfg->bus_khz = 0;
+}
+
+/**
+ * @brief - Parses a signal generator given as shape[:base[:amplitude[:period]]], e.g. sine:25:5:60.
+ * Fields that are left out keep their previous value.
+ *
+ * @param spec - The specification, shape is one of const, sine, ramp, square or noise.
+ * @param sig - The signal generator to be configured.
+ * @return err_t
+ */
+err_t sim_parse_signal(const char *spec, sim_signal *sig)
+{
+    static const char *shapes[] = {"const", "sine", "ramp", "square", "noise"};
+    double *fields[3] = {&sig->base, &sig->amp, &sig->period_s};
+    size_t len = strcspn(spec, ":");
+    const char *p = spec + len;
+    char *end;
+    uint8_t i;
+
+    for (i = 0; i < sizeof(shapes) / sizeof(shapes[0]); i++)
+    {
+        if (strlen(shapes[i]) == len && !strncmp(spec, shapes[i], len))
+        {
+            break;
+        }
+    }
+    if (i == sizeof(shapes) / sizeof(shapes[0]))
+    {
+        return FAIL;
+    }
+    sig->shape = i;
+
+    for (i = 0; i < 3 && *p == ':'; i++)
+    {
+        *fields[i] = strtod(p + 1, &end);
+        if (end == p + 1)
+        {
+            return FAIL;
+        }
+        p = end;
+    }
+    if (*p != '\0')
+    {
+        return FAIL;
+    }
+
+    //Periodic shapes need a period
+    if (sig->shape != SIM_SIG_CONST && sig->shape != SIM_SIG_NOISE && sig->period_s <= 0)
+    {
+        return FAIL;
+    }
+    return OK;
+}
+
+/**
+ * @brief - Parses the bus latency given as latency_us[:jitter_us].
+ *
+ * @param spec - The specification.
+ * @param cfg - The configuration to be updated.
+ * @return err_t
+ */
+err_t sim_parse_latency(const char *spec, sim_cfg *cfg)
+{
+    char *end;
+
+    cfg->latency_us = strtoul(spec, &end, 0);
+    if (end == spec)
+    {
+        return FAIL;
+    }
+    cfg->jitter_us = 0;
+    if (*end == ':')
+    {
+        spec = end + 1;
+        cfg->jitter_us = strtoul(spec, &end, 0);
+        if (end == spec)
+        {
+            return FAIL;
+        }
+    }
+    return (*end == '\0') ? OK : FAIL;
+}
+
+/**
+ * @brief - Evaluates a signal generator.
+ *
+ * @param sig - The signal generator.
+ * @param t - Seconds since the bus was opened.
+ * @param seed - State of the random numbers used by SIM_SIG_NOISE.
+ * @return double
+ */
+double sim_signal_value(const sim_signal *sig, double t, uint32_t *seed)
+{
+    double phase = (sig->period_s > 0) ? fmod(t, sig->period_s) / sig->period_s : 0;
+
+    switch (sig->shape)
+    {
+    case SIM_SIG_SINE:
+        return sig->base + sig->amp * sin(2 * M_PI * phase);
+    case SIM_SIG_RAMP:
+        return sig->base + sig->amp * (2 * phase - 1);
+    case SIM_SIG_SQUARE:
+        return (phase < 0.5) ? sig->base + sig->amp : sig->base - sig->amp;
+    case SIM_SIG_NOISE:
+        return sig->base + sig->amp * (2.0 * rand_r(seed) / RAND_MAX - 1);
+    default:
+        return sig->base;
+    }
+}
+
+/**
+ * @brief - Returns the seconds since the bus was opened.
+ *
+ * @return double
+ */
+static double sim_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - sim_start.tv_sec) + (now.tv_nsec - sim_start.tv_nsec) / 1e9;
+}
+
+/**
+ * @brief - Holds the bus for the configured transaction time plus the time the bytes take at the
+ * configured bus clock.
+ *
+ * @param bytes - Bytes on the bus, address bytes included.
+ */
+static void sim_delay(size_t bytes)
+{
+    struct timespec ts;
+    uint64_t ns = (uint64_t)g_sim_cfg.latency_us * 1000;
+
+    //A byte takes 9 clock cycles with its ACK
+    if (g_sim_cfg.bus_khz)
+    {
+        ns += (uint64_t)bytes * 9 * 1000000 / g_sim_cfg.bus_khz;
+    }
+    if (g_sim_cfg.jitter_us)
+    {
+        ns += (uint64_t)(rand_r(&sim_seed) % (g_sim_cfg.jitter_us + 1)) * 1000;
+    }
+    if (ns == 0)
+    {
+        return;
+    }
+    ts.tv_sec = ns / 1000000000ULL;
+    ts.tv_nsec = ns % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, 0, &ts, &ts) == EINTR)
+    {
+    }
+}
+
+/**
+ * @brief - Runs a temperature conversion unless the TMP102 is shut down. The result is left aligned in
+ * the temperature register as 12 bit, or 13 bit in extended mode, two's complement.
+ *
+ * @param t - Seconds since the bus was opened.
+ */
+static void tmp102_convert(double t)
+{
+    double temp_c;
+    long counts;
+
+    if (tmp102.reg[CONFIG_REG] & TMP102_CFG_SD)
+    {
+        return;
+    }
+
+    temp_c = sim_signal_value(&g_sim_cfg.temp, t, &sim_seed);
+    if (temp_c < -55)
+    {
+        temp_c = -55;
+    }
+    if (temp_c > 150)
+    {
+        temp_c = 150;
+    }
+    counts = lround(temp_c / TEMP_LSB_C);
+
+    if (tmp102.reg[CONFIG_REG] & TMP102_CFG_EM)
+    {
+        tmp102.reg[TEMP_REG] = (uint16_t)((counts & 0x1FFF) << 3) | 0x0001;
+    }
+    else
+    {
+        if (counts > 2047)
+        {
+            counts = 2047;
+        }
+        tmp102.reg[TEMP_REG] = (uint16_t)((counts & 0x0FFF) << 4);
+    }
+}
+
+/**
+ * @brief - Write transaction to the TMP102: the first byte sets the pointer register, the following two
+ * bytes are written MSB first to the register it points to.
+ *
+ * @param buf - Bytes on the bus.
+ * @param len - Number of bytes.
+ */
+static void tmp102_write(const uint8_t *buf, size_t len)
+{
+    uint16_t data;
+
+    if (len == 0)
+    {
+        return;
+    }
+    tmp102.ptr = buf[0] & 0x03;
+    if (len < 3 || tmp102.ptr == TEMP_REG)
+    {
+        return;
+    }
+
+    data = ((uint16_t)buf[1] << 8) | buf[2];
+    if (tmp102.ptr == CONFIG_REG)
+    {
+        tmp102.reg[CONFIG_REG] = (data & ~TMP102_CFG_RO) | (tmp102.reg[CONFIG_REG] & TMP102_CFG_RO);
+    }
+    else
+    {
+        tmp102.reg[tmp102.ptr] = data & 0xFFF0;
+    }
+}
+
+/**
+ * @brief - Read transaction from the TMP102: the register selected by the pointer is returned MSB first,
+ * repeatedly for longer reads.
+ *
+ * @param buf - Buffer the bytes are read to.
+ * @param len - Number of bytes.
+ * @param t - Seconds since the bus was opened.
+ */
+static void tmp102_read(uint8_t *buf, size_t len, double t)
+{
+    uint16_t data;
+
+    if (tmp102.ptr == TEMP_REG)
+    {
+        tmp102_convert(t);
+    }
+    data = tmp102.reg[tmp102.ptr];
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[i] = (i % 2) ? (uint8_t)data : (uint8_t)(data >> 8);
+    }
+}
+
+/**
+ * @brief - Runs a conversion of both APDS-9301 channels. The counts are derived from the lux signal at a
+ * fixed channel ratio and scale with the gain and the integration time like the real device.
+ *
+ * @param t - Seconds since the bus was opened.
+ */
+static void apds_convert(double t)
+{
+    static const double tint_scale[4] = {13.7 / 402, 101.0 / 402, 1, 1};
+    static const double full_scale[4] = {5047, 37177, 65535, 65535};
+    uint8_t timing = apds.reg[TIMING_REG];
+    double lux, counts[2];
+
+    if ((apds.reg[CNTRL_REG] & APDS_POWER_ON) != APDS_POWER_ON)
+    {
+        apds.adc[0] = apds.adc[1] = 0;
+        return;
+    }
+
+    lux = sim_signal_value(&g_sim_cfg.light, t, &sim_seed);
+    if (lux < 0)
+    {
+        lux = 0;
+    }
+
+    //Inverse of the first lux equation, valid for ratios up to 0.50
+    counts[0] = lux / (0.0304 - 0.062 * pow(SIM_LUX_RATIO, 1.4));
+    counts[1] = counts[0] * SIM_LUX_RATIO;
+
+    for (uint8_t ch = 0; ch < 2; ch++)
+    {
+        counts[ch] *= tint_scale[timing & 0x03] * ((timing & HIGH_GAIN_MASK) ? 16 : 1);
+        if (counts[ch] > full_scale[timing & 0x03])
+        {
+            counts[ch] = full_scale[timing & 0x03];
+        }
+        apds.adc[ch] = (uint16_t)lround(counts[ch]);
+    }
+}
+
+/**
+ * @brief - Returns the value of an APDS-9301 register. Reading ADC0_L starts a new conversion so that
+ * the four ADC bytes read after it belong to the same sample.
+ *
+ * @param addr - Register address.
+ * @param t - Seconds since the bus was opened.
+ * @return uint8_t
+ */
+static uint8_t apds_reg(uint8_t addr, double t)
+{
+    switch (addr)
+    {
+    case CNTRL_REG:
+        return apds.reg[CNTRL_REG] & APDS_POWER_ON;
+    case ID_REG:
+        return APDS_ID;
+    case ADC0_L:
+        apds_convert(t);
+        return (uint8_t)apds.adc[0];
+    case ADC0_H:
+        return (uint8_t)(apds.adc[0] >> 8);
+    case ADC1_L:
+        return (uint8_t)apds.adc[1];
+    case ADC1_H:
+        return (uint8_t)(apds.adc[1] >> 8);
+    default:
+        return apds.reg[addr];
+    }
+}
+
+/**
+ * @brief - Write transaction to the APDS-9301: a byte with the CMD bit set loads the command register,
+ * the other bytes are written to the addressed register. With the WORD bit set the address
+ * advances after every byte.
+ *
+ * @param buf - Bytes on the bus.
+ * @param len - Number of bytes.
+ */
+static void apds_write(const uint8_t *buf, size_t len)
+{
+    size_t i = 0;
+    uint8_t addr;
+
+    if (len && (buf[0] & COMMAND_MASK))
+    {
+        apds.cmd = buf[0];
+        i = 1;
+    }
+
+    addr = apds.cmd & 0x0F;
+    for (; i < len; i++)
+    {
+        switch (addr)
+        {
+        case CNTRL_REG:
+            apds.reg[addr] = buf[i] & APDS_POWER_ON;
+            break;
+        case TIMING_REG:
+            apds.reg[addr] = buf[i] & 0x1B;
+            break;
+        case INT_L_L:
+        case INT_L_H:
+        case INT_H_L:
+        case INT_H_H:
+            apds.reg[addr] = buf[i];
+            break;
+        case INT_CTRL:
+            apds.reg[addr] = buf[i] & 0x3F;
+            break;
+        default:
+            break; //ID and ADC registers are read only
+        }
+        if (apds.cmd & WORD_MASK)
+        {
+            addr = (addr + 1) & 0x0F;
+        }
+    }
+}
+
+/**
+ * @brief - Read transaction from the APDS-9301, starting at the register of the last command.
+ *
+ * @param buf - Buffer the bytes are read to.
+ * @param len - Number of bytes.
+ * @param t - Seconds since the bus was opened.
+ */
+static void apds_read(uint8_t *buf, size_t len, double t)
+{
+    uint8_t addr = apds.cmd & 0x0F;
+
+    for (size_t i = 0; i < len; i++)
+    {
+        buf[i] = apds_reg(addr, t);
+        if (apds.cmd & WORD_MASK)
+        {
+            addr = (addr + 1) & 0x0F;
+        }
+    }
+}
+
+/**
+ * @brief - Powers on the simulated sensors with their reset register values.
+ *
+ * @return err_t
+ */
+static err_t sim_open(void)
+{
+    pthread_mutex_lock(&sim_lock);
+    clock_gettime(CLOCK_MONOTONIC, &sim_start);
+    sim_seed = 1;
+    sim_slave = SIM_NO_SLAVE;
+
+    memset(&tmp102, 0, sizeof(tmp102));
+    tmp102.reg[CONFIG_REG] = CONFIG_DEFAULT;
+    tmp102.reg[TLOW_REG] = TMP102_TLOW_DEFAULT;
+    tmp102.reg[THIGH_REG] = TMP102_THIGH_DEFAULT;
+    tmp102_convert(0);
+
+    memset(&apds, 0, sizeof(apds));
+    apds.reg[TIMING_REG] = APDS_TIMING_DEFAULT;
+    pthread_mutex_unlock(&sim_lock);
+    return OK;
+}
+
+/**
+ * @brief - Nothing to release, the models keep their state until the next sim_open().
+ */
+static void sim_close(void)
+{
+}
+
+/**
+ * @brief - Selects the slave. Like I2C_SLAVE on i2c-dev this always succeeds, transfers to an address
+ * without a device fail with ENXIO.
+ *
+ * @param addr - 7 bit slave address.
+ * @return int
+ */
+static int sim_slave_select(uint8_t addr)
+{
+    pthread_mutex_lock(&sim_lock);
+    sim_slave = addr;
+    pthread_mutex_unlock(&sim_lock);
+    return 0;
+}
+
+/**
+ * @brief - Runs one transaction on the simulated bus. The bus is held for the configured latency and
+ * the calling thread cannot be cancelled while it holds it.
+ *
+ * @param msgs - Messages of the transaction, joined by repeated STARTs.
+ * @param count - Number of messages.
+ * @return int - Number of messages transferred, -1 with errno set to ENXIO if a message is addressed
+ * to a slave that is not on the bus.
+ */
+static int sim_transfer(struct i2c_msg *msgs, uint32_t count)
+{
+    int res = count;
+    int state;
+    size_t bytes = 0;
+    uint16_t addr;
+    double t;
+
+    pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+    pthread_mutex_lock(&sim_lock);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bytes += 1 + msgs[i].len;
+    }
+    sim_delay(bytes);
+    t = sim_time();
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        bool rd = msgs[i].flags & I2C_M_RD;
+
+        addr = (msgs[i].addr == SIM_SELECTED) ? sim_slave : msgs[i].addr;
+        if (addr == TEMP_ADDR)
+        {
+            rd ? tmp102_read(msgs[i].buf, msgs[i].len, t) : tmp102_write(msgs[i].buf, msgs[i].len);
+        }
+        else if (addr == LIGHT_ADDR)
+        {
+            rd ? apds_read(msgs[i].buf, msgs[i].len, t) : apds_write(msgs[i].buf, msgs[i].len);
+        }
+        else
+        {
+            errno = ENXIO;
+            res = -1;
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&sim_lock);
+    pthread_setcancelstate(state, NULL);
+    return res;
+}
+
+/**
+ * @brief - Write transaction to the selected slave on the simulated bus.
+ *
+ * @param buf - Bytes to be written.
+ * @param len - Number of bytes.
+ * @return ssize_t
+ */
+static ssize_t sim_write(const void *buf, size_t len)
+{
+    struct i2c_msg msg = {.addr = SIM_SELECTED, .flags = 0, .len = len, .buf = (uint8_t *)buf};
+
+    return (sim_transfer(&msg, 1) == 1) ? (ssize_t)len : -1;
+}
+
+/**
+ * @brief - Read transaction from the selected slave on the simulated bus.
+ *
+ * @param buf - Buffer the bytes are read to.
+ * @param len - Number of bytes.
+ * @return ssize_t
+ */
+static ssize_t sim_read(void *buf, size_t len)
+{
+    struct i2c_msg msg = {.addr = SIM_SELECTED, .flags = I2C_M_RD, .len = len, .buf = buf};
+
+    return (sim_transfer(&msg, 1) == 1) ? (ssize_t)len : -1;
+}
+
+const i2c_backend sim_backend = {
+    .name = "sim",
+    .open = sim_open,
+    .close = sim_close,
+    .slave = sim_slave_select,
+    .write = sim_write,
+    .read = sim_read,
+    .transfer = sim_transfer,
+};
@@ -0,0 +1,87 @@
+/**
+ * @file jitter.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the sampling jitter measurement, enabled with --jitter. The ideal schedule of
+ * a sensor is the first deadline of its timer plus whole periods. Every timer sample is placed in the period
+ * its read started in, its distance from the start of that period is recorded in a latency histogram,
+ * and periods left without a sample are counted as missed. A sample late by more than a period therefore
+ * shows up as a missed period followed by a small deviation. The deadlines and the read stamps are both on
+ * CLOCK_MONOTONIC, so a step of the wall clock does not move a sample to another period.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "jitter.h"
+#include "latency.h"
+
+/**
+ * @brief - Starts the measurement of a sensor. Called by timer_init() when its timer is armed.
+ *
+ * @param j - The measurement.
+ * @param name - Name of the sensor in the stats.
+ * @param hist - LAT_TEMP_JITTER or LAT_LIGHT_JITTER.
+ * @param first - First deadline of the timer on CLOCK_MONOTONIC.
+ * @param period_ns - Period of the timer.
+ */
+void jitter_start(sample_jitter *j, const char *name, uint8_t hist, const struct timespec *first, uint64_t period_ns)
+{
+	memset(j, 0, sizeof(sample_jitter));
+	j->name = name;
+	j->hist = hist;
+	j->first_ns = lat_ns(first);
+	j->period_ns = period_ns;
+}
+
+/**
+ * @brief - Records the deviation of a timer sample. Called by the sensor thread that owns the measurement.
+ *
+ * @param j - The measurement.
+ * @param read_ns - CLOCK_MONOTONIC time the read of the sample started, stamps.read_start.
+ */
+void jitter_record(sample_jitter *j, uint64_t read_ns)
+{
+	uint64_t offset, slot;
+
+	//The timer never fires before its first deadline
+	if (j->period_ns == 0 || read_ns < j->first_ns)
+	{
+		return;
+	}
+	offset = read_ns - j->first_ns;
+	slot = offset / j->period_ns;
+	if (j->samples && slot > j->last_slot + 1)
+	{
+		j->missed += slot - j->last_slot - 1;
+	}
+	else if (j->samples == 0 && slot > 0)
+	{
+		j->missed += slot;
+	}
+	j->last_slot = slot;
+	j->samples++;
+	lat_record(j->hist, offset - slot * j->period_ns);
+}
+
+/**
+ * @brief - Formats the sample and missed period counts of a sensor and the percentiles of its deviation in
+ * 			microseconds.
+ *
+ * @param arg - The measurement.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t jitter_stats(void *arg, char *buf, size_t size)
+{
+	sample_jitter *j = (sample_jitter *)arg;
+	int len;
+
+	len = snprintf(buf, size, "period_us=%.1f samples=%llu missed=%llu dev_us[p50=%.1f p90=%.1f p99=%.1f p999=%.1f]\n",
+				   j->period_ns / 1e3, (unsigned long long)j->samples, (unsigned long long)j->missed,
+				   lat_percentile(j->hist, 50) / 1e3, lat_percentile(j->hist, 90) / 1e3,
+				   lat_percentile(j->hist, 99) / 1e3, lat_percentile(j->hist, 99.9) / 1e3);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
@@ -0,0 +1,254 @@
+/**
+ * @file latency.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the latency histograms of the sample pipeline, from the timer expiry to the
+ * sample being written to the log or sent to remote hosts, and of the queue depths met on the way. Any
+ * thread records into them with a few relaxed atomic additions; the percentiles are computed when the
+ * stats are dumped or a remote host asks for them.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "latency.h"
+
+static lat_hist hists[LAT_HISTS] = {
+	[LAT_TIMER] = {.name = "timer", .ns = true},
+	[LAT_WAKE] = {.name = "wake", .ns = true},
+	[LAT_READ] = {.name = "read", .ns = true},
+	[LAT_PUBLISH] = {.name = "publish", .ns = true},
+	[LAT_LOG_QUEUE] = {.name = "log_queue", .ns = true},
+	[LAT_LOG_WRITE] = {.name = "log_write", .ns = true},
+	[LAT_LOG_E2E] = {.name = "log_e2e", .ns = true},
+	[LAT_SOCK_QUEUE] = {.name = "sock_queue", .ns = true},
+	[LAT_SOCK_SEND] = {.name = "sock_send", .ns = true},
+	[LAT_SOCK_E2E] = {.name = "sock_e2e", .ns = true},
+	[LAT_I2C_WAIT] = {.name = "i2c_wait", .ns = true},
+	[LAT_I2C_EXEC] = {.name = "i2c_exec", .ns = true},
+	[LAT_LOG_DEPTH] = {.name = "log_depth", .ns = false},
+	[LAT_SOCK_DEPTH] = {.name = "sock_depth", .ns = false},
+	[LAT_I2C_DEPTH] = {.name = "i2c_depth", .ns = false},
+	[LAT_TEMP_JITTER] = {.name = "temp_jitter", .ns = true},
+	[LAT_LIGHT_JITTER] = {.name = "light_jitter", .ns = true},
+};
+
+/**
+ * @brief - Returns the bucket of a value.
+ *
+ * @param value - The value.
+ * @return uint32_t
+ */
+static uint32_t lat_bucket(uint64_t value)
+{
+	uint32_t shift;
+
+	if (value < HIST_SUB)
+	{
+		return value;
+	}
+	if (value >= (1ULL << HIST_MAX_BITS))
+	{
+		return HIST_BUCKETS - 1;
+	}
+	shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + (uint32_t)(value >> shift) - HIST_SUB;
+}
+
+/**
+ * @brief - Returns the highest value counted in a bucket.
+ *
+ * @param bucket - The bucket.
+ * @return uint64_t
+ */
+static uint64_t lat_bucket_top(uint32_t bucket)
+{
+	uint32_t shift;
+
+	if (bucket < HIST_SUB)
+	{
+		return bucket;
+	}
+	shift = bucket / HIST_SUB - 1;
+	return (((uint64_t)(bucket % HIST_SUB + HIST_SUB) + 1) << shift) - 1;
+}
+
+/**
+ * @brief - Returns the current CLOCK_MONOTONIC time in nanoseconds.
+ *
+ * @return uint64_t
+ */
+uint64_t lat_now(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return lat_ns(&now);
+}
+
+/**
+ * @brief - Converts a CLOCK_MONOTONIC time to nanoseconds.
+ *
+ * @param ts - The time.
+ * @return uint64_t
+ */
+uint64_t lat_ns(const struct timespec *ts)
+{
+	return (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+}
+
+/**
+ * @brief - Adds a value to a histogram.
+ *
+ * @param id - LAT_* histogram.
+ * @param value - Nanoseconds, or a depth for the depth histograms.
+ */
+void lat_record(uint8_t id, uint64_t value)
+{
+	lat_hist *hist = &hists[id];
+	unsigned long long max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+
+	atomic_fetch_add_explicit(&hist->buckets[lat_bucket(value)], 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hist->sum, value, memory_order_relaxed);
+	atomic_fetch_add_explicit(&hist->count, 1, memory_order_relaxed);
+	while (value > max &&
+		   !atomic_compare_exchange_weak_explicit(&hist->max, &max, value, memory_order_relaxed, memory_order_relaxed))
+	{
+	}
+}
+
+/**
+ * @brief - Adds the time between two stamps to a histogram. Nothing is recorded if either step did not
+ * 			happen.
+ *
+ * @param id - LAT_* histogram.
+ * @param start - Earlier stamp in nanoseconds, 0 if unknown.
+ * @param end - Later stamp in nanoseconds, 0 if unknown.
+ */
+void lat_since(uint8_t id, uint64_t start, uint64_t end)
+{
+	if (start && end)
+	{
+		lat_record(id, (end > start) ? end - start : 0);
+	}
+}
+
+/**
+ * @brief - Returns a percentile of a histogram, the highest value of the bucket it falls in and never
+ * 			more than the largest value recorded.
+ *
+ * @param id - LAT_* histogram.
+ * @param pct - Percentile, 0 to 100.
+ * @return uint64_t - 0 if the histogram is empty.
+ */
+uint64_t lat_percentile(uint8_t id, double pct)
+{
+	lat_hist *hist = &hists[id];
+	uint64_t count = atomic_load_explicit(&hist->count, memory_order_relaxed);
+	uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+	uint64_t rank, seen = 0;
+
+	if (count == 0)
+	{
+		return 0;
+	}
+	rank = (uint64_t)(pct / 100 * count + 0.5);
+	if (rank == 0)
+	{
+		rank = 1;
+	}
+	for (uint32_t i = 0; i < HIST_BUCKETS; i++)
+	{
+		seen += atomic_load_explicit(&hist->buckets[i], memory_order_relaxed);
+		if (seen >= rank)
+		{
+			uint64_t top = lat_bucket_top(i);
+			return (top < max) ? top : max;
+		}
+	}
+	return max;
+}
+
+/**
+ * @brief - Stamps a sample about to be published on the sample bus and records the hops from its event to
+ * 			this point. Samples answered from the cache have no read stamps.
+ *
+ * @param sample - The sample.
+ */
+void lat_published(sensor_struct *sample)
+{
+	sample_stamps *stamps = &sample->stamps;
+
+	stamps->published = lat_now();
+	lat_since(LAT_WAKE, stamps->posted, stamps->read_start);
+	lat_since(LAT_READ, stamps->read_start, stamps->read_done);
+	lat_since(LAT_PUBLISH, stamps->read_done, stamps->published);
+}
+
+/**
+ * @brief - Fills the records of a WIRE_MSG_LATENCY reply, one per histogram.
+ *
+ * @param recs - The records.
+ * @param max - Number of records that fit.
+ * @return uint16_t - Number of records filled.
+ */
+uint16_t lat_fill(wire_latency *recs, uint16_t max)
+{
+	uint16_t n;
+
+	for (n = 0; n < LAT_HISTS && n < max; n++)
+	{
+		double scale = hists[n].ns ? 1e3 : 1;
+
+		memset(&recs[n], 0, sizeof(wire_latency));
+		strncpy(recs[n].name, hists[n].name, sizeof(recs[n].name));
+		recs[n].unit = hists[n].ns ? WIRE_LAT_US : WIRE_LAT_COUNT;
+		recs[n].count = atomic_load_explicit(&hists[n].count, memory_order_relaxed);
+		recs[n].p50 = lat_percentile(n, 50) / scale;
+		recs[n].p90 = lat_percentile(n, 90) / scale;
+		recs[n].p99 = lat_percentile(n, 99) / scale;
+		recs[n].p999 = lat_percentile(n, 99.9) / scale;
+		recs[n].max = atomic_load_explicit(&hists[n].max, memory_order_relaxed) / scale;
+	}
+	return n;
+}
+
+/**
+ * @brief - Formats the percentiles of every histogram that has values, in microseconds for the latency
+ * 			histograms.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t lat_stats(void *arg, char *buf, size_t size)
+{
+	size_t used = 0;
+	int len;
+
+	for (uint8_t i = 0; i < LAT_HISTS && used < size - 1; i++)
+	{
+		uint64_t count = atomic_load_explicit(&hists[i].count, memory_order_relaxed);
+		double scale = hists[i].ns ? 1e3 : 1;
+
+		if (count == 0)
+		{
+			continue;
+		}
+		len = snprintf(buf + used, size - used, "%s%s[n=%llu avg=%.1f p50=%.1f p90=%.1f p99=%.1f p999=%.1f max=%.1f]",
+					   used ? " " : "", hists[i].name, (unsigned long long)count,
+					   atomic_load_explicit(&hists[i].sum, memory_order_relaxed) / scale / count, lat_percentile(i, 50) / scale,
+					   lat_percentile(i, 90) / scale, lat_percentile(i, 99) / scale, lat_percentile(i, 99.9) / scale,
+					   atomic_load_explicit(&hists[i].max, memory_order_relaxed) / scale);
+		used += (len < 0) ? 0 : ((size_t)len >= size - used ? size - used - 1 : (size_t)len);
+	}
+
+	if (used < size - 1)
+	{
+		buf[used++] = '\n';
+		buf[used] = '\0';
+	}
+	return used;
+}
@@ -21,22 +21,39 @@ int read_buff;
 sensor_struct read_light_data(uint8_t id)
 {
     sensor_struct read_data;
-    if (ioctl(i2c_open, I2C_SLAVE, LIGHT_ADDR) < 0) 
-    {
-        error_log("ERROR: ioctl(); in read_light_data() function", ERROR_DEBUG, P2);
-    }
-    write_command(CNTRL_REG);
-    char buff = 0x03; //To power up the sensor
-    if(write(i2c_open,&buff,1) != 1) 
+    uint16_t adc[2];
+    i2c_sample_mark mark;
+
+    i2c_sample_begin(&mark);
+    read_data.id = id;
+    if (g_i2c_split)
     {
-       error_log("ERROR: write(); in read_light_data() function", ERROR_DEBUG, P2);
+        write_command(CNTRL_REG);
+        char buff = 0x03; //To power up the sensor
+        if(i2c_bus_write(LIGHT_ADDR, &buff,1) != 1) 
+        {
+           error_log("ERROR: write(); in read_light_data() function", ERROR_DEBUG, P2);
+        }
+        if (clock_gettime(CLOCK_REALTIME, &read_data.sensor_data.light_data.data_time))
+        {
+            error_log("ERROR: clock_gettime(); in read_light_data() function", ERROR_DEBUG, P2);
+        }
+        adc[0] = ADC_CH0();
+        adc[1] = ADC_CH1();
     }
-    read_data.id = id;
-    if (clock_gettime(CLOCK_REALTIME, &read_data.sensor_data.light_data.data_time))
+    else
     {
-        error_log("ERROR: clock_gettime(); in read_light_data() function", ERROR_DEBUG, P2);
+        if (clock_gettime(CLOCK_REALTIME, &read_data.sensor_data.light_data.data_time))
+        {
+            error_log("ERROR: clock_gettime(); in read_light_data() function", ERROR_DEBUG, P2);
+        }
+        read_adc(adc);
     }
-    read_data.sensor_data.light_data.light = lux_data();  //Get lux data from the light sensor.
+    i2c_sample_end(&light_bus_stats, &mark);
+
+    read_data.sensor_data.light_data.adc0 = adc[0];
+    read_data.sensor_data.light_data.adc1 = adc[1];
+    read_data.sensor_data.light_data.light = lux_calc(read_data.sensor_data.light_data.adc0, read_data.sensor_data.light_data.adc1);
     if(read_data.sensor_data.light_data.light < LIGHT_TH)
     {
         read_data.sensor_data.light_data.light_state = DARK;
@@ -57,19 +74,15 @@ sensor_struct read_light_data(uint8_t id)
 uint8_t light_id(void)
 {
     printf("Inside light id\n\n");
-    if (ioctl(i2c_open, I2C_SLAVE, LIGHT_ADDR) < 0) 
-    {
-        error_log("ERROR: ioctl(); in light_id() function", ERROR_DEBUG, P2);
-    }
     write_command(CNTRL_REG);
     char buff = 0x03;
-    if(write(i2c_open,&buff,1) != 1) 
+    if(i2c_bus_write(LIGHT_ADDR, &buff,1) != 1) 
     {
        error_log("ERROR: write(); in light_id() function", ERROR_DEBUG, P2);
     }
     write_command(ID_REG);
     uint8_t id;
-    if (read(i2c_open,&id,1) != 1) 
+    if (i2c_bus_read(LIGHT_ADDR, &id,1) != 1) 
     {
        error_log("ERROR: read(); in light_id() function", ERROR_DEBUG, P2);
     }
@@ -85,7 +98,7 @@ uint8_t light_id(void)
 err_t write_command(uint8_t reg_addr)
 {
     char buff = COMMAND_MASK|reg_addr;
-    if(write(i2c_open,&buff,1) != 1) 
+    if(i2c_bus_write(LIGHT_ADDR, &buff,1) != 1) 
     {
        error_log("ERROR: write(); in write_command() function", ERROR_DEBUG, P2);
     }
@@ -103,12 +116,12 @@ uint16_t ADC_CH0(void)
     uint8_t lsb;
     uint16_t ch0,msb;
     write_command(ADC0_L);
-    if (read(i2c_open,&lsb,1) != 1) 
+    if (i2c_bus_read(LIGHT_ADDR, &lsb,1) != 1) 
     {
        error_log("ERROR: read(lsb); in ADC_CH0() function", ERROR_DEBUG, P2);
     }
     write_command(ADC0_H);
-    if (read(i2c_open,&msb,1) != 1) 
+    if (i2c_bus_read(LIGHT_ADDR, &msb,1) != 1) 
     {
        error_log("ERROR: read(msb); in ADC_CH0() function", ERROR_DEBUG, P2);
     }
@@ -127,14 +140,6 @@ uint16_t ADC_CH0(void)
 uint16_t read_adc0(void)
 {
     uint16_t data;
-    if((i2c_open = open(I2C_BUS, O_RDWR)) < 0)
-    {
-        error_log("ERROR: open(); in light_id() function", ERROR_DEBUG, P2);
-    }
-    if (ioctl(i2c_open, I2C_SLAVE, LIGHT_ADDR) < 0) 
-    {
-        error_log("ERROR: ioctl(); in light_id() function", ERROR_DEBUG, P2);
-    }
     data = ADC_CH0();
     return data;
 }
@@ -149,12 +154,12 @@ uint16_t ADC_CH1(void)
     uint8_t lsb;
     uint16_t ch1,msb;
     write_command(ADC1_L);
-    if (read(i2c_open,&lsb,1) != 1) 
+    if (i2c_bus_read(LIGHT_ADDR, &lsb,1) != 1) 
     {
        error_log("ERROR: read(lsb); in ADC_CH1() function", ERROR_DEBUG, P2);
     }
     write_command(ADC1_H);
-    if (read(i2c_open,&msb,1) != 1) 
+    if (i2c_bus_read(LIGHT_ADDR, &msb,1) != 1) 
     {
        error_log("ERROR: read(msb); in ADC_CH1() function", ERROR_DEBUG, P2);
     }
@@ -163,6 +168,39 @@ uint16_t ADC_CH1(void)
     return ch1;
 }
 
+/**
+ * @brief Powers up the sensor and reads both ADC channels in one combined transfer. Each channel is
+ * read with the word protocol, the command selects the low byte and the WORD bit makes the sensor
+ * return the high byte after it.
+ * 
+ * @param adc - Filled with ADC channel 0 and ADC channel 1, zero on error.
+ * @return err_t 
+ */
+err_t read_adc(uint16_t adc[2])
+{
+    uint8_t power[2] = {COMMAND_MASK | CNTRL_REG, 0x03};
+    uint8_t cmd[2] = {COMMAND_MASK | WORD_MASK | ADC0_L, COMMAND_MASK | WORD_MASK | ADC1_L};
+    uint8_t data[2][2] = {{0}};
+    struct i2c_msg msgs[5] = {
+        {.addr = LIGHT_ADDR, .flags = 0, .len = 2, .buf = power},
+        {.addr = LIGHT_ADDR, .flags = 0, .len = 1, .buf = &cmd[0]},
+        {.addr = LIGHT_ADDR, .flags = I2C_M_RD, .len = 2, .buf = data[0]},
+        {.addr = LIGHT_ADDR, .flags = 0, .len = 1, .buf = &cmd[1]},
+        {.addr = LIGHT_ADDR, .flags = I2C_M_RD, .len = 2, .buf = data[1]},
+    };
+    err_t res = OK;
+
+    if (i2c_bus_transfer(msgs, 5) != 5)
+    {
+        error_log("ERROR: i2c_bus_transfer(); in read_adc() function", ERROR_DEBUG, P2);
+        memset(data, 0, sizeof(data));
+        res = FAIL;
+    }
+    adc[0] = ((uint16_t)data[0][1] << 8) | data[0][0];
+    adc[1] = ((uint16_t)data[1][1] << 8) | data[1][0];
+    return res;
+}
+
 /**
  * @brief Lux Data calculations
  * Reads ADC_CH0 and ADC_CH1 data and does the computations.
@@ -173,32 +211,17 @@ uint16_t ADC_CH1(void)
 
 float lux_data(void)
 {
-    uint16_t adc0, adc1;
-    adc0 = ADC_CH0();
-    adc1 = ADC_CH1();
-    float final_adc = (float)(adc1/adc0);
-    float lux_data;
-    if( 0 < final_adc <= 0.50)
+    uint16_t adc[2];
+    if (g_i2c_split)
     {
-        lux_data = (0.0304 * adc0) - ((0.062 * adc0) * (pow((adc1/adc0), 1.4)));
+        adc[0] = ADC_CH0();
+        adc[1] = ADC_CH1();
     }
-    else if (0.5 < final_adc && final_adc <= 0.61)
-    {
-        lux_data = (0.0224 * adc0) - (0.031 * adc1);
-    }
-    else if (0.61 < final_adc && final_adc <= 0.8)
-    {
-        lux_data = (0.0128 * adc0) - (0.0153 * adc1);
-    }
-    else if (0.8 < final_adc && final_adc <= 1.3)
-    {
-        lux_data = (0.00146 * adc0) - (0.00112*adc1);
-    }
-    else if(final_adc > 1.30)
+    else
     {
-        lux_data = 0;
+        read_adc(adc);
     }
-    return lux_data;
+    return lux_calc(adc[0], adc[1]);
 }
 
 
@@ -211,7 +234,7 @@ float lux_data(void)
 err_t read_light_reg(uint8_t reg)
 {
     write_command(reg);
-    if (read(i2c_open, &read_buff,1) != 1) 
+    if (i2c_bus_read(LIGHT_ADDR, &read_buff,1) != 1) 
     {
        error_log("ERROR: read(); in read_light_reg() function", ERROR_DEBUG, P2);
     }
@@ -230,7 +253,7 @@ err_t write_timing_reg(uint8_t data)
     write_command(TIMING_REG);
     read_light_reg(TIMING_REG);
     data = data | read_buff;
-    if(write(i2c_open,&data,1) != 1) 
+    if(i2c_bus_write(LIGHT_ADDR, &data,1) != 1) 
     {
        error_log("ERROR: write(); in write_timing_reg() function", ERROR_DEBUG, P2);
     }
@@ -248,7 +271,7 @@ err_t write_int_ctrl(uint8_t data)
     write_command(INT_CTRL);
     read_light_reg(INT_CTRL);
     data = data | read_buff;
-    if(write(i2c_open,&data,1) != 1) 
+    if(i2c_bus_write(LIGHT_ADDR, &data,1) != 1) 
     {
       error_log("ERROR: write(); in write_int_reg() function", ERROR_DEBUG, P2);
     }
@@ -306,13 +329,13 @@ err_t write_int_th(uint16_t data, uint8_t reg)
     {
         write_command(INT_L_L);
         temp = data & 0x00FF;
-        if(write(i2c_open,&temp,1) != 1) 
+        if(i2c_bus_write(LIGHT_ADDR, &temp,1) != 1) 
         {
             error_log("ERROR: write(); reg = 0; in write_int_th() function", ERROR_DEBUG, P2);
         }
         write_command(INT_L_H);
         temp = data >> 8;
-        if(write(i2c_open,&temp,1) != 1) 
+        if(i2c_bus_write(LIGHT_ADDR, &temp,1) != 1) 
         {
             error_log("ERROR: write(); reg = 0; in write_int_th() function", ERROR_DEBUG, P2);
         }
@@ -321,13 +344,13 @@ err_t write_int_th(uint16_t data, uint8_t reg)
     {
         write_command(INT_H_L);
         temp = data & 0x00FF;
-        if(write(i2c_open,&temp,1) != 1) 
+        if(i2c_bus_write(LIGHT_ADDR, &temp,1) != 1) 
         {
            error_log("ERROR: write(); reg = 1; in write_int_th() function", ERROR_DEBUG, P2);
         }
         write_command(INT_H_H);
         temp = data >> 8;
-        if(write(i2c_open,&temp,1) != 1) 
+        if(i2c_bus_write(LIGHT_ADDR, &temp,1) != 1) 
         {
             error_log("ERROR: write(); reg = 1; in write_int_th() function", ERROR_DEBUG, P2);
         }
@@ -0,0 +1,525 @@
+/**
+ * @file log_archive.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the archive thread which looks after the segments closed by the log sink.
+ * It runs at the lowest CPU and I/O priority and is woken after every rotation: it gzips the segments not
+ * compressed yet, oldest first, then deletes the oldest segments until the segments and the log file fit
+ * in the retention budget. Segments are found by scanning the directory of the log file, so the ones left
+ * by a previous run, or by a compression cut short at exit, are handled as well. The directory is opened
+ * once and the segments are reached relative to it, so that their paths are never built.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <dirent.h>
+#include <limits.h>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "log_archive.h"
+#include "rt_sched.h"
+#include "trace.h"
+
+//Segment kinds, from the suffix after the time and sequence number
+#define SEG_PLAIN	(0)
+#define SEG_GZ		(1)
+#define SEG_TMP		(2)	//Compression in progress, or cut short
+
+//Longest suffix added to the name of a segment
+#define SEG_SUFFIX	".gz.tmp"
+
+typedef struct
+{
+	char name[NAME_MAX + 1];
+	uint64_t size;
+	uint8_t kind;
+} archive_seg;
+
+static pthread_t archive_tid;
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t archive_cond = PTHREAD_COND_INITIALIZER;
+static atomic_bool running;
+static bool started, pending;
+static sink_cfg archive_cfg;
+static char base[NAME_MAX + 1], path_copy[PATH_MAX];
+static int dir_fd = -1;
+static char last_synced[NAME_MAX + 1];	//Newest plain segment synced when segments are not compressed
+
+//Counters, written by the archive thread under archive_lock
+static uint32_t seg_count;
+static uint64_t compressed, in_bytes, out_bytes, deleted, deleted_bytes, disk_bytes, busy_ns, errors;
+
+/**
+ * @brief - Returns the kind of a file of the log directory.
+ *
+ * @param name - Name of the file.
+ * @return int - SEG_PLAIN, SEG_GZ or SEG_TMP, -1 if the file is not a segment of the log file.
+ */
+static int segment_kind(const char *name)
+{
+	static const char pattern[SINK_SEGMENT_LEN + 1] = "DDDDDDDDTDDDDDD-DDDD";
+	size_t len = strlen(base);
+	const char *suffix = name + len + 1;
+
+	if (strncmp(name, base, len) || name[len] != '.')
+	{
+		return -1;
+	}
+	for (int i = 0; i < SINK_SEGMENT_LEN; i++)
+	{
+		if ((pattern[i] == 'D') ? (suffix[i] < '0' || suffix[i] > '9') : (suffix[i] != pattern[i]))
+		{
+			return -1;
+		}
+	}
+	suffix += SINK_SEGMENT_LEN;
+	if (*suffix == '\0')
+	{
+		return SEG_PLAIN;
+	}
+	if (!strcmp(suffix, ".gz"))
+	{
+		return SEG_GZ;
+	}
+	if (!strcmp(suffix, ".gz.tmp"))
+	{
+		return SEG_TMP;
+	}
+	return -1;
+}
+
+//Sorts segments oldest first, the names start with the time they were closed
+static int segment_cmp(const void *a, const void *b)
+{
+	return strcmp(((const archive_seg *)a)->name, ((const archive_seg *)b)->name);
+}
+
+/**
+ * @brief - Lists the segments of the log file, oldest first.
+ *
+ * @param count - Set to the number of segments.
+ * @return archive_seg* - To be freed by the caller, NULL if there is none.
+ */
+static archive_seg *segment_scan(uint32_t *count)
+{
+	archive_seg *segs = NULL, *grown;
+	uint32_t cap = 0;
+	struct dirent *entry;
+	struct stat st;
+	DIR *d;
+	int fd, kind;
+
+	*count = 0;
+	//The stream owns and closes its descriptor, dir_fd stays open for the next scan
+	fd = dup(dir_fd);
+	d = (fd == -1) ? NULL : fdopendir(fd);
+	if (d == NULL)
+	{
+		perror("ERROR: fdopendir(); in segment_scan() function");
+		if (fd != -1)
+		{
+			close(fd);
+		}
+		return NULL;
+	}
+	//The duplicate shares the position of dir_fd, left at the end by the previous scan
+	rewinddir(d);
+	while ((entry = readdir(d)) != NULL)
+	{
+		if ((kind = segment_kind(entry->d_name)) == -1 || fstatat(dir_fd, entry->d_name, &st, 0))
+		{
+			continue;
+		}
+		if (*count == cap)
+		{
+			cap = cap ? 2 * cap : 16;
+			grown = realloc(segs, cap * sizeof(archive_seg));
+			if (grown == NULL)
+			{
+				break;
+			}
+			segs = grown;
+		}
+		snprintf(segs[*count].name, sizeof(segs[*count].name), "%s", entry->d_name);
+		segs[*count].size = st.st_size;
+		segs[*count].kind = kind;
+		(*count)++;
+	}
+	closedir(d);
+	if (*count == 0)
+	{
+		return segs;
+	}
+	qsort(segs, *count, sizeof(archive_seg), segment_cmp);
+	return segs;
+}
+
+/**
+ * @brief - Syncs a file of the log directory to the disk.
+ *
+ * @param name - Name of the file.
+ * @return err_t
+ */
+static err_t archive_sync(const char *name)
+{
+	int fd = openat(dir_fd, name, O_RDONLY | O_CLOEXEC);
+	err_t res = OK;
+
+	if (fd == -1 || fsync(fd))
+	{
+		res = FAIL;
+	}
+	if (fd != -1)
+	{
+		close(fd);
+	}
+	return res;
+}
+
+/**
+ * @brief - Gzips a segment to <segment>.gz.tmp, syncs it, renames it to <segment>.gz and deletes the
+ * 			segment, so that a crash at any point leaves at least one complete copy.
+ *
+ * @param seg - The segment, updated to the compressed file.
+ * @return err_t - FAIL if it failed or was cut short by archive_stop().
+ */
+static err_t segment_compress(archive_seg *seg)
+{
+	//archive_start() made sure that the names with a suffix fit in NAME_MAX
+	char tmp[sizeof(seg->name) + sizeof(SEG_SUFFIX)], dst[sizeof(seg->name) + sizeof(SEG_SUFFIX)], mode[8];
+	struct stat st;
+	char *buf;
+	size_t n;
+	FILE *in = NULL;
+	gzFile out = NULL;
+	int in_fd, out_fd;
+	err_t res = OK;
+
+	snprintf(dst, sizeof(dst), "%s.gz", seg->name);
+	snprintf(tmp, sizeof(tmp), "%s" SEG_SUFFIX, seg->name);
+	snprintf(mode, sizeof(mode), "wb%d", archive_cfg.gzip_level);
+
+	buf = malloc(ARCHIVE_CHUNK);
+	in_fd = openat(dir_fd, seg->name, O_RDONLY | O_CLOEXEC);
+	out_fd = openat(dir_fd, tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (in_fd != -1)
+	{
+		in = fdopen(in_fd, "rb");
+	}
+	if (out_fd != -1)
+	{
+		out = gzdopen(out_fd, mode);
+	}
+	if (buf == NULL || in == NULL || out == NULL)
+	{
+		error_log("ERROR: gzdopen(); in segment_compress() function", ERROR_DEBUG, P2);
+		free(buf);
+		if (in)
+		{
+			fclose(in);
+		}
+		else if (in_fd != -1)
+		{
+			close(in_fd);
+		}
+		if (out)
+		{
+			gzclose(out);
+		}
+		else if (out_fd != -1)
+		{
+			close(out_fd);
+		}
+		if (out_fd != -1)
+		{
+			unlinkat(dir_fd, tmp, 0);
+		}
+		return FAIL;
+	}
+
+	while ((n = fread(buf, 1, ARCHIVE_CHUNK, in)) > 0)
+	{
+		if (!atomic_load(&running) || gzwrite(out, buf, n) != (int)n)
+		{
+			res = FAIL;
+			break;
+		}
+	}
+	if (ferror(in))
+	{
+		res = FAIL;
+	}
+	fclose(in);
+	free(buf);
+	if (gzclose(out) != Z_OK)
+	{
+		res = FAIL;
+	}
+
+	if (res || archive_sync(tmp) || renameat(dir_fd, tmp, dir_fd, dst) || fstatat(dir_fd, dst, &st, 0))
+	{
+		//Cut short by archive_stop() is not an error, the segment is compressed at the next start
+		if (atomic_load(&running))
+		{
+			error_log("ERROR: gzwrite(); cannot compress a log segment", ERROR_DEBUG, P2);
+		}
+		unlinkat(dir_fd, tmp, 0);
+		return FAIL;
+	}
+	unlinkat(dir_fd, seg->name, 0);
+
+	pthread_mutex_lock(&archive_lock);
+	compressed++;
+	in_bytes += seg->size;
+	out_bytes += st.st_size;
+	pthread_mutex_unlock(&archive_lock);
+
+	strncat(seg->name, ".gz", sizeof(seg->name) - strlen(seg->name) - 1);
+	seg->size = st.st_size;
+	seg->kind = SEG_GZ;
+	return OK;
+}
+
+/**
+ * @brief - Compresses the segments that are not compressed yet and applies the retention budget.
+ *
+ */
+static void archive_run(void)
+{
+	struct timespec start, end;
+	struct stat st;
+	archive_seg *segs;
+	uint32_t count, kept = 0;
+	uint64_t total = 0, gone = 0, gone_bytes = 0, failed = 0;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	trace_begin("archive_run");
+	segs = segment_scan(&count);
+	for (uint32_t i = 0; i < count && atomic_load(&running); i++)
+	{
+		//Nothing else writes them, a temporary file was left by a compression that did not finish
+		if (segs[i].kind == SEG_TMP)
+		{
+			unlinkat(dir_fd, segs[i].name, 0);
+			segs[i].size = 0;
+			continue;
+		}
+		if (segs[i].kind != SEG_PLAIN)
+		{
+			continue;
+		}
+		if (archive_cfg.gzip_level > 0)
+		{
+			if (segment_compress(&segs[i]) && atomic_load(&running))
+			{
+				failed++;
+			}
+		}
+		else if (archive_cfg.fsync_policy != SINK_FSYNC_NEVER && strcmp(segs[i].name, last_synced) > 0)
+		{
+			//The log sink leaves the sync of a closed segment to this thread
+			if (archive_sync(segs[i].name))
+			{
+				failed++;
+			}
+			snprintf(last_synced, sizeof(last_synced), "%s", segs[i].name);
+		}
+	}
+
+	//The log file counts against the budget too, the oldest segments make room for it
+	for (uint32_t i = 0; i < count; i++)
+	{
+		total += segs[i].size;
+	}
+	if (!stat(path_copy, &st))
+	{
+		total += st.st_size;
+	}
+	for (uint32_t i = 0; i < count; i++)
+	{
+		if (segs[i].kind == SEG_TMP)
+		{
+			continue;
+		}
+		if (archive_cfg.retain_bytes && total > archive_cfg.retain_bytes)
+		{
+			if (unlinkat(dir_fd, segs[i].name, 0))
+			{
+				failed++;
+			}
+			else
+			{
+				total -= segs[i].size;
+				gone++;
+				gone_bytes += segs[i].size;
+				continue;
+			}
+		}
+		kept++;
+	}
+	free(segs);
+	trace_end("archive_run");
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	pthread_mutex_lock(&archive_lock);
+	seg_count = kept;
+	disk_bytes = total;
+	deleted += gone;
+	deleted_bytes += gone_bytes;
+	errors += failed;
+	busy_ns += (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+	pthread_mutex_unlock(&archive_lock);
+}
+
+/**
+ * @brief - Archive thread. Sleeps until a segment is closed, and handles the segments already on the disk
+ * 			when it starts.
+ *
+ * @param arg - Unused.
+ * @return void*
+ */
+static void *archive_thread(void *arg)
+{
+	(void)arg;
+	trace_register("archive");
+	//Lowest CPU and I/O priority, compressing must never delay the sensor and logger threads
+	if (setpriority(PRIO_PROCESS, syscall(SYS_gettid), ARCHIVE_NICE))
+	{
+		perror("ERROR: setpriority(); in archive_thread() function");
+	}
+#ifdef SYS_ioprio_set
+	syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, 0, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+#endif
+	rt_apply(RT_ROLE_ARCHIVE);
+
+	pthread_mutex_lock(&archive_lock);
+	while (atomic_load(&running))
+	{
+		if (!pending)
+		{
+			pthread_cond_wait(&archive_cond, &archive_lock);
+			continue;
+		}
+		pending = false;
+		pthread_mutex_unlock(&archive_lock);
+		archive_run();
+		pthread_mutex_lock(&archive_lock);
+	}
+	pthread_mutex_unlock(&archive_lock);
+	return NULL;
+}
+
+/**
+ * @brief - This function starts the archive thread of a rotated log file.
+ *
+ * @param path - Path of the log file.
+ * @param cfg - Configuration of the log sink, for the compression level, the budget and the fsync policy.
+ * @return err_t
+ */
+err_t archive_start(const char *path, const sink_cfg *cfg)
+{
+	const char *slash = strrchr(path, '/');
+	char dir[PATH_MAX];
+
+	//A compressed segment is named <log file>.<time>-<sequence>.gz.tmp while it is written
+	if (strlen(path) >= sizeof(path_copy) ||
+		strlen(slash ? slash + 1 : path) + 1 + SINK_SEGMENT_LEN + strlen(SEG_SUFFIX) > NAME_MAX)
+	{
+		printf("ERROR: Log file name %s is too long to be rotated.\n", path);
+		return FAIL;
+	}
+	snprintf(path_copy, sizeof(path_copy), "%s", path);
+	snprintf(base, sizeof(base), "%s", slash ? slash + 1 : path);
+	if (slash == NULL)
+	{
+		snprintf(dir, sizeof(dir), ".");
+	}
+	else
+	{
+		snprintf(dir, sizeof(dir), "%.*s", (slash == path) ? 1 : (int)(slash - path), path);
+	}
+	dir_fd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir_fd == -1)
+	{
+		perror("ERROR: open(); in archive_start() function, cannot open the log directory");
+		return FAIL;
+	}
+	archive_cfg = *cfg;
+
+	atomic_store(&running, true);
+	pending = true;
+	if (pthread_create(&archive_tid, NULL, archive_thread, NULL))
+	{
+		error_log("ERROR: pthread_create(); in archive_start() function", ERROR_DEBUG, P2);
+		atomic_store(&running, false);
+		close(dir_fd);
+		dir_fd = -1;
+		return FAIL;
+	}
+	started = true;
+	return OK;
+}
+
+/**
+ * @brief - Wakes the archive thread up after a segment was closed. Never blocks on the archive work.
+ *
+ */
+void archive_wake(void)
+{
+	if (!started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&archive_lock);
+	pending = true;
+	pthread_cond_signal(&archive_cond);
+	pthread_mutex_unlock(&archive_lock);
+}
+
+/**
+ * @brief - Stops the archive thread. A compression in progress is abandoned and resumed at the next start.
+ *
+ */
+void archive_stop(void)
+{
+	if (!started)
+	{
+		return;
+	}
+	pthread_mutex_lock(&archive_lock);
+	atomic_store(&running, false);
+	pthread_cond_signal(&archive_cond);
+	pthread_mutex_unlock(&archive_lock);
+	pthread_join(archive_tid, NULL);
+	close(dir_fd);
+	dir_fd = -1;
+	started = false;
+}
+
+/**
+ * @brief - Formats the segments on the disk and the compression and deletion counters.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t archive_stats(void *arg, char *buf, size_t size)
+{
+	int len;
+
+	(void)arg;
+	pthread_mutex_lock(&archive_lock);
+	len = snprintf(buf, size, "segments=%u disk_bytes=%llu budget=%llu compressed=%llu in_bytes=%llu out_bytes=%llu "
+							  "ratio=%.2f deleted=%llu deleted_bytes=%llu busy_ms=%.1f errors=%llu\n",
+				   seg_count, (unsigned long long)disk_bytes, (unsigned long long)archive_cfg.retain_bytes,
+				   (unsigned long long)compressed, (unsigned long long)in_bytes, (unsigned long long)out_bytes,
+				   out_bytes ? (double)in_bytes / out_bytes : 0, (unsigned long long)deleted,
+				   (unsigned long long)deleted_bytes, busy_ns / 1e6, (unsigned long long)errors);
+	pthread_mutex_unlock(&archive_lock);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
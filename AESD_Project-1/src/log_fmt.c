@@ -0,0 +1,257 @@
+/**
+ * @file log_fmt.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the table of interned log formats and of the formatter which applies a
+ * format to the raw arguments of a message. Messages only carry the id of their format; the daemon
+ * interns the format string literals the first time they are logged, log_export learns them from the
+ * format records of a binary log.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "log_fmt.h"
+
+static const char *fmt_table[LOGFMT_MAX + 1];
+static uint16_t fmt_count;
+static pthread_mutex_t fmt_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * @brief - Returns the id of a format, adding it to the table if it is new. Called once per call site,
+ * 			which keeps the id for its later messages. The string must stay valid for the lifetime of the
+ * 			process, as string literals do.
+ *
+ * @param fmt - The format string.
+ * @return uint16_t - The id, 0 if the table is full.
+ */
+uint16_t logfmt_intern(const char *fmt)
+{
+	uint16_t id = 0;
+
+	pthread_mutex_lock(&fmt_lock);
+	//Identical literals of different call sites share one id
+	for (uint16_t i = 1; i <= fmt_count; i++)
+	{
+		if (fmt_table[i] == fmt || strcmp(fmt_table[i], fmt) == 0)
+		{
+			id = i;
+			break;
+		}
+	}
+	if (id == 0 && fmt_count < LOGFMT_MAX)
+	{
+		id = ++fmt_count;
+		fmt_table[id] = fmt;
+	}
+	pthread_mutex_unlock(&fmt_lock);
+	return id;
+}
+
+/**
+ * @brief - Returns the format string of an id.
+ *
+ * @param id - The id.
+ * @return const char* - NULL if the id is unknown.
+ */
+const char *logfmt_lookup(uint16_t id)
+{
+	if (id == 0 || id > LOGFMT_MAX)
+	{
+		return NULL;
+	}
+	return fmt_table[id];
+}
+
+/**
+ * @brief - Sets the format string of an id read from a binary log. The string is copied.
+ *
+ * @param id - The id.
+ * @param fmt - The format string, not NUL terminated.
+ * @param len - Length of the format string.
+ * @return err_t
+ */
+err_t logfmt_define(uint16_t id, const char *fmt, size_t len)
+{
+	char *copy;
+
+	if (id == 0 || id > LOGFMT_MAX)
+	{
+		return FAIL;
+	}
+	copy = strndup(fmt, len);
+	if (copy == NULL)
+	{
+		return FAIL;
+	}
+	pthread_mutex_lock(&fmt_lock);
+	free((char *)fmt_table[id]);
+	fmt_table[id] = copy;
+	if (id > fmt_count)
+	{
+		fmt_count = id;
+	}
+	pthread_mutex_unlock(&fmt_lock);
+	return OK;
+}
+
+/**
+ * @brief - Returns the number of interned formats.
+ *
+ * @return uint16_t
+ */
+uint16_t logfmt_count(void)
+{
+	uint16_t count;
+
+	pthread_mutex_lock(&fmt_lock);
+	count = fmt_count;
+	pthread_mutex_unlock(&fmt_lock);
+	return count;
+}
+
+/**
+ * @brief - Formats raw arguments like snprintf() would. Integer conversions read log_arg.i with their
+ * 			length modifier widened to long long, floating point conversions read log_arg.d. Conversions
+ * 			without a raw representation, such as %s, %p and '*' widths, are printed as "?".
+ *
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @param fmt - The format string.
+ * @param args - The raw arguments.
+ * @param nargs - Number of arguments.
+ * @return size_t - Number of characters written.
+ */
+size_t logfmt_render(char *buf, size_t size, const char *fmt, const log_arg *args, uint8_t nargs)
+{
+	size_t len = 0;
+	uint8_t next = 0;
+
+	if (size == 0)
+	{
+		return 0;
+	}
+
+	while (*fmt && len + 1 < size)
+	{
+		char spec[32];
+		const char *start;
+		size_t spec_len;
+		char conv;
+		int res = 0;
+
+		if (*fmt != '%')
+		{
+			buf[len++] = *fmt++;
+			continue;
+		}
+		if (fmt[1] == '%')
+		{
+			buf[len++] = '%';
+			fmt += 2;
+			continue;
+		}
+
+		//Flags, width and precision are kept, length modifiers are replaced
+		start = fmt++;
+		while (*fmt && strchr("-+ #0123456789.", *fmt))
+		{
+			fmt++;
+		}
+		spec_len = fmt - start;
+		while (*fmt && strchr("hlLqjzt", *fmt))
+		{
+			fmt++;
+		}
+		conv = *fmt;
+		if (conv == '\0')
+		{
+			break;
+		}
+		fmt++;
+
+		//A spec too long for the buffer can only come from a corrupt or crafted log, it is printed as it is
+		if (spec_len > sizeof(spec) - 4)
+		{
+			res = snprintf(buf + len, size - len, "%.*s", (int)(fmt - start), start);
+			if (next < nargs)
+			{
+				next++;
+			}
+			if (res > 0)
+			{
+				len += ((size_t)res >= size - len) ? size - len - 1 : (size_t)res;
+			}
+			continue;
+		}
+		if (next >= nargs)
+		{
+			conv = '?';
+		}
+		memcpy(spec, start, spec_len);
+		if (strchr("di", conv))
+		{
+			memcpy(spec + spec_len, "ll", 2);
+			spec[spec_len + 2] = conv;
+			spec[spec_len + 3] = '\0';
+			res = snprintf(buf + len, size - len, spec, (long long)args[next++].i);
+		}
+		else if (strchr("ouxX", conv))
+		{
+			memcpy(spec + spec_len, "ll", 2);
+			spec[spec_len + 2] = conv;
+			spec[spec_len + 3] = '\0';
+			res = snprintf(buf + len, size - len, spec, (unsigned long long)args[next++].i);
+		}
+		else if (conv == 'c')
+		{
+			spec[spec_len] = conv;
+			spec[spec_len + 1] = '\0';
+			res = snprintf(buf + len, size - len, spec, (int)args[next++].i);
+		}
+		else if (strchr("fFeEgGaA", conv))
+		{
+			spec[spec_len] = conv;
+			spec[spec_len + 1] = '\0';
+			res = snprintf(buf + len, size - len, spec, args[next++].d);
+		}
+		else
+		{
+			//The argument, if any, is skipped
+			res = snprintf(buf + len, size - len, "?");
+			if (next < nargs)
+			{
+				next++;
+			}
+		}
+
+		if (res > 0)
+		{
+			len += ((size_t)res >= size - len) ? size - len - 1 : (size_t)res;
+		}
+	}
+	buf[len] = '\0';
+	return len;
+}
+
+/**
+ * @brief - Formats an interned log message.
+ *
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @param msg - The message.
+ * @return size_t - Number of characters written.
+ */
+size_t logmsg_text(char *buf, size_t size, const struct logmsg_struct *msg)
+{
+	const char *fmt = logfmt_lookup(msg->fmt);
+	int len;
+
+	if (fmt == NULL)
+	{
+		len = snprintf(buf, size, "<unknown log format %u>\n", msg->fmt);
+		return (len < 0 || size == 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+	}
+	return logfmt_render(buf, size, fmt, msg->args, (msg->nargs > LOG_MAX_ARGS) ? LOG_MAX_ARGS : msg->nargs);
+}
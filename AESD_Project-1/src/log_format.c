@@ -0,0 +1,810 @@
+/**
+ * @file log_format.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the functions which convert a sensor_struct to the text layout of the
+ * logfile, to CSV and to and from the compact binary telemetry layout. It does not depend on any
+ * daemon state so that the log exporter can link it together with log_fmt.c.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "log_format.h"
+#include "light.h"
+
+#define STAR_LINE "\n***********************************\n\n"
+
+/**
+ * @brief - Clamps the return value of snprintf() to the number of characters actually written.
+ *
+ * @param len - Return value of snprintf().
+ * @param size - Size of the buffer passed to snprintf().
+ * @return size_t
+ */
+static size_t clamp_len(int len, size_t size)
+{
+	if (len < 0 || size == 0)
+	{
+		return 0;
+	}
+	return ((size_t)len >= size) ? size - 1 : (size_t)len;
+}
+
+/**
+ * @brief - This function formats a record in the text layout of the logfile depending on the id field
+ * 			obtained from the structure sensor_struct.
+ *
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @param data - The record to be formatted.
+ * @param prev_state - Last light state seen, used to print light state changes. Updated by the function.
+ * @return size_t - Number of characters written.
+ */
+size_t log_format_text(char *buf, size_t size, sensor_struct *data, bool *prev_state)
+{
+	size_t len = 0;
+
+	switch (data->id)
+	{
+	case TEMP_RCV_ID:
+	{
+		len = clamp_len(snprintf(buf, size, "Timestamp: %lu seconds and %lu nanoseconds.\n"
+											"Temperature Value Recorded: %f %s.\n" STAR_LINE,
+								 data->sensor_data.temp_data.data_time.tv_sec, data->sensor_data.temp_data.data_time.tv_nsec,
+								 data->sensor_data.temp_data.temp_c, temp_unit_name(data->sensor_data.temp_data.unit)),
+						size);
+		break;
+	}
+
+	case LIGHT_RCV_ID:
+	{
+		len = clamp_len(snprintf(buf, size, "Timestamp: %lu seconds and %lu nanoseconds.\n"
+											"Light Value: %f.\n"
+											"Light State: %s.\n",
+								 data->sensor_data.light_data.data_time.tv_sec, data->sensor_data.light_data.data_time.tv_nsec,
+								 data->sensor_data.light_data.light, (data->sensor_data.light_data.light_state) ? "LIGHT" : "DARK"),
+						size);
+		if (*prev_state != data->sensor_data.light_data.light_state)
+		{
+			len += clamp_len(snprintf(buf + len, size - len, "LIGHT STATE CHANGED FROM %s to %s\n", (*prev_state) ? "'LIGHT'" : "'DARK'",
+									  (data->sensor_data.light_data.light_state) ? "'LIGHT'" : "'DARK'"),
+							 size - len);
+			*prev_state = data->sensor_data.light_data.light_state;
+		}
+		len += clamp_len(snprintf(buf + len, size - len, STAR_LINE), size - len);
+		break;
+	}
+
+	case ERROR_RCV_ID:
+	{
+		len = clamp_len(snprintf(buf, size, "Timestamp: %lu seconds and %lu nanoseconds.\n"
+											"%s.\n"
+											"%s.\n" STAR_LINE,
+								 data->sensor_data.error_data.data_time.tv_sec, data->sensor_data.error_data.data_time.tv_nsec,
+								 data->sensor_data.error_data.error_str, strerror(data->sensor_data.error_data.error_value)),
+						size);
+		break;
+	}
+
+	case MSG_RCV_ID:
+	{
+		len = clamp_len(snprintf(buf, size, "%s", data->sensor_data.msg_data.msg_str), size);
+		break;
+	}
+
+	case LOGMSG_RCV_ID:
+	{
+		struct logmsg_struct *m = &data->sensor_data.logmsg_data;
+		char text[LOGFMT_TEXT_SIZE];
+
+		logmsg_text(text, sizeof(text), m);
+		if (m->error)
+		{
+			len = clamp_len(snprintf(buf, size, "Timestamp: %lu seconds and %lu nanoseconds.\n"
+												"%s.\n"
+												"%s.\n" STAR_LINE,
+									 m->data_time.tv_sec, m->data_time.tv_nsec, text, strerror(m->error_value)),
+							size);
+		}
+		else
+		{
+			len = clamp_len(snprintf(buf, size, "%s", text), size);
+		}
+		break;
+	}
+
+	case SOCK_TEMP_RCV_ID:
+	{
+		len = clamp_len(snprintf(buf, size, "SOCKET REQUEST RECEIVED\n"
+											"Timestamp: %lu seconds and %lu nanoseconds.\n"
+											"Temperature Value Recorded: %f.\n" STAR_LINE,
+								 data->sensor_data.temp_data.data_time.tv_sec, data->sensor_data.temp_data.data_time.tv_nsec,
+								 data->sensor_data.temp_data.temp_c),
+						size);
+		break;
+	}
+
+	case SOCK_LIGHT_RCV_ID:
+	{
+		len = clamp_len(snprintf(buf, size, "SOCKET REQUEST RECEIVED\n"
+											"Timestamp: %lu seconds and %lu nanoseconds.\n"
+											"Light Value: %f.\n" STAR_LINE,
+								 data->sensor_data.light_data.data_time.tv_sec, data->sensor_data.light_data.data_time.tv_nsec,
+								 data->sensor_data.light_data.light),
+						size);
+		break;
+	}
+	default:
+		break;
+	}
+	return len;
+}
+
+/**
+ * @brief - Returns the header line matching the output of log_format_csv().
+ *
+ * @return const char*
+ */
+const char *log_csv_header(void)
+{
+	return "id,tv_sec,tv_nsec,value,unit,state,raw0,raw1,errno,text\n";
+}
+
+/**
+ * @brief - Copies a string into a quoted CSV field, doubling quotes and dropping line breaks.
+ *
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @param str - String to be quoted.
+ * @param max - Maximum length of str.
+ * @return size_t - Number of characters written.
+ */
+static size_t csv_quote(char *buf, size_t size, const char *str, size_t max)
+{
+	size_t len = 0;
+
+	if (size < 3)
+	{
+		return 0;
+	}
+	buf[len++] = '"';
+	for (size_t i = 0; i < max && str[i] && len + 3 < size; i++)
+	{
+		if (str[i] == '\n' || str[i] == '\r')
+		{
+			continue;
+		}
+		if (str[i] == '"')
+		{
+			buf[len++] = '"';
+		}
+		buf[len++] = str[i];
+	}
+	buf[len++] = '"';
+	buf[len] = '\0';
+	return len;
+}
+
+/**
+ * @brief - This function formats a record as one CSV line, see log_csv_header() for the columns.
+ *
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @param data - The record to be formatted.
+ * @return size_t - Number of characters written.
+ */
+size_t log_format_csv(char *buf, size_t size, sensor_struct *data)
+{
+	size_t len = 0;
+
+	switch (data->id)
+	{
+	case TEMP_RCV_ID:
+	case SOCK_TEMP_RCV_ID:
+	{
+		struct temp_struct *t = &data->sensor_data.temp_data;
+		len = clamp_len(snprintf(buf, size, "%u,%lu,%lu,%f,%s,,%u,,,\n", data->id, t->data_time.tv_sec, t->data_time.tv_nsec,
+								 t->temp_c, temp_unit_name(t->unit), t->raw),
+						size);
+		break;
+	}
+
+	case LIGHT_RCV_ID:
+	case SOCK_LIGHT_RCV_ID:
+	{
+		struct light_struct *l = &data->sensor_data.light_data;
+		len = clamp_len(snprintf(buf, size, "%u,%lu,%lu,%f,lux,%s,%u,%u,,\n", data->id, l->data_time.tv_sec, l->data_time.tv_nsec,
+								 l->light, (l->light_state) ? "LIGHT" : "DARK", l->adc0, l->adc1),
+						size);
+		break;
+	}
+
+	case ERROR_RCV_ID:
+	{
+		struct error_struct *e = &data->sensor_data.error_data;
+		len = clamp_len(snprintf(buf, size, "%u,%lu,%lu,,,,,,%u,", data->id, e->data_time.tv_sec, e->data_time.tv_nsec,
+								 e->error_value),
+						size);
+		len += csv_quote(buf + len, size - len, e->error_str, sizeof(e->error_str));
+		len += clamp_len(snprintf(buf + len, size - len, "\n"), size - len);
+		break;
+	}
+
+	case MSG_RCV_ID:
+	{
+		len = clamp_len(snprintf(buf, size, "%u,,,,,,,,,", data->id), size);
+		len += csv_quote(buf + len, size - len, data->sensor_data.msg_data.msg_str, sizeof(data->sensor_data.msg_data.msg_str));
+		len += clamp_len(snprintf(buf + len, size - len, "\n"), size - len);
+		break;
+	}
+
+	case LOGMSG_RCV_ID:
+	{
+		//Same rows as the text messages and errors the log used to hold
+		struct logmsg_struct *m = &data->sensor_data.logmsg_data;
+		char text[LOGFMT_TEXT_SIZE];
+
+		logmsg_text(text, sizeof(text), m);
+		if (m->error)
+		{
+			len = clamp_len(snprintf(buf, size, "%u,%lu,%lu,,,,,,%u,", ERROR_RCV_ID, m->data_time.tv_sec,
+									 m->data_time.tv_nsec, m->error_value),
+							size);
+		}
+		else
+		{
+			len = clamp_len(snprintf(buf, size, "%u,,,,,,,,,", MSG_RCV_ID), size);
+		}
+		len += csv_quote(buf + len, size - len, text, sizeof(text));
+		len += clamp_len(snprintf(buf + len, size - len, "\n"), size - len);
+		break;
+	}
+	default:
+		break;
+	}
+	return len;
+}
+
+/**
+ * @brief - Fills the header written at the start of every binary log file.
+ *
+ * @param hdr - Header to be filled.
+ * @param raw - True if sensor records hold raw registers.
+ * @param blocks - True if sensor samples are stored in block records.
+ */
+void binlog_file_init(binlog_file_header *hdr, bool raw, bool blocks)
+{
+	memset(hdr, 0, sizeof(binlog_file_header));
+	memcpy(hdr->magic, BINLOG_MAGIC, sizeof(hdr->magic));
+	hdr->version = BINLOG_VERSION;
+	hdr->header_size = sizeof(binlog_file_header);
+	hdr->rec_header_size = sizeof(binlog_rec_header);
+	hdr->flags = (raw ? BINLOG_FILE_RAW : 0) | (blocks ? BINLOG_FILE_BLOCKS : 0);
+}
+
+/**
+ * @brief - Validates the header read from the start of a binary log file.
+ *
+ * @param hdr - Header read from the file.
+ * @return err_t - OK if the file can be decoded by this version.
+ */
+err_t binlog_file_check(const binlog_file_header *hdr)
+{
+	if (memcmp(hdr->magic, BINLOG_MAGIC, sizeof(hdr->magic)))
+	{
+		return FAIL;
+	}
+	if (hdr->version > BINLOG_VERSION || hdr->rec_header_size != sizeof(binlog_rec_header) ||
+		hdr->header_size < sizeof(binlog_file_header))
+	{
+		return FAIL;
+	}
+	return OK;
+}
+
+/**
+ * @brief - This function encodes a record in the binary layout.
+ *
+ * @param buf - Output buffer, at least sizeof(binlog_rec_header) + BINLOG_MAX_PAYLOAD bytes.
+ * @param size - Size of the output buffer.
+ * @param data - The record to be encoded.
+ * @param raw - Store raw registers instead of converted sensor values.
+ * @return size_t - Number of bytes written, 0 if the record id has no binary layout.
+ */
+size_t binlog_encode(uint8_t *buf, size_t size, sensor_struct *data, bool raw)
+{
+	binlog_rec_header hdr;
+	uint8_t *payload = buf + sizeof(binlog_rec_header);
+	struct timespec *ts = NULL;
+	size_t len = 0;
+
+	if (size < sizeof(binlog_rec_header) + BINLOG_MAX_PAYLOAD)
+	{
+		return 0;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.id = data->id;
+
+	switch (data->id)
+	{
+	case TEMP_RCV_ID:
+	case SOCK_TEMP_RCV_ID:
+	{
+		ts = &data->sensor_data.temp_data.data_time;
+		if (raw)
+		{
+			binlog_temp_raw rec = {data->sensor_data.temp_data.raw, data->sensor_data.temp_data.unit, 0};
+			hdr.flags |= BINLOG_REC_RAW;
+			len = sizeof(rec);
+			memcpy(payload, &rec, len);
+		}
+		else
+		{
+			binlog_temp rec = {data->sensor_data.temp_data.temp_c, data->sensor_data.temp_data.unit, {0}};
+			len = sizeof(rec);
+			memcpy(payload, &rec, len);
+		}
+		break;
+	}
+
+	case LIGHT_RCV_ID:
+	case SOCK_LIGHT_RCV_ID:
+	{
+		ts = &data->sensor_data.light_data.data_time;
+		if (raw)
+		{
+			binlog_light_raw rec = {data->sensor_data.light_data.adc0, data->sensor_data.light_data.adc1};
+			hdr.flags |= BINLOG_REC_RAW;
+			len = sizeof(rec);
+			memcpy(payload, &rec, len);
+		}
+		else
+		{
+			binlog_light rec = {data->sensor_data.light_data.light, data->sensor_data.light_data.light_state, {0}};
+			len = sizeof(rec);
+			memcpy(payload, &rec, len);
+		}
+		break;
+	}
+
+	case ERROR_RCV_ID:
+	{
+		uint32_t error_value = data->sensor_data.error_data.error_value;
+		size_t str_len = strnlen(data->sensor_data.error_data.error_str, sizeof(data->sensor_data.error_data.error_str));
+		ts = &data->sensor_data.error_data.data_time;
+		memcpy(payload, &error_value, sizeof(error_value));
+		memcpy(payload + sizeof(error_value), data->sensor_data.error_data.error_str, str_len);
+		len = sizeof(error_value) + str_len;
+		break;
+	}
+
+	case MSG_RCV_ID:
+	{
+		len = strnlen(data->sensor_data.msg_data.msg_str, sizeof(data->sensor_data.msg_data.msg_str));
+		memcpy(payload, data->sensor_data.msg_data.msg_str, len);
+		break;
+	}
+
+	case LOGMSG_RCV_ID:
+	{
+		struct logmsg_struct *m = &data->sensor_data.logmsg_data;
+		uint8_t nargs = (m->nargs > LOG_MAX_ARGS) ? LOG_MAX_ARGS : m->nargs;
+		binlog_logmsg rec = {m->fmt, nargs, m->error ? BINLOG_MSG_ERROR : 0, m->error_value};
+		ts = &m->data_time;
+		memcpy(payload, &rec, sizeof(rec));
+		memcpy(payload + sizeof(rec), m->args, nargs * sizeof(log_arg));
+		len = sizeof(rec) + nargs * sizeof(log_arg);
+		break;
+	}
+	default:
+		return 0;
+	}
+
+	if (ts)
+	{
+		hdr.tv_sec = ts->tv_sec;
+		hdr.tv_nsec = ts->tv_nsec;
+	}
+	hdr.length = len;
+	memcpy(buf, &hdr, sizeof(hdr));
+	return sizeof(hdr) + len;
+}
+
+/**
+ * @brief - This function encodes the record holding the text of an interned format. Formats longer than
+ * 			the payload are truncated.
+ *
+ * @param buf - Output buffer, at least sizeof(binlog_rec_header) + BINLOG_MAX_PAYLOAD bytes.
+ * @param size - Size of the output buffer.
+ * @param id - The format id.
+ * @return size_t - Number of bytes written, 0 if the id is unknown.
+ */
+size_t binlog_encode_fmt(uint8_t *buf, size_t size, uint16_t id)
+{
+	binlog_rec_header hdr;
+	const char *fmt = logfmt_lookup(id);
+	size_t len;
+
+	if (fmt == NULL || size < sizeof(binlog_rec_header) + BINLOG_MAX_PAYLOAD)
+	{
+		return 0;
+	}
+
+	len = strnlen(fmt, BINLOG_MAX_PAYLOAD - sizeof(id));
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.id = LOGFMT_RCV_ID;
+	hdr.length = sizeof(id) + len;
+	memcpy(buf, &hdr, sizeof(hdr));
+	memcpy(buf + sizeof(hdr), &id, sizeof(id));
+	memcpy(buf + sizeof(hdr) + sizeof(id), fmt, len);
+	return sizeof(hdr) + hdr.length;
+}
+
+/**
+ * @brief - This function decodes one record from the binary layout. Raw registers are converted here,
+ * 			format records are added to the format table for the log messages that follow.
+ *
+ * @param buf - Input buffer starting at a record header.
+ * @param len - Number of bytes available in buf.
+ * @param data - Decoded record. data->id is 0 for record ids this version does not know, and BLOCK_RCV_ID
+ * 				for a block record, whose samples are read with binlog_block_open().
+ * @return size_t - Number of bytes consumed, 0 if buf does not hold a complete record.
+ */
+size_t binlog_decode(const uint8_t *buf, size_t len, sensor_struct *data)
+{
+	binlog_rec_header hdr;
+	const uint8_t *payload = buf + sizeof(binlog_rec_header);
+	struct timespec ts;
+
+	if (len < sizeof(binlog_rec_header))
+	{
+		return 0;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	if (len < sizeof(binlog_rec_header) + hdr.length)
+	{
+		return 0;
+	}
+
+	memset(data, 0, sizeof(sensor_struct));
+	ts.tv_sec = hdr.tv_sec;
+	ts.tv_nsec = hdr.tv_nsec;
+	data->id = hdr.id;
+
+	switch (hdr.id)
+	{
+	case TEMP_RCV_ID:
+	case SOCK_TEMP_RCV_ID:
+	{
+		struct temp_struct *t = &data->sensor_data.temp_data;
+		t->data_time = ts;
+		if ((hdr.flags & BINLOG_REC_RAW) && hdr.length >= sizeof(binlog_temp_raw))
+		{
+			binlog_temp_raw rec;
+			memcpy(&rec, payload, sizeof(rec));
+			t->raw = rec.raw;
+			t->unit = rec.unit;
+			t->temp_c = temp_convert(temp_raw_to_c(rec.raw), rec.unit);
+		}
+		else if (hdr.length >= sizeof(binlog_temp))
+		{
+			binlog_temp rec;
+			memcpy(&rec, payload, sizeof(rec));
+			t->temp_c = rec.value;
+			t->unit = rec.unit;
+		}
+		break;
+	}
+
+	case LIGHT_RCV_ID:
+	case SOCK_LIGHT_RCV_ID:
+	{
+		struct light_struct *l = &data->sensor_data.light_data;
+		l->data_time = ts;
+		if ((hdr.flags & BINLOG_REC_RAW) && hdr.length >= sizeof(binlog_light_raw))
+		{
+			binlog_light_raw rec;
+			memcpy(&rec, payload, sizeof(rec));
+			l->adc0 = rec.adc0;
+			l->adc1 = rec.adc1;
+			l->light = lux_calc(rec.adc0, rec.adc1);
+			l->light_state = (l->light < LIGHT_TH) ? DARK : LIGHT;
+		}
+		else if (hdr.length >= sizeof(binlog_light))
+		{
+			binlog_light rec;
+			memcpy(&rec, payload, sizeof(rec));
+			l->light = rec.lux;
+			l->light_state = rec.state;
+		}
+		break;
+	}
+
+	case ERROR_RCV_ID:
+	{
+		struct error_struct *e = &data->sensor_data.error_data;
+		uint32_t error_value;
+		size_t str_len;
+		e->data_time = ts;
+		if (hdr.length >= sizeof(error_value))
+		{
+			memcpy(&error_value, payload, sizeof(error_value));
+			e->error_value = error_value;
+			str_len = hdr.length - sizeof(error_value);
+			if (str_len >= sizeof(e->error_str))
+			{
+				str_len = sizeof(e->error_str) - 1;
+			}
+			memcpy(e->error_str, payload + sizeof(error_value), str_len);
+		}
+		break;
+	}
+
+	case MSG_RCV_ID:
+	{
+		size_t str_len = hdr.length;
+		if (str_len >= sizeof(data->sensor_data.msg_data.msg_str))
+		{
+			str_len = sizeof(data->sensor_data.msg_data.msg_str) - 1;
+		}
+		memcpy(data->sensor_data.msg_data.msg_str, payload, str_len);
+		break;
+	}
+
+	case LOGMSG_RCV_ID:
+	{
+		struct logmsg_struct *m = &data->sensor_data.logmsg_data;
+		binlog_logmsg rec;
+		m->data_time = ts;
+		if (hdr.length >= sizeof(rec))
+		{
+			memcpy(&rec, payload, sizeof(rec));
+			m->fmt = rec.fmt;
+			m->error = rec.flags & BINLOG_MSG_ERROR;
+			m->error_value = rec.error_value;
+			m->nargs = rec.nargs;
+			if (m->nargs > LOG_MAX_ARGS)
+			{
+				m->nargs = LOG_MAX_ARGS;
+			}
+			if (hdr.length < sizeof(rec) + m->nargs * sizeof(log_arg))
+			{
+				m->nargs = (hdr.length - sizeof(rec)) / sizeof(log_arg);
+			}
+			memcpy(m->args, payload + sizeof(rec), m->nargs * sizeof(log_arg));
+		}
+		break;
+	}
+
+	case LOGFMT_RCV_ID:
+	{
+		//Formats are kept in the format table for the messages that follow
+		uint16_t id;
+		if (hdr.length >= sizeof(id))
+		{
+			memcpy(&id, payload, sizeof(id));
+			logfmt_define(id, (const char *)payload + sizeof(id), hdr.length - sizeof(id));
+		}
+		break;
+	}
+	case BLOCK_RCV_ID:
+		//Holds many samples, they are read with binlog_block_next()
+		break;
+
+	default:
+		//Unknown record, skip it
+		data->id = 0;
+		break;
+	}
+	return sizeof(binlog_rec_header) + hdr.length;
+}
+
+/**
+ * @brief - Returns the encoding of the samples of a block: registers step by a few counts, converted
+ * 			values and the two light channels are compared bit for bit.
+ *
+ * @param id - Sensor record id.
+ * @param raw - True if the block holds raw registers.
+ * @return uint8_t - GORILLA_DELTA or GORILLA_XOR.
+ */
+static uint8_t block_mode(uint8_t id, bool raw)
+{
+	return (raw && (id == TEMP_RCV_ID || id == SOCK_TEMP_RCV_ID)) ? GORILLA_DELTA : GORILLA_XOR;
+}
+
+/**
+ * @brief - Starts an empty block for the samples of one sensor record id.
+ *
+ * @param blk - The block.
+ * @param id - TEMP_RCV_ID, LIGHT_RCV_ID, SOCK_TEMP_RCV_ID or SOCK_LIGHT_RCV_ID.
+ * @param raw - Store raw registers instead of converted sensor values.
+ */
+void binlog_block_init(binlog_block *blk, uint8_t id, bool raw)
+{
+	blk->id = id;
+	blk->raw = raw;
+	blk->unit = 0;
+	blk->first_ns = 0;
+	gorilla_enc_init(&blk->enc, blk->buf + sizeof(binlog_rec_header) + sizeof(binlog_block_hdr),
+					 BINLOG_MAX_PAYLOAD - sizeof(binlog_block_hdr), block_mode(id, raw));
+}
+
+/**
+ * @brief - Appends a sample to a block.
+ *
+ * @param blk - The block.
+ * @param data - A sample with the record id of the block.
+ * @return bool - false if the block is full or the sample has another temperature unit, the block must
+ * 				then be finished before the sample is added again.
+ */
+bool binlog_block_add(binlog_block *blk, sensor_struct *data)
+{
+	struct timespec *ts;
+	uint64_t time_ns;
+	uint32_t value;
+
+	if (blk->id == TEMP_RCV_ID || blk->id == SOCK_TEMP_RCV_ID)
+	{
+		struct temp_struct *t = &data->sensor_data.temp_data;
+		if (blk->enc.count && t->unit != blk->unit)
+		{
+			return false;
+		}
+		ts = &t->data_time;
+		if (blk->raw)
+		{
+			value = t->raw;
+		}
+		else
+		{
+			memcpy(&value, &t->temp_c, sizeof(value));
+		}
+		blk->unit = t->unit;
+	}
+	else
+	{
+		struct light_struct *l = &data->sensor_data.light_data;
+		ts = &l->data_time;
+		if (blk->raw)
+		{
+			value = l->adc0 | (uint32_t)l->adc1 << 16;
+		}
+		else
+		{
+			memcpy(&value, &l->light, sizeof(value));
+		}
+	}
+	time_ns = (uint64_t)ts->tv_sec * 1000000000ULL + ts->tv_nsec;
+	if (blk->enc.count == 0)
+	{
+		blk->first_ns = time_ns;
+	}
+	return gorilla_enc_add(&blk->enc, time_ns, value);
+}
+
+/**
+ * @brief - Completes the record of a block and empties the block for the next samples.
+ *
+ * @param blk - The block.
+ * @return size_t - Number of bytes of the record at blk->buf, 0 if the block holds no sample.
+ */
+size_t binlog_block_finish(binlog_block *blk)
+{
+	binlog_rec_header hdr;
+	binlog_block_hdr block;
+
+	if (blk->enc.count == 0)
+	{
+		return 0;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.id = BLOCK_RCV_ID;
+	hdr.flags = blk->raw ? BINLOG_REC_RAW : 0;
+	hdr.length = sizeof(block) + gorilla_enc_bytes(&blk->enc);
+	hdr.tv_sec = blk->first_ns / 1000000000ULL;
+	hdr.tv_nsec = blk->first_ns % 1000000000ULL;
+	block.id = blk->id;
+	block.unit = blk->unit;
+	block.count = blk->enc.count;
+	memcpy(blk->buf, &hdr, sizeof(hdr));
+	memcpy(blk->buf + sizeof(hdr), &block, sizeof(block));
+
+	binlog_block_init(blk, blk->id, blk->raw);
+	return sizeof(hdr) + hdr.length;
+}
+
+/**
+ * @brief - Starts reading the samples of a block record.
+ *
+ * @param rd - The reader.
+ * @param buf - The block record, header included. Must stay valid while the samples are read.
+ * @param len - Number of bytes of the record.
+ * @return err_t - FAIL if the record is not a block of sensor samples.
+ */
+err_t binlog_block_open(binlog_block_reader *rd, const uint8_t *buf, size_t len)
+{
+	binlog_rec_header hdr;
+	binlog_block_hdr block;
+
+	if (len < sizeof(hdr) + sizeof(block))
+	{
+		return FAIL;
+	}
+	memcpy(&hdr, buf, sizeof(hdr));
+	memcpy(&block, buf + sizeof(hdr), sizeof(block));
+	if (hdr.id != BLOCK_RCV_ID || hdr.length < sizeof(block) || len < sizeof(hdr) + hdr.length ||
+		(block.id != TEMP_RCV_ID && block.id != SOCK_TEMP_RCV_ID && block.id != LIGHT_RCV_ID &&
+		 block.id != SOCK_LIGHT_RCV_ID))
+	{
+		return FAIL;
+	}
+
+	rd->id = block.id;
+	rd->raw = hdr.flags & BINLOG_REC_RAW;
+	rd->unit = block.unit;
+	gorilla_dec_init(&rd->dec, buf + sizeof(hdr) + sizeof(block), hdr.length - sizeof(block),
+					 block_mode(block.id, rd->raw), block.count);
+	return OK;
+}
+
+/**
+ * @brief - Reads the next sample of a block record, converting raw registers like binlog_decode().
+ *
+ * @param rd - The reader.
+ * @param data - The sample.
+ * @return bool - false once all the samples have been read, or if the block is truncated.
+ */
+bool binlog_block_next(binlog_block_reader *rd, sensor_struct *data)
+{
+	uint64_t time_ns;
+	uint32_t value;
+	struct timespec ts;
+
+	if (!gorilla_dec_next(&rd->dec, &time_ns, &value))
+	{
+		return false;
+	}
+
+	memset(data, 0, sizeof(sensor_struct));
+	data->id = rd->id;
+	ts.tv_sec = time_ns / 1000000000ULL;
+	ts.tv_nsec = time_ns % 1000000000ULL;
+
+	if (rd->id == TEMP_RCV_ID || rd->id == SOCK_TEMP_RCV_ID)
+	{
+		struct temp_struct *t = &data->sensor_data.temp_data;
+		t->data_time = ts;
+		t->unit = rd->unit;
+		if (rd->raw)
+		{
+			t->raw = value;
+			t->temp_c = temp_convert(temp_raw_to_c(value), rd->unit);
+		}
+		else
+		{
+			memcpy(&t->temp_c, &value, sizeof(value));
+		}
+	}
+	else
+	{
+		struct light_struct *l = &data->sensor_data.light_data;
+		l->data_time = ts;
+		if (rd->raw)
+		{
+			l->adc0 = value & 0xFFFF;
+			l->adc1 = value >> 16;
+			l->light = lux_calc(l->adc0, l->adc1);
+		}
+		else
+		{
+			memcpy(&l->light, &value, sizeof(value));
+		}
+		//The light state is not stored, it follows from the lux value as in light.c
+		l->light_state = (l->light < LIGHT_TH) ? DARK : LIGHT;
+	}
+	return true;
+}
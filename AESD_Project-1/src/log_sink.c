@@ -0,0 +1,610 @@
+/**
+ * @file log_sink.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the long lived log sink used by the logger thread. The log file is
+ * opened once, records are built in a user-space buffer and written out by size, age and fsync policy.
+ * With rotation the log file is closed between two records once it is large or old enough, renamed to a
+ * segment and opened again; the closed segments are compressed and deleted by the archive thread.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <limits.h>
+#include <sys/stat.h>
+#include "log_sink.h"
+#include "log_archive.h"
+#include "trace.h"
+
+/**
+ * @brief - Returns the time elapsed between two timespec values in nanoseconds.
+ *
+ * @param start - Start time.
+ * @param end - End time.
+ * @return uint64_t
+ */
+static uint64_t elapsed_ns(struct timespec *start, struct timespec *end)
+{
+	return (uint64_t)(end->tv_sec - start->tv_sec) * 1000000000ULL + end->tv_nsec - start->tv_nsec;
+}
+
+/**
+ * @brief - Writes the complete buffer to the file descriptor, retrying on short writes.
+ *
+ * @param fd - File descriptor.
+ * @param data - Data to be written.
+ * @param len - Length of the data in bytes.
+ * @return err_t
+ */
+static err_t write_all(int fd, const char *data, size_t len)
+{
+	ssize_t res;
+
+	while (len)
+	{
+		res = write(fd, data, len);
+		if (res == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return FAIL;
+		}
+		data += res;
+		len -= res;
+	}
+	return OK;
+}
+
+/**
+ * @brief - Fills the configuration structure with the default sink configuration.
+ *
+ * @param cfg - Configuration structure to be filled.
+ */
+void sink_default_cfg(sink_cfg *cfg)
+{
+	cfg->buf_size = SINK_BUF_SIZE;
+	cfg->flush_bytes = SINK_FLUSH_BYTES;
+	cfg->flush_ms = SINK_FLUSH_MS;
+	cfg->fsync_policy = SINK_FSYNC_POLICY;
+	cfg->fsync_ms = SINK_FSYNC_MS;
+	cfg->rotate_bytes = 0;
+	cfg->rotate_sec = 0;
+	cfg->retain_bytes = 0;
+	cfg->gzip_level = SINK_GZIP_LEVEL;
+}
+
+/**
+ * @brief - Returns true if the configuration rotates the log file.
+ *
+ * @param cfg - Sink configuration.
+ * @return bool
+ */
+bool sink_rotating(const sink_cfg *cfg)
+{
+	return cfg->rotate_bytes || cfg->rotate_sec;
+}
+
+/**
+ * @brief - Builds an unused name for a segment of the log file from the current UTC time.
+ *
+ * @param path - Path of the log file.
+ * @param name - Filled with the name of the segment.
+ * @param size - Size of name.
+ * @return err_t - FAIL if the name does not fit or every sequence number of this second is taken.
+ */
+err_t sink_segment_name(const char *path, char *name, size_t size)
+{
+	char gz[PATH_MAX];
+	struct timespec now;
+	struct tm tm;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	gmtime_r(&now.tv_sec, &tm);
+	for (unsigned seq = 0; seq < 10000; seq++)
+	{
+		int len = snprintf(name, size, "%s.%04d%02d%02dT%02d%02d%02d-%04u", path, tm.tm_year + 1900, tm.tm_mon + 1,
+						   tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec, seq);
+		if (len < 0 || (size_t)len >= size)
+		{
+			return FAIL;
+		}
+		snprintf(gz, sizeof(gz), "%s.gz", name);
+		if (access(name, F_OK) && access(gz, F_OK))
+		{
+			return OK;
+		}
+	}
+	return FAIL;
+}
+
+/**
+ * @brief - Opens the log file for appending and starts a segment.
+ *
+ * @param sink - The log sink.
+ * @return err_t
+ */
+static err_t sink_open_file(log_sink *sink)
+{
+	struct stat st;
+
+	sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+	if (sink->fd == -1)
+	{
+		return FAIL;
+	}
+	sink->file_bytes = fstat(sink->fd, &st) ? 0 : st.st_size;
+	sink->file_records = 0;
+	clock_gettime(CLOCK_MONOTONIC, &sink->opened);
+	return OK;
+}
+
+/**
+ * @brief - This function opens the log file once and allocates the record buffer.
+ *
+ * @param sink - The sink to be initialized.
+ * @param path - Path of the log file.
+ * @param cfg - Sink configuration. Pass NULL to use the default configuration.
+ * @return err_t - Error value (0 for success)
+ */
+err_t sink_open(log_sink *sink, const char *path, const sink_cfg *cfg)
+{
+	memset(sink, 0, sizeof(log_sink));
+	if (cfg)
+	{
+		sink->cfg = *cfg;
+	}
+	else
+	{
+		sink_default_cfg(&sink->cfg);
+	}
+
+	if (sink->cfg.flush_bytes > sink->cfg.buf_size)
+	{
+		sink->cfg.flush_bytes = sink->cfg.buf_size;
+	}
+
+	sink->buf = malloc(sink->cfg.buf_size);
+	sink->path = strdup(path);
+	if (sink->buf == NULL || sink->path == NULL)
+	{
+		perror("ERROR: malloc(); in sink_open() function");
+		free(sink->buf);
+		free(sink->path);
+		sink->buf = NULL;
+		sink->path = NULL;
+		return FAIL;
+	}
+
+	//The log of the previous run is kept as the oldest segment instead of being appended to
+	if (sink_rotating(&sink->cfg))
+	{
+		struct stat st;
+		char name[PATH_MAX];
+
+		if (!stat(path, &st) && st.st_size > 0 && !sink_segment_name(path, name, sizeof(name)) && rename(path, name))
+		{
+			perror("ERROR: rename(); in sink_open() function");
+		}
+	}
+
+	if (sink_open_file(sink))
+	{
+		perror("ERROR: open(); in sink_open() function");
+		free(sink->buf);
+		free(sink->path);
+		sink->buf = NULL;
+		sink->path = NULL;
+		return FAIL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &sink->last_sync);
+	sink->rate_time = sink->last_sync;
+	return OK;
+}
+
+/**
+ * @brief - This function writes the buffered records to the log file and applies the fsync policy.
+ *
+ * @param sink - The log sink.
+ * @return err_t
+ */
+err_t sink_flush(log_sink *sink)
+{
+	struct timespec start, end;
+	err_t res = OK;
+
+	if (sink->buf == NULL)
+	{
+		return FAIL;
+	}
+	//The log file could not be opened again after a rotation, the records wait in the buffer until it can
+	if (sink->fd == -1 && sink_open_file(sink))
+	{
+		return FAIL;
+	}
+
+	trace_begin("sink_flush");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (sink->len)
+	{
+		if (write_all(sink->fd, sink->buf, sink->len))
+		{
+			perror("ERROR: write(); in sink_flush() function");
+			sink->write_errors++;
+			res = FAIL;
+		}
+		sink->len = 0;
+		sink->dirty = true;
+	}
+
+	if (sink->dirty && ((sink->cfg.fsync_policy == SINK_FSYNC_FLUSH) ||
+						((sink->cfg.fsync_policy == SINK_FSYNC_INTERVAL) &&
+						 (elapsed_ns(&sink->last_sync, &start) >= (uint64_t)sink->cfg.fsync_ms * 1000000ULL))))
+	{
+		if (fsync(sink->fd))
+		{
+			perror("ERROR: fsync(); in sink_flush() function");
+			sink->write_errors++;
+			res = FAIL;
+		}
+		sink->last_sync = start;
+		sink->dirty = false;
+		sink->syncs++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	trace_end("sink_flush");
+
+	uint64_t ns = elapsed_ns(&start, &end);
+	sink->flushes++;
+	sink->flush_ns_total += ns;
+	if (ns > sink->flush_ns_max)
+	{
+		sink->flush_ns_max = ns;
+	}
+	return res;
+}
+
+/**
+ * @brief - This function appends raw bytes to the record buffer, flushing first if they do not fit.
+ *
+ * @param sink - The log sink.
+ * @param data - Data to be appended.
+ * @param len - Length of the data in bytes.
+ * @return err_t
+ */
+err_t sink_write(log_sink *sink, const void *data, size_t len)
+{
+	if (sink->buf == NULL)
+	{
+		return FAIL;
+	}
+
+	if (sink->len + len > sink->cfg.buf_size)
+	{
+		sink_flush(sink);
+	}
+
+	//Records larger than the whole buffer bypass it
+	if (len > sink->cfg.buf_size)
+	{
+		sink->bytes += len;
+		sink->file_bytes += len;
+		if (write_all(sink->fd, data, len))
+		{
+			sink->write_errors++;
+			return FAIL;
+		}
+		sink->dirty = true;
+		return OK;
+	}
+
+	//Only when the log file cannot be opened, the buffer was not written and the record is lost
+	if (sink->len + len > sink->cfg.buf_size)
+	{
+		sink->write_errors++;
+		return FAIL;
+	}
+
+	if (sink->len == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &sink->oldest);
+	}
+	memcpy(sink->buf + sink->len, data, len);
+	sink->len += len;
+	sink->bytes += len;
+	sink->file_bytes += len;
+	return OK;
+}
+
+/**
+ * @brief - This function formats a string straight into the record buffer.
+ *
+ * @param sink - The log sink.
+ * @param fmt - printf() style format string.
+ * @return err_t
+ */
+err_t sink_printf(log_sink *sink, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (sink->buf == NULL)
+	{
+		return FAIL;
+	}
+
+	va_start(args, fmt);
+	len = vsnprintf(sink->buf + sink->len, sink->cfg.buf_size - sink->len, fmt, args);
+	va_end(args);
+	if (len < 0)
+	{
+		return FAIL;
+	}
+
+	if (sink->len + len >= sink->cfg.buf_size)
+	{
+		//Did not fit, flush and format again into the empty buffer
+		char *tmp;
+		sink_flush(sink);
+		tmp = malloc(len + 1);
+		if (tmp == NULL)
+		{
+			return FAIL;
+		}
+		va_start(args, fmt);
+		vsnprintf(tmp, len + 1, fmt, args);
+		va_end(args);
+		sink_write(sink, tmp, len);
+		free(tmp);
+		return OK;
+	}
+
+	if (sink->len == 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &sink->oldest);
+	}
+	sink->len += len;
+	sink->bytes += len;
+	sink->file_bytes += len;
+	return OK;
+}
+
+/**
+ * @brief - Marks the end of one log record and flushes if the size threshold has been reached. A segment
+ * 			that reached the rotation size is closed here, so that a record never spans two segments.
+ *
+ * @param sink - The log sink.
+ */
+void sink_record_end(log_sink *sink)
+{
+	sink->records++;
+	sink->file_records++;
+	if (sink->cfg.rotate_bytes && sink->file_bytes >= sink->cfg.rotate_bytes)
+	{
+		sink_rotate(sink);
+	}
+	else if (sink->len >= sink->cfg.flush_bytes)
+	{
+		sink_flush(sink);
+	}
+}
+
+/**
+ * @brief - This function closes the current segment and starts a new one: the buffered records are written,
+ * 			the log file is renamed to a segment and opened again. Only the rename and the open are added
+ * 			to a flush, syncing and compressing the segment is left to the archive thread.
+ *
+ * @param sink - The log sink.
+ * @return err_t - FAIL if the segment could not be renamed or the log file opened again, the records are
+ * 			then appended to the same file.
+ */
+err_t sink_rotate(log_sink *sink)
+{
+	struct timespec start, end;
+	char name[PATH_MAX];
+	err_t res = OK;
+
+	if (sink->buf == NULL)
+	{
+		return FAIL;
+	}
+
+	trace_begin("sink_rotate");
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	sink_flush(sink);
+	if (sink->fd == -1)
+	{
+		//sink_flush() could not open the log file again, there is no segment to close
+		res = FAIL;
+	}
+	else if (sink_segment_name(sink->path, name, sizeof(name)) || rename(sink->path, name))
+	{
+		error_log("ERROR: rename(); cannot rotate the log file", ERROR_DEBUG, P2);
+		sink->write_errors++;
+		sink->file_bytes = 0;
+		sink->file_records = 0;
+		sink->opened = start;
+		res = FAIL;
+	}
+	else
+	{
+		close(sink->fd);
+		sink->dirty = false;
+		if (sink_open_file(sink))
+		{
+			//The segment is renamed back so that the archiver does not take it, sink_flush() retries the open
+			perror("ERROR: open(); in sink_rotate() function");
+			sink->write_errors++;
+			if (rename(name, sink->path))
+			{
+				perror("ERROR: rename(); in sink_rotate() function");
+			}
+			res = FAIL;
+		}
+		else
+		{
+			sink->segments++;
+			archive_wake();
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	trace_end("sink_rotate");
+
+	uint64_t ns = elapsed_ns(&start, &end);
+	if (ns > sink->rotate_ns_max)
+	{
+		sink->rotate_ns_max = ns;
+	}
+	return res;
+}
+
+/**
+ * @brief - This function applies the age based flush and the interval fsync policy. It is called
+ * 			periodically by the logger thread even when no records arrive.
+ *
+ * @param sink - The log sink.
+ * @return err_t
+ */
+err_t sink_poll(log_sink *sink)
+{
+	struct timespec now;
+
+	if (sink->buf == NULL)
+	{
+		return FAIL;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	//A segment without records is not worth closing, the binary header alone is no record
+	if (sink->cfg.rotate_sec && sink->file_records &&
+		(elapsed_ns(&sink->opened, &now) >= (uint64_t)sink->cfg.rotate_sec * 1000000000ULL))
+	{
+		return sink_rotate(sink);
+	}
+
+	if (sink->len && (elapsed_ns(&sink->oldest, &now) >= (uint64_t)sink->cfg.flush_ms * 1000000ULL))
+	{
+		return sink_flush(sink);
+	}
+
+	if (sink->dirty && (sink->cfg.fsync_policy == SINK_FSYNC_INTERVAL) &&
+		(elapsed_ns(&sink->last_sync, &now) >= (uint64_t)sink->cfg.fsync_ms * 1000000ULL))
+	{
+		return sink_flush(sink);
+	}
+	return OK;
+}
+
+/**
+ * @brief - Returns the time in milliseconds after which sink_poll() has work to do.
+ *
+ * @param sink - The log sink.
+ * @return uint32_t
+ */
+uint32_t sink_timeout_ms(log_sink *sink)
+{
+	struct timespec now;
+	uint64_t age_ms;
+	uint32_t timeout = sink->cfg.flush_ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (sink->len)
+	{
+		age_ms = elapsed_ns(&sink->oldest, &now) / 1000000ULL;
+		timeout = (age_ms >= sink->cfg.flush_ms) ? 0 : sink->cfg.flush_ms - age_ms;
+	}
+
+	if (sink->dirty && (sink->cfg.fsync_policy == SINK_FSYNC_INTERVAL) && (sink->cfg.fsync_ms < timeout))
+	{
+		timeout = sink->cfg.fsync_ms;
+	}
+
+	if (sink->cfg.rotate_sec && sink->file_records)
+	{
+		age_ms = elapsed_ns(&sink->opened, &now) / 1000000ULL;
+		if (age_ms >= (uint64_t)sink->cfg.rotate_sec * 1000)
+		{
+			timeout = 0;
+		}
+		else if ((uint64_t)sink->cfg.rotate_sec * 1000 - age_ms < timeout)
+		{
+			timeout = sink->cfg.rotate_sec * 1000 - age_ms;
+		}
+	}
+	return timeout;
+}
+
+/**
+ * @brief - This function flushes the remaining records, syncs and closes the log file.
+ *
+ * @param sink - The log sink.
+ * @return err_t
+ */
+err_t sink_close(log_sink *sink)
+{
+	if (sink->buf == NULL)
+	{
+		return FAIL;
+	}
+
+	sink_flush(sink);
+	if (sink->fd != -1)
+	{
+		if (sink->cfg.fsync_policy != SINK_FSYNC_NEVER)
+		{
+			fsync(sink->fd);
+		}
+		if (close(sink->fd))
+		{
+			perror("ERROR: close(); in sink_close() function");
+		}
+	}
+	free(sink->buf);
+	free(sink->path);
+	sink->buf = NULL;
+	sink->path = NULL;
+	sink->fd = -1;
+	return OK;
+}
+
+/**
+ * @brief - Formats the sink counters. Rates are computed since the previous call.
+ *
+ * @param arg - The log sink.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t sink_stats(void *arg, char *buf, size_t size)
+{
+	log_sink *sink = (log_sink *)arg;
+	struct timespec now;
+	double secs, avg_us;
+	int len;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	secs = elapsed_ns(&sink->rate_time, &now) / 1e9;
+	if (secs <= 0)
+	{
+		secs = 1e-9;
+	}
+	avg_us = sink->flushes ? (sink->flush_ns_total / sink->flushes) / 1e3 : 0;
+
+	len = snprintf(buf, size, "records=%llu bytes=%llu records/s=%.1f bytes/s=%.1f flushes=%llu syncs=%llu "
+							  "flush_avg_us=%.1f flush_max_us=%.1f buffered=%zu file_bytes=%llu segments=%u "
+							  "rotate_max_us=%.1f errors=%llu\n",
+				   (unsigned long long)sink->records, (unsigned long long)sink->bytes,
+				   (sink->records - sink->rate_records) / secs, (sink->bytes - sink->rate_bytes) / secs,
+				   (unsigned long long)sink->flushes, (unsigned long long)sink->syncs,
+				   avg_us, sink->flush_ns_max / 1e3, sink->len, (unsigned long long)sink->file_bytes, sink->segments,
+				   sink->rotate_ns_max / 1e3, (unsigned long long)sink->write_errors);
+
+	sink->rate_records = sink->records;
+	sink->rate_bytes = sink->bytes;
+	sink->rate_time = now;
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
@@ -13,110 +13,292 @@
 
 bool previous_state;
 
+//Interned formats already written to the binary log file, and the log sink segment they were written to
+static uint8_t fmt_written[LOGFMT_MAX / 8 + 1];
+static uint32_t header_segment;
+static bool blocks_ready;
+
+//Compressed blocks being filled, one per sensor record id, with the time their first sample was added
+static const uint8_t block_ids[4] = {TEMP_RCV_ID, LIGHT_RCV_ID, SOCK_TEMP_RCV_ID, SOCK_LIGHT_RCV_ID};
+static binlog_block blocks[4];
+static uint64_t block_opened[4];
+static uint64_t block_samples, block_records, block_bytes;
+
+/**
+ * @brief - Returns the block of a sensor record id.
+ * 
+ * @param id - Record id.
+ * @return int - Index in blocks, -1 if the record is not a sensor sample.
+ */
+static int block_index(uint8_t id)
+{
+	for (int i = 0; i < 4; i++)
+	{
+		if (block_ids[i] == id)
+		{
+			return i;
+		}
+	}
+	return -1;
+}
+
 /**
- * @brief - This function logs data to the textfile depending on the id field obtained from the structure sensor_struct
- * 			upon dequeuing the data.
+ * @brief - Writes the file header again once the log sink has started a new segment, so that every
+ * 			segment of a rotated binary log can be read on its own.
+ * 
+ */
+static void log_segment_check(void)
+{
+	if (logfile_sink.segments != header_segment)
+	{
+		log_header();
+	}
+}
+
+/**
+ * @brief - Writes a block to the log sink and empties it.
+ * 
+ * @param blk - The block.
+ */
+static void log_block_write(binlog_block *blk)
+{
+	uint32_t count = blk->enc.count;
+	size_t len = binlog_block_finish(blk);
+
+	if (len)
+	{
+		log_segment_check();
+		sink_write(&logfile_sink, blk->buf, len);
+		sink_record_end(&logfile_sink);
+		block_samples += count;
+		block_records++;
+		block_bytes += len;
+	}
+}
+
+/**
+ * @brief - Adds a sample to the block of its record id, writing the block out first when it is full.
+ * 
+ * @param idx - Index of the block.
+ * @param data - The sample.
+ */
+static void log_block_add(int idx, sensor_struct *data)
+{
+	binlog_block *blk = &blocks[idx];
+
+	if (!binlog_block_add(blk, data))
+	{
+		log_block_write(blk);
+		binlog_block_add(blk, data);	//One sample always fits in an empty block
+	}
+	if (blk->enc.count == 1)
+	{
+		block_opened[idx] = lat_now();
+	}
+}
+
+/**
+ * @brief - This function logs data to the log sink depending on the id field obtained from the structure
+ * 			sensor_struct upon dequeuing the data. In text mode the record is formatted once and written to
+ * 			stdout and to the buffered log sink, in binary mode only the compact record is written.
  * 
  * @param data_rcv - This is the local object of the structure sensor_struct. This is obtained from function queue_receive().
   
  */
 void log_data(sensor_struct data_rcv)
 {
-	switch (data_rcv.id)
+	char record[LOG_RECORD_SIZE];
+	size_t len;
+
+	if (g_log_format == LOG_FORMAT_BINARY)
 	{
+		log_segment_check();
+		//The text of a format precedes its first message in the segment so that log_export can format it
+		if (data_rcv.id == LOGMSG_RCV_ID)
+		{
+			uint16_t fmt = data_rcv.sensor_data.logmsg_data.fmt;
+			if (fmt <= LOGFMT_MAX && !(fmt_written[fmt / 8] & (1 << (fmt % 8))))
+			{
+				len = binlog_encode_fmt((uint8_t *)record, sizeof(record), fmt);
+				if (len)
+				{
+					sink_write(&logfile_sink, record, len);
+				}
+				fmt_written[fmt / 8] |= 1 << (fmt % 8);
+			}
+		}
+		int idx = block_index(data_rcv.id);
+		if (g_log_compress && idx >= 0)
+		{
+			log_block_add(idx, &data_rcv);
+			return;
+		}
+		len = binlog_encode((uint8_t *)record, sizeof(record), &data_rcv, g_log_raw);
+		if (len)
+		{
+			sink_write(&logfile_sink, record, len);
+			sink_record_end(&logfile_sink);
+		}
+		return;
+	}
 
-	case TEMP_RCV_ID:
+	len = log_format_text(record, sizeof(record), &data_rcv, &previous_state);
+	if (len == 0)
 	{
-		FILE *logfile = fopen(filename, "a");
-		fprintf(stdout, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.temp_data.data_time.tv_sec, data_rcv.sensor_data.temp_data.data_time.tv_nsec);
-		fprintf(stdout, "Temperature Value Recorded: %f %s.\n", data_rcv.sensor_data.temp_data.temp_c, UNIT);
-		fprintf(stdout, "\n***********************************\n\n");
-		fprintf(logfile, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.temp_data.data_time.tv_sec, data_rcv.sensor_data.temp_data.data_time.tv_nsec);
-		fprintf(logfile, "Temperature Value Recorded: %f %s.\n", data_rcv.sensor_data.temp_data.temp_c, UNIT);
-		fprintf(logfile, "\n***********************************\n\n");
-		fclose(logfile);
-		break;
+		return;
 	}
 
-	case LIGHT_RCV_ID:
+	fwrite(record, 1, len, stdout);
+	sink_write(&logfile_sink, record, len);
+	sink_record_end(&logfile_sink);
+}
+
+/**
+ * @brief - This function writes the binary file header if the log file is in binary format. It must be
+ * 			called once right after the log sink has been opened, and is called again by the logger for
+ * 			every new segment of a rotated log.
+ * 
+ */
+void log_header(void)
+{
+	binlog_file_header hdr;
+
+	if (g_log_format == LOG_FORMAT_BINARY)
 	{
-		FILE *logfile = fopen(filename, "a");
-		fprintf(stdout, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.light_data.data_time.tv_sec, data_rcv.sensor_data.light_data.data_time.tv_nsec);
-		fprintf(stdout, "Light Value: %f.\n", data_rcv.sensor_data.light_data.light);
-		fprintf(stdout, "Light State: %s.\n", (data_rcv.sensor_data.light_data.light_state)? "LIGHT":"DARK");
-		fprintf(stdout, "\n***********************************\n\n");
-		fprintf(logfile, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.light_data.data_time.tv_sec, data_rcv.sensor_data.light_data.data_time.tv_nsec);
-		fprintf(logfile, "Light Value: %f.\n", data_rcv.sensor_data.light_data.light);
-		fprintf(logfile, "Light State: %s.\n", (data_rcv.sensor_data.light_data.light_state)? "LIGHT":"DARK");
-		if(previous_state != data_rcv.sensor_data.light_data.light_state)
+		binlog_file_init(&hdr, g_log_raw, g_log_compress);
+		sink_write(&logfile_sink, &hdr, sizeof(hdr));
+		header_segment = logfile_sink.segments;
+		memset(fmt_written, 0, sizeof(fmt_written));
+		//Blocks being filled are carried over to the new segment
+		if (!blocks_ready)
 		{
-			fprintf(stdout, "LIGHT STATE CHANGED FROM %s to %s\n", (previous_state)? "'LIGHT'": "'DARK'", (data_rcv.sensor_data.light_data.light_state)? "'LIGHT'":"'DARK'");
-			fprintf(logfile, "LIGHT STATE CHANGED FROM %s to %s\n", (previous_state)? "'LIGHT'": "'DARK'", (data_rcv.sensor_data.light_data.light_state)? "'LIGHT'":"'DARK'");
-			previous_state = data_rcv.sensor_data.light_data.light_state;
+			for (int i = 0; i < 4; i++)
+			{
+				binlog_block_init(&blocks[i], block_ids[i], g_log_raw);
+			}
+			blocks_ready = true;
 		}
-		fprintf(logfile, "\n***********************************\n\n");
-		fclose(logfile);
-		break;
 	}
+}
 
-	case ERROR_RCV_ID:
+/**
+ * @brief - This function writes a message straight to the log sink, bypassing the logger queue. It is
+ * 			only used once the logger thread has stopped.
+ * 
+ * @param str - The message string.
+ */
+void log_string(char *str)
+{
+	sensor_struct data;
+
+	data.id = MSG_RCV_ID;
+	strncpy(data.sensor_data.msg_data.msg_str, str, sizeof(data.sensor_data.msg_data.msg_str) - 1);
+	data.sensor_data.msg_data.msg_str[sizeof(data.sensor_data.msg_data.msg_str) - 1] = '\0';
+	log_data(data);
+}
+
+/**
+ * @brief - This function logs the samples published on the sample bus since the previous call. Each
+ * 			sample is released before it is written, so that a publisher never waits for the disk.
+ * 
+ */
+void log_samples(void)
+{
+	const sensor_struct *sample;
+	sensor_struct data;
+	uint64_t taken, written;
+
+	if (log_sub == NULL)
 	{
-		FILE *logfile = fopen(filename, "a");
-		fprintf(stdout, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.error_data.data_time.tv_sec, data_rcv.sensor_data.error_data.data_time.tv_nsec);
-		fprintf(stdout, "%s.\n", data_rcv.sensor_data.error_data.error_str);
-		fprintf(stdout, "%s.\n", strerror(data_rcv.sensor_data.error_data.error_value));
-		fprintf(stdout, "\n***********************************\n\n");
-		fprintf(logfile, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.error_data.data_time.tv_sec, data_rcv.sensor_data.error_data.data_time.tv_nsec);
-		fprintf(logfile, "%s.\n", data_rcv.sensor_data.error_data.error_str);
-		fprintf(logfile, "%s.\n", strerror(data_rcv.sensor_data.error_data.error_value));
-		fprintf(logfile, "\n***********************************\n\n");
-		fclose(logfile);
-		break;
+		return;
 	}
 
-	case MSG_RCV_ID:
+	bus_clear(log_sub);
+	while ((sample = bus_next(&samples, log_sub)) != NULL)
 	{
-		FILE *logfile = fopen(filename, "a");
+		taken = lat_now();
+		lat_record(LAT_LOG_DEPTH, log_sub->backlog);
+		lat_since(LAT_LOG_QUEUE, sample->stamps.published, taken);
+		data = *sample;
+		bus_release(&samples, log_sub);
 
-		fprintf(stdout, "%s", data_rcv.sensor_data.msg_data.msg_str);
+		trace_begin("log_write");
+		log_data(data);
+		trace_end("log_write");
+		written = lat_now();
+		lat_since(LAT_LOG_WRITE, taken, written);
+		lat_since(LAT_LOG_E2E, data.stamps.posted, written);
+	}
+	log_blocks_flush(false);
+}
 
-		fprintf(logfile, "%s", data_rcv.sensor_data.msg_data.msg_str);
+/**
+ * @brief - This function writes out the compressed blocks whose first sample has waited for the flush
+ * 			age of the log sink, so that samples reach the log file as late as they would uncompressed.
+ * 			Called by the logger thread after every batch and once at exit with all set.
+ * 
+ * @param all - Write out every block that holds a sample.
+ */
+void log_blocks_flush(bool all)
+{
+	uint64_t now;
 
-		fclose(logfile);
-		break;
+	if (!g_log_compress || g_log_format != LOG_FORMAT_BINARY)
+	{
+		return;
 	}
-	case SOCK_TEMP_RCV_ID:
+	now = lat_now();
+	for (int i = 0; i < 4; i++)
 	{
-		pthread_mutex_lock(&mutex_error);
-		FILE *logfile = fopen(filename, "a");
-		fprintf(logfile, "SOCKET REQUEST RECEIVED\n");
-		fprintf(stdout, "SOCKET REQUEST RECEIVED\n");
-		fprintf(stdout, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.temp_data.data_time.tv_sec, data_rcv.sensor_data.temp_data.data_time.tv_nsec);
-		fprintf(stdout, "Temperature Value Recorded: %f.\n", data_rcv.sensor_data.temp_data.temp_c);
-		fprintf(stdout, "\n***********************************\n\n");
-		fprintf(logfile, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.temp_data.data_time.tv_sec, data_rcv.sensor_data.temp_data.data_time.tv_nsec);
-		fprintf(logfile, "Temperature Value Recorded: %f.\n", data_rcv.sensor_data.temp_data.temp_c);
-		fprintf(logfile, "\n***********************************\n\n");
-		fclose(logfile);
-		pthread_mutex_unlock(&mutex_error);
-		break;
+		if (blocks[i].enc.count && (all || now - block_opened[i] >= (uint64_t)logfile_sink.cfg.flush_ms * 1000000ULL))
+		{
+			log_block_write(&blocks[i]);
+		}
 	}
+}
 
-	case SOCK_LIGHT_RCV_ID:
+/**
+ * @brief - This function formats the counters of the compressed blocks written so far. The ratio
+ * 			compares their bytes with the bytes the same samples take as one binary record each.
+ * 
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t log_block_stats(void *arg, char *buf, size_t size)
+{
+	//Temperature and light records have the same size
+	uint64_t plain = block_samples * (sizeof(binlog_rec_header) + (g_log_raw ? sizeof(binlog_temp_raw) : sizeof(binlog_temp)));
+	int len;
+
+	(void)arg;
+	len = snprintf(buf, size, "samples=%llu blocks=%llu bytes=%llu bytes_per_sample=%.2f ratio=%.2f\n",
+				   (unsigned long long)block_samples, (unsigned long long)block_records,
+				   (unsigned long long)block_bytes, block_samples ? (double)block_bytes / block_samples : 0,
+				   block_bytes ? (double)plain / block_bytes : 0);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
+
+/**
+ * @brief - This function writes the counters of all the modules to stdout, and to the log sink when the
+ * 			log file is in text format.
+ * 
+ */
+void log_stats(void)
+{
+	char buf[STATS_BUF_SIZE];
+	size_t len;
+
+	len = stats_dump(buf, sizeof(buf));
+	if (len)
 	{
-		FILE *logfile = fopen(filename, "a");
-		fprintf(logfile, "SOCKET REQUEST RECEIVED\n");
-		fprintf(stdout, "SOCKET REQUEST RECEIVED\n");
-		fprintf(stdout, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.light_data.data_time.tv_sec, data_rcv.sensor_data.light_data.data_time.tv_nsec);
-		fprintf(stdout, "Light Value: %f.\n", data_rcv.sensor_data.light_data.light);
-		fprintf(stdout, "\n***********************************\n\n");
-		fprintf(logfile, "Timestamp: %lu seconds and %lu nanoseconds.\n", data_rcv.sensor_data.light_data.data_time.tv_sec, data_rcv.sensor_data.light_data.data_time.tv_nsec);
-		fprintf(logfile, "Light Value: %f.\n", data_rcv.sensor_data.light_data.light);
-		fprintf(logfile, "\n***********************************\n\n");
-		fclose(logfile);
-		break;
-	}
-	default:
-		break;
+		fwrite(buf, 1, len, stdout);
+		fflush(stdout);	//Stdout is fully buffered when piped to a benchmark or a supervisor
+		if (g_log_format == LOG_FORMAT_TEXT)
+		{
+			sink_write(&logfile_sink, buf, len);
+			sink_record_end(&logfile_sink);
+		}
 	}
 }
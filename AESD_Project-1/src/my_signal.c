@@ -26,12 +26,8 @@ err_t sig_init()
 	{
 		perror("ERROR: sigaction(); in sig_init() function");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
 		exit(EXIT_FAILURE);
 
 	}
@@ -39,14 +35,15 @@ err_t sig_init()
 	{
 		perror("ERROR: sigaction(); in sig_init() SIGPIPE function");
 		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		mq_close(log_mq);
 		mq_unlink(LOG_QUEUE);
-		mq_close(sock_mq);
-		mq_unlink(SOCK_QUEUE);
 		exit(EXIT_FAILURE);
 	}
+	//SIGUSR1 toggles tracing, SIGUSR2 dumps the trace
+	if (sigaction(SIGUSR1, &send_sig, NULL) || sigaction(SIGUSR2, &send_sig, NULL))
+	{
+		perror("ERROR: sigaction(); in sig_init() SIGUSR function");
+	}
 
 	return OK;
 }
@@ -71,4 +68,12 @@ void signal_handler(int signo, siginfo_t *info, void *extra)
 	{
 		printf("Sigpipe rcvd\n");
 	}
+	if (signo == SIGUSR1)
+	{
+		trace_toggle();
+	}
+	if (signo == SIGUSR2)
+	{
+		trace_request_dump();
+	}
 }
@@ -3,7 +3,8 @@
  * @file queue.c
  * @author Siddhant Jajoo and Satya Mehta
  * @brief This file consists of all the functions related to queue initialization, sending,
- * receiving, closing and unlinking.
+ * receiving, closing and unlinking. A sender never waits on a full logger queue unless the block policy
+ * is selected, and then only for a bounded time; error messages go through a priority lane.
  * @version 0.1
  * @date 2019-03-28
  * 
@@ -12,6 +13,102 @@
  */
 
 #include "queue.h"
+#include "stats.h"
+#include "trace.h"
+
+//In-process channel replacing log_mq in QUEUE_MODE_RING
+static ring_chan log_chan;
+
+//Set once queue_init() has opened every queue
+static bool queues_ready;
+
+//Producer ring of the calling thread
+static __thread uint8_t queue_role = QUEUE_ROLE_SHARED;
+
+//Counters of log_mq in QUEUE_MODE_MQUEUE, the channel keeps its own in QUEUE_MODE_RING
+static struct
+{
+	atomic_ullong sent;
+	atomic_ullong received;
+	atomic_ullong dropped;
+	atomic_ullong prio_sent;
+	atomic_ullong blocks;
+	atomic_ullong block_timeouts;
+	atomic_ullong block_ns_total;
+	atomic_ullong block_ns_max;
+	atomic_uint hwm;
+} mq_counters;
+
+/**
+ * @brief - Returns the in-process channel standing in for a message queue, or NULL if the message queue
+ * has to be used.
+ * 
+ * @param mq - Message queue descriptor.
+ * @return ring_chan* 
+ */
+static ring_chan *queue_chan(mqd_t mq)
+{
+	if (g_queue_mode != QUEUE_MODE_RING)
+	{
+		return NULL;
+	}
+	if (mq == log_mq)
+	{
+		return &log_chan;
+	}
+	return NULL;
+}
+
+/**
+ * @brief - This function selects the producer ring used by the calling thread. Every thread that sends
+ * on the queues calls it once when it starts; threads that do not share one ring under a mutex.
+ * 
+ * @param role - QUEUE_ROLE_MAIN, QUEUE_ROLE_TEMP, QUEUE_ROLE_LIGHT, QUEUE_ROLE_LOGGER, QUEUE_ROLE_SOCKET
+ * 				 or QUEUE_ROLE_TIMER.
+ */
+void queue_register(uint8_t role)
+{
+	queue_role = role;
+}
+
+/**
+ * @brief - Parses a --log-policy value, "drop", "overwrite" or "block[:<ms>]".
+ * 
+ * @param arg - The value.
+ * @return err_t 
+ */
+err_t queue_parse_policy(const char *arg)
+{
+	char *end;
+
+	if (!strcmp(arg, "drop"))
+	{
+		g_queue_policy = QUEUE_DROP_NEWEST;
+	}
+	else if (!strcmp(arg, "overwrite"))
+	{
+		g_queue_policy = QUEUE_OVERWRITE;
+	}
+	else if (!strcmp(arg, "block"))
+	{
+		g_queue_policy = QUEUE_BLOCK;
+		g_queue_block_ms = QUEUE_BLOCK_MS;
+	}
+	else if (!strncmp(arg, "block:", 6))
+	{
+		g_queue_policy = QUEUE_BLOCK;
+		g_queue_block_ms = strtoul(arg + 6, &end, 10);
+		if (end == arg + 6 || *end != '\0')
+		{
+			return FAIL;
+		}
+	}
+	else
+	{
+		return FAIL;
+	}
+	return OK;
+}
 
 /**
  * @brief - This function initializes and creates all the message queues required in the application.
@@ -24,45 +121,135 @@ int queue_init(void)
 
 	//Assigning the appropriate values to the message queues
 	attr.mq_flags = 0;
-	attr.mq_maxmsg = 20;
+	attr.mq_maxmsg = LOG_QUEUE_DEPTH;
 	attr.mq_msgsize = sizeof(sensor_struct); //Change afterwards
 	attr.mq_curmsgs = 0;
 
-	heartbeat_mq = mq_open(HEARTBEAT_QUEUE, O_RDWR | O_CREAT, 0644, &attr);
-	if (heartbeat_mq == -1)
-	{
-		perror("Heartbeat message queue initialization failed.\n");
-		exit(EXIT_FAILURE);
-	}
-
 	log_mq = mq_open(LOG_QUEUE, O_RDWR | O_CREAT, 0644, &attr);
 	if (log_mq == -1)
 	{
 		perror("Logger message queue initialization failed.\n");
-		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
 		exit(EXIT_FAILURE);
 	}
 
-	sock_mq = mq_open(SOCK_QUEUE, O_RDWR | O_CREAT, 0644, &attr);
-	if (sock_mq == -1)
+	if (g_queue_mode == QUEUE_MODE_RING)
 	{
-		perror("Socket message queue initialization failed.\n");
-		/*Closing all the previous resources and freeing memory uptil failure*/
-		mq_close(heartbeat_mq);
-		mq_unlink(HEARTBEAT_QUEUE);
-		mq_close(log_mq);
-		mq_unlink(LOG_QUEUE);
-		exit(EXIT_FAILURE);
+		if (chan_init(&log_chan, sizeof(sensor_struct), QUEUE_RING_SIZE))
+		{
+			perror("Ring channel initialization failed.\n");
+			/*Closing all the previous resources and freeing memory uptil failure*/
+			mq_close(log_mq);
+			mq_unlink(LOG_QUEUE);
+			exit(EXIT_FAILURE);
+		}
+		chan_policy(&log_chan, g_queue_policy, g_queue_block_ms);
+		stats_register("queue_log", chan_stats, &log_chan);
+	}
+	else
+	{
+		stats_register("queue_log", queue_stats, NULL);
 	}
 
+	queues_ready = true;
 	return OK;
 }
 
+/**
+ * @brief - Returns true for the messages sent through the priority lane.
+ * 
+ * @param data - The message.
+ * @return bool 
+ */
+static bool queue_urgent(const sensor_struct *data)
+{
+	return data->id == ERROR_RCV_ID || (data->id == LOGMSG_RCV_ID && data->sensor_data.logmsg_data.error);
+}
+
+/**
+ * @brief - Sends a message on a POSIX message queue according to g_queue_policy. The message queue cannot
+ * drop its oldest message without taking the most urgent one, so QUEUE_OVERWRITE drops the newest.
+ * 
+ * @param mq - Message queue descriptor.
+ * @param data_send - The message.
+ * @param prio - Priority of the message, urgent messages are sent with P2 at least.
+ */
+static void queue_mq_send(mqd_t mq, const sensor_struct *data_send, uint8_t prio)
+{
+	struct timespec start, now, deadline;
+	bool urgent = queue_urgent(data_send);
+	uint64_t depth, ns, max;
+	int res;
+
+	if (urgent && prio < P2)
+	{
+		prio = P2;
+	}
+
+	//mq_timedsend() only accepts an absolute CLOCK_REALTIME deadline, one in the past means do not wait
+	clock_gettime(CLOCK_REALTIME, &start);
+	res = mq_timedsend(mq, (const char *)data_send, sizeof(sensor_struct), prio, &start);
+	if (res == -1 && errno == ETIMEDOUT && g_queue_policy == QUEUE_BLOCK && !urgent)
+	{
+		deadline = start;
+		deadline.tv_sec += g_queue_block_ms / 1000;
+		deadline.tv_nsec += (g_queue_block_ms % 1000) * 1000000L;
+		if (deadline.tv_nsec >= 1000000000L)
+		{
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000L;
+		}
+		res = mq_timedsend(mq, (const char *)data_send, sizeof(sensor_struct), prio, &deadline);
+		if (res == -1 && errno == ETIMEDOUT)
+		{
+			atomic_fetch_add_explicit(&mq_counters.block_timeouts, 1, memory_order_relaxed);
+		}
+
+		clock_gettime(CLOCK_REALTIME, &now);
+		ns = (now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+		atomic_fetch_add_explicit(&mq_counters.blocks, 1, memory_order_relaxed);
+		atomic_fetch_add_explicit(&mq_counters.block_ns_total, ns, memory_order_relaxed);
+		max = atomic_load_explicit(&mq_counters.block_ns_max, memory_order_relaxed);
+		while (ns > max && !atomic_compare_exchange_weak_explicit(&mq_counters.block_ns_max, &max, ns,
+																   memory_order_relaxed, memory_order_relaxed))
+		{
+		}
+	}
+
+	if (res == -1)
+	{
+		if (errno == ETIMEDOUT)
+		{
+			atomic_fetch_add_explicit(&mq_counters.dropped, 1, memory_order_relaxed);
+		}
+		else if (errno != EINTR)
+		{
+			perror("ERROR: mq_timedsend(); in queue_mq_send() function");
+		}
+		return;
+	}
+
+	atomic_fetch_add_explicit(&mq_counters.sent, 1, memory_order_relaxed);
+	if (urgent)
+	{
+		atomic_fetch_add_explicit(&mq_counters.prio_sent, 1, memory_order_relaxed);
+	}
+	//The receiver counts a message after taking it, so the difference may exceed the queue by one
+	depth = atomic_load_explicit(&mq_counters.sent, memory_order_relaxed) -
+			atomic_load_explicit(&mq_counters.received, memory_order_relaxed);
+	if (depth > LOG_QUEUE_DEPTH)
+	{
+		depth = LOG_QUEUE_DEPTH;
+	}
+	if (depth > atomic_load_explicit(&mq_counters.hwm, memory_order_relaxed))
+	{
+		atomic_store_explicit(&mq_counters.hwm, depth, memory_order_relaxed);
+	}
+}
+
 /**
  * @brief - This function is used to enqueue the specified structure in the specified message queue
- * as the parameter
+ * as the parameter. A full queue is handled according to g_queue_policy, error messages skip the
+ * queue of the sender and never wait.
  * 
  * @param mq - The message queue descriptor in which the data needs to be enqueued.
  * @param data_send - The structure object consisting data. This can be obtained from functions such as:
@@ -72,14 +259,31 @@ int queue_init(void)
  */
 void queue_send(mqd_t mq, sensor_struct data_send, uint8_t loglevel, uint8_t prio)
 {
+	//Errors raised before queue_init(), e.g. by the GPIO setup, have no queue to go to
+	if (!queues_ready)
+	{
+		return;
+	}
+
 	if (loglevel & g_ll)
 	{
-		ssize_t res;
-		res = mq_send(mq, (char *)&data_send, sizeof(sensor_struct), prio);
-		if (res == -1)
+		ring_chan *chan = queue_chan(mq);
+
+		trace_instant("enqueue", data_send.id);
+		if (chan)
 		{
-			error_log("ERROR: mq_send(); in queue_send() function", ERROR_DEBUG, P2);
+			//Drops are accounted for in the channel stats
+			if (queue_urgent(&data_send))
+			{
+				chan_send_prio(chan, &data_send);
+			}
+			else
+			{
+				chan_send(chan, queue_role, &data_send);
+			}
+			return;
 		}
+		queue_mq_send(mq, &data_send, prio);
 	}
 }
 /**
@@ -92,14 +296,96 @@ sensor_struct queue_receive(mqd_t mq)
 {
 	sensor_struct data_rcv;
 	ssize_t res;
+	ring_chan *chan = queue_chan(mq);
+	if (chan)
+	{
+		chan_receive(chan, &data_rcv, -1);
+		return data_rcv;
+	}
 	res = mq_receive(mq, (char *)&data_rcv, sizeof(sensor_struct), NULL);
 	if (res == -1)
 	{
 		error_log("ERROR: mq_receive(); in queue_receive() function", ERROR_DEBUG, P2);
 	}
+	else
+	{
+		atomic_fetch_add_explicit(&mq_counters.received, 1, memory_order_relaxed);
+	}
 	return data_rcv;
 }
 
+/**
+ * @brief - This function dequeues the data from the specified message queue descriptor parameter, waiting
+ * at most timeout_ms milliseconds for a message to arrive.
+ * 
+ * @param mq - Message queue descriptor
+ * @param data_rcv - The structure in which the data received is stored.
+ * @param timeout_ms - Maximum time to wait in milliseconds.
+ * @return err_t - OK if a message was received, FAIL on timeout or error.
+ */
+err_t queue_timedreceive(mqd_t mq, sensor_struct *data_rcv, uint32_t timeout_ms)
+{
+	struct timespec deadline;
+	ssize_t res;
+	ring_chan *chan = queue_chan(mq);
+
+	if (chan)
+	{
+		return chan_receive(chan, data_rcv, timeout_ms);
+	}
+
+	//mq_timedreceive() only accepts an absolute CLOCK_REALTIME deadline
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout_ms / 1000;
+	deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	res = mq_timedreceive(mq, (char *)data_rcv, sizeof(sensor_struct), NULL, &deadline);
+	if (res == -1)
+	{
+		if (errno != ETIMEDOUT && errno != EINTR)
+		{
+			error_log("ERROR: mq_timedreceive(); in queue_timedreceive() function", ERROR_DEBUG, P2);
+		}
+		return FAIL;
+	}
+	atomic_fetch_add_explicit(&mq_counters.received, 1, memory_order_relaxed);
+	return OK;
+}
+
+/**
+ * @brief - Returns a file descriptor that becomes readable when the queue has messages, for threads that
+ * wait on several sources with poll() or epoll. The eventfd of the channel in QUEUE_MODE_RING, the
+ * message queue descriptor itself otherwise.
+ * 
+ * @param mq - Message queue descriptor
+ * @return int 
+ */
+int queue_fd(mqd_t mq)
+{
+	ring_chan *chan = queue_chan(mq);
+	return chan ? chan->efd : (int)mq;
+}
+
+/**
+ * @brief - Acknowledges the readiness reported on queue_fd(). Must be called before draining the queue
+ * with queue_timedreceive(mq, data, 0) so that a message arriving during the drain is not missed.
+ * 
+ * @param mq - Message queue descriptor
+ */
+void queue_clear(mqd_t mq)
+{
+	ring_chan *chan = queue_chan(mq);
+	if (chan)
+	{
+		chan_clear(chan);
+	}
+}
+
 /**
  * @brief - This function closes all the message queues.
  * 
@@ -107,17 +393,13 @@ sensor_struct queue_receive(mqd_t mq)
  */
 err_t queues_close(void)
 {
-	if (mq_close(heartbeat_mq))
-	{
-		perror("ERROR: mq_close(heartbeat); in queues_close() function");
-	}
 	if (mq_close(log_mq))
 	{
 		perror("ERROR: mq_close(logger); in queues_close() function");
 	}
-	if (mq_close(sock_mq))
+	if (g_queue_mode == QUEUE_MODE_RING)
 	{
-		perror("ERROR: mq_close(socket); in queues_close() function");
+		chan_free(&log_chan);
 	}
 	return OK;
 }
@@ -129,18 +411,39 @@ err_t queues_close(void)
  */
 err_t queues_unlink(void)
 {
-	if (mq_unlink(HEARTBEAT_QUEUE))
-	{
-		perror("ERROR: mq_unlink(heartbeat); in queues_unlink() function");
-	}
-
 	if (mq_unlink(LOG_QUEUE))
 	{
 		perror("ERROR: mq_unlink(logger); in queues_unlink() function");
 	}
+}
+
+/**
+ * @brief - Formats the counters of log_mq in QUEUE_MODE_MQUEUE, with the same keys as chan_stats().
+ * 
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t queue_stats(void *arg, char *buf, size_t size)
+{
+	static const char *const policies[] = {"drop", "overwrite", "block"};
+	struct mq_attr attr;
+	int len;
 
-	if (mq_unlink(SOCK_QUEUE))
+	if (mq_getattr(log_mq, &attr))
 	{
-		perror("ERROR: mq_unlink(socket); in queues_unlink() function");
+		attr.mq_curmsgs = 0;
 	}
+	len = snprintf(buf, size,
+				   "sent=%llu received=%llu dropped=%llu depth=%ld hwm=%u policy=%s blocks=%llu block_timeouts=%llu "
+				   "block_ms_total=%.1f block_us_max=%.1f prio[sent=%llu]\n",
+				   (unsigned long long)atomic_load(&mq_counters.sent), (unsigned long long)atomic_load(&mq_counters.received),
+				   (unsigned long long)atomic_load(&mq_counters.dropped), (long)attr.mq_curmsgs,
+				   atomic_load(&mq_counters.hwm), policies[g_queue_policy],
+				   (unsigned long long)atomic_load(&mq_counters.blocks),
+				   (unsigned long long)atomic_load(&mq_counters.block_timeouts),
+				   atomic_load(&mq_counters.block_ns_total) / 1e6, atomic_load(&mq_counters.block_ns_max) / 1e3,
+				   (unsigned long long)atomic_load(&mq_counters.prio_sent));
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
 }
@@ -0,0 +1,587 @@
+/**
+ * @file ring.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the lock-free single producer single consumer rings and the channel which
+ * merges one ring per producer thread into one consumer. The consumer sleeps on an eventfd which producers
+ * only signal when a ring goes from empty to non-empty. A channel has a priority lane drained first, and a
+ * backpressure policy applied when a producer ring is full: drop the new element, overwrite the oldest one
+ * or wait a bounded time for room.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "ring.h"
+
+/**
+ * @brief - This function initializes a ring. The capacity is rounded up to a power of two.
+ *
+ * @param ring - The ring to be initialized.
+ * @param elem_size - Size of one element in bytes.
+ * @param capacity - Number of elements.
+ * @return err_t
+ */
+err_t ring_init(spsc_ring *ring, uint32_t elem_size, uint32_t capacity)
+{
+	uint32_t size = 1;
+	void *data;
+
+	while (size < capacity)
+	{
+		size <<= 1;
+	}
+
+	if (posix_memalign(&data, RING_CACHE_LINE, (size_t)size * elem_size))
+	{
+		return FAIL;
+	}
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	ring->tail_cache = 0;
+	ring->head_cache = 0;
+	ring->pops = 0;
+	atomic_init(&ring->overwrites, 0);
+	ring->pushes = 0;
+	ring->drops = 0;
+	ring->wakeups = 0;
+	ring->hwm = 0;
+	ring->mask = size - 1;
+	ring->elem_size = elem_size;
+	ring->data = data;
+	return OK;
+}
+
+/**
+ * @brief - Frees the storage of a ring.
+ *
+ * @param ring - The ring.
+ */
+void ring_free(spsc_ring *ring)
+{
+	free(ring->data);
+	ring->data = NULL;
+}
+
+/**
+ * @brief - Enqueues one element. Must only be called by the producer of the ring.
+ *
+ * @param ring - The ring.
+ * @param elem - Element to be copied into the ring.
+ * @param overwrite - If the ring is full, drop its oldest element instead of the new one.
+ * @param was_empty - Set to true if the consumer had already drained the ring, i.e. it may be sleeping.
+ * 					  May be NULL.
+ * @return bool - false if the ring is full and overwrite is not set.
+ */
+bool ring_push(spsc_ring *ring, const void *elem, bool overwrite, bool *was_empty)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	if (tail - ring->head_cache > ring->mask)
+	{
+		ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+		while (tail - ring->head_cache > ring->mask)
+		{
+			if (!overwrite)
+			{
+				ring->drops++;
+				return false;
+			}
+
+			/*
+			 * The producer takes the oldest element away by moving head itself. The consumer moves head
+			 * with a compare and swap too, so exactly one of them gets the element, and a consumer that
+			 * was copying it while it is overwritten finds head moved and copies the next one instead.
+			 */
+			if (atomic_compare_exchange_strong_explicit(&ring->head, &ring->head_cache, ring->head_cache + 1,
+														memory_order_seq_cst, memory_order_acquire))
+			{
+				ring->head_cache++;
+				atomic_fetch_add_explicit(&ring->overwrites, 1, memory_order_relaxed);
+			}
+		}
+	}
+
+	memcpy(ring->data + (size_t)(tail & ring->mask) * ring->elem_size, elem, ring->elem_size);
+
+	/*
+	 * Publishing tail and reading head are both sequentially consistent, pairing with the consumer
+	 * which publishes head and then reads tail before it goes to sleep. Either the consumer sees this
+	 * element or this producer sees that the consumer had caught up with it and has to wake it.
+	 */
+	atomic_store_explicit(&ring->tail, tail + 1, memory_order_seq_cst);
+	if (was_empty)
+	{
+		*was_empty = (atomic_load_explicit(&ring->head, memory_order_seq_cst) == tail);
+	}
+	ring->pushes++;
+	return true;
+}
+
+/**
+ * @brief - Dequeues one element. Must only be called by the consumer of the ring.
+ *
+ * @param ring - The ring.
+ * @param elem - Buffer the element is copied to.
+ * @return bool - false if the ring is empty.
+ */
+bool ring_pop(spsc_ring *ring, void *elem)
+{
+	uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+	do
+	{
+		//An overwriting producer may have moved head past the copy of tail
+		if ((int32_t)(ring->tail_cache - head) <= 0)
+		{
+			ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_seq_cst);
+			if ((int32_t)(ring->tail_cache - head) <= 0)
+			{
+				return false;
+			}
+			if (ring->tail_cache - head > ring->hwm)
+			{
+				ring->hwm = ring->tail_cache - head;
+			}
+		}
+		memcpy(elem, ring->data + (size_t)(head & ring->mask) * ring->elem_size, ring->elem_size);
+
+		//Fails if the producer has overwritten the element meanwhile, head is reloaded then
+	} while (!atomic_compare_exchange_strong_explicit(&ring->head, &head, head + 1, memory_order_seq_cst,
+													  memory_order_acquire));
+	ring->pops++;
+	return true;
+}
+
+/**
+ * @brief - Returns the number of elements in the ring. Approximate when called by a third thread.
+ *
+ * @param ring - The ring.
+ * @return uint32_t
+ */
+uint32_t ring_count(spsc_ring *ring)
+{
+	return atomic_load_explicit(&ring->tail, memory_order_acquire) - atomic_load_explicit(&ring->head, memory_order_acquire);
+}
+
+/**
+ * @brief - Returns true if the ring has no room. Must only be called by the producer of the ring.
+ *
+ * @param ring - The ring.
+ * @return bool
+ */
+static bool ring_full(spsc_ring *ring)
+{
+	uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+
+	ring->head_cache = atomic_load_explicit(&ring->head, memory_order_seq_cst);
+	return tail - ring->head_cache > ring->mask;
+}
+
+/**
+ * @brief - This function initializes a channel with one ring per producer and a priority lane. The
+ * 			policy is CHAN_DROP_NEWEST until chan_policy() is called.
+ *
+ * @param chan - The channel to be initialized.
+ * @param elem_size - Size of one element in bytes.
+ * @param capacity - Number of elements per producer ring and in the priority lane.
+ * @return err_t
+ */
+err_t chan_init(ring_chan *chan, uint32_t elem_size, uint32_t capacity)
+{
+	pthread_condattr_t attr;
+
+	for (uint8_t i = 0; i < CHAN_MAX_PRODUCERS; i++)
+	{
+		if (ring_init(&chan->rings[i], elem_size, capacity))
+		{
+			while (i--)
+			{
+				ring_free(&chan->rings[i]);
+			}
+			return FAIL;
+		}
+	}
+	if (ring_init(&chan->prio, elem_size, capacity))
+	{
+		for (uint8_t i = 0; i < CHAN_MAX_PRODUCERS; i++)
+		{
+			ring_free(&chan->rings[i]);
+		}
+		return FAIL;
+	}
+
+	chan->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (chan->efd == -1)
+	{
+		for (uint8_t i = 0; i < CHAN_MAX_PRODUCERS; i++)
+		{
+			ring_free(&chan->rings[i]);
+		}
+		ring_free(&chan->prio);
+		return FAIL;
+	}
+
+	pthread_mutex_init(&chan->shared_lock, NULL);
+	pthread_mutex_init(&chan->prio_lock, NULL);
+	pthread_mutex_init(&chan->room_lock, NULL);
+
+	//Blocked producers wait on CLOCK_MONOTONIC deadlines
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&chan->room, &attr);
+	pthread_condattr_destroy(&attr);
+
+	chan->next = 0;
+	chan->policy = CHAN_DROP_NEWEST;
+	chan->block_ms = 0;
+	atomic_init(&chan->blocked, 0);
+	atomic_init(&chan->blocks, 0);
+	atomic_init(&chan->block_timeouts, 0);
+	atomic_init(&chan->block_ns_total, 0);
+	atomic_init(&chan->block_ns_max, 0);
+	return OK;
+}
+
+/**
+ * @brief - Sets what producers do when their ring is full. Must be called before the channel is used.
+ *
+ * @param chan - The channel.
+ * @param policy - CHAN_DROP_NEWEST, CHAN_OVERWRITE or CHAN_BLOCK.
+ * @param block_ms - Longest wait of a producer for CHAN_BLOCK.
+ */
+void chan_policy(ring_chan *chan, uint8_t policy, uint32_t block_ms)
+{
+	chan->policy = policy;
+	chan->block_ms = block_ms;
+}
+
+/**
+ * @brief - Frees all resources of a channel.
+ *
+ * @param chan - The channel.
+ */
+void chan_free(ring_chan *chan)
+{
+	for (uint8_t i = 0; i < CHAN_MAX_PRODUCERS; i++)
+	{
+		ring_free(&chan->rings[i]);
+	}
+	ring_free(&chan->prio);
+	close(chan->efd);
+	pthread_mutex_destroy(&chan->shared_lock);
+	pthread_mutex_destroy(&chan->prio_lock);
+	pthread_mutex_destroy(&chan->room_lock);
+	pthread_cond_destroy(&chan->room);
+}
+
+/**
+ * @brief - Waits until the consumer makes room in a full ring or block_ms have passed. Must only be called
+ * 			by the producer of the ring, with cancellation disabled.
+ *
+ * @param chan - The channel.
+ * @param ring - The ring of the calling producer.
+ */
+static void chan_wait_room(ring_chan *chan, spsc_ring *ring)
+{
+	struct timespec start, now, deadline;
+	uint64_t ns, max;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	deadline = start;
+	deadline.tv_sec += chan->block_ms / 1000;
+	deadline.tv_nsec += (chan->block_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	/*
+	 * blocked is raised before the ring is looked at again, and the consumer reads it after moving head,
+	 * both sequentially consistent: either this producer sees the room or the consumer sees it waiting.
+	 * The consumer broadcasts under room_lock, which is held from the check to the wait.
+	 */
+	pthread_mutex_lock(&chan->room_lock);
+	atomic_fetch_add(&chan->blocked, 1);
+	while (ring_full(ring))
+	{
+		if (pthread_cond_timedwait(&chan->room, &chan->room_lock, &deadline) == ETIMEDOUT)
+		{
+			atomic_fetch_add_explicit(&chan->block_timeouts, 1, memory_order_relaxed);
+			break;
+		}
+	}
+	atomic_fetch_sub(&chan->blocked, 1);
+	pthread_mutex_unlock(&chan->room_lock);
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ns = (now.tv_sec - start.tv_sec) * 1000000000ULL + now.tv_nsec - start.tv_nsec;
+	atomic_fetch_add_explicit(&chan->blocks, 1, memory_order_relaxed);
+	atomic_fetch_add_explicit(&chan->block_ns_total, ns, memory_order_relaxed);
+	max = atomic_load_explicit(&chan->block_ns_max, memory_order_relaxed);
+	while (ns > max && !atomic_compare_exchange_weak_explicit(&chan->block_ns_max, &max, ns, memory_order_relaxed,
+															   memory_order_relaxed))
+	{
+	}
+}
+
+/**
+ * @brief - Pushes one element on a producer ring according to the policy of the channel.
+ *
+ * @param chan - The channel.
+ * @param ring - The ring of the calling producer.
+ * @param elem - Element to be sent.
+ * @param was_empty - Set to true if the consumer may be sleeping.
+ * @return bool - false if the element was dropped.
+ */
+static bool chan_push(ring_chan *chan, spsc_ring *ring, const void *elem, bool *was_empty)
+{
+	bool res;
+
+	if (chan->policy == CHAN_BLOCK && ring_full(ring))
+	{
+		chan_wait_room(chan, ring);
+	}
+	res = ring_push(ring, elem, chan->policy == CHAN_OVERWRITE, was_empty);
+	if (res && *was_empty)
+	{
+		ring->wakeups++;
+	}
+	return res;
+}
+
+/**
+ * @brief - Wakes the consumer sleeping on the eventfd.
+ *
+ * @param chan - The channel.
+ */
+static void chan_wake(ring_chan *chan)
+{
+	uint64_t one = 1;
+
+	//Only fails if the counter would overflow, the consumer is awake in that case
+	if (write(chan->efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+	{
+		perror("ERROR: write(eventfd); in chan_wake() function");
+	}
+}
+
+/**
+ * @brief - Sends one element on the ring of the producer and wakes the consumer if the ring was empty.
+ * 			A full ring is handled according to the policy of the channel.
+ *
+ * @param chan - The channel.
+ * @param producer - Ring index of the calling thread. CHAN_SHARED may be used by any thread.
+ * @param elem - Element to be sent.
+ * @return bool - false if the element was dropped.
+ */
+bool chan_send(ring_chan *chan, uint8_t producer, const void *elem)
+{
+	spsc_ring *ring;
+	bool was_empty = false;
+	bool res;
+	int state;
+
+	if (producer >= CHAN_MAX_PRODUCERS)
+	{
+		producer = CHAN_SHARED;
+	}
+	ring = &chan->rings[producer];
+
+	//A producer cancelled while it waits for room would leave room_lock and shared_lock held and blocked raised,
+	//the consumer would then hang on room_lock
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	if (producer == CHAN_SHARED)
+	{
+		pthread_mutex_lock(&chan->shared_lock);
+		res = chan_push(chan, ring, elem, &was_empty);
+		pthread_mutex_unlock(&chan->shared_lock);
+	}
+	else
+	{
+		res = chan_push(chan, ring, elem, &was_empty);
+	}
+
+	if (res && was_empty)
+	{
+		chan_wake(chan);
+	}
+	pthread_setcancelstate(state, NULL);
+	return res;
+}
+
+/**
+ * @brief - Sends one element on the priority lane, which the consumer drains before the producer rings.
+ * 			Never blocks, the element is dropped if the lane is full.
+ *
+ * @param chan - The channel.
+ * @param elem - Element to be sent.
+ * @return bool - false if the element was dropped.
+ */
+bool chan_send_prio(ring_chan *chan, const void *elem)
+{
+	bool was_empty = false;
+	bool res;
+
+	pthread_mutex_lock(&chan->prio_lock);
+	res = ring_push(&chan->prio, elem, false, &was_empty);
+	if (res && was_empty)
+	{
+		chan->prio.wakeups++;
+	}
+	pthread_mutex_unlock(&chan->prio_lock);
+
+	if (res && was_empty)
+	{
+		chan_wake(chan);
+	}
+	return res;
+}
+
+/**
+ * @brief - Dequeues one element from the priority lane or else from any producer ring without blocking.
+ * 			Rings are visited round robin so that a busy producer cannot starve the others.
+ *
+ * @param chan - The channel.
+ * @param elem - Buffer the element is copied to.
+ * @return bool - false if all rings are empty.
+ */
+bool chan_tryreceive(ring_chan *chan, void *elem)
+{
+	if (ring_pop(&chan->prio, elem))
+	{
+		return true;
+	}
+	for (uint8_t i = 0; i < CHAN_MAX_PRODUCERS; i++)
+	{
+		uint32_t idx = (chan->next + i) % CHAN_MAX_PRODUCERS;
+		if (ring_pop(&chan->rings[idx], elem))
+		{
+			chan->next = (idx + 1) % CHAN_MAX_PRODUCERS;
+
+			//A producer is waiting for the room just made
+			if (atomic_load(&chan->blocked))
+			{
+				pthread_mutex_lock(&chan->room_lock);
+				pthread_cond_broadcast(&chan->room);
+				pthread_mutex_unlock(&chan->room_lock);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * @brief - Dequeues one element, sleeping on the eventfd while all rings are empty.
+ *
+ * @param chan - The channel.
+ * @param elem - Buffer the element is copied to.
+ * @param timeout_ms - Maximum time to wait in milliseconds, -1 to wait forever.
+ * @return err_t - OK if an element was received, FAIL on timeout.
+ */
+err_t chan_receive(ring_chan *chan, void *elem, int timeout_ms)
+{
+	struct pollfd pfd;
+	struct timespec start, now;
+	uint64_t count;
+	int remaining = timeout_ms;
+
+	pfd.fd = chan->efd;
+	pfd.events = POLLIN;
+	if (timeout_ms > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+
+	while (1)
+	{
+		if (chan_tryreceive(chan, elem))
+		{
+			return OK;
+		}
+		if (remaining == 0)
+		{
+			return FAIL;
+		}
+
+		if (poll(&pfd, 1, remaining) > 0)
+		{
+			//Reset the counter before looking at the rings again
+			if (read(chan->efd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+			{
+				perror("ERROR: read(eventfd); in chan_receive() function");
+			}
+		}
+
+		if (timeout_ms > 0)
+		{
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			remaining = timeout_ms - (int)((now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000);
+			if (remaining < 0)
+			{
+				remaining = 0;
+			}
+		}
+	}
+}
+
+/**
+ * @brief - Resets the eventfd of a channel. Used by consumers that wait on the eventfd with their own
+ * 			poll or epoll loop, they call it before draining the channel with chan_tryreceive().
+ *
+ * @param chan - The channel.
+ */
+void chan_clear(ring_chan *chan)
+{
+	uint64_t count;
+
+	if (read(chan->efd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+	{
+		perror("ERROR: read(eventfd); in chan_clear() function");
+	}
+}
+
+/**
+ * @brief - Formats the counters of a channel summed over all producer rings, and those of the priority lane.
+ *
+ * @param arg - The channel.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t chan_stats(void *arg, char *buf, size_t size)
+{
+	static const char *const policies[] = {"drop", "overwrite", "block"};
+	ring_chan *chan = (ring_chan *)arg;
+	uint64_t pushes = 0, pops = 0, drops = 0, overwrites = 0, wakeups = 0;
+	uint32_t depth = 0, hwm = 0;
+	int len;
+
+	for (uint8_t i = 0; i < CHAN_MAX_PRODUCERS; i++)
+	{
+		pushes += chan->rings[i].pushes;
+		pops += chan->rings[i].pops;
+		drops += chan->rings[i].drops;
+		overwrites += atomic_load_explicit(&chan->rings[i].overwrites, memory_order_relaxed);
+		wakeups += chan->rings[i].wakeups;
+		depth += ring_count(&chan->rings[i]);
+		if (chan->rings[i].hwm > hwm)
+		{
+			hwm = chan->rings[i].hwm;
+		}
+	}
+
+	len = snprintf(buf, size,
+				   "sent=%llu received=%llu dropped=%llu overwritten=%llu wakeups=%llu depth=%u hwm=%u policy=%s "
+				   "blocks=%llu block_timeouts=%llu block_ms_total=%.1f block_us_max=%.1f prio[sent=%llu dropped=%llu hwm=%u]\n",
+				   (unsigned long long)pushes, (unsigned long long)pops, (unsigned long long)drops,
+				   (unsigned long long)overwrites, (unsigned long long)wakeups, depth, hwm, policies[chan->policy],
+				   (unsigned long long)atomic_load(&chan->blocks), (unsigned long long)atomic_load(&chan->block_timeouts),
+				   atomic_load(&chan->block_ns_total) / 1e6, atomic_load(&chan->block_ns_max) / 1e3,
+				   (unsigned long long)chan->prio.pushes, (unsigned long long)chan->prio.drops, chan->prio.hwm);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
@@ -0,0 +1,571 @@
+/**
+ * @file rollup.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the rollups of the sensors: the count, minimum, maximum and mean of their
+ * samples per period, at up to ROLLUP_TIERS_MAX resolutions such as one second, one minute and one hour.
+ * Every tier is a fixed ring of buckets indexed by period number, so that a sample updates one bucket per
+ * tier and a query reads the buckets of its range directly. The logger thread writes closed buckets to a
+ * rollup file next to the log, which has one slot per bucket and therefore a fixed size, and the rings are
+ * loaded back from it when the daemon starts.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <sys/stat.h>
+#include "rollup.h"
+
+//Tiers shared by every series, from rollup_parse()
+static uint8_t ntiers;
+static uint64_t periods[ROLLUP_TIERS_MAX];
+static uint32_t depths[ROLLUP_TIERS_MAX];
+
+static rollup_series *series_list[ROLLUP_SERIES_MAX];
+static uint8_t nseries;
+static int file_fd = -1;
+static struct timespec last_persist;
+
+/**
+ * @brief - Parses the tiers, a comma separated list of "<period>:<buckets>" where the period is a number
+ * 			followed by ms, s, m, h or d, for example "1s:3600,1m:1440,1h:720".
+ *
+ * @param spec - The tiers.
+ * @return err_t
+ */
+err_t rollup_parse(const char *spec)
+{
+	uint64_t p[ROLLUP_TIERS_MAX] = {0};
+	uint32_t d[ROLLUP_TIERS_MAX] = {0};
+	uint8_t n = 0;
+	char *end;
+
+	while (*spec)
+	{
+		unsigned long value = strtoul(spec, &end, 10);
+		uint64_t unit;
+
+		if (end == spec || value == 0 || n == ROLLUP_TIERS_MAX)
+		{
+			return FAIL;
+		}
+		if (!strncmp(end, "ms", 2))
+		{
+			unit = 1000000ULL;
+			end += 2;
+		}
+		else if (*end == 's' || *end == 'm' || *end == 'h' || *end == 'd')
+		{
+			unit = (*end == 's') ? 1000000000ULL : (*end == 'm') ? 60000000000ULL : (*end == 'h') ? 3600000000000ULL
+																								  : 86400000000000ULL;
+			end++;
+		}
+		else
+		{
+			return FAIL;
+		}
+		p[n] = value * unit;
+
+		if (*end != ':')
+		{
+			return FAIL;
+		}
+		spec = end + 1;
+		value = strtoul(spec, &end, 10);
+		if (end == spec || value < 2 || value > ROLLUP_DEPTH_MAX)
+		{
+			return FAIL;
+		}
+		d[n++] = value;
+
+		if (*end == ',')
+		{
+			end++;
+		}
+		else if (*end != '\0')
+		{
+			return FAIL;
+		}
+		spec = end;
+	}
+	if (n == 0)
+	{
+		return FAIL;
+	}
+
+	ntiers = n;
+	memcpy(periods, p, sizeof(p));
+	memcpy(depths, d, sizeof(d));
+	return OK;
+}
+
+/**
+ * @brief - This function allocates the tiers of a series and adds it to the rollup file.
+ *
+ * @param series - The series.
+ * @param name - Name of the sensor, used in the stats.
+ * @return err_t
+ */
+err_t rollup_init(rollup_series *series, const char *name)
+{
+	if (ntiers == 0 && rollup_parse(ROLLUP_DEFAULT))
+	{
+		return FAIL;
+	}
+	if (nseries == ROLLUP_SERIES_MAX)
+	{
+		return FAIL;
+	}
+
+	memset(series, 0, sizeof(rollup_series));
+	series->name = name;
+	series->ntiers = ntiers;
+	for (uint8_t i = 0; i < ntiers; i++)
+	{
+		rollup_tier *tier = &series->tiers[i];
+
+		tier->period_ns = periods[i];
+		tier->depth = depths[i];
+		tier->buckets = calloc(depths[i], sizeof(rollup_bucket));
+		if (tier->buckets == NULL)
+		{
+			perror("ERROR: calloc(); in rollup_init() function");
+			while (i--)
+			{
+				free(series->tiers[i].buckets);
+			}
+			return FAIL;
+		}
+		atomic_init(&tier->closed, 0);
+	}
+	atomic_init(&series->seq, 0);
+	series_list[nseries++] = series;
+	return OK;
+}
+
+/**
+ * @brief - Adds a sample to the open bucket of every tier, opening a new bucket when the sample belongs to
+ * 			a later period. Must only be called by the thread that owns the sensor. A sample older than
+ * 			the open bucket, after the clock was stepped back, is added to the open bucket.
+ *
+ * @param series - The series.
+ * @param time - Time stamp of the sample.
+ * @param value - Celsius or lux.
+ */
+void rollup_add(rollup_series *series, const struct timespec *time, float value)
+{
+	uint64_t t = (uint64_t)time->tv_sec * 1000000000ULL + time->tv_nsec;
+	unsigned seq = atomic_load_explicit(&series->seq, memory_order_relaxed);
+
+	if (series->ntiers == 0)
+	{
+		return;
+	}
+
+	atomic_store_explicit(&series->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+
+	for (uint8_t i = 0; i < series->ntiers; i++)
+	{
+		rollup_tier *tier = &series->tiers[i];
+		uint64_t b = t / tier->period_ns;
+		rollup_bucket *bucket;
+
+		if (b > tier->open)
+		{
+			if (tier->open)
+			{
+				atomic_store_explicit(&tier->closed, tier->open, memory_order_relaxed);
+			}
+			tier->open = b;
+			bucket = &tier->buckets[b % tier->depth];
+			bucket->start_ns = b * tier->period_ns;
+			bucket->count = 0;
+			bucket->sum = 0;
+		}
+		else if (b < tier->open)
+		{
+			series->late += (i == 0);
+		}
+		bucket = &tier->buckets[tier->open % tier->depth];
+
+		if (bucket->count == 0 || value < bucket->min)
+		{
+			bucket->min = value;
+		}
+		if (bucket->count == 0 || value > bucket->max)
+		{
+			bucket->max = value;
+		}
+		bucket->count++;
+		bucket->sum += value;
+	}
+	series->samples++;
+
+	atomic_store_explicit(&series->seq, seq + 2, memory_order_release);
+}
+
+/**
+ * @brief - Copies the buckets of a tier between two period numbers, oldest first, without ever making the
+ * 			sensor thread wait. The range is cut to the buckets the ring still holds.
+ *
+ * @param series - The series.
+ * @param tier - The tier.
+ * @param first - First period number.
+ * @param last - Last period number, included.
+ * @param newest - Keep the newest max buckets of the range rather than the oldest ones.
+ * @param out - Filled with the buckets.
+ * @param max - Room in out.
+ * @return uint32_t - Number of buckets copied.
+ */
+static uint32_t rollup_copy(rollup_series *series, rollup_tier *tier, uint64_t first, uint64_t last, bool newest,
+							rollup_bucket *out, uint32_t max)
+{
+	unsigned seq;
+	uint32_t n;
+
+	while (1)
+	{
+		seq = atomic_load_explicit(&series->seq, memory_order_acquire);
+		n = 0;
+		if ((seq & 1) == 0)
+		{
+			uint64_t open = tier->open;
+			uint64_t lo = (open >= tier->depth) ? open - tier->depth + 1 : 1;
+			uint64_t hi = (last < open) ? last : open;
+
+			lo = (first > lo) ? first : lo;
+			//Empty periods keep the bucket of an older period in their slot, it is skipped
+			for (uint64_t i = 0; lo <= hi && i <= hi - lo && n < max; i++)
+			{
+				uint64_t b = newest ? hi - i : lo + i;
+				const rollup_bucket *bucket = &tier->buckets[b % tier->depth];
+
+				if (bucket->count && bucket->start_ns == b * tier->period_ns)
+				{
+					out[n++] = *bucket;
+				}
+			}
+			atomic_thread_fence(memory_order_acquire);
+			if (atomic_load_explicit(&series->seq, memory_order_relaxed) == seq)
+			{
+				break;
+			}
+		}
+		atomic_fetch_add_explicit(&series->retries, 1, memory_order_relaxed);
+	}
+
+	if (newest)
+	{
+		for (uint32_t i = 0; i < n / 2; i++)
+		{
+			rollup_bucket tmp = out[i];
+			out[i] = out[n - 1 - i];
+			out[n - 1 - i] = tmp;
+		}
+	}
+	return n;
+}
+
+/**
+ * @brief - Copies the buckets of a time range, oldest first, the open bucket included. Safe to call from
+ * 			any thread while the sensor thread adds samples.
+ *
+ * @param series - The series.
+ * @param tier - Index of the tier.
+ * @param from_ns - Start of the range.
+ * @param to_ns - End of the range, 0 for no limit.
+ * @param last - Only the newest last buckets of the range, 0 for all of them.
+ * @param out - Filled with the buckets.
+ * @param max - Room in out. A range holding more buckets is cut to its oldest max buckets, or to its
+ * 				newest ones when last is set.
+ * @return uint32_t - Number of buckets copied.
+ */
+uint32_t rollup_query(rollup_series *series, uint8_t tier, uint64_t from_ns, uint64_t to_ns, uint32_t last,
+					  rollup_bucket *out, uint32_t max)
+{
+	rollup_tier *t;
+
+	atomic_fetch_add_explicit(&series->queries, 1, memory_order_relaxed);
+	if (tier >= series->ntiers || max == 0)
+	{
+		return 0;
+	}
+	t = &series->tiers[tier];
+
+	if (last && last < max)
+	{
+		max = last;
+	}
+	return rollup_copy(series, t, from_ns / t->period_ns, (to_ns == 0) ? UINT64_MAX : to_ns / t->period_ns,
+					   last != 0, out, max);
+}
+
+/**
+ * @brief - Returns the period of a tier in nanoseconds, 0 if there is no such tier.
+ *
+ * @param tier - Index of the tier.
+ * @return uint64_t
+ */
+uint64_t rollup_period(uint8_t tier)
+{
+	return (tier < ntiers) ? periods[tier] : 0;
+}
+
+/**
+ * @brief - Fills the header of the rollup file for the current series and tiers.
+ *
+ * @param hdr - The header.
+ */
+static void rollup_header(rollup_file_hdr *hdr)
+{
+	memset(hdr, 0, sizeof(rollup_file_hdr));
+	hdr->magic = ROLLUP_MAGIC;
+	hdr->version = ROLLUP_VERSION;
+	hdr->nseries = nseries;
+	hdr->ntiers = ntiers;
+	memcpy(hdr->period_ns, periods, sizeof(periods));
+	memcpy(hdr->depth, depths, sizeof(depths));
+}
+
+/**
+ * @brief - Opens the rollup file and loads the buckets it holds. A file written with other series or tiers
+ * 			is started over. Called once all series are initialized and before the sensor threads start.
+ *
+ * @param path - The rollup file.
+ * @return err_t
+ */
+err_t rollup_open(const char *path)
+{
+	rollup_file_hdr hdr, found;
+	off_t off = sizeof(rollup_file_hdr);
+	bool load;
+
+	file_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (file_fd == -1)
+	{
+		perror("ERROR: open(); in rollup_open() function");
+		return FAIL;
+	}
+
+	rollup_header(&hdr);
+	load = (pread(file_fd, &found, sizeof(found), 0) == sizeof(found) && !memcmp(&hdr, &found, sizeof(hdr)));
+	for (uint8_t s = 0; s < nseries; s++)
+	{
+		series_list[s]->file_off = off;
+		for (uint8_t i = 0; i < ntiers; i++)
+		{
+			rollup_tier *tier = &series_list[s]->tiers[i];
+			size_t len = (size_t)tier->depth * sizeof(rollup_bucket);
+
+			if (load && pread(file_fd, tier->buckets, len, off) == (ssize_t)len)
+			{
+				//The newest bucket on file is opened again by a sample of the same period
+				for (uint32_t j = 0; j < tier->depth; j++)
+				{
+					uint64_t b = tier->buckets[j].start_ns / tier->period_ns;
+					if (tier->buckets[j].count && b > tier->open)
+					{
+						tier->open = b;
+					}
+				}
+				tier->persisted = tier->open ? tier->open - 1 : 0;
+			}
+			else
+			{
+				memset(tier->buckets, 0, len);
+			}
+			off += len;
+		}
+	}
+
+	if (!load)
+	{
+		if (ftruncate(file_fd, 0) || ftruncate(file_fd, off) || pwrite(file_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		{
+			perror("ERROR: ftruncate(); in rollup_open() function");
+			close(file_fd);
+			file_fd = -1;
+			return FAIL;
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &last_persist);
+	return OK;
+}
+
+/**
+ * @brief - Writes the buckets of a tier between two period numbers to their slots in the rollup file.
+ *
+ * @param series - The series.
+ * @param idx - Index of the tier.
+ * @param first - First period number.
+ * @param last - Last period number, included.
+ */
+static void rollup_write(rollup_series *series, uint8_t idx, uint64_t first, uint64_t last)
+{
+	static rollup_bucket run[256];
+	rollup_tier *tier = &series->tiers[idx];
+	off_t base = series->file_off;
+
+	for (uint8_t i = 0; i < idx; i++)
+	{
+		base += (off_t)series->tiers[i].depth * sizeof(rollup_bucket);
+	}
+
+	//Runs of consecutive slots, copied consistently and written with one pwrite() each
+	while (first <= last)
+	{
+		uint32_t slot = first % tier->depth;
+		uint32_t n = last - first + 1;
+		unsigned seq;
+
+		if (n > tier->depth - slot)
+		{
+			n = tier->depth - slot;
+		}
+		if (n > sizeof(run) / sizeof(run[0]))
+		{
+			n = sizeof(run) / sizeof(run[0]);
+		}
+		do
+		{
+			seq = atomic_load_explicit(&series->seq, memory_order_acquire);
+			memcpy(run, &tier->buckets[slot], n * sizeof(rollup_bucket));
+			atomic_thread_fence(memory_order_acquire);
+		} while ((seq & 1) || atomic_load_explicit(&series->seq, memory_order_relaxed) != seq);
+		first += n;
+
+		//Slots never filled since the start are left as they are on file
+		uint32_t lo = 0, hi = n;
+		while (lo < hi && run[lo].count == 0)
+		{
+			lo++;
+		}
+		while (hi > lo && run[hi - 1].count == 0)
+		{
+			hi--;
+		}
+		if (lo == hi)
+		{
+			continue;
+		}
+		if (pwrite(file_fd, run + lo, (hi - lo) * sizeof(rollup_bucket),
+				   base + (off_t)(slot + lo) * sizeof(rollup_bucket)) == -1)
+		{
+			error_log("ERROR: pwrite(); in rollup_write() function", ERROR_DEBUG, P2);
+			return;
+		}
+		atomic_fetch_add_explicit(&series->writes, hi - lo, memory_order_relaxed);
+	}
+}
+
+/**
+ * @brief - Writes the buckets closed since the previous call to the rollup file. Called by the logger
+ * 			thread, at most every ROLLUP_PERSIST_MS unless forced. Forcing also writes the open buckets,
+ * 			which is done once the sensor threads have exited.
+ *
+ * @param force - Write now, the open buckets included.
+ */
+void rollup_persist(bool force)
+{
+	struct timespec now;
+
+	if (file_fd == -1)
+	{
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!force && (now.tv_sec - last_persist.tv_sec) * 1000 + (now.tv_nsec - last_persist.tv_nsec) / 1000000 <
+					  ROLLUP_PERSIST_MS)
+	{
+		return;
+	}
+	last_persist = now;
+
+	for (uint8_t s = 0; s < nseries; s++)
+	{
+		for (uint8_t i = 0; i < series_list[s]->ntiers; i++)
+		{
+			rollup_tier *tier = &series_list[s]->tiers[i];
+			uint64_t upto = force ? tier->open : atomic_load_explicit(&tier->closed, memory_order_relaxed);
+			uint64_t first = tier->persisted + 1;
+
+			if (upto == 0 || upto < first)
+			{
+				continue;
+			}
+			//A ring holds depth periods, older ones were overwritten
+			if (upto - first >= tier->depth)
+			{
+				first = upto - tier->depth + 1;
+			}
+			rollup_write(series_list[s], i, first, upto);
+			tier->persisted = force ? upto - 1 : upto;
+		}
+	}
+}
+
+/**
+ * @brief - Closes the rollup file and frees the tiers of every series.
+ */
+void rollup_close(void)
+{
+	if (file_fd != -1)
+	{
+		close(file_fd);
+		file_fd = -1;
+	}
+	for (uint8_t s = 0; s < nseries; s++)
+	{
+		for (uint8_t i = 0; i < series_list[s]->ntiers; i++)
+		{
+			free(series_list[s]->tiers[i].buckets);
+			series_list[s]->tiers[i].buckets = NULL;
+		}
+		series_list[s]->ntiers = 0;
+	}
+	nseries = 0;
+}
+
+/**
+ * @brief - Formats the counters of a series and the open bucket of every tier.
+ *
+ * @param arg - The series.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t rollup_stats(void *arg, char *buf, size_t size)
+{
+	rollup_series *series = (rollup_series *)arg;
+	rollup_bucket bucket;
+	size_t used;
+	int len;
+
+	len = snprintf(buf, size, "samples=%llu late=%llu queries=%llu retries=%llu writes=%llu",
+				   (unsigned long long)series->samples, (unsigned long long)series->late,
+				   (unsigned long long)atomic_load(&series->queries), (unsigned long long)atomic_load(&series->retries),
+				   (unsigned long long)atomic_load(&series->writes));
+	used = (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+	for (uint8_t i = 0; i < series->ntiers && used < size - 1; i++)
+	{
+		rollup_tier *tier = &series->tiers[i];
+
+		if (rollup_copy(series, tier, 0, UINT64_MAX, true, &bucket, 1) == 0)
+		{
+			bucket.count = 0;
+		}
+		len = snprintf(buf + used, size - used, " tier%u[period_ms=%llu depth=%u count=%u min=%.3f max=%.3f mean=%.3f]",
+					   i, (unsigned long long)(tier->period_ns / 1000000), tier->depth, bucket.count,
+					   bucket.count ? bucket.min : 0, bucket.count ? bucket.max : 0,
+					   bucket.count ? bucket.sum / bucket.count : 0);
+		used += (len < 0) ? 0 : ((size_t)len >= size - used ? size - used - 1 : (size_t)len);
+	}
+	if (used < size - 1)
+	{
+		buf[used++] = '\n';
+		buf[used] = '\0';
+	}
+	return used;
+}
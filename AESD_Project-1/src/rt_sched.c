@@ -0,0 +1,268 @@
+/**
+ * @file rt_sched.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the real-time configuration of the threads. Every thread role can be given a
+ * scheduling policy and priority with --sched=<role>:<fifo|rr|other>:<priority> and a set of CPUs with
+ * --cpus=<role>:<list>. Each thread applies the settings of its role to itself when it starts, so threads
+ * restarted by the heartbeat supervisor get them too. --mlock locks the memory of the process so that
+ * page faults do not delay the sampling threads.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#define _GNU_SOURCE //CPU_SET and sched_setaffinity()
+#include "rt_sched.h"
+
+static rt_role roles[RT_ROLES] = {
+	[RT_ROLE_MAIN] = {.name = "main", .policy = SCHED_OTHER},
+	[RT_ROLE_TIMER] = {.name = "timer", .policy = SCHED_OTHER},
+	[RT_ROLE_I2C_BUS] = {.name = "i2c_bus", .policy = SCHED_OTHER},
+	[RT_ROLE_TEMP] = {.name = "temp", .policy = SCHED_OTHER},
+	[RT_ROLE_LIGHT] = {.name = "light", .policy = SCHED_OTHER},
+	[RT_ROLE_LOGGER] = {.name = "logger", .policy = SCHED_OTHER},
+	[RT_ROLE_SOCKET] = {.name = "socket", .policy = SCHED_OTHER},
+	[RT_ROLE_ARCHIVE] = {.name = "archive", .policy = SCHED_OTHER},
+};
+
+static bool configured[RT_ROLES];
+static bool mlocked;
+
+/**
+ * @brief - Finds the role named at the start of an option value.
+ *
+ * @param arg - "<role>:...".
+ * @param rest - Set to the text following the colon.
+ * @return int - The role, -1 if unknown.
+ */
+static int rt_role_find(const char *arg, const char **rest)
+{
+	const char *colon = strchr(arg, ':');
+
+	if (colon == NULL)
+	{
+		return -1;
+	}
+	for (int i = 0; i < RT_ROLES; i++)
+	{
+		if (strlen(roles[i].name) == (size_t)(colon - arg) && !strncmp(arg, roles[i].name, colon - arg))
+		{
+			*rest = colon + 1;
+			return i;
+		}
+	}
+	return -1;
+}
+
+/**
+ * @brief - Parses a --sched value, "<role>:<fifo|rr|other>:<priority>".
+ *
+ * @param arg - The value.
+ * @return err_t
+ */
+err_t rt_parse_sched(const char *arg)
+{
+	const char *rest;
+	char *end;
+	int role = rt_role_find(arg, &rest);
+	int policy;
+	long prio;
+
+	if (role == -1)
+	{
+		return FAIL;
+	}
+	if (!strncmp(rest, "fifo:", 5))
+	{
+		policy = SCHED_FIFO;
+	}
+	else if (!strncmp(rest, "rr:", 3))
+	{
+		policy = SCHED_RR;
+	}
+	else if (!strncmp(rest, "other:", 6))
+	{
+		policy = SCHED_OTHER;
+	}
+	else
+	{
+		return FAIL;
+	}
+	prio = strtol(strchr(rest, ':') + 1, &end, 10);
+	if (*end != '\0' || prio < sched_get_priority_min(policy) || prio > sched_get_priority_max(policy))
+	{
+		return FAIL;
+	}
+	roles[role].policy = policy;
+	roles[role].priority = prio;
+	configured[role] = true;
+	return OK;
+}
+
+/**
+ * @brief - Parses a --cpus value, "<role>:<list>" where the list is like "1" or "0,2-3".
+ *
+ * @param arg - The value.
+ * @return err_t
+ */
+err_t rt_parse_cpus(const char *arg)
+{
+	const char *rest;
+	char *end;
+	int role = rt_role_find(arg, &rest);
+	uint64_t cpus = 0;
+
+	if (role == -1)
+	{
+		return FAIL;
+	}
+	while (*rest)
+	{
+		unsigned long first = strtoul(rest, &end, 10);
+		unsigned long last = first;
+
+		if (end == rest)
+		{
+			return FAIL;
+		}
+		if (*end == '-')
+		{
+			rest = end + 1;
+			last = strtoul(rest, &end, 10);
+			if (end == rest)
+			{
+				return FAIL;
+			}
+		}
+		if (first > last || last >= RT_MAX_CPUS)
+		{
+			return FAIL;
+		}
+		for (unsigned long cpu = first; cpu <= last; cpu++)
+		{
+			cpus |= 1ULL << cpu;
+		}
+		if (*end == ',')
+		{
+			end++;
+		}
+		else if (*end != '\0')
+		{
+			return FAIL;
+		}
+		rest = end;
+	}
+	if (cpus == 0)
+	{
+		return FAIL;
+	}
+	roles[role].cpus = cpus;
+	configured[role] = true;
+	return OK;
+}
+
+/**
+ * @brief - Applies the scheduling policy, priority and CPUs of a role to the calling thread. Real-time
+ * 			policies need CAP_SYS_NICE or an RLIMIT_RTPRIO, a failure is logged and the thread keeps
+ * 			running with the default scheduling.
+ *
+ * @param role - RT_ROLE_MAIN to RT_ROLE_ARCHIVE.
+ */
+void rt_apply(uint8_t role)
+{
+	rt_role *r = &roles[role];
+	struct sched_param param;
+	int res;
+
+	if (!configured[role])
+	{
+		return;
+	}
+
+	if (r->cpus)
+	{
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu = 0; cpu < RT_MAX_CPUS; cpu++)
+		{
+			if (r->cpus & (1ULL << cpu))
+			{
+				CPU_SET(cpu, &set);
+			}
+		}
+		if (sched_setaffinity(0, sizeof(set), &set))
+		{
+			atomic_store(&r->result, errno);
+			error_logf("ERROR: sched_setaffinity(%u); in rt_apply() function", ERROR_DEBUG, P2, role);
+			return;
+		}
+	}
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = r->priority;
+	res = pthread_setschedparam(pthread_self(), r->policy, &param);
+	if (res)
+	{
+		atomic_store(&r->result, res);
+		error_logf("ERROR: pthread_setschedparam(%u); in rt_apply() function", ERROR_DEBUG, P2, role);
+		return;
+	}
+	atomic_store(&r->result, RT_APPLIED);
+}
+
+/**
+ * @brief - Locks the current and future pages of the process in memory, the stacks of the threads
+ * 			created afterwards included.
+ *
+ * @return err_t
+ */
+err_t rt_mlock(void)
+{
+	if (mlockall(MCL_CURRENT | MCL_FUTURE))
+	{
+		perror("ERROR: mlockall(); in rt_mlock() function");
+		return FAIL;
+	}
+	mlocked = true;
+	return OK;
+}
+
+/**
+ * @brief - Formats the configured roles and whether their threads could apply the settings.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t rt_stats(void *arg, char *buf, size_t size)
+{
+	static const char *const policies[] = {[SCHED_OTHER] = "other", [SCHED_FIFO] = "fifo", [SCHED_RR] = "rr"};
+	size_t used;
+	int len;
+
+	len = snprintf(buf, size, "mlock=%d", mlocked ? 1 : 0);
+	used = (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+	for (uint8_t i = 0; i < RT_ROLES && used < size - 1; i++)
+	{
+		int result = atomic_load(&roles[i].result);
+
+		if (!configured[i])
+		{
+			continue;
+		}
+		//error is the errno of the failure, 0 while the thread has not started
+		len = snprintf(buf + used, size - used, " %s[policy=%s prio=%d cpus=0x%llx applied=%d error=%d]",
+					   roles[i].name, policies[roles[i].policy], roles[i].priority, (unsigned long long)roles[i].cpus,
+					   result == RT_APPLIED ? 1 : 0, result == RT_APPLIED ? 0 : result);
+		used += (len < 0) ? 0 : ((size_t)len >= size - used ? size - used - 1 : (size_t)len);
+	}
+	if (used < size - 1)
+	{
+		buf[used++] = '\n';
+		buf[used] = '\0';
+	}
+	return used;
+}
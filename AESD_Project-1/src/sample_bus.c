@@ -0,0 +1,411 @@
+/**
+ * @file sample_bus.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the publish/subscribe bus the sensor threads hand their samples to. Every
+ * sample is copied once into a reference counted slot of a broadcast ring and read in place by each
+ * subscriber at its own cursor, so that adding a consumer costs neither a bus read nor a copy. A subscriber
+ * that falls a whole ring behind loses its oldest samples, or briefly holds back the publishers if it asked
+ * for BUS_BLOCK.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "sample_bus.h"
+#include "trace.h"
+
+/**
+ * @brief - Wakes up a subscriber that had nothing to read. Called with the bus lock held.
+ *
+ * @param sub - The subscriber.
+ */
+static void bus_signal(bus_sub *sub)
+{
+	uint64_t one = 1;
+
+	if (write(sub->efd, &one, sizeof(one)) == -1 && errno != EAGAIN)
+	{
+		perror("ERROR: write(eventfd); in bus_signal() function");
+	}
+}
+
+/**
+ * @brief - Moves the cursor of a lagging subscriber past a slot it has not taken, dropping its reference.
+ * 			Called with the bus lock held.
+ *
+ * @param bus - The bus.
+ * @param sub - The subscriber.
+ * @param slot - The oldest slot, about to be overwritten.
+ */
+static void bus_skip(sample_bus *bus, bus_sub *sub, bus_slot *slot)
+{
+	uint8_t bit = 1 << (sub - bus->subs);
+
+	sub->cursor = slot->seq + 1;
+	if (slot->readers & bit)
+	{
+		slot->readers &= ~bit;
+		slot->refs--;
+		sub->pending--;
+		sub->dropped++;
+	}
+}
+
+/**
+ * @brief - Waits until the oldest slot is no longer referenced so that it can be overwritten. Lagging
+ * 			subscribers lose the slot right away unless they are BUS_BLOCK, which lose it after
+ * 			BUS_BLOCK_MS. A subscriber holding the slot is always waited for. Called with the bus lock held.
+ *
+ * @param bus - The bus.
+ * @param slot - The oldest slot.
+ */
+static void bus_reclaim(sample_bus *bus, bus_slot *slot)
+{
+	struct timespec deadline;
+	bool timed_out = false;
+	bool waited = false;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_nsec += BUS_BLOCK_MS * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	while (slot->refs)
+	{
+		bool blocked = false;
+
+		for (uint32_t i = 0; i < BUS_MAX_SUBS; i++)
+		{
+			bus_sub *sub = &bus->subs[i];
+			if (!sub->active || sub->cursor > slot->seq)
+			{
+				continue;
+			}
+			if (sub->policy == BUS_BLOCK && (slot->readers & (1 << i)) && !timed_out)
+			{
+				if (!waited)
+				{
+					sub->waits++;
+				}
+				blocked = true;
+				continue;
+			}
+			bus_skip(bus, sub, slot);
+		}
+		if (slot->refs == 0)
+		{
+			break;
+		}
+
+		//Left are BUS_BLOCK subscribers and subscribers reading the slot right now
+		waited = true;
+		bus->waiting++;
+		if (blocked)
+		{
+			if (pthread_cond_timedwait(&bus->released, &bus->lock, &deadline) == ETIMEDOUT)
+			{
+				timed_out = true;
+			}
+		}
+		else
+		{
+			pthread_cond_wait(&bus->released, &bus->lock);
+		}
+		bus->waiting--;
+	}
+}
+
+/**
+ * @brief - This function initializes an empty bus without subscribers.
+ *
+ * @param bus - The bus.
+ * @return err_t
+ */
+err_t bus_init(sample_bus *bus)
+{
+	memset(bus, 0, sizeof(sample_bus));
+	for (uint32_t i = 0; i < BUS_MAX_SUBS; i++)
+	{
+		bus->subs[i].efd = -1;
+	}
+	if (pthread_mutex_init(&bus->lock, NULL))
+	{
+		perror("ERROR: pthread_mutex_init(); in bus_init() function");
+		return FAIL;
+	}
+	if (pthread_cond_init(&bus->released, NULL))
+	{
+		perror("ERROR: pthread_cond_init(); in bus_init() function");
+		pthread_mutex_destroy(&bus->lock);
+		return FAIL;
+	}
+	return OK;
+}
+
+/**
+ * @brief - This function destroys a bus and the eventfds of its subscribers.
+ *
+ * @param bus - The bus.
+ */
+void bus_destroy(sample_bus *bus)
+{
+	for (uint32_t i = 0; i < BUS_MAX_SUBS; i++)
+	{
+		if (bus->subs[i].efd != -1)
+		{
+			close(bus->subs[i].efd);
+			bus->subs[i].efd = -1;
+		}
+	}
+	if (pthread_mutex_destroy(&bus->lock))
+	{
+		perror("ERROR: pthread_mutex_destroy(); in bus_destroy() function");
+	}
+	if (pthread_cond_destroy(&bus->released))
+	{
+		perror("ERROR: pthread_cond_destroy(); in bus_destroy() function");
+	}
+}
+
+/**
+ * @brief - Adds a subscriber. It receives the samples published from now on whose topics match its mask.
+ *
+ * @param bus - The bus.
+ * @param name - Name of the subscriber, used in the stats.
+ * @param mask - BUS_TOPIC_* bits.
+ * @param policy - BUS_DROP_OLDEST or BUS_BLOCK.
+ * @return bus_sub* - NULL if all BUS_MAX_SUBS subscribers are taken.
+ */
+bus_sub *bus_subscribe(sample_bus *bus, const char *name, uint32_t mask, uint8_t policy)
+{
+	bus_sub *sub = NULL;
+
+	pthread_mutex_lock(&bus->lock);
+	for (uint32_t i = 0; i < BUS_MAX_SUBS; i++)
+	{
+		if (!bus->subs[i].active)
+		{
+			sub = &bus->subs[i];
+			break;
+		}
+	}
+	if (sub == NULL)
+	{
+		pthread_mutex_unlock(&bus->lock);
+		error_log("ERROR: no free subscriber; in bus_subscribe() function", ERROR_DEBUG, P2);
+		return NULL;
+	}
+
+	if (sub->efd == -1)
+	{
+		sub->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (sub->efd == -1)
+		{
+			pthread_mutex_unlock(&bus->lock);
+			perror("ERROR: eventfd(); in bus_subscribe() function");
+			return NULL;
+		}
+	}
+	sub->name = name;
+	sub->policy = policy;
+	sub->mask = mask;
+	sub->cursor = bus->head;
+	sub->pending = 0;
+	sub->held = NULL;
+	sub->active = true;
+	pthread_mutex_unlock(&bus->lock);
+	return sub;
+}
+
+/**
+ * @brief - Changes the topics of a subscriber. Samples already published are delivered as before.
+ *
+ * @param bus - The bus.
+ * @param sub - The subscriber.
+ * @param mask - BUS_TOPIC_* bits.
+ */
+void bus_mask(sample_bus *bus, bus_sub *sub, uint32_t mask)
+{
+	pthread_mutex_lock(&bus->lock);
+	sub->mask = mask;
+	pthread_mutex_unlock(&bus->lock);
+}
+
+/**
+ * @brief - Copies a sample into the next slot and hands it to every subscriber whose mask matches its
+ * 			topics. Subscribers that had nothing to read are woken up. Cancellation is disabled while the
+ * 			publisher waits for a slot so that it cannot leave the bus locked.
+ *
+ * @param bus - The bus.
+ * @param sample - The sample.
+ * @param topics - BUS_TOPIC_* bits.
+ */
+void bus_publish(sample_bus *bus, const sensor_struct *sample, uint32_t topics)
+{
+	bus_slot *slot;
+	int state;
+
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+	trace_begin("bus_publish");
+	pthread_mutex_lock(&bus->lock);
+
+	slot = &bus->slots[bus->head & (BUS_SLOTS - 1)];
+	if (bus->head >= BUS_SLOTS)
+	{
+		bus_reclaim(bus, slot);
+	}
+
+	slot->sample = *sample;
+	slot->seq = bus->head;
+	slot->topics = topics;
+	slot->readers = 0;
+	slot->refs = 0;
+	for (uint32_t i = 0; i < BUS_MAX_SUBS; i++)
+	{
+		bus_sub *sub = &bus->subs[i];
+		if (sub->active && (sub->mask & topics))
+		{
+			slot->readers |= 1 << i;
+			slot->refs++;
+			if (sub->pending++ == 0)
+			{
+				bus_signal(sub);
+			}
+		}
+	}
+	if (slot->refs == 0)
+	{
+		bus->unheard++;
+	}
+	bus->head++;
+	bus->published++;
+
+	pthread_mutex_unlock(&bus->lock);
+	trace_end("bus_publish");
+	pthread_setcancelstate(state, NULL);
+}
+
+/**
+ * @brief - Returns the next sample of a subscriber without copying it. The sample stays valid until
+ * 			bus_release(), which must be called before the next bus_next().
+ *
+ * @param bus - The bus.
+ * @param sub - The subscriber.
+ * @return const sensor_struct* - NULL if the subscriber has read everything.
+ */
+const sensor_struct *bus_next(sample_bus *bus, bus_sub *sub)
+{
+	uint8_t bit = 1 << (sub - bus->subs);
+
+	pthread_mutex_lock(&bus->lock);
+	while (sub->cursor < bus->head)
+	{
+		bus_slot *slot = &bus->slots[sub->cursor & (BUS_SLOTS - 1)];
+		sub->cursor++;
+		if (slot->readers & bit)
+		{
+			slot->readers &= ~bit;
+			sub->held = slot;
+			sub->backlog = sub->pending--;
+			sub->delivered++;
+			pthread_mutex_unlock(&bus->lock);
+			return &slot->sample;
+		}
+	}
+	pthread_mutex_unlock(&bus->lock);
+	return NULL;
+}
+
+/**
+ * @brief - Drops the reference of a subscriber to the sample returned by bus_next().
+ *
+ * @param bus - The bus.
+ * @param sub - The subscriber.
+ */
+void bus_release(sample_bus *bus, bus_sub *sub)
+{
+	pthread_mutex_lock(&bus->lock);
+	if (sub->held)
+	{
+		sub->held->refs--;
+		if (sub->held->refs == 0 && bus->waiting)
+		{
+			pthread_cond_broadcast(&bus->released);
+		}
+		sub->held = NULL;
+	}
+	pthread_mutex_unlock(&bus->lock);
+}
+
+/**
+ * @brief - Returns the eventfd of a subscriber for consumers that wait on several sources with poll() or
+ * 			epoll.
+ *
+ * @param sub - The subscriber.
+ * @return int
+ */
+int bus_fd(bus_sub *sub)
+{
+	return sub->efd;
+}
+
+/**
+ * @brief - Acknowledges the readiness reported on bus_fd(). Must be called before draining the subscriber
+ * 			with bus_next() so that a sample published during the drain is not missed.
+ *
+ * @param sub - The subscriber.
+ */
+void bus_clear(bus_sub *sub)
+{
+	uint64_t count;
+
+	if (read(sub->efd, &count, sizeof(count)) == -1 && errno != EAGAIN)
+	{
+		perror("ERROR: read(eventfd); in bus_clear() function");
+	}
+}
+
+/**
+ * @brief - Formats the counters of the bus and of each subscriber.
+ *
+ * @param arg - The bus.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t bus_stats(void *arg, char *buf, size_t size)
+{
+	sample_bus *bus = (sample_bus *)arg;
+	size_t used = 0;
+	int len;
+
+	pthread_mutex_lock(&bus->lock);
+	len = snprintf(buf, size, "published=%llu unheard=%llu", (unsigned long long)bus->published,
+				   (unsigned long long)bus->unheard);
+	used = (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+	for (uint32_t i = 0; i < BUS_MAX_SUBS && used < size - 1; i++)
+	{
+		bus_sub *sub = &bus->subs[i];
+		if (!sub->active)
+		{
+			continue;
+		}
+		len = snprintf(buf + used, size - used, " %s[delivered=%llu dropped=%llu waits=%llu pending=%u]", sub->name,
+					   (unsigned long long)sub->delivered, (unsigned long long)sub->dropped,
+					   (unsigned long long)sub->waits, sub->pending);
+		used += (len < 0) ? 0 : ((size_t)len >= size - used ? size - used - 1 : (size_t)len);
+	}
+	pthread_mutex_unlock(&bus->lock);
+
+	if (used < size - 1)
+	{
+		buf[used++] = '\n';
+		buf[used] = '\0';
+	}
+	return used;
+}
@@ -0,0 +1,180 @@
+/**
+ * @file sample_cache.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the latest-sample cache of each sensor. Remote requests are answered from
+ * the cached sample while it is younger than the staleness bound, otherwise the socket thread posts the
+ * request to the sensor thread, which refreshes the cache with one bus read. Requests posted while one is
+ * still pending are merged by the event bits (see event.c), so only the sensor thread ever reads the bus
+ * and no reader has to wait for another. Samples are cached raw, the unit asked for is applied when the
+ * reply is sent.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "sample_cache.h"
+
+/**
+ * @brief - Returns true if the cached sample is younger than max_age_ms. Called with the cache lock held.
+ *
+ * @param cache - The cache.
+ * @param max_age_ms - Staleness bound in milliseconds.
+ * @return bool
+ */
+static bool cache_fresh(sample_cache *cache, uint32_t max_age_ms)
+{
+	struct timespec now;
+	uint64_t age_ns;
+
+	if (!cache->valid || max_age_ms == 0)
+	{
+		return false;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	age_ns = (uint64_t)(now.tv_sec - cache->taken.tv_sec) * 1000000000ULL + now.tv_nsec - cache->taken.tv_nsec;
+	return age_ns <= (uint64_t)max_age_ms * 1000000ULL;
+}
+
+/**
+ * @brief - Stores a sample and its time. Called with the cache lock held.
+ *
+ * @param cache - The cache.
+ * @param sample - The sample.
+ */
+static void cache_store(sample_cache *cache, const sensor_struct *sample)
+{
+	cache->sample = *sample;
+	clock_gettime(CLOCK_MONOTONIC, &cache->taken);
+	cache->valid = true;
+}
+
+/**
+ * @brief - This function initializes an empty cache.
+ *
+ * @param cache - The cache.
+ * @param name - Name of the sensor.
+ * @return err_t
+ */
+err_t cache_init(sample_cache *cache, const char *name)
+{
+	memset(cache, 0, sizeof(sample_cache));
+	cache->name = name;
+	if (pthread_mutex_init(&cache->lock, NULL))
+	{
+		perror("ERROR: pthread_mutex_init(); in cache_init() function");
+		return FAIL;
+	}
+	return OK;
+}
+
+/**
+ * @brief - Stores a sample read by the periodic timer so that requests arriving shortly after it are
+ * 			served without touching the bus.
+ *
+ * @param cache - The cache.
+ * @param sample - The sample.
+ */
+void cache_put(sample_cache *cache, const sensor_struct *sample)
+{
+	pthread_mutex_lock(&cache->lock);
+	cache_store(cache, sample);
+	cache->updates++;
+	pthread_mutex_unlock(&cache->lock);
+}
+
+/**
+ * @brief - Returns the cached sample if it is fresh, without ever reading the sensor. Used by the socket
+ * 			thread, which must not block on the bus.
+ *
+ * @param cache - The cache.
+ * @param max_age_ms - Staleness bound in milliseconds.
+ * @param sample - Filled with the cached sample on a hit. May be NULL to only test for a hit.
+ * @return bool - true on a hit.
+ */
+bool cache_peek(sample_cache *cache, uint32_t max_age_ms, sensor_struct *sample)
+{
+	bool hit;
+
+	pthread_mutex_lock(&cache->lock);
+	hit = cache_fresh(cache, max_age_ms);
+	if (hit && sample)
+	{
+		*sample = cache->sample;
+		cache->hits++;
+	}
+	pthread_mutex_unlock(&cache->lock);
+	return hit;
+}
+
+/**
+ * @brief - Returns a sample no older than max_age_ms, reading the sensor on a miss. Called by the sensor
+ * 			thread that owns the cache, the only thread that reads its sensor.
+ *
+ * @param cache - The cache.
+ * @param max_age_ms - Staleness bound in milliseconds, 0 always reads the sensor.
+ * @param read - Reads a fresh sample from the sensor.
+ * @param sample - Filled with the sample.
+ * @return bool - true if this call read the sensor, i.e. the sample is new.
+ */
+bool cache_get(sample_cache *cache, uint32_t max_age_ms, cache_read_fn read, sensor_struct *sample)
+{
+	pthread_mutex_lock(&cache->lock);
+	if (cache_fresh(cache, max_age_ms))
+	{
+		cache->hits++;
+		*sample = cache->sample;
+		pthread_mutex_unlock(&cache->lock);
+		return false;
+	}
+	cache->reads++;
+	pthread_mutex_unlock(&cache->lock);
+
+	//The bus is read without the lock, so that the socket thread can still peek meanwhile
+	*sample = read();
+
+	pthread_mutex_lock(&cache->lock);
+	cache_store(cache, sample);
+	pthread_mutex_unlock(&cache->lock);
+	return true;
+}
+
+/**
+ * @brief - This function destroys a cache.
+ *
+ * @param cache - The cache.
+ * @return err_t
+ */
+err_t cache_destroy(sample_cache *cache)
+{
+	if (pthread_mutex_destroy(&cache->lock))
+	{
+		perror("ERROR: pthread_mutex_destroy(); in cache_destroy() function");
+	}
+	return OK;
+}
+
+/**
+ * @brief - Formats the counters of a cache. Requests merged while a refresh was pending are counted by
+ * 			the event stats of the sensor thread, as coalesced.
+ *
+ * @param arg - The cache.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t cache_stats(void *arg, char *buf, size_t size)
+{
+	sample_cache *cache = (sample_cache *)arg;
+	uint64_t served;
+	int len;
+
+	pthread_mutex_lock(&cache->lock);
+	served = cache->hits + cache->reads;
+	len = snprintf(buf, size, "max_age_ms=%u hits=%llu reads=%llu timer_updates=%llu hit_ratio=%.3f\n",
+				   g_cache_ms, (unsigned long long)cache->hits, (unsigned long long)cache->reads,
+				   (unsigned long long)cache->updates, served ? (double)cache->hits / served : 0);
+	pthread_mutex_unlock(&cache->lock);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
@@ -0,0 +1,95 @@
+/**
+ * @file sensor_math.c
+ * @author Satya Mehta and Siddhant Jajoo
+ * @brief Conversions from raw TMP102 and APDS-9301 register values. Kept free of any I2C access so that
+ * conversions can be deferred to the logger, the socket or the log exporter.
+ * @version 0.1
+ * @date 2019-03-28
+ * 
+ * @copyright Copyright (c) 2019
+ * 
+ */
+#include "sensor_math.h"
+
+/**
+ * @brief Converts the 12 bit two's complement TMP102 temperature register to degree celsius.
+ * 
+ * @param raw - Temperature register value right aligned to 12 bits.
+ * @return float 
+ */
+float temp_raw_to_c(uint16_t raw)
+{
+    raw &= 0x0FFF;
+    if (raw & 0x0800)
+    {
+        return ((int)raw - 0x1000) * TEMP_LSB_C;
+    }
+    return raw * TEMP_LSB_C;
+}
+
+/**
+ * @brief Converts a temperature in degree celsius to the requested unit.
+ * 
+ * @param temp_c - Temperature in degree celsius.
+ * @param unit - Specify 0, 1, 2 for celsius, kelvin, fahrenheit.
+ * @return float 
+ */
+float temp_convert(float temp_c, uint8_t unit)
+{
+    if (unit == UNIT_KELVIN)
+    {
+        return temp_c + 273; //Kelvin Computations
+    }
+    else if (unit == UNIT_FAHRENHEIT)
+    {
+        return ((9.0 / 5.0) * temp_c) + 32; //Farhenheit calculations
+    }
+    return temp_c;
+}
+
+/**
+ * @brief Returns the name of the temperature unit.
+ * 
+ * @param unit - Specify 0, 1, 2 for celsius, kelvin, fahrenheit.
+ * @return const char* 
+ */
+const char *temp_unit_name(uint8_t unit)
+{
+    return (unit == UNIT_CELSIUS) ? "Celsius" : (unit == UNIT_KELVIN) ? "Kelvin" : (unit == UNIT_FAHRENHEIT) ? "Fahrenheit" : "";
+}
+
+/**
+ * @brief Lux calculations from the APDS-9301 ADC channels.
+ * 
+ * @param adc0 - ADC channel 0 (visible and infrared).
+ * @param adc1 - ADC channel 1 (infrared).
+ * @return float 
+ */
+float lux_calc(uint16_t adc0, uint16_t adc1)
+{
+    float ratio;
+
+    if (adc0 == 0)
+    {
+        return 0;
+    }
+
+    ratio = (float)adc1 / adc0;
+    if (ratio <= 0.50)
+    {
+        return (0.0304 * adc0) - (0.062 * adc0 * pow(ratio, 1.4));
+    }
+    else if (ratio <= 0.61)
+    {
+        return (0.0224 * adc0) - (0.031 * adc1);
+    }
+    else if (ratio <= 0.80)
+    {
+        return (0.0128 * adc0) - (0.0153 * adc1);
+    }
+    else if (ratio <= 1.30)
+    {
+        return (0.00146 * adc0) - (0.00112 * adc1);
+    }
+    return 0;
+}
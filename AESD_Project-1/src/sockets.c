@@ -2,143 +2,1521 @@
  * @file sockets.c
  * @Satya Mehta and Siddhant Jajoo
  * @Functions supporting sockets initialization.
+ * The server is non-blocking and driven by epoll: every client keeps its own receive and send buffers
+ * and may pipeline requests, which are answered in order as the sensor threads reply.
  * @date 2019-03-22
- * 
+ *
  * @copyright Copyright (c) 2019
- * 
+ *
  */
 #include "sockets.h"
+#include "stats.h"
+#include "sample_cache.h"
+#include "sample_bus.h"
+#include "latency.h"
+#include "trace.h"
+#include "tsdb.h"
+#include "rollup.h"
+#include "gorilla.h"
+
+static sock_conn *conns[SOCK_MAX_CONN];
+static uint32_t conn_active;
+static uint32_t conn_gen;
+static int epfd = -1;
+static struct timespec last_sweep;
+
+//Subscription of the socket thread to the sample bus
+static bus_sub *sock_sub;
+
+//Sensors with requests that the sample cache can answer, set by conn_parse()
+static bool cached_temp, cached_light;
+
+//Server counters
+static uint64_t cache_replies;
+static uint64_t accepted, rejected, idle_closed, requests, invalid, replies, unmatched, bytes_in, bytes_out;
+static uint64_t frames_sent, frames_dropped, samples_streamed;
+static uint64_t history_queries, history_records, history_dropped, history_packed_bytes;
+static uint64_t rollup_queries, rollup_buckets, rollup_dropped;
+
+//History reply being built, the socket thread answers one query at a time
+static uint64_t history_time[WIRE_HISTORY_MAX];
+static float history_value[WIRE_HISTORY_MAX];
+static wire_record history_recs[WIRE_HISTORY_MAX];
+static uint8_t history_packed[sizeof(wire_series) + WIRE_HISTORY_MAX * GORILLA_SAMPLE_MAX];
+
+//Rollup reply being built
+static rollup_bucket rollup_found[WIRE_ROLLUP_MAX];
+static wire_bucket rollup_recs[WIRE_ROLLUP_MAX];
 
 /**
- * @Initializes socket and opens port 3124 
+ * @brief Returns the connection cap in effect
+ *
+ * @return uint32_t
  */
-void socket_init(void)
+static uint32_t sock_max_conn(void)
 {
-    port = PORT;
-    int opt = 1;
-    char string[40];
-    if ((serv = socket(AF_INET, SOCK_STREAM, 0)) < 0)
+    if (g_sock_max_conn == 0 || g_sock_max_conn > SOCK_MAX_CONN)
     {
-        error_log("ERROR: socket() initialization; in socket_init()", ERROR_DEBUG, P2);
+        return SOCK_MAX_CONN;
     }
-    bzero((char *)&serv_addr, sizeof(serv_addr));
-    serv_addr.sin_family = AF_INET;
-    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    serv_addr.sin_port = htons(port);
-    if (setsockopt(serv, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    return g_sock_max_conn;
+}
+
+/**
+ * @brief Updates the epoll interest of a connection: readable while it has room for
+ * more requests, writable while it has unsent replies
+ *
+ * @param idx - Connection slot
+ */
+static void conn_update(uint32_t idx)
+{
+    sock_conn *conn = conns[idx];
+    struct epoll_event ev;
+    uint32_t events = 0;
+
+    if (conn->count < SOCK_MAX_PENDING && conn->in_len < SOCK_IN_SIZE)
     {
-        error_log("ERROR: setsockopt() in socket_init() function", ERROR_DEBUG, P2);
+        events |= EPOLLIN;
     }
-    if (bind(serv, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    if (conn->out_len > conn->out_off)
     {
-        error_log("ERROR: bind() failed in socket_init() function", ERROR_DEBUG, P2);
+        events |= EPOLLOUT;
+    }
+    if (events == conn->events)
+    {
+        return;
     }
+
+    ev.events = events;
+    ev.data.u64 = SOCK_TAG(conn->gen, idx);
+    if (epoll_ctl(epfd, EPOLL_CTL_MOD, conn->fd, &ev) == -1)
+    {
+        error_log("ERROR: epoll_ctl(MOD); in conn_update() function", ERROR_DEBUG, P2);
+    }
+    conn->events = events;
 }
 
 /**
- * @brief Used to listen on port again
- * 
+ * @brief Recomputes the channels that have subscribers. The socket thread only receives
+ * the periodic samples of a sensor while a connection streams them.
+ *
  */
-void socket_listen()
+static void stream_update(void)
 {
-    if (listen(serv, 5) == -1)
+    uint8_t mask = 0;
+
+    for (uint32_t idx = 0; idx < SOCK_MAX_CONN; idx++)
     {
-        error_log("ERROR: listen(); in sockekt_init() function", ERROR_DEBUG, P2);
+        if (conns[idx])
+        {
+            mask |= conns[idx]->sub_mask;
+        }
     }
-    client_len = sizeof(client_addr);
-    if ((ser = accept(serv, (struct sockaddr *)&client_addr, &client_len)) == -1)
+    bus_mask(&samples, sock_sub, BUS_TOPIC_ANSWER | ((mask & SOCK_SUB_TEMP) ? BUS_TOPIC_TEMP : 0) |
+                                     ((mask & SOCK_SUB_LIGHT) ? BUS_TOPIC_LIGHT : 0));
+}
+
+/**
+ * @brief Closes a connection and frees its slot
+ *
+ * @param idx - Connection slot
+ */
+static void conn_close(uint32_t idx)
+{
+    sock_conn *conn = conns[idx];
+    bool subscribed = conn->sub_mask;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, conn->fd, NULL);
+    close(conn->fd);
+    free(conn->out);
+    free(conn);
+    conns[idx] = NULL;
+    conn_active--;
+    if (subscribed)
     {
-        error_log("ERROR: accept() in socket_init() function", ERROR_DEBUG, P2);
+        stream_update();
     }
-    else
+}
+
+/**
+ * @brief Sends as much of the send buffer as the socket accepts
+ *
+ * @param idx - Connection slot
+ * @return err_t - FAIL if the connection was closed
+ */
+static err_t conn_write(uint32_t idx)
+{
+    sock_conn *conn = conns[idx];
+    ssize_t res;
+
+    while (conn->out_off < conn->out_len)
+    {
+        trace_begin("send");
+        res = send(conn->fd, conn->out + conn->out_off, conn->out_len - conn->out_off, MSG_NOSIGNAL);
+        trace_end("send");
+        if (res == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            conn_close(idx);
+            return FAIL;
+        }
+        conn->out_off += res;
+        bytes_out += res;
+    }
+
+    if (conn->out_off == conn->out_len)
     {
-        msg_log("Connected to remote Host\n", INFO_DEBUG, P0);
+        conn->out_off = 0;
+        conn->out_len = 0;
+
+        //Giving back the room taken by a history or rollup reply
+        if (conn->out_cap > SOCK_OUT_SIZE)
+        {
+            uint8_t *out = realloc(conn->out, SOCK_OUT_SIZE);
+            if (out)
+            {
+                conn->out = out;
+                conn->out_cap = SOCK_OUT_SIZE;
+            }
+        }
     }
+    return OK;
 }
+
 /**
- * @brief Send data via socket  depending on light and temperature id's.
- * 
- * @param data_send 
+ * @brief Moves the unsent bytes to the start of the send buffer before appending
+ *
+ * @param conn - The connection
  */
+static void conn_compact(sock_conn *conn)
+{
+    if (conn->out_off)
+    {
+        memmove(conn->out, conn->out + conn->out_off, conn->out_len - conn->out_off);
+        conn->out_len -= conn->out_off;
+        conn->out_off = 0;
+    }
+}
 
-void socket_send(sensor_struct data_send)
+/**
+ * @brief Sends one wire.h message. When nothing is queued ahead of it the header and
+ * the records are handed to the kernel with a single sendmsg() straight from the
+ * caller's buffers, only the part the socket does not take is copied to the send
+ * buffer. The caller checks conn_room() first.
+ *
+ * @param idx - Connection slot
+ * @param type - WIRE_MSG_* type
+ * @param payload - Records of the message
+ * @param count - Number of records
+ * @param rec_size - Size of one record
+ * @return err_t - FAIL if the connection was closed
+ */
+static err_t conn_send(uint32_t idx, uint8_t type, const void *payload, uint16_t count, size_t rec_size)
 {
-    if (data_send.id == 5)
+    sock_conn *conn = conns[idx];
+    wire_hdr hdr;
+    struct iovec iov[2];
+    struct msghdr msg;
+    ssize_t res = 0;
+
+    hdr.length = WIRE_LENGTH(count, rec_size);
+    hdr.magic = WIRE_MAGIC;
+    hdr.version = WIRE_VERSION;
+    hdr.type = type;
+    hdr.seq = conn->tx_seq++;
+    hdr.count = count;
+    hdr.reserved = 0;
+
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = (void *)payload;
+    iov[1].iov_len = count * rec_size;
+
+    conn_compact(conn);
+    if (conn->out_len == 0)
+    {
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = iov;
+        msg.msg_iovlen = count ? 2 : 1;
+        trace_begin("send");
+        do
+        {
+            res = sendmsg(conn->fd, &msg, MSG_NOSIGNAL);
+        } while (res == -1 && errno == EINTR);
+        trace_end("send");
+
+        if (res == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                conn_close(idx);
+                return FAIL;
+            }
+            res = 0;
+        }
+        bytes_out += res;
+    }
+
+    //Queuing what the socket did not take, only history and rollup replies may not fit
+    if (conn->out_len + sizeof(hdr) + count * rec_size - res > conn->out_cap)
     {
-        send(ser, (void *)&data_send.sensor_data.temp_data.temp_c, sizeof(float), 0);
+        uint32_t cap = conn->out_len + sizeof(hdr) + count * rec_size - res;
+        uint8_t *out = realloc(conn->out, cap);
+        if (out == NULL)
+        {
+            conn_close(idx);
+            return FAIL;
+        }
+        conn->out = out;
+        conn->out_cap = cap;
     }
-    if (data_send.id == 6)
+    for (uint8_t i = 0; i < (count ? 2 : 1); i++)
     {
-        send(ser, (void *)&data_send.sensor_data.light_data.light, sizeof(float), 0);
+        size_t skip = ((size_t)res < iov[i].iov_len) ? (size_t)res : iov[i].iov_len;
+        memcpy(conn->out + conn->out_len, (uint8_t *)iov[i].iov_base + skip, iov[i].iov_len - skip);
+        conn->out_len += iov[i].iov_len - skip;
+        res -= skip;
     }
+    conn_update(idx);
+    return OK;
 }
 
 /**
- * @Read data from the socket request
- * 
- * @return int 
+ * @brief Tells whether len more bytes fit in the send buffer
+ *
+ * @param conn - The connection
+ * @param len - Bytes to be queued
+ * @return bool
  */
+static bool conn_room(sock_conn *conn, size_t len)
+{
+    return (conn->out_len - conn->out_off) + len <= SOCK_OUT_SIZE;
+}
 
-int socket_recv(void)
+/**
+ * @brief Moves the answered requests at the front of the FIFO into the send buffer
+ * and sends them, keeping replies in request order. Legacy connections get one bare
+ * float per value, framed connections one WIRE_MSG_REPLY carrying all of them.
+ *
+ * @param idx - Connection slot
+ */
+static void conn_flush(uint32_t idx)
 {
-    int len, data;
-    // len = recv(ser, (void *)&data, sizeof(data), MSG_WAITALL);
-    len = read(ser, (void *)&data, sizeof(data));
-    if (len == 0)
+    sock_conn *conn = conns[idx];
+    wire_record records[SOCK_MAX_PENDING];
+    uint16_t n = 0;
+
+    conn_compact(conn);
+
+    if (conn->framed)
     {
-        return 0;
+        while (conn->count && conn->pending[conn->head].done &&
+               conn_room(conn, sizeof(wire_hdr) + (n + 1) * sizeof(wire_record)))
+        {
+            sock_req *req = &conn->pending[conn->head];
+            records[n].id = (req->id == SOCK_TEMP_RCV_ID) ? WIRE_ID_TEMP : WIRE_ID_LIGHT;
+            records[n].unit = (req->id == SOCK_TEMP_RCV_ID) ? req->unit : WIRE_UNIT_LUX;
+            records[n].reserved = 0;
+            records[n].seq = req->tag;
+            records[n].tv_sec = req->time.tv_sec;
+            records[n].tv_nsec = req->time.tv_nsec;
+            records[n].value = req->value;
+            n++;
+            conn->head = (conn->head + 1) % SOCK_MAX_PENDING;
+            conn->count--;
+        }
+        if (n)
+        {
+            conn_send(idx, WIRE_MSG_REPLY, records, n, sizeof(wire_record));
+        }
+        else if (conn_write(idx) == OK)
+        {
+            conn_update(idx);
+        }
+        return;
+    }
+
+    while (conn->count && conn->pending[conn->head].done && conn->out_len + sizeof(float) <= SOCK_OUT_SIZE)
+    {
+        memcpy(conn->out + conn->out_len, &conn->pending[conn->head].value, sizeof(float));
+        conn->out_len += sizeof(float);
+        conn->head = (conn->head + 1) % SOCK_MAX_PENDING;
+        conn->count--;
+    }
+
+    if (conn_write(idx) == OK)
+    {
+        conn_update(idx);
     }
-    return data;
 }
+
 /**
- * @brief Calls socket receive function and sets the flag based on 
- * the request received from the remote machine
- * 
+ * @brief Sends the batched samples of a subscribed connection as one
+ * WIRE_MSG_SAMPLES message. The message is dropped if the client has not read the
+ * previous ones, the gap shows in the sequence numbers.
+ *
+ * @param idx - Connection slot
+ * @return err_t - FAIL if the connection was closed
  */
+static err_t stream_flush(uint32_t idx)
+{
+    sock_conn *conn = conns[idx];
+    uint16_t n = conn->nbatch;
+
+    if (n == 0)
+    {
+        return OK;
+    }
+
+    conn->nbatch = 0;
+    if (!conn_room(conn, sizeof(wire_hdr) + n * sizeof(wire_record)))
+    {
+        frames_dropped++;
+        return OK;
+    }
+    frames_sent++;
+    return conn_send(idx, WIRE_MSG_SAMPLES, conn->batch, n, sizeof(wire_record));
+}
 
-void handle_socket_req()
+/**
+ * @brief Sends the percentiles of the latency histograms as one WIRE_MSG_LATENCY
+ * message. Nothing is sent if the client has not read its previous messages.
+ *
+ * @param idx - Connection slot
+ * @return err_t - FAIL if the connection was closed
+ */
+static err_t conn_latency(uint32_t idx)
 {
-    switch (socket_recv())
+    wire_latency recs[LAT_HISTS];
+    uint16_t n;
+
+    requests++;
+    n = lat_fill(recs, LAT_HISTS);
+    if (!conn_room(conns[idx], sizeof(wire_hdr) + n * sizeof(wire_latency)))
+    {
+        return OK;
+    }
+    return conn_send(idx, WIRE_MSG_LATENCY, recs, n, sizeof(wire_latency));
+}
+
+/**
+ * @brief Tells whether a connection still has a history or rollup reply beyond its
+ * send buffer. Only one may be queued at a time, further queries are dropped until
+ * the client has read it.
+ *
+ * @param conn - The connection
+ * @return bool
+ */
+static bool conn_bulk_pending(const sock_conn *conn)
+{
+    return conn->out_len - conn->out_off > SOCK_OUT_SIZE;
+}
+
+/**
+ * @brief Sends the samples found for a history query as one compressed
+ * WIRE_MSG_SERIES message
+ *
+ * @param idx - Connection slot
+ * @param query - The query
+ * @param tag - seq of the WIRE_MSG_HISTORY, 0 for legacy requests
+ * @param n - Samples in history_time and history_value
+ * @return err_t - FAIL if the connection was closed
+ */
+static err_t conn_history_packed(uint32_t idx, const wire_history *query, uint32_t tag, uint32_t n)
+{
+    wire_series series;
+    gorilla_enc enc;
+    bool temp = (query->id == WIRE_ID_TEMP);
+    size_t len;
+
+    series.id = query->id;
+    series.unit = temp ? ((query->unit <= WIRE_UNIT_FAHRENHEIT) ? query->unit : WIRE_UNIT_CELSIUS) : WIRE_UNIT_LUX;
+    series.mode = GORILLA_XOR;
+    series.reserved = 0;
+    series.seq = tag;
+
+    //The buffer holds WIRE_HISTORY_MAX samples at their largest, every sample fits
+    gorilla_enc_init(&enc, history_packed + sizeof(series), sizeof(history_packed) - sizeof(series), GORILLA_XOR);
+    for (uint32_t i = 0; i < n; i++)
+    {
+        float value = temp ? temp_convert(history_value[i], series.unit) : history_value[i];
+        uint32_t bits;
+
+        memcpy(&bits, &value, sizeof(bits));
+        gorilla_enc_add(&enc, history_time[i], bits);
+    }
+    series.samples = enc.count;
+    memcpy(history_packed, &series, sizeof(series));
+    len = sizeof(series) + gorilla_enc_bytes(&enc);
+
+    history_records += n;
+    history_packed_bytes += len;
+    return conn_send(idx, WIRE_MSG_SERIES, history_packed, len, 1);
+}
+
+/**
+ * @brief Answers a history query with one WIRE_MSG_HISTORY message, or one
+ * WIRE_MSG_SERIES message for a packed query, see conn_bulk_pending().
+ *
+ * @param idx - Connection slot
+ * @param query - The query
+ * @param tag - seq of the WIRE_MSG_HISTORY, 0 for legacy requests
+ * @return err_t - FAIL if the connection was closed
+ */
+static err_t conn_history(uint32_t idx, const wire_history *query, uint32_t tag)
+{
+    sock_conn *conn = conns[idx];
+    bool temp = (query->id == WIRE_ID_TEMP);
+    uint32_t n = 0;
+
+    requests++;
+    history_queries++;
+    if (query->id != WIRE_ID_TEMP && query->id != WIRE_ID_LIGHT)
+    {
+        invalid++;
+    }
+    else
+    {
+        n = tsdb_query(temp ? &temp_series : &light_series, query->from_ns, query->to_ns, query->last, history_time,
+                       history_value, WIRE_HISTORY_MAX);
+    }
+
+    if (conn_bulk_pending(conn))
+    {
+        history_dropped++;
+        return OK;
+    }
+
+    if (query->flags & WIRE_HIST_PACKED)
+    {
+        return conn_history_packed(idx, query, tag, n);
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        wire_record *rec = &history_recs[i];
+        rec->id = query->id;
+        rec->unit = temp ? ((query->unit <= WIRE_UNIT_FAHRENHEIT) ? query->unit : WIRE_UNIT_CELSIUS) : WIRE_UNIT_LUX;
+        rec->reserved = 0;
+        rec->seq = tag;
+        rec->tv_sec = history_time[i] / 1000000000ULL;
+        rec->tv_nsec = history_time[i] % 1000000000ULL;
+        rec->value = temp ? temp_convert(history_value[i], rec->unit) : history_value[i];
+    }
+    history_records += n;
+    return conn_send(idx, WIRE_MSG_HISTORY, history_recs, n, sizeof(wire_record));
+}
+
+/**
+ * @brief Answers a rollup query with one WIRE_MSG_ROLLUP message, see
+ * conn_bulk_pending().
+ *
+ * @param idx - Connection slot
+ * @param query - The query
+ * @param tag - seq of the WIRE_MSG_ROLLUP, 0 for legacy requests
+ * @return err_t - FAIL if the connection was closed
+ */
+static err_t conn_rollup(uint32_t idx, const wire_rollup *query, uint32_t tag)
+{
+    sock_conn *conn = conns[idx];
+    bool temp = (query->id == WIRE_ID_TEMP);
+    uint32_t n = 0;
+
+    requests++;
+    rollup_queries++;
+    if ((query->id != WIRE_ID_TEMP && query->id != WIRE_ID_LIGHT) || rollup_period(query->tier) == 0)
+    {
+        invalid++;
+    }
+    else
+    {
+        n = rollup_query(temp ? &temp_rollup : &light_rollup, query->tier, query->from_ns, query->to_ns, query->last,
+                         rollup_found, WIRE_ROLLUP_MAX);
+    }
+
+    if (conn_bulk_pending(conn))
+    {
+        rollup_dropped++;
+        return OK;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        wire_bucket *rec = &rollup_recs[i];
+        const rollup_bucket *bucket = &rollup_found[i];
+        float mean = bucket->sum / bucket->count;
+
+        rec->id = query->id;
+        rec->unit = temp ? ((query->unit <= WIRE_UNIT_FAHRENHEIT) ? query->unit : WIRE_UNIT_CELSIUS) : WIRE_UNIT_LUX;
+        rec->tier = query->tier;
+        rec->reserved = 0;
+        rec->seq = tag;
+        rec->start_ns = bucket->start_ns;
+        rec->period_ms = rollup_period(query->tier) / 1000000;
+        rec->count = bucket->count;
+        //The unit conversions are linear, so they apply to the mean as well
+        rec->min = temp ? temp_convert(bucket->min, rec->unit) : bucket->min;
+        rec->max = temp ? temp_convert(bucket->max, rec->unit) : bucket->max;
+        rec->mean = temp ? temp_convert(mean, rec->unit) : mean;
+    }
+    rollup_buckets += n;
+    return conn_send(idx, WIRE_MSG_ROLLUP, rollup_recs, n, sizeof(wire_bucket));
+}
+
+/**
+ * @brief Adds a periodic sensor sample to the batch of every connection subscribed
+ * to its channel, honouring the decimation factor of each subscription
+ *
+ * @param data - TEMP_RCV_ID or LIGHT_RCV_ID sample
+ */
+static void stream_sample(const sensor_struct *data)
+{
+    uint8_t chan = (data->id == TEMP_RCV_ID) ? 0 : 1;
+    uint8_t bit = (data->id == TEMP_RCV_ID) ? SOCK_SUB_TEMP : SOCK_SUB_LIGHT;
+    wire_record rec;
+
+    memset(&rec, 0, sizeof(rec));
+    if (data->id == TEMP_RCV_ID)
+    {
+        rec.id = WIRE_ID_TEMP;
+        rec.unit = data->sensor_data.temp_data.unit;
+        rec.tv_sec = data->sensor_data.temp_data.data_time.tv_sec;
+        rec.tv_nsec = data->sensor_data.temp_data.data_time.tv_nsec;
+        rec.value = data->sensor_data.temp_data.temp_c;
+    }
+    else
+    {
+        rec.id = WIRE_ID_LIGHT;
+        rec.unit = WIRE_UNIT_LUX;
+        rec.tv_sec = data->sensor_data.light_data.data_time.tv_sec;
+        rec.tv_nsec = data->sensor_data.light_data.data_time.tv_nsec;
+        rec.value = data->sensor_data.light_data.light;
+    }
+
+    for (uint32_t idx = 0; idx < SOCK_MAX_CONN; idx++)
+    {
+        sock_conn *conn = conns[idx];
+        if (conn == NULL || !(conn->sub_mask & bit))
+        {
+            continue;
+        }
+        if (conn->sub_seen[chan]++ % conn->sub_decim)
+        {
+            continue;
+        }
+
+        rec.seq = conn->seq++;
+        conn->batch[conn->nbatch++] = rec;
+        samples_streamed++;
+        if (conn->nbatch >= conn->sub_batch)
+        {
+            stream_flush(idx);
+        }
+    }
+}
+
+/**
+ * @brief Starts or updates the streaming subscription of a connection
+ *
+ * @param conn - The connection
+ * @param mask - SOCK_SUB_TEMP and/or SOCK_SUB_LIGHT, 0 unsubscribes
+ * @param decim - Stream every decim-th sample
+ * @param batch - Samples per message
+ */
+static void stream_subscribe(sock_conn *conn, uint32_t mask, uint32_t decim, uint32_t batch)
+{
+    conn->sub_mask = mask & (SOCK_SUB_TEMP | SOCK_SUB_LIGHT);
+    conn->sub_decim = decim ? decim : 1;
+    conn->sub_batch = (batch == 0) ? 1 : ((batch > SOCK_BATCH_MAX) ? SOCK_BATCH_MAX : batch);
+    conn->sub_seen[0] = 0;
+    conn->sub_seen[1] = 0;
+    stream_update();
+}
+
+/**
+ * @brief Appends a request to the FIFO of a connection
+ *
+ * @param conn - The connection
+ * @param id - SOCK_TEMP_RCV_ID or SOCK_LIGHT_RCV_ID
+ * @param unit - Temperature unit
+ * @param tag - seq of the WIRE_MSG_REQUEST, 0 for legacy requests
+ */
+static void conn_push(sock_conn *conn, uint8_t id, uint8_t unit, uint32_t tag)
+{
+    sock_req *req = &conn->pending[(conn->head + conn->count) % SOCK_MAX_PENDING];
+
+    req->id = id;
+    req->unit = unit;
+    req->done = false;
+    req->tag = tag;
+    conn->count++;
+}
+
+/**
+ * @brief Queues the replies expected for one 100-106 command and collects the event
+ * bits to be posted to the sensor threads. The caller makes sure two entries fit.
+ *
+ * @param conn - The connection
+ * @param cmd - The command
+ * @param tag - seq of the WIRE_MSG_REQUEST, 0 for legacy requests
+ * @param temp_bits - Events for the temperature thread
+ * @param light_bits - Events for the light thread
+ */
+static void conn_command(sock_conn *conn, int cmd, uint32_t tag, uint32_t *temp_bits, uint32_t *light_bits)
+{
+    requests++;
+    switch (cmd)
     {
     case 100:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag |= TC;
-        pthread_mutex_unlock(&mutex_a);
+        conn_push(conn, SOCK_TEMP_RCV_ID, UNIT_CELSIUS, tag);
+        *temp_bits |= TC;
         break;
     case 101:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag |= TF;
-        pthread_mutex_unlock(&mutex_a);
+        conn_push(conn, SOCK_TEMP_RCV_ID, UNIT_FAHRENHEIT, tag);
+        *temp_bits |= TF;
         break;
     case 102:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag |= TK;
-        pthread_mutex_unlock(&mutex_a);
+        conn_push(conn, SOCK_TEMP_RCV_ID, UNIT_KELVIN, tag);
+        *temp_bits |= TK;
         break;
     case 103:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag |= L;
-        pthread_mutex_unlock(&mutex_a);
+        conn_push(conn, SOCK_LIGHT_RCV_ID, 0, tag);
+        *light_bits |= L;
         break;
     case 104:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag |= STATE;
-        pthread_mutex_unlock(&mutex_a);
+        conn_push(conn, SOCK_LIGHT_RCV_ID, 0, tag);
+        *light_bits |= STATE;
         break;
     case 105:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag |= TFL;
-        pthread_mutex_unlock(&mutex_a);
+        conn_push(conn, SOCK_TEMP_RCV_ID, UNIT_FAHRENHEIT, tag);
+        conn_push(conn, SOCK_LIGHT_RCV_ID, 0, tag);
+        *temp_bits |= TF;
+        *light_bits |= L;
         break;
     case 106:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag |= TKL;
-        pthread_mutex_unlock(&mutex_a);
+        conn_push(conn, SOCK_TEMP_RCV_ID, UNIT_KELVIN, tag);
+        conn_push(conn, SOCK_LIGHT_RCV_ID, 0, tag);
+        *temp_bits |= TK;
+        *light_bits |= L;
+        break;
+    default:
+        invalid++;
+        break;
+    }
+}
+
+/**
+ * @brief Parses one legacy 4 byte command
+ *
+ * @param idx - Connection slot
+ * @param off - Offset of the command in the receive buffer, advanced past it
+ * @param temp_bits - Events for the temperature thread
+ * @param light_bits - Events for the light thread
+ * @return int - 1 if a command was consumed, 0 if more data or room for the reply is
+ * needed, -1 if the connection was closed
+ */
+static int parse_legacy(uint32_t idx, uint32_t *off, uint32_t *temp_bits, uint32_t *light_bits)
+{
+    sock_conn *conn = conns[idx];
+    wire_history query;
+    wire_rollup rquery;
+    int cmd, args[3];
+
+    //105 and 106 need two entries
+    if (conn->in_len - *off < sizeof(int) || conn->count + 2 > SOCK_MAX_PENDING)
+    {
+        return 0;
+    }
+    memcpy(&cmd, conn->in + *off, sizeof(int));
+
+    switch (cmd)
+    {
+    case SOCK_SUBSCRIBE:
+        if (conn->in_len - *off < 4 * sizeof(int))
+        {
+            //Waiting for the rest of the subscription
+            return 0;
+        }
+        memcpy(args, conn->in + *off + sizeof(int), sizeof(args));
+        *off += 4 * sizeof(int);
+        requests++;
+        if (stream_flush(idx))
+        {
+            return -1;
+        }
+        stream_subscribe(conn, args[0], args[1], args[2]);
+        break;
+    case SOCK_UNSUBSCRIBE:
+        *off += sizeof(int);
+        requests++;
+        if (stream_flush(idx))
+        {
+            return -1;
+        }
+        stream_subscribe(conn, 0, 1, 1);
+        break;
+    case WIRE_HELLO:
+        if (!conn_room(conn, sizeof(wire_hdr)))
+        {
+            //Parsed again once conn_flush() has drained the send buffer
+            return 0;
+        }
+        *off += sizeof(int);
+        requests++;
+        conn->framed = true;
+        if (conn_send(idx, WIRE_MSG_HELLO, NULL, 0, 0))
+        {
+            return -1;
+        }
+        break;
+    case WIRE_LATENCY:
+        *off += sizeof(int);
+        if (conn_latency(idx))
+        {
+            return -1;
+        }
+        break;
+    case WIRE_HISTORY:
+        if (conn->in_len - *off < sizeof(int) + sizeof(wire_history))
+        {
+            //Waiting for the rest of the query
+            return 0;
+        }
+        memcpy(&query, conn->in + *off + sizeof(int), sizeof(query));
+        *off += sizeof(int) + sizeof(wire_history);
+        if (conn_history(idx, &query, 0))
+        {
+            return -1;
+        }
+        break;
+    case WIRE_ROLLUP:
+        if (conn->in_len - *off < sizeof(int) + sizeof(wire_rollup))
+        {
+            return 0;
+        }
+        memcpy(&rquery, conn->in + *off + sizeof(int), sizeof(rquery));
+        *off += sizeof(int) + sizeof(wire_rollup);
+        if (conn_rollup(idx, &rquery, 0))
+        {
+            return -1;
+        }
         break;
     default:
-        pthread_mutex_lock(&mutex_a);
-        socket_flag = 0;
-        pthread_mutex_unlock(&mutex_a);
+        *off += sizeof(int);
+        conn_command(conn, cmd, 0, temp_bits, light_bits);
         break;
     }
-}
\ No newline at end of file
+    return 1;
+}
+
+/**
+ * @brief Parses one wire.h message
+ *
+ * @param idx - Connection slot
+ * @param off - Offset of the message in the receive buffer, advanced past it
+ * @param temp_bits - Events for the temperature thread
+ * @param light_bits - Events for the light thread
+ * @return int - 1 if a message was consumed, 0 if more data is needed, -1 if the
+ * connection was closed
+ */
+static int parse_framed(uint32_t idx, uint32_t *off, uint32_t *temp_bits, uint32_t *light_bits)
+{
+    sock_conn *conn = conns[idx];
+    uint8_t *payload = conn->in + *off + sizeof(wire_hdr);
+    uint32_t payload_len;
+    wire_subscribe sub;
+    wire_history query;
+    wire_rollup rquery;
+    wire_hdr hdr;
+    int cmd;
+
+    if (conn->in_len - *off < sizeof(wire_hdr))
+    {
+        return 0;
+    }
+    memcpy(&hdr, conn->in + *off, sizeof(hdr));
+
+    //A message must fit in the receive buffer
+    if (hdr.magic != WIRE_MAGIC || hdr.version != WIRE_VERSION || hdr.length < WIRE_LENGTH(0, 0) ||
+        hdr.length > SOCK_IN_SIZE - sizeof(uint32_t))
+    {
+        invalid++;
+        conn_close(idx);
+        return -1;
+    }
+    if (conn->in_len - *off < hdr.length + sizeof(uint32_t))
+    {
+        return 0;
+    }
+    payload_len = hdr.length - WIRE_LENGTH(0, 0);
+
+    switch (hdr.type)
+    {
+    case WIRE_MSG_REQUEST:
+        if (payload_len != hdr.count * sizeof(int) || hdr.count > SOCK_MAX_PENDING / 2)
+        {
+            invalid++;
+            conn_close(idx);
+            return -1;
+        }
+        if (conn->count + 2 * hdr.count > SOCK_MAX_PENDING)
+        {
+            //Waiting for earlier replies to make room
+            return 0;
+        }
+        for (uint16_t i = 0; i < hdr.count; i++)
+        {
+            memcpy(&cmd, payload + i * sizeof(int), sizeof(int));
+            conn_command(conn, cmd, hdr.seq, temp_bits, light_bits);
+        }
+        break;
+    case WIRE_MSG_SUBSCRIBE:
+        if (payload_len < sizeof(sub))
+        {
+            invalid++;
+            break;
+        }
+        memcpy(&sub, payload, sizeof(sub));
+        requests++;
+        if (stream_flush(idx))
+        {
+            return -1;
+        }
+        stream_subscribe(conn, sub.mask, sub.decim, sub.batch);
+        break;
+    case WIRE_MSG_UNSUBSCRIBE:
+        requests++;
+        if (stream_flush(idx))
+        {
+            return -1;
+        }
+        stream_subscribe(conn, 0, 1, 1);
+        break;
+    case WIRE_MSG_HELLO:
+        requests++;
+        if (conn_room(conn, sizeof(wire_hdr)) && conn_send(idx, WIRE_MSG_HELLO, NULL, 0, 0))
+        {
+            return -1;
+        }
+        break;
+    case WIRE_MSG_LATENCY:
+        if (conn_latency(idx))
+        {
+            return -1;
+        }
+        break;
+    case WIRE_MSG_HISTORY:
+        if (payload_len < sizeof(query))
+        {
+            invalid++;
+            break;
+        }
+        memcpy(&query, payload, sizeof(query));
+        if (conn_history(idx, &query, hdr.seq))
+        {
+            return -1;
+        }
+        break;
+    case WIRE_MSG_ROLLUP:
+        if (payload_len < sizeof(rquery))
+        {
+            invalid++;
+            break;
+        }
+        memcpy(&rquery, payload, sizeof(rquery));
+        if (conn_rollup(idx, &rquery, hdr.seq))
+        {
+            return -1;
+        }
+        break;
+    default:
+        invalid++;
+        break;
+    }
+
+    *off += hdr.length + sizeof(uint32_t);
+    return 1;
+}
+
+/**
+ * @brief Parses the requests in the receive buffer, queues one entry per expected
+ * reply and posts the request to the sensor threads
+ *
+ * @param idx - Connection slot
+ */
+static void conn_parse(uint32_t idx)
+{
+    sock_conn *conn = conns[idx];
+    uint32_t off = 0;
+    uint32_t temp_bits = 0, light_bits = 0;
+    int res;
+
+    do
+    {
+        res = conn->framed ? parse_framed(idx, &off, &temp_bits, &light_bits) : parse_legacy(idx, &off, &temp_bits, &light_bits);
+    } while (res == 1);
+
+    if (res == -1)
+    {
+        return;
+    }
+
+    if (off)
+    {
+        memmove(conn->in, conn->in + off, conn->in_len - off);
+        conn->in_len -= off;
+    }
+
+    //Requests are answered from a fresh cached sample, otherwise coalesced into one sensor read
+    if (temp_bits)
+    {
+        if (cache_peek(&temp_cache, g_cache_ms, NULL))
+        {
+            cached_temp = true;
+        }
+        else
+        {
+            event_post(&temp_event, temp_bits);
+        }
+    }
+    if (light_bits)
+    {
+        if (cache_peek(&light_cache, g_cache_ms, NULL))
+        {
+            cached_light = true;
+        }
+        else
+        {
+            event_post(&light_event, light_bits);
+        }
+    }
+}
+
+/**
+ * @brief Reads everything the client has sent and parses the complete requests
+ *
+ * @param idx - Connection slot
+ */
+static void conn_read(uint32_t idx)
+{
+    sock_conn *conn = conns[idx];
+    ssize_t len;
+
+    while (conn->in_len < SOCK_IN_SIZE)
+    {
+        len = recv(conn->fd, conn->in + conn->in_len, SOCK_IN_SIZE - conn->in_len, 0);
+        if (len == 0)
+        {
+            conn_close(idx);
+            return;
+        }
+        if (len == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                break;
+            }
+            conn_close(idx);
+            return;
+        }
+        conn->in_len += len;
+        bytes_in += len;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &conn->last_active);
+    conn_parse(idx);
+    if (conns[idx])
+    {
+        conn_update(idx);
+    }
+}
+
+/**
+ * @brief Accepts all pending connections, closing the ones above the connection cap
+ *
+ */
+static void socket_accept(void)
+{
+    struct sockaddr_in client_addr;
+    socklen_t client_len;
+    struct epoll_event ev;
+    sock_conn *conn;
+    uint32_t idx;
+    int fd, opt = 1;
+
+    while (1)
+    {
+        client_len = sizeof(client_addr);
+        fd = accept(serv, (struct sockaddr *)&client_addr, &client_len);
+        if (fd == -1)
+        {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED)
+            {
+                error_log("ERROR: accept() in socket_accept() function", ERROR_DEBUG, P2);
+            }
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            return;
+        }
+
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+        //Replies are small and already batched per wakeup, Nagle would only delay them
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+
+        if (conn_active >= sock_max_conn())
+        {
+            rejected++;
+            close(fd);
+            continue;
+        }
+
+        for (idx = 0; idx < SOCK_MAX_CONN && conns[idx]; idx++)
+            ;
+        conn = calloc(1, sizeof(sock_conn));
+        if (idx == SOCK_MAX_CONN || conn == NULL)
+        {
+            free(conn);
+            rejected++;
+            close(fd);
+            continue;
+        }
+
+        conn->out = malloc(SOCK_OUT_SIZE);
+        if (conn->out == NULL)
+        {
+            free(conn);
+            rejected++;
+            close(fd);
+            continue;
+        }
+        conn->out_cap = SOCK_OUT_SIZE;
+        conn->fd = fd;
+        conn->gen = ++conn_gen;
+        conn->events = EPOLLIN;
+        clock_gettime(CLOCK_MONOTONIC, &conn->last_active);
+        ev.events = EPOLLIN;
+        ev.data.u64 = SOCK_TAG(conn->gen, idx);
+        if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        {
+            error_log("ERROR: epoll_ctl(ADD); in socket_accept() function", ERROR_DEBUG, P2);
+            free(conn->out);
+            free(conn);
+            close(fd);
+            continue;
+        }
+        conns[idx] = conn;
+        conn_active++;
+        accepted++;
+        trace_instant("accept", idx);
+        msg_logf("Connected to remote Host, connection %u, %u active\n", DEBUG, P0, idx, conn_active);
+    }
+}
+
+/**
+ * @brief Answers every request waiting for the sensor of a sample, on every connection.
+ * Temperature samples are raw, each request gets the unit it asked for.
+ *
+ * @param data - Sample with id SOCK_TEMP_RCV_ID or SOCK_LIGHT_RCV_ID
+ * @return bool - false if no request was waiting for the sample
+ */
+static bool socket_answer(const sensor_struct *data)
+{
+    struct timespec time;
+    bool matched = false;
+    float temp_c = 0;
+
+    if (data->id == SOCK_TEMP_RCV_ID)
+    {
+        temp_c = temp_raw_to_c(data->sensor_data.temp_data.raw);
+        time = data->sensor_data.temp_data.data_time;
+    }
+    else
+    {
+        time = data->sensor_data.light_data.data_time;
+    }
+
+    for (uint32_t idx = 0; idx < SOCK_MAX_CONN; idx++)
+    {
+        sock_conn *conn = conns[idx];
+        if (conn == NULL)
+        {
+            continue;
+        }
+        for (uint32_t i = 0; i < conn->count; i++)
+        {
+            sock_req *req = &conn->pending[(conn->head + i) % SOCK_MAX_PENDING];
+            if (!req->done && req->id == data->id)
+            {
+                req->value = (data->id == SOCK_TEMP_RCV_ID) ? temp_convert(temp_c, req->unit) : data->sensor_data.light_data.light;
+                req->time = time;
+                req->done = true;
+                matched = true;
+                replies++;
+            }
+        }
+    }
+    return matched;
+}
+
+/**
+ * @brief Sends the answered requests at the head of every connection and parses the
+ * requests that were waiting for room in the pending FIFO.
+ *
+ */
+static void socket_ready(void)
+{
+    for (uint32_t idx = 0; idx < SOCK_MAX_CONN; idx++)
+    {
+        if (conns[idx] && conns[idx]->count && conns[idx]->pending[conns[idx]->head].done)
+        {
+            conn_flush(idx);
+            //More requests fit now, the receive buffer may already hold some
+            if (conns[idx] && conns[idx]->in_len)
+            {
+                conn_parse(idx);
+                if (conns[idx])
+                {
+                    conn_update(idx);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * @brief Records the send and end-to-end latencies of the samples socket_replies()
+ * has just handed to the connections
+ *
+ * @param posted - Post time of the event each sample was taken for
+ * @param taken - Time each sample was taken from the sample bus
+ * @param n - Number of samples
+ */
+static void socket_sent(const uint64_t *posted, const uint64_t *taken, uint32_t n)
+{
+    uint64_t now = lat_now();
+
+    for (uint32_t i = 0; i < n; i++)
+    {
+        lat_since(LAT_SOCK_SEND, taken[i], now);
+        lat_since(LAT_SOCK_E2E, posted[i], now);
+    }
+}
+
+/**
+ * @brief Drains the samples the sample bus has for the socket thread. A reading answers
+ * every request waiting for the same sensor, on every connection. Samples are read in
+ * place on the bus.
+ *
+ */
+static void socket_replies(void)
+{
+    const sensor_struct *data;
+    uint64_t posted[SOCK_LAT_BATCH], taken[SOCK_LAT_BATCH];
+    uint32_t n = 0;
+
+    bus_clear(sock_sub);
+    while ((data = bus_next(&samples, sock_sub)) != NULL)
+    {
+        posted[n] = data->stamps.posted;
+        taken[n] = lat_now();
+        lat_record(LAT_SOCK_DEPTH, sock_sub->backlog);
+        lat_since(LAT_SOCK_QUEUE, data->stamps.published, taken[n]);
+        n++;
+
+        if (data->id == SOCK_TEMP_RCV_ID || data->id == SOCK_LIGHT_RCV_ID)
+        {
+            if (!socket_answer(data))
+            {
+                unmatched++;
+            }
+        }
+        else if (data->id == TEMP_RCV_ID || data->id == LIGHT_RCV_ID)
+        {
+            stream_sample(data);
+        }
+        bus_release(&samples, sock_sub);
+
+        if (n == SOCK_LAT_BATCH)
+        {
+            socket_ready();
+            socket_sent(posted, taken, n);
+            n = 0;
+        }
+    }
+    socket_ready();
+    socket_sent(posted, taken, n);
+}
+
+/**
+ * @brief Answers the requests conn_parse() found a fresh cached sample for. A sample
+ * that went stale in the meantime is read by the sensor thread instead.
+ *
+ */
+static void socket_cached(void)
+{
+    sensor_struct data;
+
+    //Answering makes room for requests still in the receive buffers, which may hit again
+    while (cached_temp || cached_light)
+    {
+        if (cached_temp)
+        {
+            cached_temp = false;
+            if (cache_peek(&temp_cache, g_cache_ms, &data))
+            {
+                data.id = SOCK_TEMP_RCV_ID;
+                socket_answer(&data);
+                cache_replies++;
+            }
+            else
+            {
+                event_post(&temp_event, TC);
+            }
+        }
+        if (cached_light)
+        {
+            cached_light = false;
+            if (cache_peek(&light_cache, g_cache_ms, &data))
+            {
+                data.id = SOCK_LIGHT_RCV_ID;
+                socket_answer(&data);
+                cache_replies++;
+            }
+            else
+            {
+                event_post(&light_event, L);
+            }
+        }
+        socket_ready();
+    }
+}
+
+/**
+ * @brief Sends the partially filled frames of subscribed connections and closes
+ * connections that have been idle for longer than the idle limit. Subscribed
+ * connections are never idle.
+ *
+ */
+static void socket_sweep(void)
+{
+    struct timespec now;
+    uint32_t idle = g_sock_idle_sec ? g_sock_idle_sec : SOCK_IDLE_SEC;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((now.tv_sec - last_sweep.tv_sec) * 1000 + (now.tv_nsec - last_sweep.tv_nsec) / 1000000 < SOCK_SWEEP_MS)
+    {
+        return;
+    }
+    last_sweep = now;
+
+    for (uint32_t idx = 0; idx < SOCK_MAX_CONN; idx++)
+    {
+        sock_conn *conn = conns[idx];
+        if (conn && conn->sub_mask)
+        {
+            stream_flush(idx);
+        }
+        else if (conn && (now.tv_sec - conn->last_active.tv_sec) >= (time_t)idle)
+        {
+            idle_closed++;
+            conn_close(idx);
+        }
+    }
+}
+
+/**
+ * @Initializes socket and opens port 3124
+ * The listening socket and the sample bus subscription are registered with epoll.
+ *
+ * @return err_t
+ */
+err_t socket_init(void)
+{
+    port = PORT;
+    int opt = 1;
+    struct epoll_event ev;
+
+    if ((serv = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) < 0)
+    {
+        error_log("ERROR: socket() initialization; in socket_init()", ERROR_DEBUG, P2);
+        return FAIL;
+    }
+    bzero((char *)&serv_addr, sizeof(serv_addr));
+    serv_addr.sin_family = AF_INET;
+    serv_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    serv_addr.sin_port = htons(port);
+    if (setsockopt(serv, SOL_SOCKET, SO_REUSEADDR | SO_REUSEPORT, &opt, sizeof(opt)) == -1)
+    {
+        error_log("ERROR: setsockopt() in socket_init() function", ERROR_DEBUG, P2);
+    }
+    if (bind(serv, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0)
+    {
+        error_log("ERROR: bind() failed in socket_init() function", ERROR_DEBUG, P2);
+        close(serv);
+        return FAIL;
+    }
+    if (listen(serv, SOCK_BACKLOG) == -1)
+    {
+        error_log("ERROR: listen(); in socket_init() function", ERROR_DEBUG, P2);
+        close(serv);
+        return FAIL;
+    }
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd == -1)
+    {
+        error_log("ERROR: epoll_create1(); in socket_init() function", ERROR_DEBUG, P2);
+        close(serv);
+        return FAIL;
+    }
+
+    ev.events = EPOLLIN;
+    ev.data.u64 = SOCK_TAG_LISTEN;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, serv, &ev) == -1)
+    {
+        error_log("ERROR: epoll_ctl(listen); in socket_init() function", ERROR_DEBUG, P2);
+    }
+    //Answers to requests must not be lost, the sensor threads wait for a lagging socket thread
+    sock_sub = bus_subscribe(&samples, "socket", BUS_TOPIC_ANSWER, BUS_BLOCK);
+    if (sock_sub == NULL)
+    {
+        close(epfd);
+        epfd = -1;
+        close(serv);
+        return FAIL;
+    }
+    ev.events = EPOLLIN;
+    ev.data.u64 = SOCK_TAG_REPLY;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, bus_fd(sock_sub), &ev) == -1)
+    {
+        error_log("ERROR: epoll_ctl(reply); in socket_init() function", ERROR_DEBUG, P2);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &last_sweep);
+    return OK;
+}
+
+/**
+ * @brief Waits for socket and reply events and handles them, then closes idle
+ * connections. Called in a loop by the socket thread.
+ *
+ * @param timeout_ms - Maximum time to wait for an event
+ */
+void socket_poll(int timeout_ms)
+{
+    struct epoll_event events[SOCK_MAX_EVENTS];
+    int n;
+
+    n = epoll_wait(epfd, events, SOCK_MAX_EVENTS, timeout_ms);
+    if (n == -1 && errno != EINTR)
+    {
+        error_log("ERROR: epoll_wait(); in socket_poll() function", ERROR_DEBUG, P2);
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+        uint64_t tag = events[i].data.u64;
+        uint32_t idx = (uint32_t)tag;
+
+        if (tag == SOCK_TAG_LISTEN)
+        {
+            socket_accept();
+        }
+        else if (tag == SOCK_TAG_REPLY)
+        {
+            socket_replies();
+        }
+        //A slot closed earlier in the batch may already hold a new connection, the stale events are dropped
+        else if (idx < SOCK_MAX_CONN && conns[idx] && tag == SOCK_TAG(conns[idx]->gen, idx))
+        {
+            if (events[i].events & (EPOLLERR | EPOLLHUP))
+            {
+                conn_close(idx);
+                continue;
+            }
+            if (events[i].events & EPOLLOUT)
+            {
+                conn_flush(idx);
+                //A request waiting for room in the send buffer is parsed now, conn_read() does it otherwise
+                if (conns[idx] && conns[idx]->in_len && !(events[i].events & EPOLLIN))
+                {
+                    conn_parse(idx);
+                    if (conns[idx])
+                    {
+                        conn_update(idx);
+                    }
+                }
+            }
+            if (conns[idx] && (events[i].events & EPOLLIN))
+            {
+                conn_read(idx);
+            }
+        }
+    }
+
+    socket_cached();
+    socket_sweep();
+}
+
+/**
+ * @brief Closes all connections, the listening socket and the epoll instance
+ *
+ */
+void socket_close(void)
+{
+    for (uint32_t idx = 0; idx < SOCK_MAX_CONN; idx++)
+    {
+        if (conns[idx])
+        {
+            conn_close(idx);
+        }
+    }
+    if (epfd != -1)
+    {
+        close(epfd);
+        epfd = -1;
+    }
+    close(serv);
+}
+
+/**
+ * @brief Formats the server counters
+ *
+ * @param arg - Unused
+ * @param buf - Output buffer
+ * @param size - Size of the output buffer
+ * @return size_t - Number of characters written
+ */
+size_t socket_stats(void *arg, char *buf, size_t size)
+{
+    int len;
+
+    len = snprintf(buf, size, "active=%u accepted=%llu rejected=%llu idle_closed=%llu requests=%llu invalid=%llu "
+                              "replies=%llu cache_replies=%llu unmatched=%llu frames=%llu frames_dropped=%llu samples_streamed=%llu "
+                              "history_queries=%llu history_records=%llu history_dropped=%llu history_packed_bytes=%llu rollup_queries=%llu rollup_buckets=%llu "
+                              "rollup_dropped=%llu bytes_in=%llu bytes_out=%llu\n",
+                   conn_active, (unsigned long long)accepted, (unsigned long long)rejected,
+                   (unsigned long long)idle_closed, (unsigned long long)requests, (unsigned long long)invalid,
+                   (unsigned long long)replies, (unsigned long long)cache_replies, (unsigned long long)unmatched, (unsigned long long)frames_sent,
+                   (unsigned long long)frames_dropped, (unsigned long long)samples_streamed,
+                   (unsigned long long)history_queries, (unsigned long long)history_records,
+                   (unsigned long long)history_dropped, (unsigned long long)history_packed_bytes, (unsigned long long)rollup_queries,
+                   (unsigned long long)rollup_buckets, (unsigned long long)rollup_dropped, (unsigned long long)bytes_in,
+                   (unsigned long long)bytes_out);
+    return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
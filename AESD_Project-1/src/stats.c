@@ -0,0 +1,121 @@
+/**
+ * @file stats.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the registry through which every module publishes its counters.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "stats.h"
+
+struct stats_source
+{
+	const char *name;
+	stats_fn fn;
+	void *arg;
+};
+
+static struct stats_source sources[STATS_MAX_SOURCES];
+static uint8_t source_count;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct timespec last_dump;
+
+/**
+ * @brief - This function registers a module whose counters are included in every stats dump.
+ *
+ * @param name - Name printed in front of the counters.
+ * @param fn - Callback formatting the counters.
+ * @param arg - Argument passed to the callback.
+ * @return err_t
+ */
+err_t stats_register(const char *name, stats_fn fn, void *arg)
+{
+	err_t res = FAIL;
+
+	pthread_mutex_lock(&stats_lock);
+	for (uint8_t i = 0; i < source_count; i++)
+	{
+		if (strcmp(sources[i].name, name) == 0)
+		{
+			//Re-registration replaces the previous source
+			sources[i].fn = fn;
+			sources[i].arg = arg;
+			pthread_mutex_unlock(&stats_lock);
+			return OK;
+		}
+	}
+	if (source_count < STATS_MAX_SOURCES)
+	{
+		sources[source_count].name = name;
+		sources[source_count].fn = fn;
+		sources[source_count].arg = arg;
+		source_count++;
+		res = OK;
+	}
+	pthread_mutex_unlock(&stats_lock);
+	return res;
+}
+
+/**
+ * @brief - This function formats the counters of all registered modules, one line per module.
+ *
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t stats_dump(char *buf, size_t size)
+{
+	size_t len = 0;
+	int res;
+
+	if (size == 0)
+	{
+		return 0;
+	}
+	buf[0] = '\0';
+
+	pthread_mutex_lock(&stats_lock);
+	for (uint8_t i = 0; i < source_count && len + 1 < size; i++)
+	{
+		res = snprintf(buf + len, size - len, "STATS %s: ", sources[i].name);
+		if (res < 0 || (size_t)res >= size - len)
+		{
+			break;
+		}
+		len += res;
+		len += sources[i].fn(sources[i].arg, buf + len, size - len);
+	}
+	pthread_mutex_unlock(&stats_lock);
+	return len;
+}
+
+/**
+ * @brief - Returns true once every g_stats_interval seconds. Used for the periodic dump.
+ *
+ * @return bool
+ */
+bool stats_due(void)
+{
+	struct timespec now;
+
+	if (g_stats_interval == 0)
+	{
+		return false;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (last_dump.tv_sec == 0)
+	{
+		last_dump = now;
+		return false;
+	}
+	if (now.tv_sec - last_dump.tv_sec >= g_stats_interval)
+	{
+		last_dump = now;
+		return true;
+	}
+	return false;
+}
@@ -21,43 +21,37 @@
 sensor_struct read_temp_data(uint8_t temp_unit, uint8_t id)
 {
     uint16_t temp;
-    char temp_buff[2];
-    int temp_data[2];
+    uint8_t temp_buff[2];
+    uint8_t reg = TEMP_REG;
     sensor_struct read_data;
-    write_pointer(TEMP_REG); //select temperature register
+    i2c_sample_mark mark;
 
-    if (read(i2c_open, temp_buff, 2) != 2)
+    i2c_sample_begin(&mark);
+    if (g_i2c_split)
     {
-        error_log("ERROR: read(); in read_temp_data() function", ERROR_DEBUG, P2);
+        write_pointer(TEMP_REG); //select temperature register
+        if (i2c_bus_read(TEMP_ADDR, temp_buff, 2) != 2)
+        {
+            error_log("ERROR: read(); in read_temp_data() function", ERROR_DEBUG, P2);
+        }
     }
-    temp_data[0] = (int)temp_buff[0]; //storing MSB
-    temp_data[1] = (int)temp_buff[1]; //storing LSB
+    else if (i2c_bus_write_read(TEMP_ADDR, &reg, 1, temp_buff, 2))
+    {
+        //Pointer write and register read joined by a repeated START
+        error_log("ERROR: i2c_bus_write_read(); in read_temp_data() function", ERROR_DEBUG, P2);
+    }
+    i2c_sample_end(&temp_bus_stats, &mark);
 
     read_data.id = id;
     if (clock_gettime(CLOCK_REALTIME, &read_data.sensor_data.temp_data.data_time))
     {
         error_log("ERROR: clock_gettime(); in read_temp_data() function", ERROR_DEBUG, P2);
     }
-    temp = ((((uint16_t)temp_data[0]) << 4) | (temp_data[1] >> 4)) & 0x0FFF;
-    float final_temp;
-    if (temp_data[0] & 0x80)
-    {
-        final_temp = ((~temp)+1) * 0.0625;
-    }
-    else
-    {
-        final_temp = 0.0625 * temp;
-    }
-    read_data.sensor_data.temp_data.temp_c = final_temp;
-    //read_data.sensor_data.temp_data.temp_c = (float)((temp_data[0] << 8 | temp_data[1]) >> 4) * 0.0625; //referred calculations from http://bildr.org/2011/01/tmp102-arduino/
-    if (temp_unit == 1)
-    {
-        read_data.sensor_data.temp_data.temp_c = read_data.sensor_data.temp_data.temp_c + 273; //Kelvin Computations
-    }
-    else if (temp_unit == 2)
-    {
-        read_data.sensor_data.temp_data.temp_c = ((9.0 / 5.0) * (read_data.sensor_data.temp_data.temp_c)) + 32; //Farhenheit calculations
-    }
+    //MSB holds bits 11:4 and the upper nibble of the LSB holds bits 3:0
+    temp = ((((uint16_t)temp_buff[0]) << 4) | (temp_buff[1] >> 4)) & 0x0FFF;
+    read_data.sensor_data.temp_data.raw = temp;
+    read_data.sensor_data.temp_data.unit = temp_unit;
+    read_data.sensor_data.temp_data.temp_c = temp_convert(temp_raw_to_c(temp), temp_unit);
     return read_data;
 }
 
@@ -75,7 +69,7 @@ uint16_t read_temp_reg(uint8_t reg)
     uint8_t data[2];
     uint16_t final;
     write_pointer(reg);
-    if (read(i2c_open, &data, 2) != 2)
+    if (i2c_bus_read(TEMP_ADDR, &data, 2) != 2)
     {
         error_log("ERROR: read(); in read_temp_reg() function", ERROR_DEBUG, P2);
     }
@@ -94,7 +88,7 @@ uint16_t read_config()
     int rc;
     uint16_t data;
     write_pointer(CONFIG_REG);
-    rc = read(i2c_open, &data, 2);
+    rc = i2c_bus_read(TEMP_ADDR, &data, 2);
     printf("No of bytes read %d\n\n", rc);
     // printf("READ LSB %x", data[1]);
     return data;
@@ -146,7 +140,7 @@ err_t write_config(uint16_t data)
     buff[1] = temp;
     buff[2] = (uint8_t)data;
     write_pointer(CONFIG_REG);
-    if ((rc = write(i2c_open, buff, 3)) != 3)
+    if ((rc = i2c_bus_write(TEMP_ADDR, buff, 3)) != 3)
     {
         error_log("ERROR: write(); in write_config function", ERROR_DEBUG, P2);
         perror("In write config");
@@ -170,7 +164,7 @@ err_t write_tlow(uint16_t data)
     read_buff[1] = data >> 4;
     read_buff[2] = data << 4;
     uint8_t buff[3] = {TLOW_REG, read_buff[1], read_buff[2]};
-    if ((rc = write(i2c_open, &buff, 3)) != 3)
+    if ((rc = i2c_bus_write(TEMP_ADDR, &buff, 3)) != 3)
     {
         error_log("ERROR: write(); in write_thigh() function", ERROR_DEBUG, P2);
     }
@@ -288,7 +282,7 @@ err_t write_thigh(uint16_t data)
     read_buff[1] = data >> 4;
     read_buff[2] = data << 4;
     uint8_t buff[3] = {THIGH_REG, read_buff[1], read_buff[2]};
-    if ((rc = write(i2c_open, &buff, 3)) != 3)
+    if ((rc = i2c_bus_write(TEMP_ADDR, &buff, 3)) != 3)
     {
         error_log("ERROR: write(); in write_thigh() function", ERROR_DEBUG, P2);
     }
@@ -304,11 +298,7 @@ err_t write_thigh(uint16_t data)
 err_t write_pointer(uint8_t reg)
 {
     int rc;
-    if (ioctl(i2c_open, I2C_SLAVE, TEMP_ADDR) < 0)
-    {
-        error_log("ERROR: ioctl(); in write_pointer() function", ERROR_DEBUG, P2);
-    }
-    if ((rc = write(i2c_open, &reg, 1)) != 1)
+    if ((rc = i2c_bus_write(TEMP_ADDR, &reg, 1)) != 1)
     {
         error_log("ERROR: write(); in write_pointer() function", ERROR_DEBUG, P2);
     }
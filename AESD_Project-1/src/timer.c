@@ -1,7 +1,9 @@
 /**
  * @file timer.c
  * @author Siddhant Jajoo and Satya Mehta
- * @brief All function related to timer have been defined in this file.
+ * @brief All function related to timer have been defined in this file. A single reactor thread owns
+ * every periodic task: each task is a timerfd armed with absolute CLOCK_MONOTONIC deadlines and all of
+ * them are waited on with one epoll instance.
  * @version 0.1
  * @date 2019-03-28
  * 
@@ -10,168 +12,351 @@
  */
 
 #include "timer.h"
+#include "queue.h"
+#include "stats.h"
+#include "latency.h"
+#include "trace.h"
+#include "rt_sched.h"
+#include "jitter.h"
+
+static reactor_timer timers[TIMER_MAX];
+static uint8_t timer_count;
+static int epoll_fd = -1;
+static pthread_t reactor_tid;
+static bool reactor_running;
 
 /**
- * @brief - This function creates and starts the respective timer.
+ * @brief - Adds nanoseconds to a timespec.
  * 
- * @param timer_handle - This signifies which timer needs to be initialized.
- * The values can be:   TIMER_TEMP
- *                      TIMER_LIGHT
- *                      TIMER_HB
- * @return err_t - Error value (0 for success)
+ * @param ts - Time to be advanced.
+ * @param ns - Nanoseconds to add.
  */
-err_t timer_init(uint8_t timer_handle)
+static void timespec_add(struct timespec *ts, uint64_t ns)
 {
-    if (timer_handle == TIMER_TEMP)
+    ns += ts->tv_nsec;
+    ts->tv_sec += ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+/**
+ * @brief - Records one wakeup of a timer: the number of expiries, the overruns and how late the reactor
+ * ran compared to the deadline.
+ * 
+ * @param timer - The timer.
+ * @param count - Expiry count read from the timerfd.
+ */
+static void timer_account(reactor_timer *timer, uint64_t count)
+{
+    struct timespec now;
+    int64_t late;
+    uint8_t bucket = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    late = (int64_t)(now.tv_sec - timer->deadline.tv_sec) * 1000000000LL + (now.tv_nsec - timer->deadline.tv_nsec);
+    if (late < 0)
     {
-        struct itimerspec trigger_temp;
-        struct sigevent sev_temp;
-        memset(&sev_temp, 0, sizeof(struct sigevent));
-        memset(&trigger_temp, 0, sizeof(struct itimerspec));
+        late = 0;
+    }
 
-        sev_temp.sigev_notify = SIGEV_THREAD;
-        sev_temp.sigev_notify_function = &timer_handler;
-        sev_temp.sigev_value.sival_int = timer_handle;
-        if (timer_create(CLOCK_REALTIME, &sev_temp, &timeout_temp))
-        {
-            error_log("ERROR: timer_create(temp); in timer_init() function", ERROR_DEBUG, P2);
-        }
-        else
+    //The deadline of the latest expiry reported by the timerfd
+    timespec_add(&timer->deadline, (count - 1) * timer->period_ns);
+    if (count > 1)
+    {
+        late -= (count - 1) * timer->period_ns;
+        if (late < 0)
         {
-            msg_log("Temperature Timer initialized.\n", DEBUG, P0);
+            late = 0;
         }
+    }
+
+    while (bucket < TIMER_JITTER_BUCKETS - 1 && (uint64_t)late >= (1000ULL << bucket))
+    {
+        bucket++;
+    }
+    timer->jitter[bucket]++;
+    lat_record(LAT_TIMER, late);
+    if ((uint64_t)late > timer->jitter_ns_max)
+    {
+        timer->jitter_ns_max = late;
+    }
+
+    timer->expiries += count;
+    timer->overruns += count - 1;
+    timespec_add(&timer->deadline, timer->period_ns);
+}
 
-        //Setting the first timer interval and the repeating timer interval
-        trigger_temp.it_value.tv_sec = TEMP_INTERVAL_SEC;
-        trigger_temp.it_interval.tv_sec = TEMP_INTERVAL_SEC;
-        trigger_temp.it_value.tv_nsec = TEMP_INTERVAL_NSEC;
-        trigger_temp.it_interval.tv_nsec = TEMP_INTERVAL_NSEC;
+/**
+ * @brief - Reactor thread, waits on all timerfds and runs the callback of every expired timer.
+ * 
+ * @param arg - Unused.
+ * @return void* 
+ */
+static void *reactor_thread(void *arg)
+{
+    struct epoll_event events[TIMER_MAX];
+    uint64_t count;
+    int n;
 
-        if (timer_settime(timeout_temp, 0, &trigger_temp, NULL))
+    queue_register(QUEUE_ROLE_TIMER);
+    trace_register("timer");
+    rt_apply(RT_ROLE_TIMER);
+    while (1)
+    {
+        n = epoll_wait(epoll_fd, events, TIMER_MAX, -1);
+        if (n == -1)
         {
-            error_log("ERROR: timer_settime(temp); in timer_init function", ERROR_DEBUG, P2);
+            if (errno != EINTR)
+            {
+                error_log("ERROR: epoll_wait(); in reactor_thread() function", ERROR_DEBUG, P2);
+            }
+            continue;
         }
-        else
+
+        for (int i = 0; i < n; i++)
         {
-            msg_log("Temperature Timer started.\n", DEBUG, P0);
+            reactor_timer *timer = &timers[events[i].data.u32];
+            if (read(timer->fd, &count, sizeof(count)) != sizeof(count))
+            {
+                continue;
+            }
+            timer_account(timer, count);
+            trace_begin(timer->name);
+            timer->fn(timer->arg);
+            trace_end(timer->name);
         }
     }
-    else if (timer_handle == TIMER_LIGHT)
+    return NULL;
+}
+
+/**
+ * @brief - This function adds a periodic task to the reactor. The first expiry is one period from now,
+ * the following ones are at fixed multiples of the period so that the schedule does not drift. May be
+ * called before or after timer_init() has started the reactor.
+ * 
+ * @param name - Name of the timer in the stats output.
+ * @param sec - Period, seconds part.
+ * @param nsec - Period, nanoseconds part.
+ * @param fn - Callback run by the reactor thread on every expiry.
+ * @param arg - Argument passed to the callback.
+ * @return int - Timer index, -1 on failure.
+ */
+int timer_add(const char *name, time_t sec, long nsec, timer_fn fn, void *arg)
+{
+    reactor_timer *timer;
+    struct itimerspec trigger;
+    struct epoll_event ev;
+
+    if (timer_count >= TIMER_MAX || epoll_fd == -1)
     {
-        struct itimerspec trigger_light;
-        struct sigevent sev_light;
-        memset(&sev_light, 0, sizeof(struct sigevent));
-        memset(&trigger_light, 0, sizeof(struct itimerspec));
+        return -1;
+    }
+    timer = &timers[timer_count];
+    memset(timer, 0, sizeof(reactor_timer));
 
-        sev_light.sigev_notify = SIGEV_THREAD;
-        sev_light.sigev_notify_function = &timer_handler;
-        sev_light.sigev_value.sival_int = timer_handle;
-        if (timer_create(CLOCK_REALTIME, &sev_light, &timeout_light))
-        {
-            error_log("ERROR: timer_create(light); in timer_init() function", ERROR_DEBUG, P2);
-        }
-        else
-        {
-            msg_log("Light Timer initialized.\n", DEBUG, P0);
-        }
+    timer->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (timer->fd == -1)
+    {
+        error_log("ERROR: timerfd_create(); in timer_add() function", ERROR_DEBUG, P2);
+        return -1;
+    }
+    timer->name = name;
+    timer->fn = fn;
+    timer->arg = arg;
+    timer->period_ns = (uint64_t)sec * 1000000000ULL + nsec;
 
-        //Setting the first timer interval and the repeating timer interval
-        trigger_light.it_value.tv_sec = LIGHT_INTERVAL_SEC;
-        trigger_light.it_interval.tv_sec = LIGHT_INTERVAL_SEC;
-        trigger_light.it_value.tv_nsec = LIGHT_INTERVAL_NSEC;
-        trigger_light.it_interval.tv_nsec = LIGHT_INTERVAL_NSEC;
+    //Absolute first deadline, the kernel derives every following one from it
+    clock_gettime(CLOCK_MONOTONIC, &timer->deadline);
+    timespec_add(&timer->deadline, timer->period_ns);
+    timer->first = timer->deadline;
+    trigger.it_value = timer->deadline;
+    trigger.it_interval.tv_sec = sec;
+    trigger.it_interval.tv_nsec = nsec;
+    if (timerfd_settime(timer->fd, TFD_TIMER_ABSTIME, &trigger, NULL))
+    {
+        error_log("ERROR: timerfd_settime(); in timer_add() function", ERROR_DEBUG, P2);
+        close(timer->fd);
+        return -1;
+    }
 
-        if (timer_settime(timeout_light, 0, &trigger_light, NULL))
-        {
-            error_log("ERROR: timer_settime(light); in timer_init function", ERROR_DEBUG, P2);
-        }
-        else
-        {
-            msg_log("Light Timer started.\n", DEBUG, P0);
-        }
+    ev.events = EPOLLIN;
+    ev.data.u32 = timer_count;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer->fd, &ev))
+    {
+        error_log("ERROR: epoll_ctl(); in timer_add() function", ERROR_DEBUG, P2);
+        close(timer->fd);
+        return -1;
     }
-    else if (timer_handle == TIMER_HB)
+
+    stats_register(name, timer_stats, timer);
+    return timer_count++;
+}
+
+/**
+ * @brief - This function creates the reactor, adds the temperature, light and heartbeat timers and
+ * starts the reactor thread. Called once from main, the timers survive thread restarts.
+ * 
+ * @return err_t - Error value (0 for success)
+ */
+err_t timer_init(void)
+{
+    int idx;
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
     {
-        struct itimerspec trigger_hb;
-        struct sigevent sev_hb;
-        memset(&sev_hb, 0, sizeof(struct sigevent));
-        memset(&trigger_hb, 0, sizeof(struct itimerspec));
+        error_log("ERROR: epoll_create1(); in timer_init() function", ERROR_DEBUG, P2);
+        return FAIL;
+    }
 
-        sev_hb.sigev_notify = SIGEV_THREAD;
-        sev_hb.sigev_notify_function = &timer_handler;
-        sev_hb.sigev_value.sival_int = timer_handle;
-        if (timer_create(CLOCK_REALTIME, &sev_hb, &timeout_hb))
+    idx = timer_add("timer_temp", g_temp_period_ns / 1000000000ULL, g_temp_period_ns % 1000000000ULL, timer_handler,
+                    (void *)(intptr_t)TIMER_TEMP);
+    if (idx == -1)
+    {
+        error_log("ERROR: timer_add(temp); in timer_init() function", ERROR_DEBUG, P2);
+    }
+    else
+    {
+        //The ideal schedule of the samples is the schedule of their timer
+        if (g_jitter)
         {
-            error_log("ERROR: timer_create(hb); in timer_init() function", ERROR_DEBUG, P2);
+            jitter_start(&temp_jitter, "temp", LAT_TEMP_JITTER, &timers[idx].first, g_temp_period_ns);
         }
-        else
+        msg_log("Temperature Timer started.\n", DEBUG, P0);
+    }
+
+    idx = timer_add("timer_light", g_light_period_ns / 1000000000ULL, g_light_period_ns % 1000000000ULL, timer_handler,
+                    (void *)(intptr_t)TIMER_LIGHT);
+    if (idx == -1)
+    {
+        error_log("ERROR: timer_add(light); in timer_init() function", ERROR_DEBUG, P2);
+    }
+    else
+    {
+        if (g_jitter)
         {
-            msg_log("Heartbeat Timer initialized.\n", DEBUG, P0);
+            jitter_start(&light_jitter, "light", LAT_LIGHT_JITTER, &timers[idx].first, g_light_period_ns);
         }
+        msg_log("Light Timer started.\n", DEBUG, P0);
+    }
 
-        //Setting the first timer interval and the repeating timer interval
-        trigger_hb.it_value.tv_sec = HB_INTERVAL_SEC;
-        trigger_hb.it_interval.tv_sec = HB_INTERVAL_SEC;
-        trigger_hb.it_value.tv_nsec = HB_INTERVAL_NSEC;
-        trigger_hb.it_interval.tv_nsec = HB_INTERVAL_NSEC;
+    if (timer_add("timer_hb", HB_INTERVAL_SEC, HB_INTERVAL_NSEC, timer_handler, (void *)(intptr_t)TIMER_HB) == -1)
+    {
+        error_log("ERROR: timer_add(hb); in timer_init() function", ERROR_DEBUG, P2);
+    }
+    else
+    {
+        msg_log("Heartbeat Timer started.\n", DEBUG, P0);
+    }
 
-        if (timer_settime(timeout_hb, 0, &trigger_hb, NULL))
-        {
-            error_log("ERROR: timer_settime(hb); in timer_init function", ERROR_DEBUG, P2);
-        }
-        else
-        {
-            msg_log("Heartbeat Timer started.\n", DEBUG, P0);
-        }
+    if (pthread_create(&reactor_tid, NULL, reactor_thread, NULL))
+    {
+        error_log("ERROR: pthread_create(); in timer_init() function", ERROR_DEBUG, P2);
+        return FAIL;
     }
+    reactor_running = true;
     return OK;
 }
 
 /**
- * @brief - This function is invoked on timer expiration.
+ * @brief - This function is invoked by the reactor thread on timer expiration. It wakes the thread that
+ * owns the periodic work.
  * 
- * @param sigval - This parameter is passed in the timer_init function in their respective cases.
+ * @param arg - TIMER_TEMP, TIMER_LIGHT or TIMER_HB, passed in timer_init().
  */
-void timer_handler(union sigval sv)
+void timer_handler(void *arg)
 {
-    if (sv.sival_int == TIMER_TEMP)
+    intptr_t timer_handle = (intptr_t)arg;
+
+    if (timer_handle == TIMER_TEMP)
     {
-        temp_timerflag = 1;
-        msg_log("In Timer Handler: Temperature Sensor Timer fired.\n", DEBUG, P0);
+        event_post(&temp_event, EV_TIMER);
     }
-    else if (sv.sival_int == TIMER_LIGHT)
+    else if (timer_handle == TIMER_LIGHT)
     {
-        light_timerflag = 1;
-        msg_log("In Timer Handler: Light Sensor Timer fired.\n", DEBUG, P0);
+        event_post(&light_event, EV_TIMER);
     }
-    else if (sv.sival_int == TIMER_HB)
+    else if (timer_handle == TIMER_HB)
     {
-        hb_send(CLEAR_HB);
+        hb_tick();
         msg_log("In Timer Handler: Heartbeat Timer fired.\n", DEBUG, P0);
     }
 }
 
 /**
- * @brief - This function deletes all the timers created.
+ * @brief - This function stops the reactor thread and deletes all the timers created.
  * 
  * @return err_t 
  */
 err_t timer_del(void)
 {
-    if (timer_delete(timeout_temp))
+    if (reactor_running)
     {
-        perror("ERROR: timer_delete(temp); in timer_del() function");
+        if (pthread_cancel(reactor_tid))
+        {
+            perror("ERROR: pthread_cancel(); in timer_del() function");
+        }
+        pthread_join(reactor_tid, NULL);
+        reactor_running = false;
     }
 
-    if (timer_delete(timeout_light))
+    for (uint8_t i = 0; i < timer_count; i++)
     {
-        perror("ERROR: timer_delete(light); in timer_del() function");
+        if (close(timers[i].fd))
+        {
+            perror("ERROR: close(timerfd); in timer_del() function");
+        }
     }
+    timer_count = 0;
 
-    if (timer_delete(timeout_hb))
+    if (epoll_fd != -1 && close(epoll_fd))
     {
-        perror("ERROR: timer_delete(hb); in timer_del() function");
+        perror("ERROR: close(epoll); in timer_del() function");
     }
-
+    epoll_fd = -1;
     return OK;
-}
\ No newline at end of file
+}
+
+/**
+ * @brief - Formats the expiry and overrun counts of a timer and its jitter histogram. Only non-empty
+ * buckets are printed, "<N" counts expiries handled less than N microseconds after the deadline.
+ * 
+ * @param arg - The timer.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t timer_stats(void *arg, char *buf, size_t size)
+{
+    reactor_timer *timer = (reactor_timer *)arg;
+    size_t total = 0;
+    int len;
+
+    len = snprintf(buf, size, "expiries=%llu overruns=%llu jitter_max_us=%.1f jitter_us:",
+                   (unsigned long long)timer->expiries, (unsigned long long)timer->overruns,
+                   timer->jitter_ns_max / 1e3);
+    total = (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+
+    for (uint8_t i = 0; i < TIMER_JITTER_BUCKETS && total < size - 1; i++)
+    {
+        if (timer->jitter[i] == 0)
+        {
+            continue;
+        }
+        if (i == TIMER_JITTER_BUCKETS - 1)
+        {
+            len = snprintf(buf + total, size - total, " >=%llu:%llu", 1ULL << (i - 1), (unsigned long long)timer->jitter[i]);
+        }
+        else
+        {
+            len = snprintf(buf + total, size - total, " <%llu:%llu", 1ULL << i, (unsigned long long)timer->jitter[i]);
+        }
+        total += (len < 0) ? 0 : ((size_t)len >= size - total ? size - total - 1 : (size_t)len);
+    }
+
+    if (total < size - 1)
+    {
+        buf[total++] = '\n';
+        buf[total] = '\0';
+    }
+    return total;
+}
@@ -0,0 +1,279 @@
+/**
+ * @file trace.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the event tracer. Every thread records begin, end and instant events at the
+ * pipeline points into a ring of its own, without locks, while tracing is enabled. SIGUSR1 toggles tracing,
+ * SIGUSR2 writes the events still in the rings as a Chrome trace JSON file, which chrome://tracing and
+ * Perfetto show as one timeline per thread.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include "trace.h"
+
+static trace_ring *_Atomic rings[TRACE_MAX_THREADS];
+static atomic_uint ring_count;
+static __thread trace_ring *thread_ring;
+static volatile sig_atomic_t dump_requested;
+static uint64_t dumps;
+
+//Copy of a ring taken by trace_dump(), which only runs on the main thread
+static trace_event snapshot[TRACE_RING_SIZE];
+
+/**
+ * @brief - Gives the calling thread a ring and its name, which top, perf and /proc also show. Threads
+ * 			that do not register record nothing. A thread restarted by the heartbeat takes over the ring of
+ * 			the thread it replaces, which has exited by then, so restarts do not use up the rings.
+ *
+ * @param name - Name of the thread on the timeline.
+ */
+void trace_register(const char *name)
+{
+	trace_ring *ring;
+	uint32_t slot;
+
+	prctl(PR_SET_NAME, name, 0, 0, 0);
+	for (slot = 0; slot < atomic_load(&ring_count) && slot < TRACE_MAX_THREADS; slot++)
+	{
+		ring = atomic_load_explicit(&rings[slot], memory_order_acquire);
+		if (ring != NULL && strcmp(ring->name, name) == 0)
+		{
+			ring->tid = syscall(SYS_gettid);
+			thread_ring = ring;
+			return;
+		}
+	}
+
+	ring = calloc(1, sizeof(trace_ring));
+	if (ring == NULL)
+	{
+		perror("ERROR: calloc(); in trace_register() function");
+		return;
+	}
+	slot = atomic_fetch_add(&ring_count, 1);
+	if (slot >= TRACE_MAX_THREADS)
+	{
+		atomic_fetch_sub(&ring_count, 1);
+		free(ring);
+		error_log("ERROR: too many threads; in trace_register() function", ERROR_DEBUG, P2);
+		return;
+	}
+	ring->name = name;
+	ring->tid = syscall(SYS_gettid);
+	atomic_store_explicit(&rings[slot], ring, memory_order_release);
+	thread_ring = ring;
+}
+
+/**
+ * @brief - Appends an event to the ring of the calling thread, overwriting its oldest event once the
+ * 			ring is full. Called through the trace_begin(), trace_end() and trace_instant() macros.
+ *
+ * @param name - Name of the event.
+ * @param phase - TRACE_PH_BEGIN, TRACE_PH_END or TRACE_PH_INSTANT.
+ * @param arg - Value shown with the event.
+ */
+void trace_record(const char *name, char phase, int64_t arg)
+{
+	trace_ring *ring = thread_ring;
+	struct timespec now;
+	unsigned long long head;
+	trace_event *ev;
+
+	if (ring == NULL)
+	{
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	ev = &ring->events[head & (TRACE_RING_SIZE - 1)];
+	ev->ts = (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+	ev->name = name;
+	ev->arg = arg;
+	ev->phase = phase;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+/**
+ * @brief - Enables tracing if it is disabled and the other way round. Async-signal-safe, called by the
+ * 			SIGUSR1 handler.
+ */
+void trace_toggle(void)
+{
+	atomic_store(&g_trace, !atomic_load(&g_trace));
+}
+
+/**
+ * @brief - Asks the main thread for a dump. Async-signal-safe, called by the SIGUSR2 handler.
+ */
+void trace_request_dump(void)
+{
+	dump_requested = 1;
+}
+
+/**
+ * @brief - Writes the dump asked for by SIGUSR2, if any. Called by the main loop.
+ */
+void trace_poll(void)
+{
+	if (dump_requested)
+	{
+		dump_requested = 0;
+		trace_dump(g_trace_file);
+	}
+}
+
+/**
+ * @brief - Copies the events of a ring that are not overwritten while they are copied. The owner keeps
+ * 			recording meanwhile.
+ *
+ * @param ring - The ring.
+ * @return uint64_t - Number of events copied to snapshot, oldest first.
+ */
+static uint64_t trace_snapshot(trace_ring *ring)
+{
+	uint64_t head, start, valid;
+
+	head = atomic_load_explicit(&ring->head, memory_order_acquire);
+	start = (head > TRACE_RING_SIZE) ? head - TRACE_RING_SIZE : 0;
+	for (uint64_t i = start; i < head; i++)
+	{
+		snapshot[i - start] = ring->events[i & (TRACE_RING_SIZE - 1)];
+	}
+
+	//The event being written while the copy ran may have replaced the oldest one
+	atomic_thread_fence(memory_order_acquire);
+	valid = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	valid = (valid >= TRACE_RING_SIZE) ? valid - TRACE_RING_SIZE + 1 : 0;
+	if (valid > start)
+	{
+		if (valid >= head)
+		{
+			return 0;
+		}
+		memmove(snapshot, snapshot + (valid - start), (head - valid) * sizeof(trace_event));
+		start = valid;
+	}
+	return head - start;
+}
+
+/**
+ * @brief - Writes the events of all the rings as a Chrome trace JSON file. Timestamps are CLOCK_MONOTONIC
+ * 			microseconds.
+ *
+ * @param path - The file.
+ * @return err_t
+ */
+err_t trace_dump(const char *path)
+{
+	uint32_t count = atomic_load(&ring_count);
+	uint64_t total = 0;
+	pid_t pid = getpid();
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+	{
+		perror("ERROR: fopen(); in trace_dump() function");
+		return FAIL;
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+	fprintf(fp, "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"project1\"}}", pid, pid);
+	for (uint32_t r = 0; r < count && r < TRACE_MAX_THREADS; r++)
+	{
+		trace_ring *ring = atomic_load_explicit(&rings[r], memory_order_acquire);
+		uint64_t n;
+
+		if (ring == NULL)
+		{
+			continue;
+		}
+		fprintf(fp, ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}", pid,
+				ring->tid, ring->name);
+
+		n = trace_snapshot(ring);
+		for (uint64_t i = 0; i < n; i++)
+		{
+			trace_event *ev = &snapshot[i];
+			fprintf(fp, ",\n{\"ph\":\"%c\",\"name\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03llu", ev->phase, ev->name,
+					pid, ring->tid, (unsigned long long)(ev->ts / 1000), (unsigned long long)(ev->ts % 1000));
+			if (ev->phase == TRACE_PH_INSTANT)
+			{
+				fprintf(fp, ",\"s\":\"t\",\"args\":{\"value\":%lld}", (long long)ev->arg);
+			}
+			fputc('}', fp);
+		}
+		total += n;
+	}
+	fprintf(fp, "\n]}\n");
+
+	if (fclose(fp))
+	{
+		perror("ERROR: fclose(); in trace_dump() function");
+		return FAIL;
+	}
+	dumps++;
+	printf("Trace of %llu events written to %s.\n", (unsigned long long)total, path);
+	return OK;
+}
+
+/**
+ * @brief - Writes a last dump if anything was traced and frees the rings. Called once every other thread
+ * 			has exited.
+ */
+void trace_close(void)
+{
+	uint32_t count = atomic_load(&ring_count);
+	bool traced = false;
+
+	atomic_store(&g_trace, false);
+
+	for (uint32_t r = 0; r < count && r < TRACE_MAX_THREADS; r++)
+	{
+		if (rings[r] && atomic_load(&rings[r]->head))
+		{
+			traced = true;
+		}
+	}
+	if (traced)
+	{
+		trace_dump(g_trace_file);
+	}
+	for (uint32_t r = 0; r < count && r < TRACE_MAX_THREADS; r++)
+	{
+		free(rings[r]);
+		rings[r] = NULL;
+	}
+	atomic_store(&ring_count, 0);
+	thread_ring = NULL;
+}
+
+/**
+ * @brief - Formats the state of the tracer.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t trace_stats(void *arg, char *buf, size_t size)
+{
+	uint32_t count = atomic_load(&ring_count);
+	uint64_t events = 0;
+	int len;
+
+	for (uint32_t r = 0; r < count && r < TRACE_MAX_THREADS; r++)
+	{
+		trace_ring *ring = atomic_load_explicit(&rings[r], memory_order_acquire);
+		if (ring)
+		{
+			events += atomic_load_explicit(&ring->head, memory_order_relaxed);
+		}
+	}
+	len = snprintf(buf, size, "enabled=%d threads=%u events=%llu dumps=%llu\n", atomic_load(&g_trace) ? 1 : 0, count,
+				   (unsigned long long)events, (unsigned long long)dumps);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
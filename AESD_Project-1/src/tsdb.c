@@ -0,0 +1,513 @@
+/**
+ * @file tsdb.c
+ * @author Siddhant Jajoo and Satya Mehta
+ * @brief This file consists of the in-memory history of the sensors. Every series is a fixed-size ring
+ * holding the latest samples of one sensor, with the time stamps and the values in two separate arrays.
+ * The sensor thread appends without a lock and publishes the new head with a release store; queries
+ * find the first and last sample of a time range by binary search on the time stamps, copy them out and
+ * then check the head again to leave out the samples that were overwritten meanwhile.
+ * With --tsdb-file every sample is also stored in a memory-mapped history file, a fixed-size ring of
+ * checksummed records per series with the cursors in the file header. An append is a few stores into the
+ * mapping, the logger thread syncs it every TSDB_SYNC_MS, and at startup the records from the cursor back
+ * are checked and loaded again so that the history survives a restart or a power loss.
+ * @version 0.1
+ * @date 2019-03-28
+ *
+ * @copyright Copyright (c) 2019
+ *
+ */
+
+#include <stddef.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "tsdb.h"
+
+static tsdb_series *series_list[TSDB_SERIES_MAX];
+static uint8_t nseries;
+static int file_fd = -1;
+static uint8_t *file_map;
+static size_t file_size;
+static struct timespec last_sync;
+
+//History file counters
+static uint64_t syncs, sync_ns_total, sync_ns_max, sync_errors, recover_ns;
+
+/**
+ * @brief - Returns the checksum of a record of the history file, a 64-bit mix of its fields that costs a
+ * 			few multiplications per append. A record of zeros does not check.
+ *
+ * @param rec - The record.
+ * @return uint32_t
+ */
+static uint32_t tsdb_check(const tsdb_rec *rec)
+{
+	uint32_t bits;
+	uint64_t h;
+
+	memcpy(&bits, &rec->value, sizeof(bits));
+	h = (rec->seq * 0x9E3779B97F4A7C15ULL) ^ rec->time_ns;
+	h = (h ^ (h >> 31)) * 0xBF58476D1CE4E5B9ULL;
+	h = (h ^ bits ^ (h >> 29)) * 0x94D049BB133111EBULL;
+	return (uint32_t)(h ^ (h >> 32)) ^ TSDB_FILE_MAGIC;
+}
+
+/**
+ * @brief - This function allocates the arrays of a series. They are written once here so that the sensor
+ * 			thread never takes a page fault when it appends.
+ *
+ * @param series - The series.
+ * @param name - Name of the sensor, used in the stats.
+ * @param depth - Samples kept, rounded up to a power of two.
+ * @return err_t
+ */
+err_t tsdb_init(tsdb_series *series, const char *name, uint32_t depth)
+{
+	uint32_t size = 1;
+
+	while (size < depth)
+	{
+		size <<= 1;
+	}
+
+	memset(series, 0, sizeof(tsdb_series));
+	series->name = name;
+	series->time_ns = malloc((size_t)size * sizeof(uint64_t));
+	series->value = malloc((size_t)size * sizeof(float));
+	if (series->time_ns == NULL || series->value == NULL)
+	{
+		perror("ERROR: malloc(); in tsdb_init() function");
+		tsdb_free(series);
+		return FAIL;
+	}
+	memset(series->time_ns, 0, (size_t)size * sizeof(uint64_t));
+	memset(series->value, 0, (size_t)size * sizeof(float));
+	series->mask = size - 1;
+	atomic_init(&series->head, 0);
+	if (nseries < TSDB_SERIES_MAX)
+	{
+		series_list[nseries++] = series;
+	}
+	return OK;
+}
+
+/**
+ * @brief - Appends a sample. Must only be called by the thread that owns the sensor. A sample older than
+ * 			the previous one, after the clock was stepped back, is stored with the time of the previous one
+ * 			so that the time stamps stay sorted.
+ *
+ * @param series - The series.
+ * @param time - Time stamp of the sample.
+ * @param value - Celsius or lux.
+ */
+void tsdb_append(tsdb_series *series, const struct timespec *time, float value)
+{
+	uint64_t head = atomic_load_explicit(&series->head, memory_order_relaxed);
+	uint64_t t = (uint64_t)time->tv_sec * 1000000000ULL + time->tv_nsec;
+
+	if (series->time_ns == NULL)
+	{
+		return;
+	}
+	//Orders the previous head before the overwrite, a query that sees the new sample sees the new head
+	atomic_thread_fence(memory_order_release);
+	if (head && t < series->time_ns[(head - 1) & series->mask])
+	{
+		t = series->time_ns[(head - 1) & series->mask];
+		series->unordered++;
+	}
+	series->time_ns[head & series->mask] = t;
+	series->value[head & series->mask] = value;
+	atomic_store_explicit(&series->head, head + 1, memory_order_release);
+
+	//The checksum is stored last and the cursor after it, a record cut short by a crash does not check
+	if (series->disk)
+	{
+		uint64_t cursor = *series->disk_cursor;
+		tsdb_rec *rec = &series->disk[cursor & series->mask];
+
+		rec->seq = cursor;
+		rec->time_ns = t;
+		rec->value = value;
+		rec->check = tsdb_check(rec);
+		*series->disk_cursor = cursor + 1;
+	}
+}
+
+/**
+ * @brief - Returns the first sample in [lo, hi) whose time stamp is after t, or not before t.
+ *
+ * @param series - The series.
+ * @param lo - First sample searched.
+ * @param hi - Sample after the last one searched.
+ * @param t - Time in nanoseconds.
+ * @param after - Look for a time stamp after t instead of one not before t.
+ * @return uint64_t - hi if there is none.
+ */
+static uint64_t tsdb_search(tsdb_series *series, uint64_t lo, uint64_t hi, uint64_t t, bool after)
+{
+	while (lo < hi)
+	{
+		uint64_t mid = lo + (hi - lo) / 2;
+		uint64_t tm = series->time_ns[mid & series->mask];
+
+		if (after ? (tm <= t) : (tm < t))
+		{
+			lo = mid + 1;
+		}
+		else
+		{
+			hi = mid;
+		}
+	}
+	return lo;
+}
+
+/**
+ * @brief - Copies the samples of a time range, oldest first. Safe to call from any thread while the sensor
+ * 			thread appends.
+ *
+ * @param series - The series.
+ * @param from_ns - Oldest time stamp wanted.
+ * @param to_ns - Newest time stamp wanted, 0 for no limit.
+ * @param last - Only the newest last samples of the range, 0 for all of them.
+ * @param time_ns - Filled with the time stamps.
+ * @param value - Filled with the values.
+ * @param max - Room in time_ns and value. A range holding more samples is cut to its oldest max samples,
+ * 				or to its newest ones when last is set.
+ * @return uint32_t - Number of samples copied.
+ */
+uint32_t tsdb_query(tsdb_series *series, uint64_t from_ns, uint64_t to_ns, uint32_t last, uint64_t *time_ns,
+					float *value, uint32_t max)
+{
+	uint64_t head, oldest, lo, hi, valid;
+	uint32_t n, skip = 0;
+
+	atomic_fetch_add_explicit(&series->queries, 1, memory_order_relaxed);
+	if (series->time_ns == NULL || max == 0)
+	{
+		return 0;
+	}
+	if (to_ns == 0)
+	{
+		to_ns = UINT64_MAX;
+	}
+
+	//The oldest sample is left out, it is the one the next append overwrites
+	head = atomic_load_explicit(&series->head, memory_order_acquire);
+	oldest = (head > series->mask) ? head - series->mask : 0;
+	lo = tsdb_search(series, oldest, head, from_ns, false);
+	hi = tsdb_search(series, lo, head, to_ns, true);
+
+	if (last && hi - lo > last)
+	{
+		lo = hi - last;
+	}
+	if (hi - lo > max)
+	{
+		if (last)
+		{
+			lo = hi - max;
+		}
+		else
+		{
+			hi = lo + max;
+		}
+	}
+
+	n = hi - lo;
+	for (uint32_t i = 0; i < n; i++)
+	{
+		time_ns[i] = series->time_ns[(lo + i) & series->mask];
+		value[i] = series->value[(lo + i) & series->mask];
+	}
+
+	//Samples the sensor thread may have overwritten while they were copied, an append in progress included
+	atomic_thread_fence(memory_order_acquire);
+	head = atomic_load_explicit(&series->head, memory_order_relaxed);
+	valid = (head > series->mask) ? head - series->mask : 0;
+	if (valid > lo)
+	{
+		skip = (valid - lo >= n) ? n : (uint32_t)(valid - lo);
+		atomic_fetch_add_explicit(&series->torn, skip, memory_order_relaxed);
+	}
+
+	//A search that read an overwritten time stamp may have started before from_ns
+	while (skip < n && time_ns[skip] < from_ns)
+	{
+		skip++;
+	}
+	if (skip)
+	{
+		n -= skip;
+		memmove(time_ns, time_ns + skip, n * sizeof(uint64_t));
+		memmove(value, value + skip, n * sizeof(float));
+	}
+	atomic_fetch_add_explicit(&series->returned, n, memory_order_relaxed);
+	return n;
+}
+
+/**
+ * @brief - Returns true if the record at a position of a ring of the history file is complete and was
+ * 			written at that position.
+ *
+ * @param series - The series, for the depth of the ring.
+ * @param recs - The ring.
+ * @param seq - Position of the record.
+ * @return bool
+ */
+static bool tsdb_rec_valid(tsdb_series *series, const tsdb_rec *recs, uint64_t seq)
+{
+	const tsdb_rec *rec = &recs[seq & series->mask];
+
+	return rec->seq == seq && rec->check == tsdb_check(rec);
+}
+
+/**
+ * @brief - Finds the last consistent record of a series in the history file and loads the records before
+ * 			it into the series. The pages of the file reach the disk in any order, so the cursor in the
+ * 			header may be behind the records, or ahead of records that were lost.
+ *
+ * @param series - The series, still empty.
+ * @param recs - Ring of the series in the history file.
+ * @param cursor - Cursor of the series in the file header, set to the position after the last record.
+ */
+static void tsdb_recover(tsdb_series *series, const tsdb_rec *recs, uint64_t *cursor)
+{
+	uint64_t depth = (uint64_t)series->mask + 1;
+	uint64_t c = *cursor, n = 0;
+
+	//Records appended after the cursor was last written back
+	for (uint64_t i = 0; i < depth && tsdb_rec_valid(series, recs, c); i++)
+	{
+		c++;
+	}
+	//Records the cursor counts but which never reached the disk
+	for (uint64_t i = 0; i < depth && c && !tsdb_rec_valid(series, recs, c - 1); i++)
+	{
+		c--;
+		series->discarded++;
+	}
+	while (n < depth && n < c && tsdb_rec_valid(series, recs, c - 1 - n))
+	{
+		n++;
+	}
+
+	for (uint64_t seq = c - n; seq < c; seq++)
+	{
+		const tsdb_rec *rec = &recs[seq & series->mask];
+		struct timespec time = {.tv_sec = rec->time_ns / 1000000000ULL, .tv_nsec = rec->time_ns % 1000000000ULL};
+
+		tsdb_append(series, &time, rec->value);
+	}
+	series->recovered = n;
+	*cursor = c;
+}
+
+/**
+ * @brief - This function maps the history file of the series initialized so far, all of the same depth,
+ * 			and loads their samples from it. A file of another depth or version is started again empty.
+ * 			The file is allocated in full here, so that an append never needs a block the disk lacks.
+ *
+ * @param path - Path of the history file.
+ * @return err_t
+ */
+err_t tsdb_open(const char *path)
+{
+	struct timespec start, end;
+	tsdb_file_hdr hdr, found;
+	uint64_t depth;
+	struct stat st;
+	bool load;
+
+	if (nseries == 0)
+	{
+		return FAIL;
+	}
+	depth = (uint64_t)series_list[0]->mask + 1;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = TSDB_FILE_MAGIC;
+	hdr.version = TSDB_FILE_VERSION;
+	hdr.series = nseries;
+	hdr.depth = depth;
+	hdr.rec_size = sizeof(tsdb_rec);
+	for (uint8_t s = 0; s < nseries; s++)
+	{
+		strncpy(hdr.names[s], series_list[s]->name, sizeof(hdr.names[s]) - 1);
+	}
+	file_size = TSDB_FILE_HDR_SIZE + nseries * depth * sizeof(tsdb_rec);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	file_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (file_fd == -1)
+	{
+		perror("ERROR: open(); in tsdb_open() function");
+		return FAIL;
+	}
+
+	load = (!fstat(file_fd, &st) && (size_t)st.st_size == file_size &&
+			pread(file_fd, &found, sizeof(found), 0) == sizeof(found) &&
+			!memcmp(&hdr, &found, offsetof(tsdb_file_hdr, cursor)));
+	if (!load)
+	{
+		if (st.st_size > 0)
+		{
+			printf("History file %s has another depth or version, its samples are dropped.\n", path);
+		}
+		if (ftruncate(file_fd, 0) || posix_fallocate(file_fd, 0, file_size) ||
+			pwrite(file_fd, &hdr, sizeof(hdr), 0) != sizeof(hdr))
+		{
+			error_log("ERROR: posix_fallocate(); in tsdb_open() function", ERROR_DEBUG, P2);
+			close(file_fd);
+			file_fd = -1;
+			return FAIL;
+		}
+	}
+
+	file_map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED, file_fd, 0);
+	if (file_map == MAP_FAILED)
+	{
+		perror("ERROR: mmap(); in tsdb_open() function");
+		file_map = NULL;
+		close(file_fd);
+		file_fd = -1;
+		return FAIL;
+	}
+
+	for (uint8_t s = 0; s < nseries; s++)
+	{
+		tsdb_rec *recs = (tsdb_rec *)(file_map + TSDB_FILE_HDR_SIZE + s * depth * sizeof(tsdb_rec));
+		uint64_t *cursor = &((tsdb_file_hdr *)file_map)->cursor[s];
+
+		if (load)
+		{
+			tsdb_recover(series_list[s], recs, cursor);
+		}
+		series_list[s]->disk = recs;
+		series_list[s]->disk_cursor = cursor;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	recover_ns = (uint64_t)(end.tv_sec - start.tv_sec) * 1000000000ULL + end.tv_nsec - start.tv_nsec;
+	last_sync = end;
+	return OK;
+}
+
+/**
+ * @brief - Syncs the history file to the disk once every TSDB_SYNC_MS. Called by the logger thread.
+ *
+ * @param force - Sync now.
+ */
+void tsdb_sync(bool force)
+{
+	struct timespec now, end;
+	uint64_t ns;
+
+	if (file_map == NULL)
+	{
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!force && (now.tv_sec - last_sync.tv_sec) * 1000 + (now.tv_nsec - last_sync.tv_nsec) / 1000000 < TSDB_SYNC_MS)
+	{
+		return;
+	}
+	last_sync = now;
+
+	if (msync(file_map, file_size, MS_SYNC))
+	{
+		perror("ERROR: msync(); in tsdb_sync() function");
+		sync_errors++;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ns = (uint64_t)(end.tv_sec - now.tv_sec) * 1000000000ULL + end.tv_nsec - now.tv_nsec;
+	syncs++;
+	sync_ns_total += ns;
+	if (ns > sync_ns_max)
+	{
+		sync_ns_max = ns;
+	}
+}
+
+/**
+ * @brief - Syncs and unmaps the history file. The sensor threads must have stopped.
+ *
+ */
+void tsdb_close(void)
+{
+	if (file_map == NULL)
+	{
+		return;
+	}
+	tsdb_sync(true);
+	for (uint8_t s = 0; s < nseries; s++)
+	{
+		series_list[s]->disk = NULL;
+		series_list[s]->disk_cursor = NULL;
+	}
+	munmap(file_map, file_size);
+	close(file_fd);
+	file_map = NULL;
+	file_fd = -1;
+}
+
+/**
+ * @brief - Frees the arrays of a series.
+ *
+ * @param series - The series.
+ */
+void tsdb_free(tsdb_series *series)
+{
+	free(series->time_ns);
+	free(series->value);
+	series->time_ns = NULL;
+	series->value = NULL;
+}
+
+/**
+ * @brief - Formats the fill level and the query counters of a series.
+ *
+ * @param arg - The series.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t tsdb_stats(void *arg, char *buf, size_t size)
+{
+	tsdb_series *series = (tsdb_series *)arg;
+	uint64_t head = atomic_load(&series->head);
+	uint64_t depth = (uint64_t)series->mask + 1;
+	uint64_t held = (head < depth) ? head : depth;
+	double span = 0;
+	int len;
+
+	if (held > 1)
+	{
+		span = (series->time_ns[(head - 1) & series->mask] - series->time_ns[(head - held) & series->mask]) / 1e9;
+	}
+	len = snprintf(buf, size, "depth=%llu samples=%llu held=%llu span_s=%.1f unordered=%llu queries=%llu returned=%llu "
+							  "torn=%llu bytes=%llu recovered=%llu discarded=%llu\n",
+				   (unsigned long long)depth, (unsigned long long)head, (unsigned long long)held, span,
+				   (unsigned long long)series->unordered, (unsigned long long)atomic_load(&series->queries),
+				   (unsigned long long)atomic_load(&series->returned), (unsigned long long)atomic_load(&series->torn),
+				   (unsigned long long)(depth * (sizeof(uint64_t) + sizeof(float))),
+				   (unsigned long long)series->recovered, (unsigned long long)series->discarded);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}
+
+/**
+ * @brief - Formats the size of the history file, the time its samples took to load and the sync counters.
+ *
+ * @param arg - Unused.
+ * @param buf - Output buffer.
+ * @param size - Size of the output buffer.
+ * @return size_t - Number of characters written.
+ */
+size_t tsdb_file_stats(void *arg, char *buf, size_t size)
+{
+	int len;
+
+	(void)arg;
+	len = snprintf(buf, size, "bytes=%zu recover_ms=%.2f syncs=%llu sync_avg_us=%.1f sync_max_us=%.1f errors=%llu\n",
+				   file_size, recover_ns / 1e6, (unsigned long long)syncs,
+				   syncs ? (sync_ns_total / syncs) / 1e3 : 0, sync_ns_max / 1e3, (unsigned long long)sync_errors);
+	return (len < 0) ? 0 : ((size_t)len >= size ? size - 1 : (size_t)len);
+}